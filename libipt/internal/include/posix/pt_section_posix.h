@@ -35,6 +35,17 @@
 struct pt_section;
 
 
+enum {
+	/* The huge page size we align section copies to. */
+	pt_sec_posix_hugepage	= 0x200000,
+
+	/* The maximal size of a section that is copied on ptmf_copy.  Bigger
+	 * sections are always mapped from their file.
+	 */
+	pt_sec_posix_copy_max	= 0x1000000
+};
+
+
 /* Fstat-based file status. */
 struct pt_sec_posix_status {
 	/* The file status. */
@@ -43,10 +54,10 @@ struct pt_sec_posix_status {
 
 /* MMAP-based section mapping information. */
 struct pt_sec_posix_mapping {
-	/* The mmap base address. */
+	/* The mmap base address; page or huge page aligned. */
 	uint8_t *base;
 
-	/* The mapped memory size. */
+	/* The mapped memory size including any padding. */
 	uint64_t size;
 
 	/* The begin and end of the mapped memory. */
@@ -55,6 +66,9 @@ struct pt_sec_posix_mapping {
 
 
 /* Map a section.
+ *
+ * Maps @section from @fd according to the pt_map_flag bit-vector @flags.  If
+ * @flags contains ptmf_copy, small sections are copied into anonymous memory.
  *
  * On success, sets @section's mapping, unmap, and read pointers.
  *
@@ -62,7 +76,8 @@ struct pt_sec_posix_mapping {
  * Returns -pte_internal if @section or @file are NULL.
  * Returns -pte_invalid if @section can't be mapped.
  */
-extern int pt_sec_posix_map(struct pt_section *section, int fd);
+extern int pt_sec_posix_map(struct pt_section *section, int fd,
+			    uint32_t flags);
 
 /* Unmap a section.
  *
@@ -90,6 +105,8 @@ extern int pt_sec_posix_read(const struct pt_section *section, uint8_t *buffer,
  * On success, provides the amount of memory used for mapping @section in bytes
  * in @size.
  *
+ * This includes the page alignment of the mapping and the padding of copies.
+ *
  * Returns zero on success, a negative error code otherwise.
  * Returns -pte_internal if @section or @size is NULL.
  * Returns -pte_internal if @section has not been mapped.
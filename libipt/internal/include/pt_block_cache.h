@@ -100,7 +100,26 @@ enum pt_bcache_qualifier {
 	 *   - near direct jumps that are too far away to be handled with a
 	 *     block cache entry as they would overflow the displacement field.
 	 */
-	ptbq_decode
+	ptbq_decode,
+
+	/* The decision point is a near direct jump.
+	 *
+	 * This is only used for the entry at the jump instruction.  Its
+	 * displacement field gives the branch displacement and its isize field
+	 * gives the size of the jump instruction.  Other entries reach it via
+	 * ptbq_again.
+	 *
+	 * No instruction decode is required.
+	 */
+	ptbq_jump,
+
+	/* The decision point is a near direct call.
+	 *
+	 * Like ptbq_jump but this also requires a return-address stack update.
+	 *
+	 * No instruction decode is required.
+	 */
+	ptbq_call
 };
 
 /* A block cache entry.
@@ -114,26 +133,32 @@ enum pt_bcache_qualifier {
  *
  * Each valid entry gives the distance from the entry's IP to the next decision
  * point both in bytes and in the number of instructions.
+ *
+ * This is the wide format, which is also used for adding and looking up
+ * entries.  Block caches in the compact format store struct pt_bcache_compact
+ * entries with narrower fields; use pt_bcache_fits() to check whether an entry
+ * can be stored.
  */
 struct pt_bcache_entry {
 	/* The displacement to the next decision point in bytes.
 	 *
 	 * This is zero if we are at a decision point except for ptbq_again
 	 * where it gives the displacement to the next block cache entry to be
-	 * used.
+	 * used and for ptbq_jump and ptbq_call where it gives the branch
+	 * displacement.
 	 */
-	int32_t displacement:16;
+	int32_t displacement;
 
 	/* The number of instructions to the next decision point.
 	 *
 	 * This is typically one at a decision point since we are already
 	 * accounting for the instruction at the decision point.
 	 *
-	 * Note that this field must be smaller than the respective struct
+	 * Note that this field must not be bigger than the respective struct
 	 * pt_block field so we can fit one block cache entry into an empty
 	 * block.
 	 */
-	uint32_t ninsn:8;
+	uint32_t ninsn:16;
 
 	/* The execution mode for all instruction between here and the next
 	 * decision point.
@@ -155,6 +180,29 @@ struct pt_bcache_entry {
 	 * This is zero if the size is too big to fit into the field.  In this
 	 * case, the instruction needs to be decoded to determine its size.
 	 */
+	uint32_t isize:4;
+};
+
+/* A compact block cache entry.
+ *
+ * This holds the same information as struct pt_bcache_entry in 32 bits.  Long
+ * runs of instructions require a chain of ptbq_again entries and far direct
+ * branches require ptbq_decode entries.
+ */
+struct pt_bcache_compact {
+	/* The displacement to the next decision point in bytes. */
+	int32_t displacement:16;
+
+	/* The number of instructions to the next decision point. */
+	uint32_t ninsn:8;
+
+	/* The execution mode - enum pt_exec_mode. */
+	uint32_t mode:2;
+
+	/* The decision point qualifier - enum pt_bcache_qualifier. */
+	uint32_t qualifier:3;
+
+	/* The size of the instruction at the decision point or zero. */
 	uint32_t isize:3;
 };
 
@@ -179,32 +227,171 @@ static inline int pt_bce_is_valid(struct pt_bcache_entry bce)
 
 
 
-/* A block cache. */
+enum {
+	/* The log2 of the number of entries in a block cache page. */
+	pt_bcache_page_shift	= 10,
+
+	/* The number of entries in a block cache page. */
+	pt_bcache_page_size	= 1 << pt_bcache_page_shift,
+
+	/* The mask for the index of an entry inside its page. */
+	pt_bcache_page_mask	= pt_bcache_page_size - 1
+};
+
+/* A block cache entry format. */
+enum pt_bcache_format {
+	/* Entries are stored as struct pt_bcache_compact. */
+	pt_bcf_compact,
+
+	/* Entries are stored as struct pt_bcache_entry. */
+	pt_bcf_wide
+};
+
+/* A block cache page.
+ *
+ * Pages are allocated on the first pt_bcache_add() into them.  They are never
+ * freed before the block cache itself.
+ */
+struct pt_bcache_page {
+	/* The cache entries. */
+	struct pt_bcache_compact entry[pt_bcache_page_size];
+};
+
+/* A block cache page in the wide format.
+ *
+ * The entries are kept as 64-bit integers so they are read and written in one
+ * piece.
+ */
+struct pt_bcache_wpage {
+	/* The cache entries. */
+	uint64_t entry[pt_bcache_page_size];
+};
+
+/* A block cache.
+ *
+ * The cache is organized as a two-level table: a page directory indexed by the
+ * upper bits of the entry index and lazily allocated pages indexed by the
+ * lower bits.  Memory consumption thus scales with the amount of code that
+ * has actually been decoded rather than with the size of the section.
+ */
 struct pt_block_cache {
 	/* The number of cache entries. */
 	uint32_t nentries;
 
-	/* A variable-length array of @nentries entries. */
-	struct pt_bcache_entry entry[];
+	/* The number of allocated pages. */
+	uint32_t npages;
+
+	/* The entry format - enum pt_bcache_format. */
+	uint32_t format;
+
+	/* A variable-length page directory of
+	 *
+	 *   (@nentries + pt_bcache_page_mask) >> pt_bcache_page_shift
+	 *
+	 * entries pointing to struct pt_bcache_page or, in the wide format, to
+	 * struct pt_bcache_wpage.  A NULL entry means that none of the
+	 * respective cache entries is valid.
+	 */
+	void *page[];
 };
 
 /* Create a block cache.
  *
  * @nentries is the number of entries in the cache and should match the size of
  * the to-be-cached section in bytes.
+ *
+ * Only the page directory is allocated.
  */
 extern struct pt_block_cache *pt_bcache_alloc(uint64_t nentries);
 
+/* Create a block cache with wide entries.
+ *
+ * Like pt_bcache_alloc() but entries are stored in the wide format, which
+ * doubles the memory used per cached instruction.  Falls back to the compact
+ * format on hosts that can't read and write 64-bit entries in one piece.
+ */
+extern struct pt_block_cache *pt_bcache_alloc_wide(uint64_t nentries);
+
 /* Destroy a block cache. */
 extern void pt_bcache_free(struct pt_block_cache *bcache);
 
+/* Get the memory size of a block cache.
+ *
+ * Provides the amount of memory used by @bcache in bytes in @size.  This
+ * includes the page directory and all allocated pages.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @bcache or @size is NULL.
+ */
+extern int pt_bcache_memsize(const struct pt_block_cache *bcache,
+			     uint64_t *size);
+
+/* Load a block cache from a file.
+ *
+ * Loads the entries stored in @filename for a section with content hash @hash
+ * into @bcache.
+ *
+ * The file is ignored if it is missing, if it had been written for a different
+ * section content, or if it is corrupted.
+ *
+ * Returns the number of loaded entries on success, a negative error code
+ * otherwise.
+ * Returns -pte_internal if @bcache or @filename is NULL.
+ */
+extern int pt_bcache_load(struct pt_block_cache *bcache, const char *filename,
+			  uint64_t hash);
+
+/* Store a block cache in a file.
+ *
+ * Stores the valid entries of @bcache for a section with content hash @hash in
+ * @filename if there are more than @nvalid of them and updates @nvalid.
+ *
+ * The entries are written to a temporary file that then replaces @filename so
+ * concurrent loads never see a partially written file.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @bcache, @filename, or @nvalid is NULL.
+ * Returns -pte_bad_file if @filename can't be written.
+ * Returns -pte_nomem if the temporary file name can't be allocated.
+ */
+extern int pt_bcache_store(const struct pt_block_cache *bcache,
+			   const char *filename, uint64_t hash,
+			   uint32_t *nvalid);
+
+/* Check whether a block cache entry can be stored.
+ *
+ * Returns non-zero if @bce can be stored in @bcache without truncating any of
+ * its fields, zero otherwise.
+ */
+static inline int pt_bcache_fits(const struct pt_block_cache *bcache,
+				 struct pt_bcache_entry bce)
+{
+	struct pt_bcache_compact cbe;
+
+	if (bcache->format == pt_bcf_wide)
+		return 1;
+
+	cbe.displacement = bce.displacement;
+	cbe.ninsn = bce.ninsn;
+	cbe.isize = bce.isize;
+
+	return (cbe.displacement == bce.displacement) &&
+		(cbe.ninsn == bce.ninsn) && (cbe.isize == bce.isize);
+}
+
 /* Cache a block.
  *
  * It is expected that all calls for the same @index write the same @bce.
  *
+ * The caller is expected to check that @bce fits using pt_bcache_fits().
+ *
+ * Allocates the page containing @index if necessary.
+ *
  * Returns zero on success, a negative error code otherwise.
  * Returns -pte_internal if @bcache is NULL.
  * Returns -pte_internal if @index is outside of @bcache.
+ * Returns -pte_internal if @bce does not fit.
+ * Returns -pte_nomem if the page could not be allocated.
  */
 extern int pt_bcache_add(struct pt_block_cache *bcache, uint64_t index,
 			 struct pt_bcache_entry bce);
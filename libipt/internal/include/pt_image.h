@@ -36,11 +36,8 @@
 #include <stdint.h>
 
 
-/* A list of sections. */
-struct pt_section_list {
-	/* The next list element. */
-	struct pt_section_list *next;
-
+/* An image section. */
+struct pt_image_entry {
 	/* The mapped section. */
 	struct pt_mapped_section section;
 
@@ -48,13 +45,59 @@ struct pt_section_list {
 	int isid;
 };
 
+/* The sections of an image in one address space.
+ *
+ * All sections share the same asid.  They are sorted by virtual address and
+ * they do not overlap, which allows us to find the section containing a given
+ * address using binary search.
+ */
+struct pt_image_space {
+	/* The address space. */
+	struct pt_asid asid;
+
+	/* An array of @nentries sections sorted by virtual address. */
+	struct pt_image_entry *entries;
+
+	/* The number of used entries. */
+	uint32_t nentries;
+
+	/* The number of allocated entries. */
+	uint32_t capacity;
+};
+
 /* A traced image consisting of a collection of sections. */
 struct pt_image {
 	/* The optional image name. */
 	char *name;
 
-	/* The list of sections. */
-	struct pt_section_list *sections;
+	/* An array of @nspaces address spaces.
+	 *
+	 * Sections are grouped by their exact asid.  Since asids may contain
+	 * wildcards, a lookup needs to search all spaces whose asid matches
+	 * the asid of the lookup.  There are typically very few.
+	 */
+	struct pt_image_space *spaces;
+
+	/* The number of used address spaces. */
+	uint32_t nspaces;
+
+	/* The number of allocated address spaces. */
+	uint32_t capacity;
+
+	/* An optional base image.
+	 *
+	 * Lookups that do not find a section in this image fall through to
+	 * @base.  The base image is not owned by this image.
+	 */
+	const struct pt_image *base;
+
+	/* The image generation.
+	 *
+	 * This changes whenever sections are added or removed and is unique
+	 * across all images.  It allows decoders to cache the results of
+	 * section lookups.
+	 */
+	uint64_t generation;
 
 	/* An optional read memory callback. */
 	struct {
@@ -122,6 +165,16 @@ extern int pt_image_read(struct pt_image *image, int *isid, uint8_t *buffer,
 extern int pt_image_find(struct pt_image *image, struct pt_mapped_section *msec,
 			 const struct pt_asid *asid, uint64_t vaddr);
 
+/* Return the generation of @image.
+ *
+ * The generation changes whenever sections are added to or removed from
+ * @image or any of its base images and whenever @image's base changes.  It
+ * is unique across all images.
+ *
+ * Returns zero if @image is NULL.
+ */
+extern uint64_t pt_image_generation(const struct pt_image *image);
+
 /* Validate an image section.
  *
  * Validate that a lookup of @vaddr in @msec->asid in @image would result in
@@ -49,6 +49,53 @@ struct pt_iscache_entry {
 
 	/* The base address at which @section has been loaded. */
 	uint64_t laddr;
+
+	/* The interned filename of @section. */
+	const char *filename;
+
+	/* The file offset and size of @section. */
+	uint64_t offset;
+	uint64_t size;
+
+	/* The isid of the next entry in the same @exact bucket; zero if this is
+	 * the last entry.
+	 */
+	uint32_t next;
+
+	/* The isid of the next entry in the same @shared bucket; zero if this
+	 * is the last entry.
+	 */
+	uint32_t snext;
+};
+
+/* A table of image section cache entries for lock-free lookups.
+ *
+ * The section and laddr fields of the first @size entries are never modified
+ * while the table is in use.  Further entries are published by writing them
+ * before incrementing @size.
+ *
+ * When the cache is expanded, we publish a new table and retire the old one.
+ * Lookups that are still using the old table may continue to do so.  The old
+ * table is freed once they are done.
+ */
+struct pt_iscache_table {
+	/* The table's entries array. */
+	struct pt_iscache_entry *entries;
+
+	/* The number of published entries in @entries. */
+	uint32_t size;
+};
+
+/* An interned filename. */
+struct pt_iscache_filename {
+	/* The next filename in the same hash bucket. */
+	struct pt_iscache_filename *next;
+
+	/* The filename.  It is allocated together with this struct. */
+	const char *name;
+
+	/* The hash of @name. */
+	uint32_t hash;
 };
 
 /* An image section cache least recently used cache entry. */
@@ -63,6 +110,36 @@ struct pt_iscache_lru_entry {
 	uint64_t size;
 };
 
+/* The maximal number of image section cache LRU shards. */
+enum {
+	pt_iscache_max_shards	= 8
+};
+
+/* An image section cache LRU shard.
+ *
+ * Mapped sections are distributed over shards based on a hash of the section
+ * so notifications for different sections do not contend for the same lock.
+ */
+struct pt_iscache_shard {
+	/* A list of mapped sections ordered by time of last access. */
+	struct pt_iscache_lru_entry *lru;
+
+	/* The section at the front of @lru and its size in @lru; NULL and zero
+	 * if @lru is empty.
+	 *
+	 * They are read without holding @lock to skip the LRU update when the
+	 * most recently used section is mapped again and its size has not
+	 * changed.
+	 */
+	const struct pt_section *mru;
+	uint64_t mrusize;
+
+#if defined(FEATURE_THREADS)
+	/* A lock protecting this shard. */
+	mtx_t lock;
+#endif /* defined(FEATURE_THREADS) */
+};
+
 /* A cache of image sections and their load addresses.
  *
  * We combine the section with its load address to reduce the amount of
@@ -79,20 +156,107 @@ struct pt_image_section_cache {
 	/* The optional name of the cache; NULL if not named. */
 	char *name;
 
-	/* An array of @nentries cached sections. */
+	/* An array of @size cached sections.
+	 *
+	 * This is the entries array of @table.
+	 */
 	struct pt_iscache_entry *entries;
 
-	/* A list of mapped sections ordered by time of last access. */
-	struct pt_iscache_lru_entry *lru;
+	/* The table used for lock-free lookups; NULL if @entries is NULL. */
+	struct pt_iscache_table *table;
+
+	/* The number of lock-free lookups in progress in each of two epochs.
+	 *
+	 * Lookups enter the current @epoch.  When clearing or expanding the
+	 * cache, we advance @epoch so new lookups don't keep an old epoch busy
+	 * and wait for the number of lookups in each epoch to drop to zero.
+	 */
+	uint32_t readers[2];
+
+	/* The current lookup epoch. */
+	uint32_t epoch;
 
-	/* The memory limit for our LRU cache. */
+	/* Hash indices into @entries with @nbuckets buckets each.
+	 *
+	 * Each bucket holds the isid of the first entry in a chain that is
+	 * linked via the entries' next and snext fields, respectively, or
+	 * zero if the bucket is empty.
+	 *
+	 * The @exact index holds all entries and is keyed by filename, offset,
+	 * size, and load address.
+	 *
+	 * The @shared index holds the first entry for each section and is
+	 * keyed by filename, offset, and size.  All other entries for the same
+	 * file range share that entry's section.
+	 *
+	 * Filenames are interned so we can compare and hash pointers.
+	 */
+	uint32_t *exact;
+	uint32_t *shared;
+
+	/* The number of buckets in @exact and @shared; a power of two. */
+	uint32_t nbuckets;
+
+	/* A hash table of interned filenames with @nfbuckets buckets. */
+	struct pt_iscache_filename **filenames;
+
+	/* The number of buckets in @filenames; a power of two. */
+	uint32_t nfbuckets;
+
+	/* The number of interned filenames. */
+	uint32_t nfilenames;
+
+	/* Our LRU cache of mapped sections, split into @nshards shards.
+	 *
+	 * Each shard orders its sections by time of last access.  We prune
+	 * shards in a round-robin fashion starting at @prune.
+	 */
+	struct pt_iscache_shard shard[pt_iscache_max_shards];
+	uint32_t nshards;
+	uint32_t prune;
+
+	/* The memory limit for our LRU cache, i.e. its high watermark.
+	 *
+	 * When we exceed @limit, we prune the cache to @low, or to @limit if
+	 * @low is bigger.
+	 */
 	uint64_t limit;
+	uint64_t low;
 
-	/* The current size of our LRU cache. */
+	/* The current size of our LRU cache.
+	 *
+	 * This is updated atomically since shards are locked individually.
+	 */
 	uint64_t used;
 
+	/* A list of pruned sections that still need to be unmapped and their
+	 * total size.
+	 *
+	 * This is only used if @defer is set.  Otherwise, pruned sections are
+	 * unmapped immediately.
+	 */
+	struct pt_iscache_lru_entry *reclaim;
+	uint64_t reclaim_size;
+
+	/* A flag saying whether unmapping pruned sections is deferred until
+	 * pt_iscache_reclaim() is called.
+	 */
+	uint32_t defer:1;
+
+	/* The directory for persistent block caches; NULL if block caches are
+	 * not persisted.
+	 */
+	char *bcache_dir;
+
+	/* The pt_map_flag bit-vector for mapping sections. */
+	uint32_t map_flags;
+
 #if defined(FEATURE_THREADS)
-	/* A lock protecting this image section cache. */
+	/* A lock protecting this image section cache except for the LRU shards,
+	 * which have their own locks.
+	 *
+	 * When taking both, this lock must be taken first.
+	 */
 	mtx_t lock;
 #endif /* defined(FEATURE_THREADS) */
 
@@ -104,7 +268,7 @@ struct pt_image_section_cache {
 	 *
 	 * We can't expand the section cache capacity beyond INT_MAX.
 	 */
-	uint16_t capacity;
+	uint32_t capacity;
 
 	/* The current size of the cache in number of entries.
 	 *
@@ -112,7 +276,7 @@ struct pt_image_section_cache {
 	 * array; equal to @capacity if the @entries array is full and needs to
 	 * be reallocated.
 	 */
-	uint16_t size;
+	uint32_t size;
 };
 
 
@@ -158,6 +322,9 @@ extern int pt_iscache_find(struct pt_image_section_cache *iscache,
  * @laddr on success.  The caller is expected to put the returned section after
  * use.
  *
+ * This does not lock @iscache.  Lookups may proceed concurrently with each
+ * other and with adding sections.
+ *
  * Returns zero on success, a negative error code otherwise.
  * Returns -pte_internal if @iscache, @section, or @laddr is NULL.
  * Returns -pte_bad_image if @iscache does not contain @isid.
@@ -179,6 +346,9 @@ extern int pt_iscache_clear(struct pt_image_section_cache *iscache);
  * The caller must not lock @section to allow @iscache to map it.  This function
  * must not try to detach from @section.
  *
+ * If @section is already the most recently used section and its size did not
+ * change, this returns without locking @iscache.
+ *
  * Returns zero on success, a negative pt_error_code otherwise.
  * Returns -pte_internal if @iscache or @section is NULL.
  * Returns -pte_bad_lock on any locking error.
@@ -203,4 +373,28 @@ extern int pt_iscache_notify_map(struct pt_image_section_cache *iscache,
 extern int pt_iscache_notify_resize(struct pt_image_section_cache *iscache,
 				    struct pt_section *section, uint64_t size);
 
+/* Get the directory for persistent block caches.
+ *
+ * Provides a copy of @iscache's block cache directory in @dir or NULL if block
+ * caches are not persisted.  The caller is responsible for freeing it.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ * Returns -pte_internal if @iscache or @dir is NULL.
+ * Returns -pte_nomem if the directory can't be copied.
+ * Returns -pte_bad_lock on any locking error.
+ */
+extern int pt_iscache_bcache_dir(struct pt_image_section_cache *iscache,
+				 char **dir);
+
+/* Get the section mapping flags.
+ *
+ * Provides @iscache's pt_map_flag bit-vector in @flags.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ * Returns -pte_internal if @iscache or @flags is NULL.
+ * Returns -pte_bad_lock on any locking error.
+ */
+extern int pt_iscache_map_flags(struct pt_image_section_cache *iscache,
+				uint32_t *flags);
+
 #endif /* PT_IMAGE_SECTION_CACHE_H */
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PT_INSN_CACHE_H
+#define PT_INSN_CACHE_H
+
+#include "intel-pt.h"
+
+#include <stdint.h>
+
+
+/* An instruction cache entry.
+ *
+ * There will be one such entry per byte of decoded memory image.  Each entry
+ * corresponds to an IP in the traced memory image.  The cache is initialized
+ * with invalid entries for all IPs.
+ *
+ * Only entries for the first byte of each instruction will be used; other
+ * entries are ignored and will remain invalid.
+ *
+ * Each valid entry holds the instruction length decode result for the
+ * instruction at the entry's IP in the entry's execution mode.  The raw bytes
+ * are not cached; they are read from the section on every lookup.
+ */
+struct pt_icache_entry {
+	/* The branch displacement for near direct branches.
+	 *
+	 * This is struct pt_insn_ext's variant.branch.displacement.
+	 */
+	int32_t displacement;
+
+	/* The execution mode in which the instruction was decoded.
+	 *
+	 * This is enum pt_exec_mode.
+	 *
+	 * This is ptem_unknown if the entry is not valid.
+	 */
+	uint32_t mode:2;
+
+	/* The size of the instruction in bytes. */
+	uint32_t size:4;
+
+	/* The instruction class.
+	 *
+	 * This is enum pt_insn_class.
+	 */
+	uint32_t iclass:4;
+
+	/* The detailed instruction class.
+	 *
+	 * This is pti_inst_enum_t, i.e. struct pt_insn_ext's iclass.
+	 */
+	uint32_t iext:6;
+
+	/* A flag saying whether a branch is direct.
+	 *
+	 * This is struct pt_insn_ext's variant.branch.is_direct.
+	 */
+	uint32_t is_direct:1;
+};
+
+/* Get the execution mode of an instruction cache entry. */
+static inline enum pt_exec_mode pt_ice_exec_mode(struct pt_icache_entry ice)
+{
+	return (enum pt_exec_mode) ice.mode;
+}
+
+/* Check if an instruction cache entry is valid. */
+static inline int pt_ice_is_valid(struct pt_icache_entry ice)
+{
+	return pt_ice_exec_mode(ice) != ptem_unknown;
+}
+
+
+
+enum {
+	/* The log2 of the number of entries in an instruction cache page. */
+	pt_icache_page_shift	= 10,
+
+	/* The number of entries in an instruction cache page. */
+	pt_icache_page_size	= 1 << pt_icache_page_shift,
+
+	/* The mask for the index of an entry inside its page. */
+	pt_icache_page_mask	= pt_icache_page_size - 1
+};
+
+/* An instruction cache page.
+ *
+ * Pages are allocated on the first pt_icache_add() into them.  They are never
+ * freed before the instruction cache itself.
+ */
+struct pt_icache_page {
+	/* The cache entries. */
+	struct pt_icache_entry entry[pt_icache_page_size];
+};
+
+/* An instruction cache.
+ *
+ * Like the block cache, the instruction cache is organized as a two-level
+ * table so memory consumption scales with the amount of code that has
+ * actually been decoded.
+ */
+struct pt_insn_cache {
+	/* The number of cache entries. */
+	uint32_t nentries;
+
+	/* The number of allocated pages. */
+	uint32_t npages;
+
+	/* A variable-length page directory of
+	 *
+	 *   (@nentries + pt_icache_page_mask) >> pt_icache_page_shift
+	 *
+	 * entries.  A NULL entry means that none of the respective cache
+	 * entries is valid.
+	 */
+	struct pt_icache_page *page[];
+};
+
+/* Create an instruction cache.
+ *
+ * @nentries is the number of entries in the cache and should match the size of
+ * the to-be-cached section in bytes.
+ *
+ * Only the page directory is allocated.
+ */
+extern struct pt_insn_cache *pt_icache_alloc(uint64_t nentries);
+
+/* Destroy an instruction cache. */
+extern void pt_icache_free(struct pt_insn_cache *icache);
+
+/* Get the memory size of an instruction cache.
+ *
+ * Provides the amount of memory used by @icache in bytes in @size.  This
+ * includes the page directory and all allocated pages.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @icache or @size is NULL.
+ */
+extern int pt_icache_memsize(const struct pt_insn_cache *icache,
+			     uint64_t *size);
+
+/* Cache an instruction.
+ *
+ * It is expected that all calls for the same @index and execution mode write
+ * the same @ice.
+ *
+ * Allocates the page containing @index if necessary.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @icache is NULL.
+ * Returns -pte_internal if @index is outside of @icache.
+ * Returns -pte_nomem if the page could not be allocated.
+ */
+extern int pt_icache_add(struct pt_insn_cache *icache, uint64_t index,
+			 struct pt_icache_entry ice);
+
+/* Lookup a cached instruction.
+ *
+ * The returned cache entry need not be valid.  The caller is expected to check
+ * for validity using pt_ice_is_valid(*@ice) and to compare the execution mode.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @icache or @ice is NULL.
+ * Returns -pte_internal if @index is outside of @icache.
+ */
+extern int pt_icache_lookup(struct pt_icache_entry *ice,
+			    const struct pt_insn_cache *icache,
+			    uint64_t index);
+
+#endif /* PT_INSN_CACHE_H */
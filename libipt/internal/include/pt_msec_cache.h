@@ -34,56 +34,102 @@
 #include "intel-pt.h"
 
 
-/* A single-entry mapped section cache.
- *
- * The cached section is implicitly mapped and unmapped.  The cache is not
- * thread-safe.
- */
-struct pt_msec_cache {
+enum {
+	/* The number of entries in a mapped section cache. */
+	pt_msec_cache_nentries	= 8
+};
+
+/* A mapped section cache entry. */
+struct pt_msec_cache_entry {
 	/* The cached section.
 	 *
-	 * The cache is valid if and only if @msec.section is not NULL.
+	 * The entry is valid if and only if @msec.section is not NULL.
 	 *
-	 * It needs to be unmapped and put.  Use pt_blk_scache_invalidate() to
-	 * release the cached section and to invalidate the cache.
+	 * It needs to be unmapped and put.
 	 */
 	struct pt_mapped_section msec;
 
+	/* The address space in which @msec had been looked up. */
+	struct pt_asid asid;
+
 	/* The section identifier. */
 	int isid;
 };
 
+/* A small mapped section cache.
+ *
+ * The cache holds up to pt_msec_cache_nentries recently used sections of a
+ * single image.  Entries are keyed by their virtual address range and by the
+ * address space in which they had been looked up.  They are replaced in least
+ * recently used order.
+ *
+ * The cached sections are implicitly mapped and unmapped.  The cache is not
+ * thread-safe.
+ */
+struct pt_msec_cache {
+	/* The cache entries. */
+	struct pt_msec_cache_entry entry[pt_msec_cache_nentries];
+
+	/* The indices of valid @entry elements in most recently used order.
+	 *
+	 * The first @nvalid elements are used.
+	 */
+	uint8_t mru[pt_msec_cache_nentries];
+
+	/* The number of valid entries. */
+	uint8_t nvalid;
+
+	/* The image from which the cached sections were taken and its
+	 * generation at that time.
+	 *
+	 * All entries are invalidated when either changes.
+	 */
+	const struct pt_image *image;
+	uint64_t generation;
+
+	/* The number of cache hits and misses. */
+	uint64_t hits;
+	uint64_t misses;
+};
+
 /* Initialize the cache. */
 extern int pt_msec_cache_init(struct pt_msec_cache *cache);
 
 /* Finalize the cache. */
 extern void pt_msec_cache_fini(struct pt_msec_cache *cache);
 
-/* Invalidate the cache. */
+/* Invalidate the cache.
+ *
+ * This does not reset the hit and miss counters.
+ */
 extern int pt_msec_cache_invalidate(struct pt_msec_cache *cache);
 
-/* Read the cached section.
+/* Read a cached section.
  *
- * If @cache is not empty and @image would find it when looking up @vaddr in
- * @*pmsec->asid, provide a pointer to the cached section in @pmsec and return
- * its image section identifier.
+ * If @cache contains a section that @image would find when looking up @vaddr
+ * in @asid, provide a pointer to the cached section in @pmsec and return its
+ * image section identifier.
  *
- * The provided pointer remains valid until @cache is invalidated.
+ * The provided pointer remains valid until @cache is filled or invalidated.
  *
  * Returns @*pmsec's isid on success, a negative pt_error_code otherwise.
+ * Returns -pte_nomap if @cache does not contain such a section.
  */
 extern int pt_msec_cache_read(struct pt_msec_cache *cache,
 			      const struct pt_mapped_section **pmsec,
-			      struct pt_image *image, uint64_t vaddr);
+			      struct pt_image *image,
+			      const struct pt_asid *asid, uint64_t vaddr);
 
 /* Fill the cache.
  *
  * Look up @vaddr in @asid in @image and cache as well as provide the found
  * section in @pmsec and return its image section identifier.
  *
- * Invalidates @cache.
+ * Replaces the least recently used entry.  Invalidates @cache if @image
+ * changed.
  *
- * The provided pointer remains valid until @cache is invalidated.
+ * The provided pointer remains valid until @cache is filled again or
+ * invalidated.
  *
  * Returns @*pmsec's isid on success, a negative pt_error_code otherwise.
  */
@@ -92,4 +138,14 @@ extern int pt_msec_cache_fill(struct pt_msec_cache *cache,
 			      struct pt_image *image,
 			      const struct pt_asid *asid, uint64_t vaddr);
 
+/* Provide @cache's hit and miss counters.
+ *
+ * Copies at most @size bytes into @stats and zeroes the rest.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ * Returns -pte_internal if @cache or @stats is NULL.
+ */
+extern int pt_msec_cache_stats(const struct pt_msec_cache *cache,
+			       struct pt_scache_stats *stats, size_t size);
+
 #endif /* PT_MSEC_CACHE_H */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PT_PSB_INDEX_H
+#define PT_PSB_INDEX_H
+
+#include <stdint.h>
+
+
+/* A PSB index record.
+ *
+ * This is the compact in-memory and on-disk representation of a struct
+ * pt_psb_entry.
+ */
+struct pt_psb_record {
+	/* The offset of the PSB packet in the trace buffer. */
+	uint64_t offset;
+
+	/* The TSC given in or carried forward to this PSB+ header. */
+	uint64_t tsc;
+
+	/* The IP given in the PSB+ header. */
+	uint64_t ip;
+
+	/* The TMA packet's CTC and fast counter payloads. */
+	uint16_t ctc;
+	uint16_t fc;
+
+	/* The core:bus ratio. */
+	uint8_t cbr;
+
+	/* The execution mode - enum pt_exec_mode. */
+	uint8_t mode;
+
+	/* A bit-vector of pt_psb_record_flag flags. */
+	uint8_t flags;
+
+	/* Reserved - must be zero. */
+	uint8_t reserved;
+};
+
+/* The PSB+ header contents given in a PSB index record. */
+enum pt_psb_record_flag {
+	ppr_tsc	= 1 << 0,
+	ppr_tma	= 1 << 1,
+	ppr_cbr	= 1 << 2,
+	ppr_ip	= 1 << 3
+};
+
+/* A PSB index. */
+struct pt_psb_index {
+	/* The records in increasing offset order. */
+	struct pt_psb_record *record;
+
+	/* The number of records. */
+	int nrecords;
+
+	/* The number of records that fit into @record. */
+	int capacity;
+
+	/* The size of the indexed trace buffer in bytes. */
+	uint64_t size;
+};
+
+#endif /* PT_PSB_INDEX_H */
@@ -33,6 +33,7 @@
 #include "pt_tnt_cache.h"
 #include "pt_time.h"
 #include "pt_event_queue.h"
+#include "pt_stream.h"
 
 #include "intel-pt.h"
 
@@ -74,6 +75,13 @@ struct pt_query_decoder {
 	/* The current event. */
 	struct pt_event *event;
 
+	/* The trace stream in streaming mode.
+	 *
+	 * The decoder's trace buffer ends at the last PSB in the stream unless
+	 * the stream has been closed.
+	 */
+	struct pt_stream stream;
+
 	/* A collection of flags relevant for decoding:
 	 *
 	 * - tracing is enabled.
@@ -94,6 +102,30 @@ extern int pt_qry_decoder_init(struct pt_query_decoder *,
 /* Finalize the query decoder. */
 extern void pt_qry_decoder_fini(struct pt_query_decoder *);
 
+/* Query a conditional branch from the TNT cache.
+ *
+ * This is a fast path for pt_qry_cond_branch() that only succeeds if @decoder
+ * holds more than one cached TNT bit.  Events are not indicated before the TNT
+ * cache is emptied so the query status is known to be zero.
+ *
+ * Returns a positive integer if the branch is taken, zero if it is not taken.
+ * Returns -pte_bad_query if pt_qry_cond_branch() needs to be used, instead.
+ */
+static inline int pt_qry_cond_branch_cached(struct pt_query_decoder *decoder)
+{
+	struct pt_tnt_cache *tnt;
+	int taken;
+
+	tnt = &decoder->tnt;
+	if (tnt->index <= 1ull)
+		return -pte_bad_query;
+
+	taken = (tnt->tnt & tnt->index) != 0ull;
+	tnt->index >>= 1;
+
+	return taken;
+}
+
 /* Decoder functions (tracing context). */
 extern int pt_qry_decode_unknown(struct pt_query_decoder *);
 extern int pt_qry_decode_pad(struct pt_query_decoder *);
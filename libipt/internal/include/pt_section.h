@@ -39,6 +39,7 @@
 #include "intel-pt.h"
 
 struct pt_block_cache;
+struct pt_insn_cache;
 
 
 /* A section of contiguous memory loaded from a file. */
@@ -84,6 +85,37 @@ struct pt_section {
 	 */
 	struct pt_block_cache *bcache;
 
+	/* The name of the file in which @bcache is persisted - NULL if @bcache
+	 * is not persisted.
+	 *
+	 * This is set when @bcache is created and cleared when it is destroyed.
+	 */
+	char *bcname;
+
+	/* The content hash of this section if @bchashed is not zero.
+	 *
+	 * Hashing a large section is expensive.  The hash is computed when the
+	 * block cache is first created and kept until the section is destroyed.
+	 * It is protected by the attach lock.
+	 */
+	uint64_t bchash;
+
+	/* The number of valid @bcache entries stored in @bcname. */
+	uint32_t bcvalid;
+
+	/* A flag saying whether @bchash has been computed. */
+	uint32_t bchashed:1;
+
+	/* A pointer to an optional instruction cache.
+	 *
+	 * The cache is created on request and destroyed implicitly when the
+	 * section is unmapped.
+	 *
+	 * Like @bcache, we read this field without locking and only lock the
+	 * section in order to install the instruction cache.
+	 */
+	struct pt_insn_cache *icache;
+
 	/* A pointer to the iscache attached to this section.
 	 *
 	 * The pointer is initialized when the iscache attaches and cleared when
@@ -296,6 +328,48 @@ pt_section_bcache(const struct pt_section *section)
 	return section->bcache;
 }
 
+/* Allocate an instruction cache.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @section is NULL.
+ * Returns -pte_nomem if the instruction cache can't be allocated.
+ * Returns -pte_bad_lock on any locking error.
+ * Returns -pte_not_supported if @section is too big or if the host does not
+ * support instruction caches.
+ */
+extern int pt_section_alloc_icache(struct pt_section *section);
+
+/* Request instruction caching.
+ *
+ * The caller must ensure that @section is mapped.
+ */
+static inline int pt_section_request_icache(struct pt_section *section)
+{
+	if (!section)
+		return -pte_internal;
+
+	if (section->icache)
+		return 0;
+
+	return pt_section_alloc_icache(section);
+}
+
+/* Return @section's instruction cache, if available.
+ *
+ * The caller must ensure that @section is mapped.
+ *
+ * The cache is not use-counted.  It is only valid as long as the caller keeps
+ * @section mapped.
+ */
+static inline struct pt_insn_cache *
+pt_section_icache(const struct pt_section *section)
+{
+	if (!section)
+		return NULL;
+
+	return section->icache;
+}
+
 /* Create the OS-specific file status.
  *
  * On success, allocates a status object, provides a pointer to it in @pstatus
@@ -334,6 +408,32 @@ static inline int pt_section_on_map(struct pt_section *section)
 	return pt_section_on_map_lock(section);
 }
 
+/* Get the mapping flags for a section.
+ *
+ * Provides the pt_map_flag bit-vector of the image section cache @section is
+ * attached to in @flags or zero if @section is not attached.
+ *
+ * This function is called by the OS-specific pt_section_map() implementation
+ * before mapping @section.  The section lock must not be held.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @section or @flags is NULL.
+ * Returns -pte_bad_lock on any locking error.
+ */
+extern int pt_section_map_flags_lock(struct pt_section *section,
+				     uint32_t *flags);
+
+static inline int pt_section_map_flags(struct pt_section *section,
+				       uint32_t *flags)
+{
+	if (section && !section->iscache && flags) {
+		*flags = 0u;
+		return 0;
+	}
+
+	return pt_section_map_flags_lock(section, flags);
+}
+
 /* Map a section.
  *
  * Maps @section into memory.  Mappings are use-counted.  The number of
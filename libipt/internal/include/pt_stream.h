@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2014-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PT_STREAM_H
+#define PT_STREAM_H
+
+#include "intel-pt.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct pt_config;
+
+
+/* A trace stream buffer.
+ *
+ * Streaming decoders do not work on a user-provided trace buffer.  Instead,
+ * the user appends trace in chunks of arbitrary size as it becomes available.
+ * The stream buffer collects those chunks in a contiguous buffer so packets
+ * that are split across chunks can be decoded as usual.
+ *
+ * Trace that is no longer needed by the decoder is discarded when appending
+ * new trace so the buffer only holds the tail of the trace stream.
+ */
+struct pt_stream {
+	/* The buffered trace.
+	 *
+	 * This is NULL if the decoder does not operate in streaming mode.
+	 */
+	uint8_t *buffer;
+
+	/* The number of buffered bytes. */
+	size_t size;
+
+	/* The size of @buffer in bytes. */
+	size_t capacity;
+
+	/* The offset of @buffer[0] in the trace stream. */
+	uint64_t base;
+
+	/* A flag saying that no more trace will be appended. */
+	uint32_t closed:1;
+};
+
+
+/* Initialize a trace stream buffer.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @stream is NULL.
+ * Returns -pte_nomem if the buffer could not be allocated.
+ */
+extern int pt_stream_init(struct pt_stream *stream);
+
+/* Finalize a trace stream buffer. */
+extern void pt_stream_fini(struct pt_stream *stream);
+
+/* Prepare a decoder configuration for a trace stream buffer.
+ *
+ * Copies the user configuration @uconfig into @config replacing the trace
+ * buffer with @stream's buffer.  The result is intended to be passed to a
+ * decoder's init function in place of @uconfig.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @config or @stream is NULL.
+ * Returns -pte_invalid if @uconfig is NULL.
+ */
+extern int pt_stream_config(struct pt_config *config,
+			    const struct pt_config *uconfig,
+			    const struct pt_stream *stream);
+
+/* Append trace to a trace stream buffer.
+ *
+ * Appends @size bytes at @buffer to @stream.  The first @discard bytes of
+ * @stream's buffer are no longer needed and may be discarded.
+ *
+ * This may move @stream's buffer and change its base offset.  Pointers into
+ * the buffer must be rebased using stream offsets.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_internal if @stream is NULL or if @discard is too big.
+ * Returns -pte_invalid if @buffer is NULL and @size is not zero.
+ * Returns -pte_not_supported if @stream is not a streaming buffer.
+ * Returns -pte_eos if @stream has been closed.
+ * Returns -pte_nomem if @stream's buffer could not be enlarged.
+ */
+extern int pt_stream_append(struct pt_stream *stream, const uint8_t *buffer,
+			    size_t size, size_t discard);
+
+/* Check whether more trace may be appended to @stream. */
+static inline int pt_stream_is_open(const struct pt_stream *stream)
+{
+	return stream->buffer && !stream->closed;
+}
+
+/* Turn -pte_eos into -pte_suspended for an open trace stream.
+ *
+ * Returns @errcode otherwise.
+ */
+static inline int pt_stream_suspend(const struct pt_stream *stream,
+				    int errcode)
+{
+	if ((errcode == -pte_eos) && pt_stream_is_open(stream))
+		return -pte_suspended;
+
+	return errcode;
+}
+
+#endif /* PT_STREAM_H */
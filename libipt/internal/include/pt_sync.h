@@ -34,6 +34,38 @@
 struct pt_config;
 
 
+/* The psb payload pattern search algorithms. */
+enum pt_sync_search {
+	/* Compare one 64bit word at a time. */
+	pt_sync_search_scalar,
+
+	/* Compare 32 bytes at a time using SSE2. */
+	pt_sync_search_sse2,
+
+	/* Compare 64 bytes at a time using AVX2. */
+	pt_sync_search_avx2
+};
+
+/* Select the best psb payload pattern search the processor supports.
+ *
+ * This is called once when the library is loaded.  Until then, or if the
+ * processor does not support any SIMD extensions, the scalar search is used.
+ */
+extern void pt_sync_init(void);
+
+/* Select the psb payload pattern search algorithm.
+ *
+ * This affects all synchronization searches.  It is intended for testing and
+ * must not be called while trace is being decoded.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ *
+ * Returns -pte_invalid if @search is not a valid algorithm.
+ * Returns -pte_not_supported if @search is not supported by the processor or
+ * by the compiler.
+ */
+extern int pt_sync_set_search(enum pt_sync_search search);
+
 /* Synchronize onto the trace stream.
  *
  * Search for the next synchronization point in forward or backward direction
@@ -27,10 +27,14 @@
  */
 
 #include "pt_ild.h"
+#include "pt_sync.h"
 
 
 static void __attribute__((constructor)) init(void)
 {
 	/* Initialize the Intel(R) Processor Trace instruction decoder. */
 	pt_ild_init();
+
+	/* Select the fastest trace synchronization search. */
+	pt_sync_init();
 }
@@ -26,6 +26,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#if defined(__linux__)
+/* We need MAP_POPULATE and MADV_HUGEPAGE for mapping sections. */
+#  define _DEFAULT_SOURCE
+#endif
+
 #include "pt_section.h"
 #include "pt_section_posix.h"
 #include "pt_section_file.h"
@@ -96,16 +101,123 @@ static int check_file_status(struct pt_section *section, int fd)
 	return 0;
 }
 
-int pt_sec_posix_map(struct pt_section *section, int fd)
+/* Copy @section into anonymous memory.
+ *
+ * The copy is padded to a multiple of the page size or, if @flags contains
+ * ptmf_hugepage, to a multiple of the huge page size.  The padding is
+ * accounted in the section's memory size.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sec_posix_copy(struct pt_section *section, int fd,
+			     uint32_t flags)
+{
+	struct pt_sec_posix_mapping *mapping;
+	uint64_t size, asize, align, offset, done;
+	uint8_t *mem, *base;
+	long pagesize;
+	size_t msize;
+	int errcode;
+
+	if (!section)
+		return -pte_internal;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		return -pte_internal;
+
+	align = (uint64_t) pagesize;
+	if ((flags & ptmf_hugepage) && (align < pt_sec_posix_hugepage))
+		align = pt_sec_posix_hugepage;
+
+	size = section->size;
+	offset = section->offset;
+
+	if (pt_sec_posix_copy_max < size)
+		return -pte_nomem;
+
+	asize = (size + align - 1) & ~(align - 1);
+	if (!asize)
+		asize = align;
+
+	/* Over-allocate so we can align the copy. */
+	msize = (size_t) (asize + align - (uint64_t) pagesize);
+
+	mem = mmap(NULL, msize, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return -pte_nomem;
+
+	base = (uint8_t *) (((uintptr_t) mem + align - 1) &
+			    ~(uintptr_t) (align - 1));
+	if (mem < base)
+		munmap(mem, (size_t) (base - mem));
+
+	if (base + asize < mem + msize)
+		munmap(base + asize, (size_t) ((mem + msize) - (base + asize)));
+
+#if defined(MADV_HUGEPAGE)
+	/* This must happen before we touch the memory. */
+	if (flags & ptmf_hugepage)
+		(void) madvise(base, (size_t) asize, MADV_HUGEPAGE);
+#endif
+
+	errcode = -pte_bad_image;
+	for (done = 0ull; done < size;) {
+		ssize_t nread;
+
+		nread = pread(fd, base + done, (size_t) (size - done),
+			      (off_t) (offset + done));
+		if (nread <= 0)
+			goto out_mem;
+
+		done += (uint64_t) nread;
+	}
+
+	(void) mprotect(base, (size_t) asize, PROT_READ);
+
+	mapping = malloc(sizeof(*mapping));
+	if (!mapping) {
+		errcode = -pte_nomem;
+		goto out_mem;
+	}
+
+	mapping->base = base;
+	mapping->size = asize;
+	mapping->begin = base;
+	mapping->end = base + size;
+
+	section->mapping = mapping;
+	section->unmap = pt_sec_posix_unmap;
+	section->read = pt_sec_posix_read;
+	section->memsize = pt_sec_posix_memsize;
+
+	return 0;
+
+out_mem:
+	munmap(base, (size_t) asize);
+	return errcode;
+}
+
+int pt_sec_posix_map(struct pt_section *section, int fd, uint32_t flags)
 {
 	struct pt_sec_posix_mapping *mapping;
 	uint64_t offset, size, adjustment;
 	uint8_t *base;
-	int errcode;
+	int errcode, mflags;
 
 	if (!section)
 		return -pte_internal;
 
+	/* Small sections may be copied.  We fall back to mapping the file if
+	 * that fails.
+	 */
+	if (flags & ptmf_copy) {
+		errcode = pt_sec_posix_copy(section, fd, flags);
+		if (!errcode)
+			return 0;
+	}
+
 	offset = section->offset;
 	size = section->size;
 
@@ -126,11 +238,23 @@ int pt_sec_posix_map(struct pt_section *section, int fd)
 	if (INT_MAX < offset)
 		return -pte_nomem;
 
-	base = mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED, fd,
+	mflags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+	if (flags & ptmf_populate)
+		mflags |= MAP_POPULATE;
+#endif
+
+	base = mmap(NULL, (size_t) size, PROT_READ, mflags, fd,
 		    (off_t) offset);
 	if (base == MAP_FAILED)
 		return -pte_nomem;
 
+#if defined(MADV_HUGEPAGE)
+	/* This is only a hint.  Not all file systems support huge pages. */
+	if (flags & ptmf_hugepage)
+		(void) madvise(base, (size_t) size, MADV_HUGEPAGE);
+#endif
+
 	mapping = malloc(sizeof(*mapping));
 	if (!mapping) {
 		errcode = -pte_nomem;
@@ -193,6 +317,7 @@ static int pt_sec_posix_map_success(struct pt_section *section)
 int pt_section_map(struct pt_section *section)
 {
 	const char *filename;
+	uint32_t flags;
 	FILE *file;
 	int fd, errcode;
 
@@ -206,6 +331,25 @@ int pt_section_map(struct pt_section *section)
 	if (section->mcount)
 		return pt_sec_posix_map_success(section);
 
+	/* We need to map @section.  Get the mapping flags first.  We must not
+	 * hold the section lock for that.
+	 */
+	errcode = pt_section_unlock(section);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_section_map_flags(section, &flags);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_section_lock(section);
+	if (errcode < 0)
+		return errcode;
+
+	/* @section may have been mapped in the meantime. */
+	if (section->mcount)
+		return pt_sec_posix_map_success(section);
+
 	if (section->mapping)
 		goto out_unlock;
 
@@ -223,7 +367,7 @@ int pt_section_map(struct pt_section *section)
 		goto out_fd;
 
 	/* We close the file on success.  This does not unmap the section. */
-	errcode = pt_sec_posix_map(section, fd);
+	errcode = pt_sec_posix_map(section, fd, flags);
 	if (!errcode) {
 		close(fd);
 
@@ -305,7 +449,6 @@ int pt_sec_posix_read(const struct pt_section *section, uint8_t *buffer,
 int pt_sec_posix_memsize(const struct pt_section *section, uint64_t *size)
 {
 	struct pt_sec_posix_mapping *mapping;
-	const uint8_t *begin, *end;
 
 	if (!section || !size)
 		return -pte_internal;
@@ -314,13 +457,10 @@ int pt_sec_posix_memsize(const struct pt_section *section, uint64_t *size)
 	if (!mapping)
 		return -pte_internal;
 
-	begin = mapping->base;
-	end = mapping->end;
-
-	if (!begin || !end || end < begin)
+	if (!mapping->base)
 		return -pte_internal;
 
-	*size = (uint64_t) (end - begin);
+	*size = mapping->size;
 
 	return 0;
 }
@@ -29,10 +29,84 @@
 #include "pt_block_cache.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 
+#if defined(_MSC_VER)
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#endif
 
-struct pt_block_cache *pt_bcache_alloc(uint64_t nentries)
+
+/* The header of a persistent block cache file.
+ *
+ * The header is followed by @nvalid records of struct pt_bcache_record.
+ *
+ * The file is written in host byte order and with the host's bit-field layout.
+ * It is not intended to be shared between different systems.
+ */
+struct pt_bcache_header {
+	/* The file magic - pt_bcache_magic. */
+	uint32_t magic;
+
+	/* The file format version - pt_bcache_version. */
+	uint16_t version;
+
+	/* The size of a block cache entry in bytes. */
+	uint16_t esize;
+
+	/* The content hash of the cached section. */
+	uint64_t hash;
+
+	/* The number of cache entries. */
+	uint32_t nentries;
+
+	/* The number of records following this header. */
+	uint32_t nvalid;
+};
+
+/* A persistent block cache record.
+ *
+ * Entries are stored in the wide format independent of the block cache's
+ * format.
+ */
+struct pt_bcache_record {
+	/* The index of the cache entry. */
+	uint32_t index;
+
+	/* The cache entry. */
+	struct pt_bcache_entry entry;
+};
+
+enum {
+	/* The persistent block cache file magic ('ptbc'). */
+	pt_bcache_magic		= 0x63627470,
+
+	/* The persistent block cache file format version. */
+	pt_bcache_version	= 2
+};
+
+
+/* Get the number of page directory entries for @nentries cache entries. */
+static uint64_t pt_bcache_ndir(uint64_t nentries)
+{
+	return (nentries + pt_bcache_page_mask) >> pt_bcache_page_shift;
+}
+
+/* Get the size of a page of @bcache in bytes. */
+static size_t pt_bcache_page_bytes(const struct pt_block_cache *bcache)
+{
+	if (bcache->format == pt_bcf_wide)
+		return sizeof(struct pt_bcache_wpage);
+
+	return sizeof(struct pt_bcache_page);
+}
+
+static struct pt_block_cache *
+pt_bcache_alloc_format(uint64_t nentries, enum pt_bcache_format format)
 {
 	struct pt_block_cache *bcache;
 	uint64_t size;
@@ -40,7 +114,8 @@ struct pt_block_cache *pt_bcache_alloc(uint64_t nentries)
 	if (!nentries || (UINT32_MAX < nentries))
 		return NULL;
 
-	size = sizeof(*bcache) + (nentries * sizeof(struct pt_bcache_entry));
+	size = sizeof(*bcache) +
+		(pt_bcache_ndir(nentries) * sizeof(struct pt_bcache_page *));
 	if (SIZE_MAX < size)
 		return NULL;
 
@@ -50,29 +125,485 @@ struct pt_block_cache *pt_bcache_alloc(uint64_t nentries)
 
 	memset(bcache, 0, (size_t) size);
 	bcache->nentries = (uint32_t) nentries;
+	bcache->format = (uint32_t) format;
 
 	return bcache;
 }
 
+struct pt_block_cache *pt_bcache_alloc(uint64_t nentries)
+{
+	return pt_bcache_alloc_format(nentries, pt_bcf_compact);
+}
+
+struct pt_block_cache *pt_bcache_alloc_wide(uint64_t nentries)
+{
+	/* We rely on 64-bit loads and stores being atomic. */
+#if (UINTPTR_MAX < UINT64_MAX)
+	return pt_bcache_alloc_format(nentries, pt_bcf_compact);
+#else
+	return pt_bcache_alloc_format(nentries, pt_bcf_wide);
+#endif
+}
+
+/* Free all pages of @bcache. */
+static void pt_bcache_clear(struct pt_block_cache *bcache)
+{
+	uint64_t ndir, pidx;
+
+	if (!bcache)
+		return;
+
+	ndir = pt_bcache_ndir(bcache->nentries);
+	for (pidx = 0; pidx < ndir; ++pidx) {
+		free(bcache->page[pidx]);
+		bcache->page[pidx] = NULL;
+	}
+
+	bcache->npages = 0;
+}
+
 void pt_bcache_free(struct pt_block_cache *bcache)
 {
+	pt_bcache_clear(bcache);
 	free(bcache);
 }
 
+int pt_bcache_memsize(const struct pt_block_cache *bcache, uint64_t *psize)
+{
+	uint64_t size;
+
+	if (!bcache || !psize)
+		return -pte_internal;
+
+	size = sizeof(*bcache);
+	size += pt_bcache_ndir(bcache->nentries) *
+		sizeof(struct pt_bcache_page *);
+	size += (uint64_t) bcache->npages * pt_bcache_page_bytes(bcache);
+
+	*psize = size;
+
+	return 0;
+}
+
+/* Install @page in @bcache's page directory at @pidx.
+ *
+ * Another thread may have installed a page concurrently.  In that case, @page
+ * is freed.
+ *
+ * Returns the installed page.
+ */
+static void *pt_bcache_install(struct pt_block_cache *bcache, uint32_t pidx,
+			       void *page)
+{
+	void *installed;
+
+#if defined(_MSC_VER)
+	installed = InterlockedCompareExchangePointer(
+		(PVOID volatile *) &bcache->page[pidx], page, NULL);
+	if (!installed)
+		(void) InterlockedIncrement((LONG volatile *) &bcache->npages);
+#else
+	installed = __sync_val_compare_and_swap(&bcache->page[pidx], NULL,
+						page);
+	if (!installed)
+		(void) __sync_fetch_and_add(&bcache->npages, 1);
+#endif
+
+	if (!installed)
+		return page;
+
+	free(page);
+	return installed;
+}
+
+/* Get the page of @bcache containing @index and allocate it if necessary.
+ *
+ * Returns the page on success, NULL if the allocation failed.
+ */
+static void *pt_bcache_page(struct pt_block_cache *bcache, uint32_t index)
+{
+	void *page;
+	size_t size;
+	uint32_t pidx;
+
+	pidx = index >> pt_bcache_page_shift;
+
+	page = bcache->page[pidx];
+	if (page)
+		return page;
+
+	size = pt_bcache_page_bytes(bcache);
+
+	page = malloc(size);
+	if (!page)
+		return NULL;
+
+	memset(page, 0, size);
+
+	return pt_bcache_install(bcache, pidx, page);
+}
+
+/* Convert a compact block cache entry into the wide format. */
+static inline struct pt_bcache_entry pt_bce_widen(struct pt_bcache_compact cbe)
+{
+	struct pt_bcache_entry bce;
+
+	memset(&bce, 0, sizeof(bce));
+	bce.displacement = cbe.displacement;
+	bce.ninsn = cbe.ninsn;
+	bce.mode = cbe.mode;
+	bce.qualifier = cbe.qualifier;
+	bce.isize = cbe.isize;
+
+	return bce;
+}
+
+/* Get the entry at @index in @page of @bcache.
+ *
+ * We rely on guaranteed atomic operations as specified in section 8.1.1 in
+ * Volume 3A of the Intel(R) Software Developer's Manual at
+ * http://www.intel.com/sdm.
+ */
+static inline struct pt_bcache_entry
+pt_bcache_page_get(const struct pt_block_cache *bcache, const void *page,
+		   uint64_t index)
+{
+	const struct pt_bcache_page *npage;
+	struct pt_bcache_entry bce;
+
+	index &= pt_bcache_page_mask;
+
+	if (bcache->format == pt_bcf_wide) {
+		uint64_t raw;
+
+		raw = ((const struct pt_bcache_wpage *) page)->entry[index];
+		memcpy(&bce, &raw, sizeof(bce));
+
+		return bce;
+	}
+
+	npage = (const struct pt_bcache_page *) page;
+
+	return pt_bce_widen(npage->entry[index]);
+}
+
+/* Read the records in @file into @bcache.
+ *
+ * Returns the number of loaded entries on success, a negative error code
+ * otherwise.
+ */
+static int pt_bcache_read(struct pt_block_cache *bcache, FILE *file,
+			  uint64_t hash)
+{
+	struct pt_bcache_header header;
+	uint32_t nvalid;
+	size_t count;
+	int errcode;
+
+	if (!bcache || !file)
+		return -pte_internal;
+
+	count = fread(&header, sizeof(header), 1, file);
+	if (count != 1)
+		return -pte_bad_file;
+
+	if ((header.magic != pt_bcache_magic) ||
+	    (header.version != pt_bcache_version) ||
+	    (header.esize != sizeof(struct pt_bcache_entry)) ||
+	    (header.hash != hash) ||
+	    (header.nentries != bcache->nentries) ||
+	    (header.nentries < header.nvalid) ||
+	    (INT_MAX < header.nvalid))
+		return -pte_bad_file;
+
+	for (nvalid = 0; nvalid < header.nvalid; ++nvalid) {
+		struct pt_bcache_record record;
+
+		count = fread(&record, sizeof(record), 1, file);
+		if (count != 1)
+			return -pte_bad_file;
+
+		if (!pt_bce_is_valid(record.entry) ||
+		    !pt_bcache_fits(bcache, record.entry))
+			return -pte_bad_file;
+
+		errcode = pt_bcache_add(bcache, record.index, record.entry);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	return (int) nvalid;
+}
+
+int pt_bcache_load(struct pt_block_cache *bcache, const char *filename,
+		   uint64_t hash)
+{
+	FILE *file;
+	int status;
+
+	if (!bcache || !filename)
+		return -pte_internal;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return 0;
+
+	status = pt_bcache_read(bcache, file, hash);
+	fclose(file);
+
+	/* Discard partially loaded entries from a corrupted file. */
+	if (status < 0) {
+		pt_bcache_clear(bcache);
+		return 0;
+	}
+
+	return status;
+}
+
+/* Write @nvalid valid entries of @bcache to @file.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_bcache_write(const struct pt_block_cache *bcache, FILE *file,
+			   uint64_t hash, uint32_t nvalid)
+{
+	struct pt_bcache_header header;
+	uint64_t index;
+	size_t count;
+
+	if (!bcache || !file)
+		return -pte_internal;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = pt_bcache_magic;
+	header.version = pt_bcache_version;
+	header.esize = sizeof(struct pt_bcache_entry);
+	header.hash = hash;
+	header.nentries = bcache->nentries;
+	header.nvalid = nvalid;
+
+	count = fwrite(&header, sizeof(header), 1, file);
+	if (count != 1)
+		return -pte_bad_file;
+
+	for (index = 0; index < bcache->nentries && nvalid; ++index) {
+		struct pt_bcache_record record;
+		const void *page;
+
+		page = bcache->page[index >> pt_bcache_page_shift];
+		if (!page) {
+			index |= pt_bcache_page_mask;
+			continue;
+		}
+
+		memset(&record, 0, sizeof(record));
+		record.index = (uint32_t) index;
+		record.entry = pt_bcache_page_get(bcache, page, index);
+
+		if (!pt_bce_is_valid(record.entry))
+			continue;
+
+		count = fwrite(&record, sizeof(record), 1, file);
+		if (count != 1)
+			return -pte_bad_file;
+
+		nvalid -= 1;
+	}
+
+	return 0;
+}
+
+/* Count the valid entries in @bcache.
+ *
+ * Other threads may still be adding entries.
+ */
+static uint32_t pt_bcache_nvalid(const struct pt_block_cache *bcache)
+{
+	uint64_t ndir, pidx;
+	uint32_t nvalid;
+
+	nvalid = 0;
+	ndir = pt_bcache_ndir(bcache->nentries);
+	for (pidx = 0; pidx < ndir; ++pidx) {
+		struct pt_bcache_entry bce;
+		const void *page;
+		int eidx;
+
+		page = bcache->page[pidx];
+		if (!page)
+			continue;
+
+		for (eidx = 0; eidx < pt_bcache_page_size; ++eidx) {
+			bce = pt_bcache_page_get(bcache, page, (uint64_t) eidx);
+			if (pt_bce_is_valid(bce))
+				nvalid += 1;
+		}
+	}
+
+	return nvalid;
+}
+
+/* Compute the name of a temporary file for storing @bcache in @filename.
+ *
+ * The name is unique among the processes and block caches that may store to
+ * @filename at the same time.
+ *
+ * Returns the name on success, NULL otherwise.
+ */
+static char *pt_bcache_tmpname(const struct pt_block_cache *bcache,
+			       const char *filename)
+{
+	unsigned long long pid;
+	char *name;
+	size_t size;
+	int len;
+
+	if (!bcache || !filename)
+		return NULL;
+
+#if defined(_MSC_VER)
+	pid = (unsigned long long) GetCurrentProcessId();
+#else
+	pid = (unsigned long long) getpid();
+#endif
+
+	/* The file name plus two 64-bit hex numbers with separators and
+	 * extension.
+	 */
+	size = strlen(filename) + (2 * 17) + sizeof(".tmp");
+
+	name = malloc(size);
+	if (!name)
+		return NULL;
+
+	len = snprintf(name, size, "%s.%llx-%llx.tmp", filename, pid,
+		       (unsigned long long) (uintptr_t) bcache);
+	if ((len < 0) || (size <= (size_t) len)) {
+		free(name);
+		return NULL;
+	}
+
+	return name;
+}
+
+/* Replace @filename with @tmpname.
+ *
+ * Readers see either the old or the new file but never a partially written
+ * one.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_bcache_replace(const char *filename, const char *tmpname)
+{
+	if (!filename || !tmpname)
+		return -pte_internal;
+
+#if defined(_MSC_VER)
+	if (!MoveFileExA(tmpname, filename, MOVEFILE_REPLACE_EXISTING))
+		return -pte_bad_file;
+#else
+	if (rename(tmpname, filename))
+		return -pte_bad_file;
+#endif
+
+	return 0;
+}
+
+int pt_bcache_store(const struct pt_block_cache *bcache, const char *filename,
+		    uint64_t hash, uint32_t *pnvalid)
+{
+	FILE *file;
+	uint32_t nvalid;
+	char *tmpname;
+	int errcode;
+
+	if (!bcache || !filename || !pnvalid)
+		return -pte_internal;
+
+	/* Other threads may still be adding entries.  We only store the
+	 * entries we counted.
+	 */
+	nvalid = pt_bcache_nvalid(bcache);
+
+	if ((nvalid <= *pnvalid) || (INT_MAX < nvalid))
+		return 0;
+
+	/* Other decoder processes may be loading or storing @filename.  We
+	 * write to a temporary file in the same directory and move it into
+	 * place when we're done.
+	 */
+	tmpname = pt_bcache_tmpname(bcache, filename);
+	if (!tmpname)
+		return -pte_nomem;
+
+	file = fopen(tmpname, "wb");
+	if (!file) {
+		free(tmpname);
+		return -pte_bad_file;
+	}
+
+	errcode = pt_bcache_write(bcache, file, hash, nvalid);
+
+	if (fclose(file) && !errcode)
+		errcode = -pte_bad_file;
+
+	if (!errcode)
+		errcode = pt_bcache_replace(filename, tmpname);
+
+	if (errcode < 0)
+		(void) remove(tmpname);
+
+	free(tmpname);
+
+	if (errcode < 0)
+		return errcode;
+
+	*pnvalid = nvalid;
+
+	return 0;
+}
+
 int pt_bcache_add(struct pt_block_cache *bcache, uint64_t index,
 		  struct pt_bcache_entry bce)
 {
+	void *page;
+
 	if (!bcache)
 		return -pte_internal;
 
 	if (bcache->nentries <= index)
 		return -pte_internal;
 
+	if (!pt_bcache_fits(bcache, bce))
+		return -pte_internal;
+
+	page = pt_bcache_page(bcache, (uint32_t) index);
+	if (!page)
+		return -pte_nomem;
+
+	index &= pt_bcache_page_mask;
+
 	/* We rely on guaranteed atomic operations as specified in section 8.1.1
 	 * in Volume 3A of the Intel(R) Software Developer's Manual at
 	 * http://www.intel.com/sdm.
 	 */
-	bcache->entry[(uint32_t) index] = bce;
+	if (bcache->format == pt_bcf_wide) {
+		uint64_t raw;
+
+		memcpy(&raw, &bce, sizeof(raw));
+		((struct pt_bcache_wpage *) page)->entry[index] = raw;
+	} else {
+		struct pt_bcache_compact cbe;
+
+		memset(&cbe, 0, sizeof(cbe));
+		cbe.displacement = bce.displacement;
+		cbe.ninsn = bce.ninsn;
+		cbe.mode = bce.mode;
+		cbe.qualifier = bce.qualifier;
+		cbe.isize = bce.isize;
+
+		((struct pt_bcache_page *) page)->entry[index] = cbe;
+	}
 
 	return 0;
 }
@@ -80,17 +611,22 @@ int pt_bcache_add(struct pt_block_cache *bcache, uint64_t index,
 int pt_bcache_lookup(struct pt_bcache_entry *bce,
 		     const struct pt_block_cache *bcache, uint64_t index)
 {
+	const void *page;
+
 	if (!bce || !bcache)
 		return -pte_internal;
 
 	if (bcache->nentries <= index)
 		return -pte_internal;
 
-	/* We rely on guaranteed atomic operations as specified in section 8.1.1
-	 * in Volume 3A of the Intel(R) Software Developer's Manual at
-	 * http://www.intel.com/sdm.
-	 */
-	*bce = bcache->entry[(uint32_t) index];
+	/* A missing page means that none of its entries is valid. */
+	page = bcache->page[index >> pt_bcache_page_shift];
+	if (!page) {
+		memset(bce, 0, sizeof(*bce));
+		return 0;
+	}
+
+	*bce = pt_bcache_page_get(bcache, page, index);
 
 	return 0;
 }
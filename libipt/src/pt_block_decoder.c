@@ -285,12 +285,19 @@ static int pt_blk_cond_branch(struct pt_block_decoder *decoder, int *taken)
 {
 	int status, errcode;
 
-	if (!decoder)
+	if (!decoder || !taken)
 		return -pte_internal;
 
-	status = pt_qry_cond_branch(&decoder->query, taken);
-	if (status < 0)
-		return status;
+	/* Take the bit directly from the TNT cache, if we can. */
+	status = pt_qry_cond_branch_cached(&decoder->query);
+	if (status >= 0) {
+		*taken = status;
+		status = 0;
+	} else {
+		status = pt_qry_cond_branch(&decoder->query, taken);
+		if (status < 0)
+			return status;
+	}
 
 	if (decoder->flags.variant.block.enable_tick_events) {
 		errcode = pt_blk_tick(decoder, decoder->ip);
@@ -454,6 +461,15 @@ int pt_blk_asid(const struct pt_block_decoder *decoder, struct pt_asid *asid,
 	return pt_asid_to_user(asid, &decoder->asid, size);
 }
 
+int pt_blk_scache_stats(const struct pt_block_decoder *decoder,
+			struct pt_scache_stats *stats, size_t size)
+{
+	if (!decoder || !stats)
+		return -pte_invalid;
+
+	return pt_msec_cache_stats(&decoder->scache, stats, size);
+}
+
 /* Fetch the next pending event.
  *
  * Checks for pending events.  If an event is pending, fetches it (if not
@@ -1719,7 +1735,8 @@ static inline int pt_blk_add_trampoline(struct pt_block_cache *bcache,
 	/* If we can't reach @nip without overflowing the displacement field, we
 	 * have to stop and re-decode the instruction at @ip.
 	 */
-	if ((int64_t) bce.displacement != disp) {
+	if (((int64_t) bce.displacement != disp) ||
+	    !pt_bcache_fits(bcache, bce)) {
 
 		memset(&bce, 0, sizeof(bce));
 		bce.ninsn = 1;
@@ -1749,6 +1766,36 @@ static inline int pt_blk_add_decode(struct pt_block_cache *bcache,
 	return pt_bcache_add(bcache, ioff, bce);
 }
 
+/* Insert a direct branch block cache entry.
+ *
+ * Add a ptbq_jump or ptbq_call block cache entry for the near direct branch
+ * @insn at @ioff.  If the branch displacement or the instruction size does not
+ * fit, add a decode block cache entry, instead.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static inline int pt_blk_add_branch(struct pt_block_cache *bcache,
+				    uint64_t ioff, const struct pt_insn *insn,
+				    const struct pt_insn_ext *iext)
+{
+	struct pt_bcache_entry bce;
+
+	if (!insn || !iext)
+		return -pte_internal;
+
+	memset(&bce, 0, sizeof(bce));
+	bce.displacement = iext->variant.branch.displacement;
+	bce.ninsn = 1;
+	bce.mode = insn->mode;
+	bce.qualifier = insn->iclass == ptic_call ? ptbq_call : ptbq_jump;
+	bce.isize = insn->size;
+
+	if (((uint8_t) bce.isize != insn->size) || !pt_bcache_fits(bcache, bce))
+		return pt_blk_add_decode(bcache, ioff, insn->mode);
+
+	return pt_bcache_add(bcache, ioff, bce);
+}
+
 enum {
 	/* The maximum number of steps when filling the block cache. */
 	bcache_fill_steps	= 0x400
@@ -1811,7 +1858,8 @@ pt_blk_proceed_no_event_fill_cache(struct pt_block_decoder *decoder,
 		bce.isize = insn.size;
 
 		/* Clear the instruction size in case of overflows. */
-		if ((uint8_t) bce.isize != insn.size)
+		if (((uint8_t) bce.isize != insn.size) ||
+		    !pt_bcache_fits(bcache, bce))
 			bce.isize = 0;
 
 		switch (insn.iclass) {
@@ -1877,13 +1925,10 @@ pt_blk_proceed_no_event_fill_cache(struct pt_block_decoder *decoder,
 	 *
 	 *   - at near direct calls to update the return-address stack
 	 *
-	 *     We are forced to re-decode @insn to get the branch displacement.
-	 *
-	 *     Even though it is constant, we don't cache it to avoid increasing
-	 *     the size of a cache entry.  Note that the displacement field is
-	 *     zero for this entry and we might be tempted to use it - but other
-	 *     entries that point to this decision point will have non-zero
-	 *     displacement.
+	 *     We cache the branch displacement in the call's ptbq_call entry
+	 *     if it fits.  Other entries that point to this decision point
+	 *     reach it via ptbq_again.  Otherwise, we are forced to re-decode
+	 *     @insn to get the branch displacement.
 	 *
 	 *     We could proceed after a near direct call but we migh as well
 	 *     postpone it to the next iteration.  Make sure to end the block if
@@ -1929,7 +1974,10 @@ pt_blk_proceed_no_event_fill_cache(struct pt_block_decoder *decoder,
 	 */
 	switch (insn.iclass) {
 	case ptic_call:
-		return pt_blk_add_decode(bcache, ioff, insn.mode);
+		if (block->truncated)
+			return pt_blk_add_decode(bcache, ioff, insn.mode);
+
+		return pt_blk_add_branch(bcache, ioff, &insn, &iext);
 
 	case ptic_jump:
 		/* An indirect branch requires trace and should have been
@@ -1938,9 +1986,12 @@ pt_blk_proceed_no_event_fill_cache(struct pt_block_decoder *decoder,
 		if (!iext.variant.branch.is_direct)
 			return -pte_internal;
 
+		if (block->truncated)
+			return pt_blk_add_decode(bcache, ioff, insn.mode);
+
 		if (iext.variant.branch.displacement < 0 ||
 		    decoder->flags.variant.block.end_on_jump)
-			return pt_blk_add_decode(bcache, ioff, insn.mode);
+			return pt_blk_add_branch(bcache, ioff, &insn, &iext);
 
 		fallthrough;
 	default:
@@ -2001,6 +2052,19 @@ pt_blk_proceed_no_event_fill_cache(struct pt_block_decoder *decoder,
 	if (pt_bce_exec_mode(bce) != insn.mode)
 		return -pte_internal;
 
+	/* The displacement of a direct branch entry is the branch displacement.
+	 * We reach the branch via a ptbq_again entry that stops right before
+	 * it.  It is extended just like any other entry by our predecessors.
+	 */
+	switch (pt_bce_qualifier(bce)) {
+	case ptbq_jump:
+	case ptbq_call:
+		return pt_blk_add_trampoline(bcache, ioff, noff, insn.mode);
+
+	default:
+		break;
+	}
+
 	/* The decision point IP and the displacement from @insn.ip. */
 	dip = nip + bce.displacement;
 	disp = (int64_t) (dip - insn.ip);
@@ -2029,7 +2093,8 @@ pt_blk_proceed_no_event_fill_cache(struct pt_block_decoder *decoder,
 	 * If one or both overflowed, let's try to insert a trampoline, i.e. we
 	 * try to reach @dip via a ptbq_again entry to @nip.
 	 */
-	if (!bce.ninsn || ((int64_t) bce.displacement != disp))
+	if (!bce.ninsn || ((int64_t) bce.displacement != disp) ||
+	    !pt_bcache_fits(bcache, bce))
 		return pt_blk_add_trampoline(bcache, ioff, noff, insn.mode);
 
 	/* We're done.  Add the cache entry.
@@ -2106,6 +2171,70 @@ static int pt_blk_proceed_truncated(struct pt_block_decoder *decoder,
 	return 0;
 }
 
+/* Determine the destination of a taken conditional branch.
+ *
+ * The conditional branch at @ip in @msec is @isize bytes long.  We recognize
+ * the common Jcc, JrCXZ, and LOOP encodings without prefixes directly from
+ * their raw bytes and only do a full instruction decode for everything else.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_blk_cond_dest(uint64_t *pdest, uint64_t ip, uint8_t isize,
+			    enum pt_exec_mode mode,
+			    const struct pt_mapped_section *msec)
+{
+	struct pt_insn_ext iext;
+	struct pt_insn insn;
+	uint8_t raw[6];
+	int status;
+
+	if (!pdest)
+		return -pte_internal;
+
+	if (isize == 2 || isize == sizeof(raw)) {
+		status = pt_msec_read(msec, raw, isize, ip);
+		if (status < 0)
+			return status;
+
+		if (status == isize) {
+			/* Jcc rel8 and JrCXZ, LOOP, LOOPcc rel8. */
+			if ((isize == 2) &&
+			    (((raw[0] & 0xf0) == 0x70) ||
+			     ((raw[0] & 0xfc) == 0xe0))) {
+				*pdest = ip + isize + (int64_t) (int8_t) raw[1];
+				return 0;
+			}
+
+			/* Jcc rel32. */
+			if ((isize == sizeof(raw)) && (raw[0] == 0x0f) &&
+			    ((raw[1] & 0xf0) == 0x80)) {
+				int32_t disp;
+
+				disp = (int32_t) ((uint32_t) raw[2] |
+						  ((uint32_t) raw[3] << 8) |
+						  ((uint32_t) raw[4] << 16) |
+						  ((uint32_t) raw[5] << 24));
+
+				*pdest = ip + isize + (int64_t) disp;
+				return 0;
+			}
+		}
+	}
+
+	memset(&iext, 0, sizeof(iext));
+	memset(&insn, 0, sizeof(insn));
+
+	insn.mode = mode;
+	insn.ip = ip;
+
+	status = pt_blk_decode_in_section(&insn, &iext, msec);
+	if (status < 0)
+		return status;
+
+	*pdest = ip + isize + (uint64_t) iext.variant.branch.displacement;
+	return 0;
+}
+
 /* Proceed to the next decision point using the block cache.
  *
  * Tracing is enabled and we don't have an event pending.  We already set
@@ -2130,6 +2259,7 @@ static int pt_blk_proceed_no_event_cached(struct pt_block_decoder *decoder,
 	struct pt_bcache_entry bce;
 	uint16_t binsn, ninsn;
 	uint64_t offset, nip;
+	int64_t disp;
 	int status;
 
 	if (!decoder || !block)
@@ -2165,8 +2295,22 @@ static int pt_blk_proceed_no_event_cached(struct pt_block_decoder *decoder,
 	 * section splits.
 	 *
 	 * Switch to the slow path until we reach the end of this section.
+	 *
+	 * Direct branch entries stop at the branch.  Their displacement field
+	 * gives the branch displacement.
 	 */
-	nip = decoder->ip + bce.displacement;
+	switch (pt_bce_qualifier(bce)) {
+	case ptbq_jump:
+	case ptbq_call:
+		disp = 0ll;
+		break;
+
+	default:
+		disp = bce.displacement;
+		break;
+	}
+
+	nip = decoder->ip + (uint64_t) disp;
 	if (!pt_blk_is_in_section(msec, nip))
 		return pt_blk_proceed_no_event_uncached(decoder, block);
 
@@ -2246,26 +2390,17 @@ static int pt_blk_proceed_no_event_cached(struct pt_block_decoder *decoder,
 			 */
 			decoder->status = status;
 
-			ip = decoder->ip;
-			if (taken) {
-				struct pt_insn_ext iext;
-				struct pt_insn insn;
-
-				memset(&iext, 0, sizeof(iext));
-				memset(&insn, 0, sizeof(insn));
-
-				insn.mode = pt_bce_exec_mode(bce);
-				insn.ip = ip;
-
-				status = pt_blk_decode_in_section(&insn, &iext,
-								  msec);
-				if (status < 0)
-					return status;
-
-				ip += iext.variant.branch.displacement;
+			if (!taken) {
+				decoder->ip += bce.isize;
+				break;
 			}
 
-			decoder->ip = ip + bce.isize;
+			status = pt_blk_cond_dest(&ip, decoder->ip, bce.isize,
+						  pt_bce_exec_mode(bce), msec);
+			if (status < 0)
+				return status;
+
+			decoder->ip = ip;
 			break;
 		}
 
@@ -2431,6 +2566,49 @@ static int pt_blk_proceed_no_event_cached(struct pt_block_decoder *decoder,
 		return pt_retstack_pop(&decoder->retstack, &decoder->ip);
 	}
 
+	case ptbq_jump:
+	case ptbq_call: {
+		uint64_t ip;
+
+		/* We're at a near direct branch.
+		 *
+		 * We know its size and displacement so we don't need to decode
+		 * the instruction.
+		 */
+		ip = decoder->ip + bce.isize;
+
+		if (pt_bce_qualifier(bce) == ptbq_call) {
+			block->iclass = ptic_call;
+
+			/* Ignore direct calls to the next instruction that are
+			 * used for position independent code.
+			 */
+			if (bce.displacement) {
+				status = pt_retstack_push(&decoder->retstack,
+							  ip);
+				if (status < 0)
+					return status;
+			}
+		} else
+			block->iclass = ptic_jump;
+
+		decoder->ip = ip + (uint64_t) (int64_t) bce.displacement;
+
+		/* End the block if the user asked us to. */
+		if ((decoder->flags.variant.block.end_on_call &&
+		     (block->iclass == ptic_call)) ||
+		    (decoder->flags.variant.block.end_on_jump &&
+		     (block->iclass == ptic_jump)))
+			break;
+
+		/* We're done if we switch sections. */
+		if (!pt_blk_is_in_section(msec, decoder->ip))
+			break;
+
+		return pt_blk_proceed_no_event_cached(decoder, block, bcache,
+						      msec);
+	}
+
 	case ptbq_indirect:
 		/* We're at an indirect jump or far transfer.
 		 *
@@ -2498,7 +2676,7 @@ static inline int pt_blk_msec_lookup(struct pt_block_decoder *decoder,
 		return -pte_internal;
 
 	isid = pt_msec_cache_read(&decoder->scache, pmsec, decoder->image,
-				  decoder->ip);
+				  &decoder->asid, decoder->ip);
 	if (isid < 0) {
 		if (isid != -pte_nomap)
 			return isid;
@@ -3159,20 +3337,13 @@ static int pt_blk_process_async_branch(struct pt_block_decoder *decoder,
 static int pt_blk_process_paging(struct pt_block_decoder *decoder,
 				 const struct pt_event *ev)
 {
-	uint64_t cr3;
-	int errcode;
-
 	if (!decoder || !ev)
 		return -pte_internal;
 
-	cr3 = ev->variant.paging.cr3;
-	if (decoder->asid.cr3 != cr3) {
-		errcode = pt_msec_cache_invalidate(&decoder->scache);
-		if (errcode < 0)
-			return errcode;
-
-		decoder->asid.cr3 = cr3;
-	}
+	/* The section cache is keyed by address space so there is no need to
+	 * invalidate it.
+	 */
+	decoder->asid.cr3 = ev->variant.paging.cr3;
 
 	decoder->process_event = 0;
 
@@ -3186,20 +3357,10 @@ static int pt_blk_process_paging(struct pt_block_decoder *decoder,
 static int pt_blk_process_vmcs(struct pt_block_decoder *decoder,
 			       const struct pt_event *ev)
 {
-	uint64_t vmcs;
-	int errcode;
-
 	if (!decoder || !ev)
 		return -pte_internal;
 
-	vmcs = ev->variant.vmcs.base;
-	if (decoder->asid.vmcs != vmcs) {
-		errcode = pt_msec_cache_invalidate(&decoder->scache);
-		if (errcode < 0)
-			return errcode;
-
-		decoder->asid.vmcs = vmcs;
-	}
+	decoder->asid.vmcs = ev->variant.vmcs.base;
 
 	decoder->process_event = 0;
 
@@ -0,0 +1,1340 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pt_block_decoder.h"
+#include "pt_packet_decoder.h"
+#include "pt_retstack.h"
+#include "pt_image.h"
+#include "pt_sync.h"
+#include "pt_config.h"
+#include "pt_opcodes.h"
+
+#include "intel-pt.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(FEATURE_THREADS)
+#  include <threads.h>
+#endif /* defined(FEATURE_THREADS) */
+
+
+enum {
+	/* The default minimal segment size in bytes. */
+	pt_blkp_segment_size	= 0x10000,
+
+	/* The maximal number of worker threads. */
+	pt_blkp_max_threads	= 64,
+
+	/* The number of segments in flight per worker thread. */
+	pt_blkp_window		= 2,
+
+	/* The initial capacity of a segment's record array. */
+	pt_blkp_records		= 0x100
+};
+
+/* A trace segment.
+ *
+ * A segment starts at a PSB and ends at the next PSB that we selected for
+ * splitting the trace or at the end of the trace.
+ */
+struct pt_blkp_segment {
+	/* The next segment in trace order. */
+	struct pt_blkp_segment *next;
+
+	/* The offset of the segment's first PSB in the trace buffer. */
+	uint64_t begin;
+
+	/* The offset of the next segment's first PSB or the end of the trace
+	 * buffer for the last segment.
+	 */
+	uint64_t end;
+
+	/* The offset just after the next segment's PSB+ header.
+	 *
+	 * The decoder needs to read the next segment's PSB+ header in order to
+	 * process the events bound to the end of this segment.
+	 */
+	uint64_t limit;
+
+	/* The decoder records for this segment. */
+	struct pt_blk_record *records;
+
+	/* The number of records and the capacity of @records. */
+	size_t nrecords;
+	size_t capacity;
+
+	/* The return-address stack at the end of this segment.
+	 *
+	 * If @complete is clear, this only contains the return addresses that
+	 * had been pushed in this segment.
+	 */
+	struct pt_retstack retstack;
+
+	/* An error code for errors other than decode errors. */
+	int errcode;
+
+	/* A non-zero value if the segment has been decoded.
+	 *
+	 * This is protected by the parallel decoder's lock.  It must not share
+	 * storage with the below flags, which are written while decoding.
+	 */
+	uint32_t done;
+
+	/* A collection of flags saying:
+	 *
+	 * - this is the first segment in the trace buffer.
+	 */
+	uint32_t first:1;
+
+	/* - this is the last segment in the trace buffer. */
+	uint32_t last:1;
+
+	/* - decoding the segment required return addresses pushed in one of
+	 *   the preceding segments.
+	 *
+	 *   The segment needs to be decoded again with the correct return-
+	 *   address stack.
+	 */
+	uint32_t underflow:1;
+
+	/* - @retstack describes the complete return-address stack. */
+	uint32_t complete:1;
+
+	/* - decoding ended while re-synchronizing.
+	 *
+	 *   The next segment starts with a synchronization.
+	 */
+	uint32_t resync:1;
+};
+
+/* A block decoder worker.
+ *
+ * Each worker uses its own decoder and its own copy of the traced image so
+ * workers do not interfere with each other.  The sections are shared.
+ */
+struct pt_blkp_worker {
+	/* The parallel decoder. */
+	struct pt_blk_parallel *pdec;
+
+	/* The block decoder. */
+	struct pt_block_decoder decoder;
+
+	/* The traced memory image. */
+	struct pt_image image;
+
+#if defined(FEATURE_THREADS)
+	/* The worker thread. */
+	thrd_t thread;
+#endif /* defined(FEATURE_THREADS) */
+
+	/* A collection of flags saying:
+	 *
+	 * - @decoder and @image have been initialized.
+	 */
+	uint32_t initialized:1;
+
+	/* - @thread has been started. */
+	uint32_t started:1;
+};
+
+/* A parallel block decoder. */
+struct pt_blk_parallel {
+	/* The decoder configuration. */
+	struct pt_config config;
+
+	/* The parallel decoder configuration. */
+	struct pt_blk_parallel_config pconfig;
+
+	/* The traced memory image. */
+	struct pt_image *image;
+
+	/* The list of segments in trace order.
+	 *
+	 * Segments are added at @tail and removed at @head.
+	 */
+	struct pt_blkp_segment *head;
+	struct pt_blkp_segment *tail;
+
+	/* The first segment that has not been picked up by a worker. */
+	struct pt_blkp_segment *pending;
+
+	/* The number of segments in the above list. */
+	uint32_t nsegments;
+
+	/* The offset of the next segment's first PSB. */
+	uint64_t next;
+
+	/* A collection of flags saying:
+	 *
+	 * - the last segment has been added.
+	 */
+	uint32_t eos:1;
+
+	/* - the workers shall stop. */
+	uint32_t stop:1;
+
+#if defined(FEATURE_THREADS)
+	/* A lock protecting the segment list and the above flags. */
+	mtx_t lock;
+
+	/* A condition signaling changes to the segment list. */
+	cnd_t cond;
+#endif /* defined(FEATURE_THREADS) */
+};
+
+
+static int pt_blkp_lock(struct pt_blk_parallel *pdec)
+{
+	if (!pdec)
+		return -pte_internal;
+
+#if defined(FEATURE_THREADS)
+	{
+		int errcode;
+
+		errcode = mtx_lock(&pdec->lock);
+		if (errcode != thrd_success)
+			return -pte_bad_lock;
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	return 0;
+}
+
+static int pt_blkp_unlock(struct pt_blk_parallel *pdec)
+{
+	if (!pdec)
+		return -pte_internal;
+
+#if defined(FEATURE_THREADS)
+	{
+		int errcode;
+
+		errcode = mtx_unlock(&pdec->lock);
+		if (errcode != thrd_success)
+			return -pte_bad_lock;
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	return 0;
+}
+
+/* Wait for a change to @pdec's segment list.
+ *
+ * The decoder must be locked.
+ */
+static int pt_blkp_wait(struct pt_blk_parallel *pdec)
+{
+	if (!pdec)
+		return -pte_internal;
+
+#if defined(FEATURE_THREADS)
+	{
+		int errcode;
+
+		errcode = cnd_wait(&pdec->cond, &pdec->lock);
+		if (errcode != thrd_success)
+			return -pte_bad_lock;
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	return 0;
+}
+
+/* Signal a change to @pdec's segment list.
+ *
+ * The decoder must be locked.
+ */
+static int pt_blkp_signal(struct pt_blk_parallel *pdec)
+{
+	if (!pdec)
+		return -pte_internal;
+
+#if defined(FEATURE_THREADS)
+	{
+		int errcode;
+
+		errcode = cnd_broadcast(&pdec->cond);
+		if (errcode != thrd_success)
+			return -pte_bad_lock;
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	return 0;
+}
+
+static void pt_blkp_free_segment(struct pt_blkp_segment *seg)
+{
+	if (!seg)
+		return;
+
+	free(seg->records);
+	free(seg);
+}
+
+static int pt_blkp_init(struct pt_blk_parallel *pdec,
+			const struct pt_config *config, struct pt_image *image,
+			const struct pt_blk_parallel_config *pconfig)
+{
+	int errcode;
+
+	if (!pdec || !pconfig)
+		return -pte_internal;
+
+	memset(pdec, 0, sizeof(*pdec));
+
+	errcode = pt_config_from_user(&pdec->config, config);
+	if (errcode < 0)
+		return errcode;
+
+	if (pconfig->size < offsetof(struct pt_blk_parallel_config, context))
+		return -pte_bad_config;
+
+	memcpy(&pdec->pconfig, pconfig,
+	       pconfig->size < sizeof(pdec->pconfig) ?
+	       pconfig->size : sizeof(pdec->pconfig));
+	pdec->pconfig.size = sizeof(pdec->pconfig);
+
+	if (!pdec->pconfig.callback)
+		return -pte_invalid;
+
+	if (!pdec->pconfig.segment_size)
+		pdec->pconfig.segment_size = pt_blkp_segment_size;
+
+	if (pt_blkp_max_threads < pdec->pconfig.nthreads)
+		pdec->pconfig.nthreads = pt_blkp_max_threads;
+
+	pdec->image = image;
+
+#if defined(FEATURE_THREADS)
+	errcode = mtx_init(&pdec->lock, mtx_plain);
+	if (errcode != thrd_success)
+		return -pte_bad_lock;
+
+	errcode = cnd_init(&pdec->cond);
+	if (errcode != thrd_success) {
+		mtx_destroy(&pdec->lock);
+		return -pte_bad_lock;
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	return 0;
+}
+
+static void pt_blkp_fini(struct pt_blk_parallel *pdec)
+{
+	struct pt_blkp_segment *seg;
+
+	if (!pdec)
+		return;
+
+	seg = pdec->head;
+	while (seg) {
+		struct pt_blkp_segment *trash;
+
+		trash = seg;
+		seg = seg->next;
+
+		pt_blkp_free_segment(trash);
+	}
+
+#if defined(FEATURE_THREADS)
+	cnd_destroy(&pdec->cond);
+	mtx_destroy(&pdec->lock);
+#endif /* defined(FEATURE_THREADS) */
+}
+
+static int pt_blkp_worker_init(struct pt_blkp_worker *worker,
+			       struct pt_blk_parallel *pdec)
+{
+	const struct pt_image *image;
+	int errcode;
+
+	if (!worker || !pdec)
+		return -pte_internal;
+
+	memset(worker, 0, sizeof(*worker));
+
+	worker->pdec = pdec;
+
+	errcode = pt_blk_decoder_init(&worker->decoder, &pdec->config);
+	if (errcode < 0)
+		return errcode;
+
+	pt_image_init(&worker->image, NULL);
+
+	image = pdec->image;
+	if (image) {
+		errcode = pt_image_copy(&worker->image, image);
+		if (errcode < 0)
+			goto out_image;
+
+		worker->image.readmem = image->readmem;
+	}
+
+	errcode = pt_blk_set_image(&worker->decoder, &worker->image);
+	if (errcode < 0)
+		goto out_image;
+
+	worker->initialized = 1;
+	return 0;
+
+out_image:
+	pt_image_fini(&worker->image);
+	pt_blk_decoder_fini(&worker->decoder);
+	return errcode;
+}
+
+static void pt_blkp_worker_fini(struct pt_blkp_worker *worker)
+{
+	if (!worker || !worker->initialized)
+		return;
+
+	pt_blk_decoder_fini(&worker->decoder);
+	pt_image_fini(&worker->image);
+}
+
+/* Check whether we may split the trace at the PSB at @offset.
+ *
+ * We require at least one branch packet between the preceding PSB+ header and
+ * @offset so each segment makes progress and the preceding segment ends at a
+ * well-defined instruction boundary.
+ *
+ * We do not split across MNT packets, which may introduce decoder state that
+ * is not re-established by the PSB+ header.
+ *
+ * Returns a positive integer and provides the offset just after the PSB+
+ * header at @offset in @limit if we may split at @offset.
+ * Returns zero if we may not split at @offset.
+ * Returns a negative error code otherwise.
+ */
+static int pt_blkp_is_seam(uint64_t *limit, const struct pt_config *config,
+			   uint64_t offset)
+{
+	struct pt_packet_decoder decoder;
+	const uint8_t *sync;
+	uint64_t pos;
+	int errcode, status, header, branch;
+
+	if (!limit || !config)
+		return -pte_internal;
+
+	errcode = pt_sync_backward(&sync, config->begin + offset, config);
+	if (errcode < 0)
+		return (errcode == -pte_eos) ? 0 : errcode;
+
+	errcode = pt_pkt_decoder_init(&decoder, config);
+	if (errcode < 0)
+		return errcode;
+
+	status = pt_pkt_sync_set(&decoder, (uint64_t) (sync - config->begin));
+	if (status < 0)
+		goto out;
+
+	header = 1;
+	branch = 0;
+	for (;;) {
+		struct pt_packet packet;
+
+		status = pt_pkt_get_offset(&decoder, &pos);
+		if (status < 0)
+			goto out;
+
+		if (offset <= pos)
+			break;
+
+		status = pt_pkt_next(&decoder, &packet, sizeof(packet));
+		if (status < 0)
+			goto out_nosplit;
+
+		switch (packet.type) {
+		default:
+			break;
+
+		case ppt_psbend:
+			header = 0;
+			break;
+
+		case ppt_tnt_8:
+		case ppt_tnt_64:
+		case ppt_tip:
+		case ppt_tip_pge:
+		case ppt_tip_pgd:
+			if (!header)
+				branch = 1;
+			break;
+
+		case ppt_mnt:
+			goto out_nosplit;
+		}
+	}
+
+	if ((pos != offset) || !branch)
+		goto out_nosplit;
+
+	/* Read the PSB+ header at @offset. */
+	for (;;) {
+		struct pt_packet packet;
+
+		status = pt_pkt_next(&decoder, &packet, sizeof(packet));
+		if (status < 0)
+			goto out_nosplit;
+
+		if (packet.type == ppt_psbend)
+			break;
+
+		if (packet.type == ppt_mnt)
+			goto out_nosplit;
+	}
+
+	status = pt_pkt_get_offset(&decoder, limit);
+	if (status < 0)
+		goto out;
+
+	status = 1;
+	goto out;
+
+out_nosplit:
+	status = 0;
+
+out:
+	pt_pkt_decoder_fini(&decoder);
+	return status;
+}
+
+/* Split off the next segment.
+ *
+ * Returns zero and provides the next segment in @pseg on success.
+ * Returns zero and sets @pseg to NULL if there are no more segments.
+ * Returns a negative error code otherwise.
+ */
+static int pt_blkp_split(struct pt_blkp_segment **pseg,
+			 struct pt_blk_parallel *pdec)
+{
+	struct pt_blkp_segment *seg;
+	const struct pt_config *config;
+	uint64_t size, target;
+	int errcode;
+
+	if (!pseg || !pdec)
+		return -pte_internal;
+
+	*pseg = NULL;
+
+	if (pdec->eos)
+		return 0;
+
+	config = &pdec->config;
+	size = (uint64_t) (config->end - config->begin);
+
+	seg = malloc(sizeof(*seg));
+	if (!seg)
+		return -pte_nomem;
+
+	memset(seg, 0, sizeof(*seg));
+	pt_retstack_init(&seg->retstack);
+
+	if (!pdec->tail) {
+		const uint8_t *sync;
+
+		seg->first = 1;
+
+		errcode = pt_sync_forward(&sync, config->begin, config);
+		if (errcode < 0) {
+			if (errcode != -pte_eos) {
+				free(seg);
+				return errcode;
+			}
+
+			/* There is no PSB in the trace.
+			 *
+			 * We start the first and only segment at the end of
+			 * the trace so synchronizing fails with -pte_eos, as
+			 * it would when decoding sequentially.
+			 */
+			sync = config->end;
+		}
+
+		pdec->next = (uint64_t) (sync - config->begin);
+	}
+
+	seg->begin = pdec->next;
+
+	/* Skip the segment's first PSB. */
+	target = pdec->pconfig.segment_size;
+	if (target < ptps_psb)
+		target = ptps_psb;
+
+	target += seg->begin;
+	while (target < size) {
+		const uint8_t *sync;
+		uint64_t offset, limit;
+		int status;
+
+		errcode = pt_sync_forward(&sync, config->begin + target,
+					  config);
+		if (errcode < 0) {
+			if (errcode != -pte_eos) {
+				free(seg);
+				return errcode;
+			}
+
+			break;
+		}
+
+		offset = (uint64_t) (sync - config->begin);
+		if (offset <= seg->begin) {
+			target += ptps_psb;
+			continue;
+		}
+
+		status = pt_blkp_is_seam(&limit, config, offset);
+		if (status < 0) {
+			free(seg);
+			return status;
+		}
+
+		if (status) {
+			seg->end = offset;
+			seg->limit = limit;
+
+			pdec->next = offset;
+
+			*pseg = seg;
+			return 0;
+		}
+
+		target = offset + ptps_psb;
+	}
+
+	seg->end = size;
+	seg->limit = size;
+	seg->last = 1;
+
+	pdec->eos = 1;
+
+	*pseg = seg;
+	return 0;
+}
+
+/* Split off segments until we have @window segments in flight.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_blkp_fill(struct pt_blk_parallel *pdec, uint32_t window)
+{
+	if (!pdec)
+		return -pte_internal;
+
+	while (!pdec->eos && (pdec->nsegments < window)) {
+		struct pt_blkp_segment *seg;
+		int errcode, status;
+
+		errcode = pt_blkp_split(&seg, pdec);
+		if (errcode < 0)
+			return errcode;
+
+		if (!seg)
+			break;
+
+		errcode = pt_blkp_lock(pdec);
+		if (errcode < 0) {
+			pt_blkp_free_segment(seg);
+			return errcode;
+		}
+
+		if (pdec->tail)
+			pdec->tail->next = seg;
+		else
+			pdec->head = seg;
+
+		pdec->tail = seg;
+		pdec->nsegments += 1;
+
+		if (!pdec->pending)
+			pdec->pending = seg;
+
+		status = pt_blkp_signal(pdec);
+
+		errcode = pt_blkp_unlock(pdec);
+		if (errcode < 0)
+			return errcode;
+
+		if (status < 0)
+			return status;
+	}
+
+	return 0;
+}
+
+/* Add a record to @seg.
+ *
+ * Returns a pointer to the new record on success, NULL otherwise.
+ */
+static struct pt_blk_record *pt_blkp_add_record(struct pt_blkp_segment *seg,
+						enum pt_blk_record_type type)
+{
+	struct pt_blk_record *record;
+
+	if (!seg)
+		return NULL;
+
+	if (seg->capacity <= seg->nrecords) {
+		struct pt_blk_record *records;
+		size_t capacity;
+
+		capacity = seg->capacity ? seg->capacity * 2 : pt_blkp_records;
+
+		records = realloc(seg->records, capacity * sizeof(*records));
+		if (!records)
+			return NULL;
+
+		seg->records = records;
+		seg->capacity = capacity;
+	}
+
+	record = &seg->records[seg->nrecords++];
+	memset(record, 0, sizeof(*record));
+	record->type = type;
+
+	return record;
+}
+
+/* Complete a record.
+ *
+ * Stores @status in @record and fills in @decoder's current offset.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_blkp_end_record(struct pt_blk_record *record,
+			      const struct pt_block_decoder *decoder,
+			      const struct pt_blkp_segment *seg, int status)
+{
+	int errcode;
+
+	if (!record || !seg)
+		return -pte_internal;
+
+	/* The end of a segment is not the end of the trace. */
+	if ((status >= 0) && !seg->last)
+		status &= ~pts_eos;
+
+	record->status = status;
+
+	errcode = pt_blk_get_offset(decoder, &record->offset);
+	if (errcode < 0) {
+		if (errcode != -pte_nosync)
+			return errcode;
+
+		record->offset = 0ull;
+	}
+
+	return 0;
+}
+
+/* Check whether @decoder reached the end of @seg.
+ *
+ * We leave the events bound to the next segment's PSB+ header to the decoder
+ * of that segment.
+ */
+static int pt_blkp_at_seam(const struct pt_block_decoder *decoder,
+			   const struct pt_blkp_segment *seg)
+{
+	const struct pt_event *ev;
+	uint64_t offset;
+	int errcode;
+
+	if (!decoder || !seg)
+		return -pte_internal;
+
+	if (seg->last || !decoder->process_event)
+		return 0;
+
+	ev = &decoder->event;
+	if (!ev->status_update && (ev->type != ptev_mnt))
+		return 0;
+
+	errcode = pt_blk_get_offset(decoder, &offset);
+	if (errcode < 0)
+		return errcode;
+
+	return seg->end <= offset;
+}
+
+/* Re-synchronize @decoder after an error.
+ *
+ * Returns a positive integer if decoding @seg shall continue.
+ * Returns zero if we reached the end of @seg.
+ * Returns a negative error code otherwise.
+ */
+static int pt_blkp_resync(struct pt_block_decoder *decoder,
+			  struct pt_blkp_segment *seg, int *pstatus)
+{
+	uint64_t last;
+	int errcode;
+
+	if (!decoder || !seg || !pstatus)
+		return -pte_internal;
+
+	errcode = pt_blk_get_offset(decoder, &last);
+	if (errcode < 0)
+		return errcode;
+
+	for (;;) {
+		struct pt_blk_record *record;
+		uint64_t offset;
+		int status;
+
+		status = pt_blk_sync_forward(decoder);
+		if ((status == -pte_eos) && !seg->last) {
+			seg->resync = 1;
+			return 0;
+		}
+
+		errcode = pt_blk_get_offset(decoder, &offset);
+		if (errcode < 0)
+			return errcode;
+
+		/* The next segment starts with the PSB we just found. */
+		if (!seg->last && (seg->end <= offset)) {
+			seg->resync = 1;
+			return 0;
+		}
+
+		record = pt_blkp_add_record(seg, ptbr_sync);
+		if (!record)
+			return -pte_nomem;
+
+		errcode = pt_blkp_end_record(record, decoder, seg, status);
+		if (errcode < 0)
+			return errcode;
+
+		if (status == -pte_eos)
+			return 0;
+
+		if (status >= 0) {
+			/* The return-address stack has been reset. */
+			pt_retstack_init(&seg->retstack);
+			seg->complete = 1;
+
+			*pstatus = status;
+			return 1;
+		}
+
+		/* Like ptxed, we give up if we do not make progress. */
+		if (offset <= last)
+			return 0;
+
+		last = offset;
+	}
+}
+
+/* Decode @seg.
+ *
+ * If @retstack is not NULL, it provides the return-address stack at the
+ * beginning of @seg.  Otherwise, we start with an empty return-address stack
+ * and indicate an underflow.
+ *
+ * The first record is always the synchronization at the beginning of @seg.
+ * It is only reported for the first segment or if the preceding segment
+ * ended while re-synchronizing.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_blkp_decode(struct pt_blkp_worker *worker,
+			  struct pt_blkp_segment *seg,
+			  const struct pt_retstack *retstack)
+{
+	struct pt_block_decoder *decoder;
+	struct pt_blk_record *record;
+	int status, errcode;
+
+	if (!worker || !seg || !worker->pdec)
+		return -pte_internal;
+
+	decoder = &worker->decoder;
+
+	seg->nrecords = 0;
+	seg->underflow = 0;
+	seg->resync = 0;
+	seg->complete = seg->first || retstack;
+
+	/* Let the decoder see the next segment's PSB+ header. */
+	decoder->query.config.end = worker->pdec->config.begin + seg->limit;
+
+	status = pt_blk_sync_set(decoder, seg->begin);
+	if (status >= 0 && retstack)
+		decoder->retstack = *retstack;
+
+	record = pt_blkp_add_record(seg, ptbr_sync);
+	if (!record)
+		return -pte_nomem;
+
+	errcode = pt_blkp_end_record(record, decoder, seg, status);
+	if (errcode < 0)
+		return errcode;
+
+	if (status < 0) {
+		if (status == -pte_eos)
+			return 0;
+
+		errcode = pt_blkp_resync(decoder, seg, &status);
+		if (errcode <= 0)
+			return errcode;
+	}
+
+	errcode = 0;
+	for (;;) {
+		if (status & pts_event_pending) {
+			errcode = pt_blkp_at_seam(decoder, seg);
+			if (errcode != 0)
+				break;
+
+			record = pt_blkp_add_record(seg, ptbr_event);
+			if (!record)
+				return -pte_nomem;
+
+			status = pt_blk_event(decoder, &record->variant.event,
+					      sizeof(record->variant.event));
+		} else {
+			record = pt_blkp_add_record(seg, ptbr_block);
+			if (!record)
+				return -pte_nomem;
+
+			status = pt_blk_next(decoder, &record->variant.block,
+					     sizeof(record->variant.block));
+		}
+
+		if ((status == -pte_retstack_empty) && !seg->complete) {
+			seg->underflow = 1;
+
+			return 0;
+		}
+
+		if ((status == -pte_eos) && !seg->last) {
+			seg->nrecords -= 1;
+			break;
+		}
+
+		errcode = pt_blkp_end_record(record, decoder, seg, status);
+		if (errcode < 0)
+			return errcode;
+
+		if (status < 0) {
+			if (status == -pte_eos)
+				break;
+
+			errcode = pt_blkp_resync(decoder, seg, &status);
+			if (errcode <= 0)
+				return errcode;
+		}
+	}
+
+	if (errcode < 0)
+		return errcode;
+
+	seg->retstack = decoder->retstack;
+	return 0;
+}
+
+/* Combine the return-address stack @seg ended with with @retstack.
+ *
+ * Unless @seg started from a reset return-address stack, the return addresses
+ * it pushed are pushed on top of @retstack.
+ */
+static int pt_blkp_update_retstack(struct pt_retstack *retstack,
+				   const struct pt_blkp_segment *seg)
+{
+	const struct pt_retstack *stack;
+	uint8_t idx;
+
+	if (!retstack || !seg)
+		return -pte_internal;
+
+	stack = &seg->retstack;
+	if (seg->complete) {
+		*retstack = *stack;
+		return 0;
+	}
+
+	for (idx = stack->bottom; idx != stack->top;) {
+		int errcode;
+
+		errcode = pt_retstack_push(retstack, stack->stack[idx]);
+		if (errcode < 0)
+			return errcode;
+
+		idx = (idx == pt_retstack_size ? 0 : idx + 1);
+	}
+
+	return 0;
+}
+
+#if defined(FEATURE_THREADS)
+
+static int pt_blkp_worker_run(void *arg)
+{
+	struct pt_blkp_worker *worker;
+	struct pt_blk_parallel *pdec;
+	int errcode, status;
+
+	worker = (struct pt_blkp_worker *) arg;
+	if (!worker)
+		return -pte_internal;
+
+	pdec = worker->pdec;
+
+	errcode = pt_blkp_lock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	for (;;) {
+		struct pt_blkp_segment *seg;
+
+		while (!pdec->stop && !pdec->pending) {
+			errcode = pt_blkp_wait(pdec);
+			if (errcode < 0)
+				break;
+		}
+
+		if (errcode < 0 || pdec->stop)
+			break;
+
+		seg = pdec->pending;
+		pdec->pending = seg->next;
+
+		errcode = pt_blkp_unlock(pdec);
+		if (errcode < 0)
+			return errcode;
+
+		status = pt_blkp_decode(worker, seg, NULL);
+
+		errcode = pt_blkp_lock(pdec);
+		if (errcode < 0)
+			return errcode;
+
+		seg->errcode = status;
+		seg->done = 1;
+
+		errcode = pt_blkp_signal(pdec);
+		if (errcode < 0)
+			break;
+	}
+
+	status = pt_blkp_unlock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	return status;
+}
+
+#endif /* defined(FEATURE_THREADS) */
+
+/* Wait for the head segment to be decoded.
+ *
+ * Decodes the head segment using @worker if it has not been picked up, yet.
+ *
+ * Returns zero and provides the head segment in @pseg on success.
+ * Returns zero and sets @pseg to NULL if there are no more segments.
+ * Returns a negative error code otherwise.
+ */
+static int pt_blkp_wait_head(struct pt_blkp_segment **pseg,
+			     struct pt_blk_parallel *pdec,
+			     struct pt_blkp_worker *worker)
+{
+	struct pt_blkp_segment *seg;
+	int errcode, status;
+
+	if (!pseg || !pdec)
+		return -pte_internal;
+
+	errcode = pt_blkp_lock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	seg = pdec->head;
+	if (seg && pdec->pending == seg) {
+		pdec->pending = seg->next;
+
+		errcode = pt_blkp_unlock(pdec);
+		if (errcode < 0)
+			return errcode;
+
+		seg->errcode = pt_blkp_decode(worker, seg, NULL);
+		seg->done = 1;
+
+		*pseg = seg;
+		return 0;
+	}
+
+	status = 0;
+	while (seg && !seg->done) {
+		status = pt_blkp_wait(pdec);
+		if (status < 0)
+			break;
+	}
+
+	errcode = pt_blkp_unlock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	if (status < 0)
+		return status;
+
+	*pseg = seg;
+	return 0;
+}
+
+/* Report @seg's records and remove it from @pdec's segment list.
+ *
+ * Starts at @seg's first record if @sync is non-zero and skips the initial
+ * synchronization record otherwise.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_blkp_report(struct pt_blk_parallel *pdec,
+			  struct pt_blkp_segment *seg, int sync)
+{
+	size_t idx;
+	int errcode;
+
+	if (!pdec || !seg)
+		return -pte_internal;
+
+	for (idx = sync ? 0 : 1; idx < seg->nrecords; ++idx) {
+		errcode = pdec->pconfig.callback(&seg->records[idx],
+						 pdec->pconfig.context);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	errcode = pt_blkp_lock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	pdec->head = seg->next;
+	if (!pdec->head)
+		pdec->tail = NULL;
+
+	pdec->nsegments -= 1;
+
+	errcode = pt_blkp_unlock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	pt_blkp_free_segment(seg);
+	return 0;
+}
+
+static int pt_blkp_run(struct pt_blk_parallel *pdec,
+		       struct pt_blkp_worker *worker, uint32_t window)
+{
+	struct pt_retstack retstack;
+	int sync;
+
+	if (!pdec)
+		return -pte_internal;
+
+	pt_retstack_init(&retstack);
+	sync = 1;
+
+	for (;;) {
+		struct pt_blkp_segment *seg;
+		int errcode, resync;
+
+		errcode = pt_blkp_fill(pdec, window);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = pt_blkp_wait_head(&seg, pdec, worker);
+		if (errcode < 0)
+			return errcode;
+
+		if (!seg)
+			return 0;
+
+		if (seg->errcode < 0)
+			return seg->errcode;
+
+		/* Decode the segment again if it returned into one of the
+		 * preceding segments.
+		 */
+		if (seg->underflow) {
+			errcode = pt_blkp_decode(worker, seg, &retstack);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		/* A sequential decoder would continue by synchronizing onto
+		 * the next segment's PSB, which resets the return-address
+		 * stack.
+		 */
+		if (seg->resync)
+			pt_retstack_init(&retstack);
+		else {
+			errcode = pt_blkp_update_retstack(&retstack, seg);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		resync = seg->resync;
+
+		errcode = pt_blkp_report(pdec, seg, sync);
+		if (errcode < 0)
+			return errcode;
+
+		sync = resync;
+	}
+}
+
+/* Stop all workers.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_blkp_stop(struct pt_blk_parallel *pdec,
+			struct pt_blkp_worker *workers, uint32_t nworkers)
+{
+	uint32_t idx;
+	int errcode, status;
+
+	if (!pdec || (nworkers && !workers))
+		return -pte_internal;
+
+	errcode = pt_blkp_lock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	pdec->stop = 1;
+
+	status = pt_blkp_signal(pdec);
+
+	errcode = pt_blkp_unlock(pdec);
+	if (errcode < 0)
+		return errcode;
+
+	for (idx = 0; idx < nworkers; ++idx) {
+		struct pt_blkp_worker *worker;
+
+		worker = &workers[idx];
+		if (!worker->started)
+			continue;
+
+#if defined(FEATURE_THREADS)
+		{
+			int result;
+
+			errcode = thrd_join(&worker->thread, &result);
+			if (errcode != thrd_success)
+				status = -pte_bad_lock;
+			else if (result < 0 && !status)
+				status = result;
+		}
+#endif /* defined(FEATURE_THREADS) */
+
+		worker->started = 0;
+	}
+
+	return status;
+}
+
+int pt_blk_decode_parallel(const struct pt_config *config,
+			   struct pt_image *image,
+			   const struct pt_blk_parallel_config *pconfig)
+{
+	struct pt_blk_parallel pdec;
+	struct pt_blkp_worker *workers;
+	uint32_t idx, nworkers, window;
+	int errcode, status;
+
+	if (!config || !pconfig)
+		return -pte_invalid;
+
+	errcode = pt_blkp_init(&pdec, config, image, pconfig);
+	if (errcode < 0)
+		return errcode;
+
+	/* Worker zero is used by the calling thread.
+	 *
+	 * It decodes segments no worker thread has picked up, yet, and it
+	 * re-decodes segments that need the return-address stack of their
+	 * preceding segments.
+	 */
+	nworkers = 1;
+#if defined(FEATURE_THREADS)
+	if (1 < pdec.pconfig.nthreads)
+		nworkers += pdec.pconfig.nthreads;
+#endif /* defined(FEATURE_THREADS) */
+
+	window = nworkers * pt_blkp_window;
+
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!workers) {
+		pt_blkp_fini(&pdec);
+		return -pte_nomem;
+	}
+
+	for (idx = 0; idx < nworkers; ++idx) {
+		errcode = pt_blkp_worker_init(&workers[idx], &pdec);
+		if (errcode < 0)
+			goto out;
+	}
+
+#if defined(FEATURE_THREADS)
+	for (idx = 1; idx < nworkers; ++idx) {
+		struct pt_blkp_worker *worker;
+
+		worker = &workers[idx];
+
+		errcode = thrd_create(&worker->thread, pt_blkp_worker_run,
+				      worker);
+		if (errcode != thrd_success) {
+			errcode = -pte_bad_lock;
+			goto out;
+		}
+
+		worker->started = 1;
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	errcode = pt_blkp_run(&pdec, &workers[0], window);
+
+out:
+	status = pt_blkp_stop(&pdec, workers, nworkers);
+	if (!errcode)
+		errcode = status;
+
+	for (idx = 0; idx < nworkers; ++idx)
+		pt_blkp_worker_fini(&workers[idx]);
+
+	free(workers);
+	pt_blkp_fini(&pdec);
+
+	return errcode;
+}
@@ -217,11 +217,218 @@ const struct pt_decoder_function pt_decode_ptw = {
 };
 
 
+/* Decoder function indices for the opcode dispatch tables below.
+ *
+ * The order must match pt_df_dfun[].
+ */
+enum pt_df_index {
+	pdfi_unknown,
+	pdfi_pad,
+	pdfi_psb,
+	pdfi_tip,
+	pdfi_tnt_8,
+	pdfi_tnt_64,
+	pdfi_tip_pge,
+	pdfi_tip_pgd,
+	pdfi_fup,
+	pdfi_pip,
+	pdfi_ovf,
+	pdfi_mode,
+	pdfi_psbend,
+	pdfi_tsc,
+	pdfi_cbr,
+	pdfi_tma,
+	pdfi_mtc,
+	pdfi_cyc,
+	pdfi_stop,
+	pdfi_vmcs,
+	pdfi_mnt,
+	pdfi_exstop,
+	pdfi_mwait,
+	pdfi_pwre,
+	pdfi_pwrx,
+	pdfi_ptw,
+
+	/* The opcode continues in the next byte.
+	 *
+	 * Those escapes must come last; they have no decoder function.
+	 */
+	pdfi_ext,
+	pdfi_ext2
+};
+
+/* The decoder functions indexed by enum pt_df_index. */
+static const struct pt_decoder_function *const pt_df_dfun[pdfi_ext] = {
+	&pt_decode_unknown,
+	&pt_decode_pad,
+	&pt_decode_psb,
+	&pt_decode_tip,
+	&pt_decode_tnt_8,
+	&pt_decode_tnt_64,
+	&pt_decode_tip_pge,
+	&pt_decode_tip_pgd,
+	&pt_decode_fup,
+	&pt_decode_pip,
+	&pt_decode_ovf,
+	&pt_decode_mode,
+	&pt_decode_psbend,
+	&pt_decode_tsc,
+	&pt_decode_cbr,
+	&pt_decode_tma,
+	&pt_decode_mtc,
+	&pt_decode_cyc,
+	&pt_decode_stop,
+	&pt_decode_vmcs,
+	&pt_decode_mnt,
+	&pt_decode_exstop,
+	&pt_decode_mwait,
+	&pt_decode_pwre,
+	&pt_decode_pwrx,
+	&pt_decode_ptw
+};
+
+/* The decoder function index for the first opcode byte. */
+static const uint8_t pt_df_opc[256] = {
+	/* 0x00 */ pdfi_pad,     pdfi_tip_pgd, pdfi_ext,     pdfi_cyc,
+	/* 0x04 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x08 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x0c */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x10 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x14 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x18 */ pdfi_tnt_8,   pdfi_tsc,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x1c */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x20 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x24 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x28 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x2c */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x30 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x34 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x38 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x3c */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x40 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x44 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x48 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x4c */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x50 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x54 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x58 */ pdfi_tnt_8,   pdfi_mtc,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x5c */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x60 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x64 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x68 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x6c */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x70 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x74 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x78 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x7c */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x80 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x84 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x88 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x8c */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0x90 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x94 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0x98 */ pdfi_tnt_8,   pdfi_mode,    pdfi_tnt_8,   pdfi_cyc,
+	/* 0x9c */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0xa0 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xa4 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xa8 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xac */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0xb0 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xb4 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xb8 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xbc */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0xc0 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xc4 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xc8 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xcc */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0xd0 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xd4 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xd8 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xdc */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0xe0 */ pdfi_tnt_8,   pdfi_tip_pgd, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xe4 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xe8 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xec */ pdfi_tnt_8,   pdfi_tip,     pdfi_tnt_8,   pdfi_cyc,
+	/* 0xf0 */ pdfi_tnt_8,   pdfi_tip_pge, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xf4 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xf8 */ pdfi_tnt_8,   pdfi_unknown, pdfi_tnt_8,   pdfi_cyc,
+	/* 0xfc */ pdfi_tnt_8,   pdfi_fup,     pdfi_tnt_8,   pdfi_cyc
+};
+
+/* The decoder function index for the extended opcode byte. */
+static const uint8_t pt_df_ext[256] = {
+	/* 0x00 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_cbr,
+	/* 0x04 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x08 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x0c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x10 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_unknown,
+	/* 0x14 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x18 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x1c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x20 */ pdfi_unknown, pdfi_unknown, pdfi_pwre,    pdfi_psbend,
+	/* 0x24 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x28 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x2c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x30 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_unknown,
+	/* 0x34 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x38 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x3c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x40 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_pip,
+	/* 0x44 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x48 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x4c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x50 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_unknown,
+	/* 0x54 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x58 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x5c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x60 */ pdfi_unknown, pdfi_unknown, pdfi_exstop,  pdfi_unknown,
+	/* 0x64 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x68 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x6c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x70 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_tma,
+	/* 0x74 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x78 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x7c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x80 */ pdfi_unknown, pdfi_unknown, pdfi_psb,     pdfi_stop,
+	/* 0x84 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x88 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x8c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x90 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_unknown,
+	/* 0x94 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x98 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0x9c */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xa0 */ pdfi_unknown, pdfi_unknown, pdfi_pwrx,    pdfi_tnt_64,
+	/* 0xa4 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xa8 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xac */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xb0 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_unknown,
+	/* 0xb4 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xb8 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xbc */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xc0 */ pdfi_unknown, pdfi_unknown, pdfi_mwait,   pdfi_ext2,
+	/* 0xc4 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xc8 */ pdfi_vmcs,    pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xcc */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xd0 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_unknown,
+	/* 0xd4 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xd8 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xdc */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xe0 */ pdfi_unknown, pdfi_unknown, pdfi_exstop,  pdfi_unknown,
+	/* 0xe4 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xe8 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xec */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xf0 */ pdfi_unknown, pdfi_unknown, pdfi_ptw,     pdfi_ovf,
+	/* 0xf4 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xf8 */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown,
+	/* 0xfc */ pdfi_unknown, pdfi_unknown, pdfi_unknown, pdfi_unknown
+};
+
+
 int pt_df_fetch(const struct pt_decoder_function **dfun, const uint8_t *pos,
 		const struct pt_config *config)
 {
 	const uint8_t *begin, *end;
-	uint8_t opc, ext, ext2;
+	uint8_t idx;
 
 	if (!dfun || !config)
 		return -pte_internal;
@@ -238,142 +445,20 @@ int pt_df_fetch(const struct pt_decoder_function **dfun, const uint8_t *pos,
 	if (pos == end)
 		return -pte_eos;
 
-	opc = *pos++;
-	switch (opc) {
-	default:
-		/* Check opcodes that require masking. */
-		if ((opc & pt_opm_tnt_8) == pt_opc_tnt_8) {
-			*dfun = &pt_decode_tnt_8;
-			return 0;
-		}
-
-		if ((opc & pt_opm_cyc) == pt_opc_cyc) {
-			*dfun = &pt_decode_cyc;
-			return 0;
-		}
-
-		if ((opc & pt_opm_tip) == pt_opc_tip) {
-			*dfun = &pt_decode_tip;
-			return 0;
-		}
-
-		if ((opc & pt_opm_fup) == pt_opc_fup) {
-			*dfun = &pt_decode_fup;
-			return 0;
-		}
-
-		if ((opc & pt_opm_tip) == pt_opc_tip_pge) {
-			*dfun = &pt_decode_tip_pge;
-			return 0;
-		}
-
-		if ((opc & pt_opm_tip) == pt_opc_tip_pgd) {
-			*dfun = &pt_decode_tip_pgd;
-			return 0;
-		}
-
-		*dfun = &pt_decode_unknown;
-		return 0;
-
-	case pt_opc_pad:
-		*dfun = &pt_decode_pad;
-		return 0;
-
-	case pt_opc_mode:
-		*dfun = &pt_decode_mode;
-		return 0;
-
-	case pt_opc_tsc:
-		*dfun = &pt_decode_tsc;
-		return 0;
-
-	case pt_opc_mtc:
-		*dfun = &pt_decode_mtc;
-		return 0;
-
-	case pt_opc_ext:
+	idx = pt_df_opc[*pos++];
+	if (idx == pdfi_ext) {
 		if (pos == end)
 			return -pte_eos;
 
-		ext = *pos++;
-		switch (ext) {
-		default:
-			/* Check opcodes that require masking. */
-			if ((ext & pt_opm_ptw) == pt_ext_ptw) {
-				*dfun = &pt_decode_ptw;
-				return 0;
-			}
-
-			*dfun = &pt_decode_unknown;
-			return 0;
-
-		case pt_ext_psb:
-			*dfun = &pt_decode_psb;
-			return 0;
-
-		case pt_ext_ovf:
-			*dfun = &pt_decode_ovf;
-			return 0;
-
-		case pt_ext_tnt_64:
-			*dfun = &pt_decode_tnt_64;
-			return 0;
-
-		case pt_ext_psbend:
-			*dfun = &pt_decode_psbend;
-			return 0;
-
-		case pt_ext_cbr:
-			*dfun = &pt_decode_cbr;
-			return 0;
-
-		case pt_ext_pip:
-			*dfun = &pt_decode_pip;
-			return 0;
-
-		case pt_ext_tma:
-			*dfun = &pt_decode_tma;
-			return 0;
-
-		case pt_ext_stop:
-			*dfun = &pt_decode_stop;
-			return 0;
-
-		case pt_ext_vmcs:
-			*dfun = &pt_decode_vmcs;
-			return 0;
-
-		case pt_ext_exstop:
-		case pt_ext_exstop_ip:
-			*dfun = &pt_decode_exstop;
-			return 0;
-
-		case pt_ext_mwait:
-			*dfun = &pt_decode_mwait;
-			return 0;
-
-		case pt_ext_pwre:
-			*dfun = &pt_decode_pwre;
-			return 0;
-
-		case pt_ext_pwrx:
-			*dfun = &pt_decode_pwrx;
-			return 0;
-
-		case pt_ext_ext2:
+		idx = pt_df_ext[*pos++];
+		if (idx == pdfi_ext2) {
 			if (pos == end)
 				return -pte_eos;
 
-			ext2 = *pos++;
-			switch (ext2) {
-			default:
-				*dfun = &pt_decode_unknown;
-				return 0;
-
-			case pt_ext2_mnt:
-				*dfun = &pt_decode_mnt;
-				return 0;
-			}
+			idx = (*pos == pt_ext2_mnt) ? pdfi_mnt : pdfi_unknown;
 		}
 	}
+
+	*dfun = pt_df_dfun[idx];
+	return 0;
 }
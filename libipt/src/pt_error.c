@@ -115,6 +115,9 @@ const char *pt_errstr(enum pt_error_code errcode)
 
 	case pte_bad_cpu:
 		return "unknown cpu";
+
+	case pte_suspended:
+		return "decoder suspended at the end of the appended trace";
 	}
 
 	/* Should not reach here. */
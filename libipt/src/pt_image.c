@@ -34,6 +34,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_MSC_VER)
+#  include <windows.h>
+#endif
+
 
 static char *dupstr(const char *str)
 {
@@ -51,55 +55,361 @@ static char *dupstr(const char *str)
 	return strcpy(dup, str);
 }
 
-static struct pt_section_list *pt_mk_section_list(struct pt_section *section,
-						  const struct pt_asid *asid,
-						  uint64_t vaddr,
-						  uint64_t offset,
-						  uint64_t size, int isid)
+/* Release the section of an image entry. */
+static void pt_image_entry_fini(struct pt_image_entry *entry)
 {
-	struct pt_section_list *list;
-	int errcode;
+	if (!entry)
+		return;
+
+	(void) pt_section_put(pt_msec_section(&entry->section));
+	pt_msec_fini(&entry->section);
+}
+
+static void pt_image_space_fini(struct pt_image_space *space)
+{
+	uint32_t idx;
+
+	if (!space)
+		return;
+
+	for (idx = 0; idx < space->nentries; ++idx)
+		pt_image_entry_fini(&space->entries[idx]);
 
-	list = malloc(sizeof(*list));
-	if (!list)
+	free(space->entries);
+
+	memset(space, 0, sizeof(*space));
+}
+
+/* Check whether two asids are identical.
+ *
+ * This is different from pt_asid_match(), which treats unknown parts of an
+ * asid as wildcards.
+ */
+static int pt_image_same_asid(const struct pt_asid *lhs,
+			      const struct pt_asid *rhs)
+{
+	return (lhs->cr3 == rhs->cr3) && (lhs->vmcs == rhs->vmcs);
+}
+
+/* Find the index of the first section in @space that ends after @vaddr.
+ *
+ * Returns @space->nentries if there is no such section.
+ */
+static uint32_t pt_image_space_lower_bound(const struct pt_image_space *space,
+					   uint64_t vaddr)
+{
+	uint32_t lower, upper;
+
+	lower = 0;
+	upper = space->nentries;
+	while (lower < upper) {
+		uint32_t middle;
+
+		middle = lower + ((upper - lower) / 2);
+		if (pt_msec_end(&space->entries[middle].section) <= vaddr)
+			lower = middle + 1;
+		else
+			upper = middle;
+	}
+
+	return lower;
+}
+
+/* Find the section containing @vaddr in @space.
+ *
+ * Returns a pointer to the section's entry on success, NULL otherwise.
+ */
+static struct pt_image_entry *
+pt_image_space_find(const struct pt_image_space *space, uint64_t vaddr)
+{
+	struct pt_image_entry *entry;
+	uint32_t idx;
+
+	idx = pt_image_space_lower_bound(space, vaddr);
+	if (space->nentries <= idx)
 		return NULL;
 
-	memset(list, 0, sizeof(*list));
+	entry = &space->entries[idx];
+	if (vaddr < pt_msec_begin(&entry->section))
+		return NULL;
 
-	errcode = pt_section_get(section);
-	if (errcode < 0)
-		goto out_mem;
+	return entry;
+}
+
+/* Find the section in @space that would be cut at @vaddr.
+ *
+ * This is the section that contains @vaddr but does not begin at @vaddr.
+ *
+ * Returns a pointer to the section's entry on success, NULL otherwise.
+ */
+static struct pt_image_entry *
+pt_image_space_cut(const struct pt_image_space *space, uint64_t vaddr)
+{
+	struct pt_image_entry *entry;
+
+	entry = pt_image_space_find(space, vaddr);
+	if (!entry || (pt_msec_begin(&entry->section) == vaddr))
+		return NULL;
+
+	return entry;
+}
+
+/* Make room for at least @nentries additional sections in @space.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_image_space_reserve(struct pt_image_space *space,
+				  uint32_t nentries)
+{
+	struct pt_image_entry *entries;
+	uint32_t capacity, needed;
+
+	needed = space->nentries + nentries;
+	if (needed < space->nentries)
+		return -pte_nomem;
+
+	capacity = space->capacity;
+	if (needed <= capacity)
+		return 0;
+
+	if (!capacity)
+		capacity = 8;
+
+	while (capacity < needed) {
+		if ((UINT32_MAX / 2) < capacity)
+			return -pte_nomem;
+
+		capacity *= 2;
+	}
+
+	entries = realloc(space->entries, capacity * sizeof(*entries));
+	if (!entries)
+		return -pte_nomem;
+
+	space->entries = entries;
+	space->capacity = capacity;
+
+	return 0;
+}
+
+/* Replace the sections [@begin; @end[ in @space with @nentries @entries.
+ *
+ * The replaced sections are not released.  The caller must ensure that
+ * @space has sufficient capacity.
+ */
+static void pt_image_space_splice(struct pt_image_space *space, uint32_t begin,
+				  uint32_t end,
+				  const struct pt_image_entry *entries,
+				  uint32_t nentries)
+{
+	uint32_t ntail;
+
+	ntail = space->nentries - end;
+	memmove(&space->entries[begin + nentries], &space->entries[end],
+		ntail * sizeof(*space->entries));
+	if (nentries)
+		memcpy(&space->entries[begin], entries,
+		       nentries * sizeof(*space->entries));
+
+	space->nentries = begin + nentries + ntail;
+}
+
+/* Get a reference to the sections in @space that would be cut by adding a
+ * section at [@begin; @end[.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_image_space_get_cuts(const struct pt_image_space *space,
+				   uint64_t begin, uint64_t end)
+{
+	struct pt_image_entry *front, *back;
+	int errcode;
 
-	pt_msec_init(&list->section, section, asid, vaddr, offset, size);
-	list->isid = isid;
+	front = pt_image_space_cut(space, begin);
+	if (front) {
+		errcode = pt_section_get(pt_msec_section(&front->section));
+		if (errcode < 0)
+			return errcode;
+	}
+
+	back = pt_image_space_cut(space, end);
+	if (back) {
+		errcode = pt_section_get(pt_msec_section(&back->section));
+		if (errcode < 0) {
+			if (front)
+				(void) pt_section_put(pt_msec_section(
+					&front->section));
+
+			return errcode;
+		}
+	}
+
+	return 0;
+}
+
+/* Drop the references obtained by pt_image_space_get_cuts(). */
+static void pt_image_space_put_cuts(const struct pt_image_space *space,
+				    uint64_t begin, uint64_t end)
+{
+	struct pt_image_entry *entry;
+
+	entry = pt_image_space_cut(space, begin);
+	if (entry)
+		(void) pt_section_put(pt_msec_section(&entry->section));
+
+	entry = pt_image_space_cut(space, end);
+	if (entry)
+		(void) pt_section_put(pt_msec_section(&entry->section));
+}
+
+/* Remove [@begin; @end[ from @space.
+ *
+ * Sections that overlap with [@begin; @end[ are shrunk, split, or removed.
+ * The caller must have obtained references for the shrunk or split sections
+ * using pt_image_space_get_cuts() and must have reserved room for at least
+ * one additional section.
+ */
+static void pt_image_space_carve(struct pt_image_space *space, uint64_t begin,
+				 uint64_t end)
+{
+	struct pt_image_entry remainder[2], *entry;
+	uint32_t lower, upper, nremainder;
+
+	nremainder = 0;
+
+	/* Keep the bytes in front of @begin. */
+	entry = pt_image_space_cut(space, begin);
+	if (entry) {
+		struct pt_mapped_section *msec;
+
+		msec = &remainder[nremainder].section;
+
+		*msec = entry->section;
+		msec->size = begin - pt_msec_begin(msec);
+		remainder[nremainder++].isid = entry->isid;
+	}
+
+	/* Keep the bytes behind @end. */
+	entry = pt_image_space_cut(space, end);
+	if (entry) {
+		struct pt_mapped_section *msec;
+		uint64_t lbegin, lend;
+
+		msec = &remainder[nremainder].section;
+
+		*msec = entry->section;
+		lbegin = pt_msec_begin(msec);
+		lend = pt_msec_end(msec);
+
+		msec->vaddr = end;
+		msec->offset += end - lbegin;
+		msec->size = lend - end;
+		remainder[nremainder++].isid = entry->isid;
+	}
+
+	lower = pt_image_space_lower_bound(space, begin);
+	for (upper = lower; upper < space->nentries; ++upper) {
+		entry = &space->entries[upper];
+		if (end <= pt_msec_begin(&entry->section))
+			break;
 
-	return list;
+		pt_image_entry_fini(entry);
+	}
+
+	pt_image_space_splice(space, lower, upper, remainder, nremainder);
+}
+
+/* Find the address space for @asid in @image.
+ *
+ * Returns a pointer to the space on success, NULL otherwise.
+ */
+static struct pt_image_space *pt_image_find_space(struct pt_image *image,
+						  const struct pt_asid *asid)
+{
+	uint32_t idx;
+
+	for (idx = 0; idx < image->nspaces; ++idx) {
+		struct pt_image_space *space;
+
+		space = &image->spaces[idx];
+		if (pt_image_same_asid(&space->asid, asid))
+			return space;
+	}
 
-out_mem:
-	free(list);
 	return NULL;
 }
 
-static void pt_section_list_free(struct pt_section_list *list)
+/* Find or add the address space for @asid in @image.
+ *
+ * Returns a pointer to the space on success, NULL otherwise.
+ */
+static struct pt_image_space *pt_image_get_space(struct pt_image *image,
+						 const struct pt_asid *asid)
 {
-	if (!list)
-		return;
+	struct pt_image_space *space;
+
+	space = pt_image_find_space(image, asid);
+	if (space)
+		return space;
+
+	if (image->capacity <= image->nspaces) {
+		struct pt_image_space *spaces;
+		uint32_t capacity;
+
+		capacity = image->capacity ? image->capacity * 2 : 4;
+		if (capacity <= image->capacity)
+			return NULL;
+
+		spaces = realloc(image->spaces, capacity * sizeof(*spaces));
+		if (!spaces)
+			return NULL;
+
+		image->spaces = spaces;
+		image->capacity = capacity;
+	}
 
-	pt_section_put(list->section.section);
-	pt_msec_fini(&list->section);
-	free(list);
+	space = &image->spaces[image->nspaces++];
+	memset(space, 0, sizeof(*space));
+	space->asid = *asid;
+
+	return space;
 }
 
-static void pt_section_list_free_tail(struct pt_section_list *list)
+/* Remove empty address spaces from @image. */
+static void pt_image_prune(struct pt_image *image)
 {
-	while (list) {
-		struct pt_section_list *trash;
+	uint32_t idx, nspaces;
+
+	nspaces = 0;
+	for (idx = 0; idx < image->nspaces; ++idx) {
+		struct pt_image_space *space;
+
+		space = &image->spaces[idx];
+		if (!space->nentries) {
+			pt_image_space_fini(space);
+			continue;
+		}
 
-		trash = list;
-		list = list->next;
+		if (nspaces != idx)
+			image->spaces[nspaces] = *space;
 
-		pt_section_list_free(trash);
+		nspaces += 1;
 	}
+
+	image->nspaces = nspaces;
+}
+
+/* Give @image a new generation. */
+static void pt_image_touch(struct pt_image *image)
+{
+	static uint64_t generation;
+
+#if defined(_MSC_VER)
+	image->generation = (uint64_t)
+		InterlockedIncrement64((LONGLONG volatile *) &generation);
+#else
+	image->generation = __sync_add_and_fetch(&generation, 1ull);
+#endif
 }
 
 void pt_image_init(struct pt_image *image, const char *name)
@@ -110,17 +420,26 @@ void pt_image_init(struct pt_image *image, const char *name)
 	memset(image, 0, sizeof(*image));
 
 	image->name = dupstr(name);
+
+	pt_image_touch(image);
 }
 
 void pt_image_fini(struct pt_image *image)
 {
+	uint32_t idx;
+
 	if (!image)
 		return;
 
-	pt_section_list_free_tail(image->sections);
+	for (idx = 0; idx < image->nspaces; ++idx)
+		pt_image_space_fini(&image->spaces[idx]);
+
+	free(image->spaces);
 	free(image->name);
 
 	memset(image, 0, sizeof(*image));
+
+	pt_image_touch(image);
 }
 
 struct pt_image *pt_image_alloc(const char *name)
@@ -151,150 +470,143 @@ const char *pt_image_name(const struct pt_image *image)
 int pt_image_add(struct pt_image *image, struct pt_section *section,
 		 const struct pt_asid *asid, uint64_t vaddr, int isid)
 {
-	struct pt_section_list **list, *next, *removed, *new;
+	struct pt_image_space *target;
+	struct pt_image_entry entry;
 	uint64_t size, begin, end;
+	uint32_t idx, sidx;
 	int errcode;
 
-	if (!image || !section)
+	if (!image || !section || !asid)
 		return -pte_internal;
 
 	size = pt_section_size(section);
 	begin = vaddr;
 	end = begin + size;
 
-	next = pt_mk_section_list(section, asid, begin, 0ull, size, isid);
-	if (!next)
+	target = pt_image_get_space(image, asid);
+	if (!target)
 		return -pte_nomem;
 
-	removed = NULL;
-	errcode = 0;
-
-	/* Check for overlaps while we move to the end of the list. */
-	list = &(image->sections);
-	while (*list) {
-		const struct pt_mapped_section *msec;
-		const struct pt_asid *masid;
-		struct pt_section_list *current;
-		struct pt_section *lsec;
-		uint64_t lbegin, lend, loff;
+	/* Prepare all spaces that might overlap with the new section so we
+	 * can't fail once we start modifying them.
+	 *
+	 * Carving out the new section adds at most one section per space.
+	 * The target space additionally gets the new section.
+	 */
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		struct pt_image_space *space;
 
-		current = *list;
-		msec = &current->section;
-		masid = pt_msec_asid(msec);
+		space = &image->spaces[sidx];
 
-		errcode = pt_asid_match(masid, asid);
+		errcode = pt_asid_match(&space->asid, asid);
 		if (errcode < 0)
-			break;
+			goto out_prune;
 
-		if (!errcode) {
-			list = &((*list)->next);
+		if (!errcode)
 			continue;
-		}
 
-		lbegin = pt_msec_begin(msec);
-		lend = pt_msec_end(msec);
+		errcode = pt_image_space_reserve(space, 2);
+		if (errcode < 0)
+			goto out_prune;
+	}
 
-		if ((end <= lbegin) || (lend <= begin)) {
-			list = &((*list)->next);
-			continue;
-		}
+	errcode = pt_section_get(section);
+	if (errcode < 0)
+		goto out_prune;
 
-		/* The new section overlaps with @msec's section. */
-		lsec = pt_msec_section(msec);
-		loff = pt_msec_offset(msec);
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		struct pt_image_space *space;
 
-		/* We remove @msec and insert new sections for the remaining
-		 * parts, if any.  Those new sections are not mapped initially
-		 * and need to be added to the end of the section list.
-		 */
-		*list = current->next;
+		space = &image->spaces[sidx];
+		if (!pt_asid_match(&space->asid, asid))
+			continue;
 
-		/* Keep a list of removed sections so we can re-add them in case
-		 * of errors.
-		 */
-		current->next = removed;
-		removed = current;
-
-		/* Add a section covering the remaining bytes at the front. */
-		if (lbegin < begin) {
-			new = pt_mk_section_list(lsec, masid, lbegin, loff,
-						 begin - lbegin, current->isid);
-			if (!new) {
-				errcode = -pte_nomem;
-				break;
-			}
+		errcode = pt_image_space_get_cuts(space, begin, end);
+		if (errcode < 0)
+			goto out_put;
+	}
 
-			new->next = next;
-			next = new;
-		}
+	/* The new section may overlap with sections in any matching space.
+	 * We shrink, split, or remove those sections.
+	 */
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		struct pt_image_space *space;
 
-		/* Add a section covering the remaining bytes at the back. */
-		if (end < lend) {
-			new = pt_mk_section_list(lsec, masid, end,
-						 loff + (end - lbegin),
-						 lend - end, current->isid);
-			if (!new) {
-				errcode = -pte_nomem;
-				break;
-			}
+		space = &image->spaces[sidx];
+		if (!pt_asid_match(&space->asid, asid))
+			continue;
 
-			new->next = next;
-			next = new;
-		}
+		pt_image_space_carve(space, begin, end);
 	}
 
-	if (errcode < 0) {
-		pt_section_list_free_tail(next);
+	pt_msec_init(&entry.section, section, asid, begin, 0ull, size);
+	entry.isid = isid;
 
-		/* Re-add removed sections to the tail of the section list. */
-		for (; *list; list = &((*list)->next))
-			;
+	idx = pt_image_space_lower_bound(target, begin);
+	pt_image_space_splice(target, idx, idx, &entry, 1);
 
-		*list = removed;
-		return errcode;
+	pt_image_prune(image);
+	pt_image_touch(image);
+	return 0;
+
+out_put:
+	while (sidx--) {
+		struct pt_image_space *space;
+
+		space = &image->spaces[sidx];
+		if (!pt_asid_match(&space->asid, asid))
+			continue;
+
+		pt_image_space_put_cuts(space, begin, end);
 	}
 
-	pt_section_list_free_tail(removed);
+	(void) pt_section_put(section);
 
-	*list = next;
-	return 0;
+out_prune:
+	/* Remove the target space in case we added it. */
+	pt_image_prune(image);
+	return errcode;
 }
 
 int pt_image_remove(struct pt_image *image, struct pt_section *section,
 		    const struct pt_asid *asid, uint64_t vaddr)
 {
-	struct pt_section_list **list;
+	uint32_t sidx;
 
-	if (!image || !section)
+	if (!image || !section || !asid)
 		return -pte_internal;
 
-	for (list = &image->sections; *list; list = &((*list)->next)) {
-		struct pt_mapped_section *msec;
-		const struct pt_section *sec;
-		const struct pt_asid *masid;
-		struct pt_section_list *trash;
-		uint64_t begin;
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		struct pt_image_space *space;
+		struct pt_image_entry *entry;
 		int errcode;
 
-		trash = *list;
-		msec = &trash->section;
-		masid = pt_msec_asid(msec);
+		space = &image->spaces[sidx];
 
-		errcode = pt_asid_match(masid, asid);
+		errcode = pt_asid_match(&space->asid, asid);
 		if (errcode < 0)
 			return errcode;
 
 		if (!errcode)
 			continue;
 
-		begin = pt_msec_begin(msec);
-		sec = pt_msec_section(msec);
-		if (sec == section && begin == vaddr) {
-			*list = trash->next;
-			pt_section_list_free(trash);
+		entry = pt_image_space_find(space, vaddr);
+		if (!entry)
+			continue;
 
-			return 0;
-		}
+		if (pt_msec_section(&entry->section) != section ||
+		    pt_msec_begin(&entry->section) != vaddr)
+			continue;
+
+		pt_image_entry_fini(entry);
+		pt_image_space_splice(space,
+				      (uint32_t) (entry - space->entries),
+				      (uint32_t) (entry - space->entries) + 1,
+				      NULL, 0);
+
+		pt_image_prune(image);
+		pt_image_touch(image);
+		return 0;
 	}
 
 	return -pte_bad_image;
@@ -325,7 +637,7 @@ int pt_image_add_file(struct pt_image *image, const char *filename,
 		return errcode;
 	}
 
-	/* The image list got its own reference; let's drop ours. */
+	/* The image got its own reference; let's drop ours. */
 	errcode = pt_section_put(section);
 	if (errcode < 0)
 		return errcode;
@@ -333,9 +645,54 @@ int pt_image_add_file(struct pt_image *image, const char *filename,
 	return 0;
 }
 
+/* Check whether @layer is @image or one of @image's base images. */
+static int pt_image_has_layer(const struct pt_image *image,
+			      const struct pt_image *layer)
+{
+	for (; image; image = image->base) {
+		if (image == layer)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Add @src's own sections to @image.
+ *
+ * Returns the number of ignored sections.
+ */
+static int pt_image_copy_layer(struct pt_image *image,
+			       const struct pt_image *src)
+{
+	uint32_t sidx;
+	int ignored;
+
+	ignored = 0;
+	for (sidx = 0; sidx < src->nspaces; ++sidx) {
+		const struct pt_image_space *space;
+		uint32_t idx;
+
+		space = &src->spaces[sidx];
+		for (idx = 0; idx < space->nentries; ++idx) {
+			const struct pt_image_entry *entry;
+			int errcode;
+
+			entry = &space->entries[idx];
+
+			errcode = pt_image_add(image, entry->section.section,
+					       &entry->section.asid,
+					       entry->section.vaddr,
+					       entry->isid);
+			if (errcode < 0)
+				ignored += 1;
+		}
+	}
+
+	return ignored;
+}
+
 int pt_image_copy(struct pt_image *image, const struct pt_image *src)
 {
-	struct pt_section_list *list;
 	int ignored;
 
 	if (!image || !src)
@@ -350,25 +707,43 @@ int pt_image_copy(struct pt_image *image, const struct pt_image *src)
 		return 0;
 
 	ignored = 0;
-	for (list = src->sections; list; list = list->next) {
-		int errcode;
 
-		errcode = pt_image_add(image, list->section.section,
-				       &list->section.asid,
-				       list->section.vaddr,
-				       list->isid);
-		if (errcode < 0)
-			ignored += 1;
+	/* Sections in @src's base images are already visible in @image if
+	 * @image is layered on top of the same base.
+	 *
+	 * Otherwise, we copy them first so @src's own sections take
+	 * precedence, as they do in @src.
+	 */
+	if (src->base && !pt_image_has_layer(image->base, src->base)) {
+		ignored = pt_image_copy(image, src->base);
+		if (ignored < 0)
+			return ignored;
 	}
 
-	return ignored;
+	return ignored + pt_image_copy_layer(image, src);
+}
+
+int pt_image_set_base(struct pt_image *image, const struct pt_image *base)
+{
+	if (!image)
+		return -pte_invalid;
+
+	/* We must not create a cycle. */
+	if (pt_image_has_layer(base, image))
+		return -pte_invalid;
+
+	image->base = base;
+
+	pt_image_touch(image);
+
+	return 0;
 }
 
 int pt_image_remove_by_filename(struct pt_image *image, const char *filename,
 				const struct pt_asid *uasid)
 {
-	struct pt_section_list **list;
 	struct pt_asid asid;
+	uint32_t sidx;
 	int errcode, removed;
 
 	if (!image || !filename)
@@ -379,36 +754,48 @@ int pt_image_remove_by_filename(struct pt_image *image, const char *filename,
 		return errcode;
 
 	removed = 0;
-	for (list = &image->sections; *list;) {
-		struct pt_mapped_section *msec;
-		const struct pt_section *sec;
-		const struct pt_asid *masid;
-		struct pt_section_list *trash;
-		const char *tname;
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		struct pt_image_space *space;
+		uint32_t idx, nentries;
 
-		trash = *list;
-		msec = &trash->section;
-		masid = pt_msec_asid(msec);
+		space = &image->spaces[sidx];
 
-		errcode = pt_asid_match(masid, &asid);
+		errcode = pt_asid_match(&space->asid, &asid);
 		if (errcode < 0)
 			return errcode;
 
-		if (!errcode) {
-			list = &trash->next;
+		if (!errcode)
 			continue;
-		}
 
-		sec = pt_msec_section(msec);
-		tname = pt_section_filename(sec);
+		nentries = 0;
+		for (idx = 0; idx < space->nentries; ++idx) {
+			struct pt_image_entry *entry;
+			const struct pt_section *sec;
+			const char *tname;
+
+			entry = &space->entries[idx];
+			sec = pt_msec_section(&entry->section);
+			tname = pt_section_filename(sec);
 
-		if (tname && (strcmp(tname, filename) == 0)) {
-			*list = trash->next;
-			pt_section_list_free(trash);
+			if (tname && (strcmp(tname, filename) == 0)) {
+				pt_image_entry_fini(entry);
 
-			removed += 1;
-		} else
-			list = &trash->next;
+				removed += 1;
+				continue;
+			}
+
+			if (nentries != idx)
+				space->entries[nentries] = *entry;
+
+			nentries += 1;
+		}
+
+		space->nentries = nentries;
+	}
+
+	if (removed) {
+		pt_image_prune(image);
+		pt_image_touch(image);
 	}
 
 	return removed;
@@ -417,8 +804,8 @@ int pt_image_remove_by_filename(struct pt_image *image, const char *filename,
 int pt_image_remove_by_asid(struct pt_image *image,
 			    const struct pt_asid *uasid)
 {
-	struct pt_section_list **list;
 	struct pt_asid asid;
+	uint32_t sidx;
 	int errcode, removed;
 
 	if (!image)
@@ -429,28 +816,26 @@ int pt_image_remove_by_asid(struct pt_image *image,
 		return errcode;
 
 	removed = 0;
-	for (list = &image->sections; *list;) {
-		struct pt_mapped_section *msec;
-		const struct pt_asid *masid;
-		struct pt_section_list *trash;
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		struct pt_image_space *space;
 
-		trash = *list;
-		msec = &trash->section;
-		masid = pt_msec_asid(msec);
+		space = &image->spaces[sidx];
 
-		errcode = pt_asid_match(masid, &asid);
+		errcode = pt_asid_match(&space->asid, &asid);
 		if (errcode < 0)
 			return errcode;
 
-		if (!errcode) {
-			list = &trash->next;
+		if (!errcode)
 			continue;
-		}
 
-		*list = trash->next;
-		pt_section_list_free(trash);
+		removed += (int) space->nentries;
 
-		removed += 1;
+		pt_image_space_fini(space);
+	}
+
+	if (removed) {
+		pt_image_prune(image);
+		pt_image_touch(image);
 	}
 
 	return removed;
@@ -486,98 +871,137 @@ static int pt_image_read_callback(struct pt_image *image, int *isid,
 	return callback(buffer, size, asid, addr, image->readmem.context);
 }
 
-/* Check whether a mapped section contains an address.
+/* Clip a section found in one of @image's base images.
+ *
+ * Sections in @image hide sections in its base images.  Clip @msec, which
+ * contains @vaddr but is not in @image, to the gap around @vaddr between
+ * sections in @image in address space @asid.
  *
- * Returns zero if @msec contains @vaddr.
- * Returns a negative error code otherwise.
- * Returns -pte_nomap if @msec does not contain @vaddr.
+ * Returns zero on success, a negative error code otherwise.
  */
-static inline int pt_image_check_msec(const struct pt_mapped_section *msec,
-				      const struct pt_asid *asid,
-				      uint64_t vaddr)
+static int pt_image_clip_section(const struct pt_image *image,
+				 struct pt_mapped_section *msec,
+				 const struct pt_asid *asid, uint64_t vaddr)
 {
-	const struct pt_asid *masid;
 	uint64_t begin, end;
-	int errcode;
+	uint32_t sidx;
 
-	if (!msec)
+	if (!image || !msec)
 		return -pte_internal;
 
 	begin = pt_msec_begin(msec);
 	end = pt_msec_end(msec);
-	if (vaddr < begin || end <= vaddr)
-		return -pte_nomap;
 
-	masid = pt_msec_asid(msec);
-	errcode = pt_asid_match(masid, asid);
-	if (errcode <= 0) {
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		const struct pt_image_space *space;
+		uint32_t idx;
+		int errcode;
+
+		space = &image->spaces[sidx];
+
+		errcode = pt_asid_match(&space->asid, asid);
+		if (errcode < 0)
+			return errcode;
+
 		if (!errcode)
-			errcode = -pte_nomap;
+			continue;
 
-		return errcode;
+		/* No section in @space contains @vaddr.  The section at
+		 * @idx, if any, lies above @vaddr; the one before it, if any,
+		 * lies below @vaddr.
+		 */
+		idx = pt_image_space_lower_bound(space, vaddr);
+		if (idx < space->nentries) {
+			uint64_t next;
+
+			next = pt_msec_begin(&space->entries[idx].section);
+			if (next < end)
+				end = next;
+		}
+
+		if (idx) {
+			uint64_t prev;
+
+			prev = pt_msec_end(&space->entries[idx - 1].section);
+			if (begin < prev)
+				begin = prev;
+		}
 	}
 
+	if ((vaddr < begin) || (end <= vaddr))
+		return -pte_internal;
+
+	msec->offset += begin - msec->vaddr;
+	msec->vaddr = begin;
+	msec->size = end - begin;
+
 	return 0;
 }
 
 /* Find the section containing a given address in a given address space.
  *
- * On success, the found section is moved to the front of the section list.
- * If caching is enabled, maps the section.
+ * Searches @image's base images if @image does not contain such a section.
+ * A section found in a base image is clipped to the part that is not hidden
+ * by sections in the layers above it.
+ *
+ * On success, provides a copy of the mapped section in @msec and its
+ * identifier in @isid.
  *
  * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_nomap if there is no such section.
  */
-static int pt_image_fetch_section(struct pt_image *image,
+static int pt_image_fetch_section(const struct pt_image *image,
+				  struct pt_mapped_section *msec, int *isid,
 				  const struct pt_asid *asid, uint64_t vaddr)
 {
-	struct pt_section_list **start, **list;
+	uint32_t sidx;
+	int errcode;
 
-	if (!image)
+	if (!image || !msec || !isid)
 		return -pte_internal;
 
-	start = &image->sections;
-	for (list = start; *list;) {
-		struct pt_mapped_section *msec;
-		struct pt_section_list *elem;
-		int errcode;
+	for (sidx = 0; sidx < image->nspaces; ++sidx) {
+		const struct pt_image_space *space;
+		struct pt_image_entry *entry;
 
-		elem = *list;
-		msec = &elem->section;
+		space = &image->spaces[sidx];
 
-		errcode = pt_image_check_msec(msec, asid, vaddr);
-		if (errcode < 0) {
-			if (errcode != -pte_nomap)
-				return errcode;
+		errcode = pt_asid_match(&space->asid, asid);
+		if (errcode < 0)
+			return errcode;
 
-			list = &elem->next;
+		if (!errcode)
 			continue;
-		}
 
-		/* Move the section to the front if it isn't already. */
-		if (list != start) {
-			*list = elem->next;
-			elem->next = *start;
-			*start = elem;
+		entry = pt_image_space_find(space, vaddr);
+		if (entry) {
+			*msec = entry->section;
+			*isid = entry->isid;
+			return 0;
 		}
-
-		return 0;
 	}
 
-	return -pte_nomap;
+	if (!image->base)
+		return -pte_nomap;
+
+	errcode = pt_image_fetch_section(image->base, msec, isid, asid, vaddr);
+	if (errcode < 0)
+		return errcode;
+
+	return pt_image_clip_section(image, msec, asid, vaddr);
 }
 
 int pt_image_read(struct pt_image *image, int *isid, uint8_t *buffer,
 		  uint16_t size, const struct pt_asid *asid, uint64_t addr)
 {
-	struct pt_mapped_section *msec;
-	struct pt_section_list *slist;
+	struct pt_mapped_section msec;
 	struct pt_section *section;
 	int errcode, status;
 
 	if (!image || !isid)
 		return -pte_internal;
 
-	errcode = pt_image_fetch_section(image, asid, addr);
+	errcode = pt_image_fetch_section(image, &msec, isid, asid, addr);
 	if (errcode < 0) {
 		if (errcode != -pte_nomap)
 			return errcode;
@@ -586,24 +1010,17 @@ int pt_image_read(struct pt_image *image, int *isid, uint8_t *buffer,
 					      addr);
 	}
 
-	slist = image->sections;
-	if (!slist)
-		return -pte_internal;
-
-	*isid = slist->isid;
-	msec = &slist->section;
-
-	section = pt_msec_section(msec);
+	section = pt_msec_section(&msec);
 
 	errcode = pt_section_map(section);
 	if (errcode < 0)
 		return errcode;
 
-	status = pt_msec_read(msec, buffer, size, addr);
+	status = pt_msec_read(&msec, buffer, size, addr);
 
 	errcode = pt_section_unmap(section);
-		if (errcode < 0)
-			return errcode;
+	if (errcode < 0)
+		return errcode;
 
 	if (status < 0) {
 		if (status != -pte_nomap)
@@ -651,41 +1068,54 @@ int pt_image_add_cached(struct pt_image *image,
 int pt_image_find(struct pt_image *image, struct pt_mapped_section *usec,
 		  const struct pt_asid *asid, uint64_t vaddr)
 {
-	struct pt_mapped_section *msec;
-	struct pt_section_list *slist;
+	struct pt_mapped_section msec;
 	struct pt_section *section;
-	int errcode;
+	int errcode, isid;
 
 	if (!image || !usec)
 		return -pte_internal;
 
-	errcode = pt_image_fetch_section(image, asid, vaddr);
+	errcode = pt_image_fetch_section(image, &msec, &isid, asid, vaddr);
 	if (errcode < 0)
 		return errcode;
 
-	slist = image->sections;
-	if (!slist)
-		return -pte_internal;
-
-	msec = &slist->section;
-	section = pt_msec_section(msec);
+	section = pt_msec_section(&msec);
 
 	errcode = pt_section_get(section);
 	if (errcode < 0)
 		return errcode;
 
-	*usec = *msec;
+	*usec = msec;
+
+	return isid;
+}
+
+uint64_t pt_image_generation(const struct pt_image *image)
+{
+	uint64_t generation;
+
+	if (!image)
+		return 0ull;
 
-	return slist->isid;
+	/* Generations increase across all images.  Any change to one of
+	 * @image's base images results in a bigger generation.
+	 */
+	generation = image->generation;
+	for (image = image->base; image; image = image->base) {
+		if (generation < image->generation)
+			generation = image->generation;
+	}
+
+	return generation;
 }
 
 int pt_image_validate(const struct pt_image *image,
 		      const struct pt_mapped_section *usec, uint64_t vaddr,
 		      int isid)
 {
-	const struct pt_section_list *slist;
+	struct pt_mapped_section msec;
 	uint64_t begin, end;
-	int status;
+	int status, misid;
 
 	if (!image || !usec)
 		return -pte_internal;
@@ -696,21 +1126,16 @@ int pt_image_validate(const struct pt_image *image,
 	if (vaddr < begin || end <= vaddr)
 		return -pte_nomap;
 
-	/* We assume that @usec is a copy of the top of our stack and accept
-	 * sporadic validation fails if it isn't, e.g. because it has moved
-	 * down.
-	 *
-	 * A failed validation requires decoders to re-fetch the section so it
-	 * only results in a (relatively small) performance loss.
-	 */
-	slist = image->sections;
-	if (!slist)
-		return -pte_nomap;
+	/* Check that a lookup of @vaddr would result in @usec. */
+	status = pt_image_fetch_section(image, &msec, &misid, &usec->asid,
+					vaddr);
+	if (status < 0)
+		return status;
 
-	if (slist->isid != isid)
+	if (misid != isid)
 		return -pte_nomap;
 
-	status = memcmp(&slist->section, usec, sizeof(*usec));
+	status = memcmp(&msec, usec, sizeof(*usec));
 	if (status)
 		return -pte_nomap;
 
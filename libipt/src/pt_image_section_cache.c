@@ -32,6 +32,12 @@
 #include "intel-pt.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(_MSC_VER)
+#  include <windows.h>
+#endif
 
 
 static char *dupstr(const char *str)
@@ -57,6 +63,8 @@ int pt_iscache_init(struct pt_image_section_cache *iscache, const char *name)
 
 	memset(iscache, 0, sizeof(*iscache));
 	iscache->limit = UINT64_MAX;
+	iscache->low = UINT64_MAX;
+	iscache->nshards = pt_iscache_max_shards;
 	if (name) {
 		iscache->name = dupstr(name);
 		if (!iscache->name)
@@ -65,11 +73,18 @@ int pt_iscache_init(struct pt_image_section_cache *iscache, const char *name)
 
 #if defined(FEATURE_THREADS)
 	{
-		int errcode;
+		int idx, errcode;
 
 		errcode = mtx_init(&iscache->lock, mtx_plain);
 		if (errcode != thrd_success)
 			return -pte_bad_lock;
+
+		for (idx = 0; idx < pt_iscache_max_shards; ++idx) {
+			errcode = mtx_init(&iscache->shard[idx].lock,
+					   mtx_plain);
+			if (errcode != thrd_success)
+				return -pte_bad_lock;
+		}
 	}
 #endif /* defined(FEATURE_THREADS) */
 
@@ -82,12 +97,18 @@ void pt_iscache_fini(struct pt_image_section_cache *iscache)
 		return;
 
 	(void) pt_iscache_clear(iscache);
+	free(iscache->bcache_dir);
 	free(iscache->name);
 
 #if defined(FEATURE_THREADS)
+	{
+		int idx;
 
-	mtx_destroy(&iscache->lock);
+		for (idx = 0; idx < pt_iscache_max_shards; ++idx)
+			mtx_destroy(&iscache->shard[idx].lock);
 
+		mtx_destroy(&iscache->lock);
+	}
 #endif /* defined(FEATURE_THREADS) */
 }
 
@@ -127,32 +148,472 @@ static inline int pt_iscache_unlock(struct pt_image_section_cache *iscache)
 	return 0;
 }
 
-static inline int isid_from_index(uint16_t index)
+static inline int isid_from_index(uint32_t index)
+{
+	return (int) index + 1;
+}
+
+/* Order memory accesses before and after the barrier. */
+static inline void pt_iscache_barrier(void)
+{
+#if defined(_MSC_VER)
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+/* Enter a lock-free lookup in @iscache.
+ *
+ * Returns the epoch to leave.
+ */
+static inline uint32_t pt_iscache_enter(struct pt_image_section_cache *iscache)
+{
+	uint32_t epoch;
+
+	/* We rely on guaranteed atomic operations as specified in section 8.1.1
+	 * in Volume 3A of the Intel(R) Software Developer's Manual at
+	 * http://www.intel.com/sdm.
+	 */
+	epoch = *((volatile uint32_t *) &iscache->epoch) & 1;
+
+#if defined(_MSC_VER)
+	(void) InterlockedIncrement((LONG volatile *) &iscache->readers[epoch]);
+#else
+	(void) __sync_add_and_fetch(&iscache->readers[epoch], 1);
+#endif
+
+	return epoch;
+}
+
+/* Leave a lock-free lookup in @iscache that entered @epoch. */
+static inline void pt_iscache_leave(struct pt_image_section_cache *iscache,
+				    uint32_t epoch)
+{
+#if defined(_MSC_VER)
+	(void) InterlockedDecrement((LONG volatile *) &iscache->readers[epoch]);
+#else
+	(void) __sync_sub_and_fetch(&iscache->readers[epoch], 1);
+#endif
+}
+
+/* Wait for lock-free lookups in @iscache to complete.
+ *
+ * Lookups that enter after this function returns will see all changes to
+ * @iscache made before it was called.
+ *
+ * We advance the epoch before waiting for the old epoch to drain so we are
+ * not held up by a steady stream of new lookups.  We do this twice to cover
+ * both epochs.
+ */
+static void pt_iscache_synchronize(struct pt_image_section_cache *iscache)
+{
+	int round;
+
+	for (round = 0; round < 2; ++round) {
+		volatile uint32_t *readers;
+		uint32_t epoch;
+
+#if defined(_MSC_VER)
+		epoch = (uint32_t) InterlockedExchangeAdd(
+			(LONG volatile *) &iscache->epoch, 1);
+#else
+		epoch = __sync_fetch_and_add(&iscache->epoch, 1);
+#endif
+
+		/* Lookups are short.  We just spin. */
+		readers = &iscache->readers[epoch & 1];
+		while (*readers)
+			pt_iscache_barrier();
+	}
+}
+
+/* Free @table and its entries array. */
+static void pt_iscache_free_table(struct pt_iscache_table *table)
+{
+	if (!table)
+		return;
+
+	free(table->entries);
+	free(table);
+}
+
+/* Mix @value into @hash. */
+static inline uint64_t pt_iscache_mix(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash *= 0x9e3779b97f4a7c15ull;
+	hash ^= hash >> 29;
+
+	return hash;
+}
+
+static uint32_t pt_iscache_hash_string(const char *str)
+{
+	uint32_t hash;
+
+	/* FNV-1a. */
+	hash = 2166136261u;
+	for (; *str; ++str) {
+		hash ^= (uint8_t) *str;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Hash a file range given an interned @filename. */
+static uint64_t pt_iscache_hash_range(const char *filename, uint64_t offset,
+				      uint64_t size)
+{
+	uint64_t hash;
+
+	hash = pt_iscache_mix(0ull, (uint64_t) (uintptr_t) filename);
+	hash = pt_iscache_mix(hash, offset);
+	hash = pt_iscache_mix(hash, size);
+
+	return hash;
+}
+
+/* Find an interned filename.
+ *
+ * Returns the interned copy of @filename or NULL if @filename has not been
+ * interned.
+ */
+static const char *
+pt_iscache_find_filename(const struct pt_image_section_cache *iscache,
+			 const char *filename, uint32_t hash)
+{
+	const struct pt_iscache_filename *fname;
+
+	if (!iscache->nfbuckets)
+		return NULL;
+
+	fname = iscache->filenames[hash & (iscache->nfbuckets - 1)];
+	for (; fname; fname = fname->next) {
+		if (fname->hash != hash)
+			continue;
+
+		if (strcmp(fname->name, filename) == 0)
+			return fname->name;
+	}
+
+	return NULL;
+}
+
+static int pt_iscache_grow_filenames(struct pt_image_section_cache *iscache)
+{
+	struct pt_iscache_filename **filenames;
+	uint32_t nfbuckets, idx;
+
+	nfbuckets = iscache->nfbuckets ? iscache->nfbuckets * 2 : 64;
+	if (nfbuckets <= iscache->nfbuckets)
+		return -pte_nomem;
+
+	filenames = calloc(nfbuckets, sizeof(*filenames));
+	if (!filenames)
+		return -pte_nomem;
+
+	for (idx = 0; idx < iscache->nfbuckets; ++idx) {
+		struct pt_iscache_filename *fname;
+
+		fname = iscache->filenames[idx];
+		while (fname) {
+			struct pt_iscache_filename *next;
+			uint32_t bucket;
+
+			next = fname->next;
+			bucket = fname->hash & (nfbuckets - 1);
+
+			fname->next = filenames[bucket];
+			filenames[bucket] = fname;
+
+			fname = next;
+		}
+	}
+
+	free(iscache->filenames);
+	iscache->filenames = filenames;
+	iscache->nfbuckets = nfbuckets;
+
+	return 0;
+}
+
+/* Intern @filename.
+ *
+ * Returns the interned copy of @filename on success, NULL otherwise.
+ */
+static const char *pt_iscache_intern(struct pt_image_section_cache *iscache,
+				     const char *filename)
 {
-	return index + 1;
+	struct pt_iscache_filename *fname;
+	const char *name;
+	uint32_t hash, bucket;
+	size_t len;
+
+	hash = pt_iscache_hash_string(filename);
+
+	name = pt_iscache_find_filename(iscache, filename, hash);
+	if (name)
+		return name;
+
+	if (iscache->nfbuckets <= iscache->nfilenames) {
+		int errcode;
+
+		errcode = pt_iscache_grow_filenames(iscache);
+		if (errcode < 0)
+			return NULL;
+	}
+
+	len = strlen(filename);
+	fname = malloc(sizeof(*fname) + len + 1);
+	if (!fname)
+		return NULL;
+
+	fname->name = memcpy(fname + 1, filename, len + 1);
+	fname->hash = hash;
+
+	bucket = hash & (iscache->nfbuckets - 1);
+	fname->next = iscache->filenames[bucket];
+	iscache->filenames[bucket] = fname;
+	iscache->nfilenames += 1;
+
+	return fname->name;
+}
+
+static void pt_iscache_free_filenames(struct pt_iscache_filename **filenames,
+				      uint32_t nfbuckets)
+{
+	uint32_t idx;
+
+	if (!filenames)
+		return;
+
+	for (idx = 0; idx < nfbuckets; ++idx) {
+		struct pt_iscache_filename *fname;
+
+		fname = filenames[idx];
+		while (fname) {
+			struct pt_iscache_filename *trash;
+
+			trash = fname;
+			fname = fname->next;
+
+			free(trash);
+		}
+	}
+
+	free(filenames);
+}
+
+/* Find the entry for an interned @filename's range loaded at @laddr.
+ *
+ * Returns the entry's isid if found, zero otherwise.
+ */
+static int pt_iscache_find_exact(const struct pt_image_section_cache *iscache,
+				 const char *filename, uint64_t offset,
+				 uint64_t size, uint64_t laddr)
+{
+	uint64_t hash;
+	uint32_t isid;
+
+	if (!iscache->nbuckets)
+		return 0;
+
+	hash = pt_iscache_hash_range(filename, offset, size);
+	hash = pt_iscache_mix(hash, laddr);
+
+	isid = iscache->exact[hash & (iscache->nbuckets - 1)];
+	while (isid) {
+		const struct pt_iscache_entry *entry;
+
+		entry = &iscache->entries[isid - 1];
+		if (entry->filename == filename && entry->offset == offset &&
+		    entry->size == size && entry->laddr == laddr)
+			return (int) isid;
+
+		isid = entry->next;
+	}
+
+	return 0;
+}
+
+/* Find the first entry for an interned @filename's range.
+ *
+ * Returns the entry's isid if found, zero otherwise.
+ */
+static int pt_iscache_find_shared(const struct pt_image_section_cache *iscache,
+				  const char *filename, uint64_t offset,
+				  uint64_t size)
+{
+	uint64_t hash;
+	uint32_t isid;
+
+	if (!iscache->nbuckets)
+		return 0;
+
+	hash = pt_iscache_hash_range(filename, offset, size);
+
+	isid = iscache->shared[hash & (iscache->nbuckets - 1)];
+	while (isid) {
+		const struct pt_iscache_entry *entry;
+
+		entry = &iscache->entries[isid - 1];
+		if (entry->filename == filename && entry->offset == offset &&
+		    entry->size == size)
+			return (int) isid;
+
+		isid = entry->snext;
+	}
+
+	return 0;
+}
+
+/* Add the entry at @index to the hash indices.
+ *
+ * The caller must ensure that the indices have enough buckets.
+ */
+static void pt_iscache_index(struct pt_image_section_cache *iscache,
+			     uint32_t index)
+{
+	struct pt_iscache_entry *entry;
+	uint64_t hash;
+	uint32_t mask, bucket;
+
+	entry = &iscache->entries[index];
+	mask = iscache->nbuckets - 1;
+
+	hash = pt_iscache_hash_range(entry->filename, entry->offset,
+				     entry->size);
+
+	entry->snext = 0;
+	if (!pt_iscache_find_shared(iscache, entry->filename, entry->offset,
+				    entry->size)) {
+		bucket = (uint32_t) hash & mask;
+
+		entry->snext = iscache->shared[bucket];
+		iscache->shared[bucket] = (uint32_t) isid_from_index(index);
+	}
+
+	hash = pt_iscache_mix(hash, entry->laddr);
+	bucket = (uint32_t) hash & mask;
+
+	entry->next = iscache->exact[bucket];
+	iscache->exact[bucket] = (uint32_t) isid_from_index(index);
+}
+
+/* Rebuild the hash indices with @nbuckets buckets.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_iscache_rehash(struct pt_image_section_cache *iscache,
+			     uint32_t nbuckets)
+{
+	uint32_t *exact, *shared, idx;
+
+	exact = calloc(nbuckets, sizeof(*exact));
+	if (!exact)
+		return -pte_nomem;
+
+	shared = calloc(nbuckets, sizeof(*shared));
+	if (!shared) {
+		free(exact);
+		return -pte_nomem;
+	}
+
+	free(iscache->exact);
+	free(iscache->shared);
+
+	iscache->exact = exact;
+	iscache->shared = shared;
+	iscache->nbuckets = nbuckets;
+
+	for (idx = 0; idx < iscache->size; ++idx)
+		pt_iscache_index(iscache, idx);
+
+	return 0;
 }
 
 static int pt_iscache_expand(struct pt_image_section_cache *iscache)
 {
-	struct pt_iscache_entry *entries;
-	uint16_t capacity, target;
+	struct pt_iscache_table *table, *retired;
+	struct pt_iscache_entry *entries, *old;
+	uint32_t capacity, target, nbuckets;
 
 	if (!iscache)
 		return -pte_internal;
 
 	capacity = iscache->capacity;
-	target = capacity + 8;
+	target = capacity ? capacity * 2 : 8;
+
+	/* Check for overflows.  Isids are positive integers. */
+	if (target > (uint32_t) INT_MAX)
+		target = (uint32_t) INT_MAX;
 
-	/* Check for overflows. */
-	if (target < capacity)
+	if (target <= capacity)
 		return -pte_nomem;
 
-	entries = realloc(iscache->entries, target * sizeof(*entries));
-	if (!entries)
+	/* Lock-free lookups may still be using the old entries array.  We
+	 * copy it into a new table and retire the old one once they are done.
+	 */
+	table = malloc(sizeof(*table));
+	if (!table)
 		return -pte_nomem;
 
-	iscache->capacity = target;
+	entries = malloc(target * sizeof(*entries));
+	if (!entries) {
+		free(table);
+		return -pte_nomem;
+	}
+
+	if (iscache->size)
+		memcpy(entries, iscache->entries,
+		       iscache->size * sizeof(*entries));
+
+	table->entries = entries;
+	table->size = iscache->size;
+
+	/* Keep the load factor of the hash indices at or below one.
+	 *
+	 * The hash indices link entries via the new @entries array.
+	 */
+	nbuckets = iscache->nbuckets ? iscache->nbuckets : 64;
+	while (nbuckets < target && nbuckets < (UINT32_MAX / 2))
+		nbuckets *= 2;
+
+	old = iscache->entries;
 	iscache->entries = entries;
+
+	if (nbuckets != iscache->nbuckets) {
+		int errcode;
+
+		errcode = pt_iscache_rehash(iscache, nbuckets);
+		if (errcode < 0) {
+			/* The old indices are still intact. */
+			iscache->entries = old;
+
+			free(entries);
+			free(table);
+			return errcode;
+		}
+	}
+
+	/* Publish the new table after it has been initialized. */
+	retired = iscache->table;
+
+	pt_iscache_barrier();
+	*((struct pt_iscache_table * volatile *) &iscache->table) = table;
+
+	iscache->capacity = target;
+
+	/* Lookups that enter from now on use the new table.  Wait for the
+	 * others before we free the old one.
+	 */
+	if (retired) {
+		pt_iscache_synchronize(iscache);
+		pt_iscache_free_table(retired);
+	}
+
 	return 0;
 }
 
@@ -160,50 +621,110 @@ static int pt_iscache_find_locked(struct pt_image_section_cache *iscache,
 				  const char *filename, uint64_t offset,
 				  uint64_t size, uint64_t laddr)
 {
-	uint16_t idx, end;
-
 	if (!iscache || !filename)
 		return -pte_internal;
 
-	end = iscache->size;
-	for (idx = 0; idx < end; ++idx) {
-		const struct pt_iscache_entry *entry;
-		const struct pt_section *section;
-		const char *sec_filename;
-		uint64_t sec_offset, sec_size;
+	filename = pt_iscache_find_filename(iscache, filename,
+					    pt_iscache_hash_string(filename));
+	if (!filename)
+		return 0;
 
-		entry = &iscache->entries[idx];
+	return pt_iscache_find_exact(iscache, filename, offset, size, laddr);
+}
 
-		/* We do not zero-initialize the array - a NULL check is
-		 * pointless.
-		 */
-		section = entry->section;
-		sec_filename = pt_section_filename(section);
-		sec_offset = pt_section_offset(section);
-		sec_size = pt_section_size(section);
+static inline int pt_iscache_lock_shard(struct pt_iscache_shard *shard)
+{
+	if (!shard)
+		return -pte_internal;
 
-		if (entry->laddr != laddr)
-			continue;
+#if defined(FEATURE_THREADS)
+	{
+		int errcode;
 
-		if (sec_offset != offset)
-			continue;
+		errcode = mtx_lock(&shard->lock);
+		if (errcode != thrd_success)
+			return -pte_bad_lock;
+	}
+#endif /* defined(FEATURE_THREADS) */
 
-		if (sec_size != size)
-			continue;
+	return 0;
+}
 
-		/* We should not have a section without a filename. */
-		if (!sec_filename)
-			return -pte_internal;
+static inline int pt_iscache_unlock_shard(struct pt_iscache_shard *shard)
+{
+	if (!shard)
+		return -pte_internal;
 
-		if (strcmp(sec_filename, filename) != 0)
-			continue;
+#if defined(FEATURE_THREADS)
+	{
+		int errcode;
 
-		return isid_from_index(idx);
+		errcode = mtx_unlock(&shard->lock);
+		if (errcode != thrd_success)
+			return -pte_bad_lock;
 	}
+#endif /* defined(FEATURE_THREADS) */
 
 	return 0;
 }
 
+/* Get the LRU shard of @section in @iscache. */
+static inline struct pt_iscache_shard *
+pt_iscache_shard(struct pt_image_section_cache *iscache,
+		 const struct pt_section *section)
+{
+	uint64_t hash;
+	uint32_t nshards;
+
+	nshards = iscache->nshards;
+	if (nshards <= 1)
+		return &iscache->shard[0];
+
+	hash = pt_iscache_mix(0ull, (uint64_t) (uintptr_t) section);
+
+	return &iscache->shard[(uint32_t) (hash >> 32) % nshards];
+}
+
+/* Add @delta to @iscache->used.
+ *
+ * Use the two's complement to subtract.
+ *
+ * Returns the new size of @iscache's LRU cache.
+ */
+static inline uint64_t
+pt_iscache_add_used(struct pt_image_section_cache *iscache, uint64_t delta)
+{
+#if defined(_MSC_VER)
+	return (uint64_t) InterlockedExchangeAdd64(
+		(LONGLONG volatile *) &iscache->used, (LONGLONG) delta) + delta;
+#else
+	return __sync_add_and_fetch(&iscache->used, delta);
+#endif
+}
+
+/* Update @shard->mru and @shard->mrusize after modifying @shard->lru.
+ *
+ * The caller must lock @shard.
+ */
+static inline void pt_iscache_lru_set_mru(struct pt_iscache_shard *shard)
+{
+	const struct pt_iscache_lru_entry *lru;
+
+	lru = shard->lru;
+
+	/* We rely on guaranteed atomic operations as specified in section 8.1.1
+	 * in Volume 3A of the Intel(R) Software Developer's Manual at
+	 * http://www.intel.com/sdm.
+	 */
+	if (lru) {
+		shard->mru = lru->section;
+		shard->mrusize = lru->size;
+	} else {
+		shard->mru = NULL;
+		shard->mrusize = 0ull;
+	}
+}
+
 static int pt_iscache_lru_free(struct pt_iscache_lru_entry *lru)
 {
 	while (lru) {
@@ -223,51 +744,199 @@ static int pt_iscache_lru_free(struct pt_iscache_lru_entry *lru)
 	return 0;
 }
 
+/* Remove the least recently used entry from @shard.
+ *
+ * Provides the removed entry in @plru or NULL if @shard is empty.
+ *
+ * Unlike other iscache_lru functions, the caller does not lock @shard.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ */
+static int pt_iscache_lru_pop(struct pt_image_section_cache *iscache,
+			      struct pt_iscache_shard *shard,
+			      struct pt_iscache_lru_entry **plru)
+{
+	struct pt_iscache_lru_entry *lru, **pnext;
+	int errcode;
+
+	if (!iscache || !shard || !plru)
+		return -pte_internal;
+
+	errcode = pt_iscache_lock_shard(shard);
+	if (errcode < 0)
+		return errcode;
+
+	pnext = &shard->lru;
+	lru = *pnext;
+	if (lru) {
+		while (lru->next) {
+			pnext = &lru->next;
+			lru = *pnext;
+		}
+
+		*pnext = NULL;
+		(void) pt_iscache_add_used(iscache, (uint64_t) -lru->size);
+
+		pt_iscache_lru_set_mru(shard);
+	}
+
+	*plru = lru;
+
+	return pt_iscache_unlock_shard(shard);
+}
+
+/* Prune @iscache's LRU cache down to its low watermark.
+ *
+ * We remove the least recently used entry of each shard in turn until we are
+ * at or below the low watermark or until all shards are empty.
+ *
+ * Provides the removed entries in @tail, even on error.
+ *
+ * Unlike other iscache_lru functions, the caller does not lock @iscache or
+ * any of its shards.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ */
 static int pt_iscache_lru_prune(struct pt_image_section_cache *iscache,
 				struct pt_iscache_lru_entry **tail)
 {
-	struct pt_iscache_lru_entry *lru, **pnext;
-	uint64_t limit, used;
+	uint64_t low;
+	uint32_t nshards, shard, empty;
 
 	if (!iscache || !tail)
 		return -pte_internal;
 
-	limit = iscache->limit;
-	used = 0ull;
+	*tail = NULL;
 
-	pnext = &iscache->lru;
-	for (lru = *pnext; lru; pnext = &lru->next, lru = *pnext) {
+	nshards = iscache->nshards;
+	if (!nshards || (pt_iscache_max_shards < nshards))
+		return -pte_internal;
+
+	low = iscache->low;
+	if (iscache->limit < low)
+		low = iscache->limit;
+
+	shard = iscache->prune % nshards;
+	for (empty = 0; empty < nshards; shard = (shard + 1) % nshards) {
+		struct pt_iscache_lru_entry *lru;
+		int errcode;
 
-		used += lru->size;
-		if (used <= limit)
+		if (pt_iscache_add_used(iscache, 0ull) <= low)
+			break;
+
+		errcode = pt_iscache_lru_pop(iscache, &iscache->shard[shard],
+					     &lru);
+		if (errcode < 0)
+			return errcode;
+
+		if (!lru) {
+			empty += 1;
 			continue;
+		}
 
-		/* The cache got too big; prune it starting from @lru. */
-		iscache->used = used - lru->size;
-		*pnext = NULL;
+		empty = 0;
+
+		lru->next = *tail;
 		*tail = lru;
+	}
+
+	iscache->prune = shard;
+
+	return 0;
+}
 
+/* Dispose of pruned LRU entries in @tail.
+ *
+ * Unmaps the pruned sections unless @iscache defers unmapping them to
+ * pt_iscache_reclaim().  If deferred sections pile up beyond @iscache->limit,
+ * nobody seems to be reclaiming them and we unmap them right away.
+ *
+ * Unlike other iscache_lru functions, the caller does not lock @iscache.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ */
+static int pt_iscache_lru_dispose(struct pt_image_section_cache *iscache,
+				  struct pt_iscache_lru_entry *tail)
+{
+	struct pt_iscache_lru_entry *lru;
+	uint64_t size;
+	int errcode, status;
+
+	if (!iscache)
+		return -pte_internal;
+
+	if (!tail)
 		return 0;
+
+	size = tail->size;
+	for (lru = tail; lru->next; lru = lru->next)
+		size += lru->next->size;
+
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0) {
+		(void) pt_iscache_lru_free(tail);
+		return errcode;
 	}
 
-	/* We shouldn't prune the cache unnecessarily. */
-	return -pte_internal;
+	if (iscache->defer) {
+		lru->next = iscache->reclaim;
+		iscache->reclaim = tail;
+		iscache->reclaim_size += size;
+
+		tail = NULL;
+		if (iscache->limit < iscache->reclaim_size) {
+			tail = iscache->reclaim;
+
+			iscache->reclaim = NULL;
+			iscache->reclaim_size = 0ull;
+		}
+	}
+
+	errcode = pt_iscache_unlock(iscache);
+
+	status = pt_iscache_lru_free(tail);
+	if (errcode < 0)
+		return errcode;
+
+	return status;
 }
 
-/* Add @section to the front of @iscache->lru.
+/* Prune @iscache's LRU cache and dispose of the pruned entries.
+ *
+ * Unlike other iscache_lru functions, the caller does not lock @iscache or
+ * any of its shards.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ */
+static int pt_iscache_lru_shrink(struct pt_image_section_cache *iscache)
+{
+	struct pt_iscache_lru_entry *tail;
+	int errcode, status;
+
+	status = pt_iscache_lru_prune(iscache, &tail);
+
+	errcode = pt_iscache_lru_dispose(iscache, tail);
+	if (status < 0)
+		return status;
+
+	return errcode;
+}
+
+/* Add @section to the front of @shard->lru.
  *
  * Returns a positive integer if we need to prune the cache.
  * Returns zero if we don't need to prune the cache.
  * Returns a negative pt_error_code otherwise.
  */
 static int pt_isache_lru_new(struct pt_image_section_cache *iscache,
+			     struct pt_iscache_shard *shard,
 			     struct pt_section *section)
 {
 	struct pt_iscache_lru_entry *lru;
-	uint64_t memsize, used, total, limit;
+	uint64_t memsize, total, limit;
 	int errcode;
 
-	if (!iscache)
+	if (!iscache || !shard)
 		return -pte_internal;
 
 	errcode = pt_section_memsize(section, &memsize);
@@ -294,34 +963,59 @@ static int pt_isache_lru_new(struct pt_image_section_cache *iscache,
 	lru->section = section;
 	lru->size = memsize;
 
-	lru->next = iscache->lru;
-	iscache->lru = lru;
+	lru->next = shard->lru;
+	shard->lru = lru;
 
-	used = iscache->used;
-	total = used + memsize;
-	if (total < used || total < memsize)
+	total = pt_iscache_add_used(iscache, memsize);
+	if (total < memsize)
 		return -pte_overflow;
 
-	iscache->used = total;
-
 	return (limit < total) ? 1 : 0;
 }
 
-/* Add or move @section to the front of @iscache->lru.
+/* Update the size of @lru in @iscache.
+ *
+ * The memory size of a cached section grows as its block cache is populated.
+ *
+ * Returns a positive integer if we need to prune the cache.
+ * Returns zero if we don't need to prune the cache.
+ * Returns a negative pt_error_code otherwise.
+ */
+static int pt_iscache_lru_refresh(struct pt_image_section_cache *iscache,
+				  struct pt_iscache_lru_entry *lru)
+{
+	uint64_t memsize, used;
+	int errcode;
+
+	if (!iscache || !lru)
+		return -pte_internal;
+
+	errcode = pt_section_memsize(lru->section, &memsize);
+	if (errcode < 0)
+		return errcode;
+
+	used = pt_iscache_add_used(iscache, memsize - lru->size);
+	lru->size = memsize;
+
+	return (iscache->limit < used) ? 1 : 0;
+}
+
+/* Add or move @section to the front of @shard->lru.
  *
  * Returns a positive integer if we need to prune the cache.
  * Returns zero if we don't need to prune the cache.
  * Returns a negative pt_error_code otherwise.
  */
 static int pt_iscache_lru_add(struct pt_image_section_cache *iscache,
+			      struct pt_iscache_shard *shard,
 			      struct pt_section *section)
 {
 	struct pt_iscache_lru_entry *lru, **pnext;
 
-	if (!iscache)
+	if (!iscache || !shard)
 		return -pte_internal;
 
-	pnext = &iscache->lru;
+	pnext = &shard->lru;
 	for (lru = *pnext; lru; pnext = &lru->next, lru = *pnext) {
 
 		if (lru->section != section)
@@ -329,38 +1023,72 @@ static int pt_iscache_lru_add(struct pt_image_section_cache *iscache,
 
 		/* We found it in the cache.  Move it to the front. */
 		*pnext = lru->next;
-		lru->next = iscache->lru;
-		iscache->lru = lru;
+		lru->next = shard->lru;
+		shard->lru = lru;
 
-		return 0;
+		return pt_iscache_lru_refresh(iscache, lru);
 	}
 
 	/* We didn't find it in the cache.  Add it. */
-	return pt_isache_lru_new(iscache, section);
+	return pt_isache_lru_new(iscache, shard, section);
 }
 
 
-/* Remove @section from @iscache->lru.
+/* Remove @section from @iscache's LRU cache.
+ *
+ * This includes sections that have been pruned but not yet unmapped.
+ *
+ * The caller must lock @iscache but not @section's shard.
  *
  * Returns zero on success, a negative pt_error_code otherwise.
  */
 static int pt_iscache_lru_remove(struct pt_image_section_cache *iscache,
 				 const struct pt_section *section)
 {
-	struct pt_iscache_lru_entry *lru, **pnext;
+	struct pt_iscache_lru_entry *lru, **pnext, *pruned;
+	struct pt_iscache_shard *shard;
+	int errcode;
 
 	if (!iscache)
 		return -pte_internal;
 
-	pnext = &iscache->lru;
-	for (lru = *pnext; lru; pnext = &lru->next, lru = *pnext) {
+	shard = pt_iscache_shard(iscache, section);
+
+	errcode = pt_iscache_lock_shard(shard);
+	if (errcode < 0)
+		return errcode;
+
+	pnext = &shard->lru;
+	for (lru = *pnext; lru; pnext = &lru->next, lru = *pnext) {
+
+		if (lru->section != section)
+			continue;
+
+		/* We found it in the cache.  Remove it. */
+		*pnext = lru->next;
+		lru->next = NULL;
+
+		(void) pt_iscache_add_used(iscache, (uint64_t) -lru->size);
+
+		pt_iscache_lru_set_mru(shard);
+		break;
+	}
+
+	errcode = pt_iscache_unlock_shard(shard);
+	if (errcode < 0)
+		return errcode;
+
+	pnext = &iscache->reclaim;
+	for (pruned = *pnext; pruned; pnext = &pruned->next, pruned = *pnext) {
 
-		if (lru->section != section)
+		if (pruned->section != section)
 			continue;
 
-		/* We found it in the cache.  Remove it. */
-		*pnext = lru->next;
-		lru->next = NULL;
+		*pnext = pruned->next;
+		pruned->next = lru;
+
+		iscache->reclaim_size -= pruned->size;
+		lru = pruned;
 		break;
 	}
 
@@ -368,27 +1096,28 @@ static int pt_iscache_lru_remove(struct pt_image_section_cache *iscache,
 }
 
 
-/* Add or move @section to the front of @iscache->lru and update its size.
+/* Add or move @section to the front of @shard->lru and update its size.
  *
  * Returns a positive integer if we need to prune the cache.
  * Returns zero if we don't need to prune the cache.
  * Returns a negative pt_error_code otherwise.
  */
 static int pt_iscache_lru_resize(struct pt_image_section_cache *iscache,
+				 struct pt_iscache_shard *shard,
 				 struct pt_section *section, uint64_t memsize)
 {
 	struct pt_iscache_lru_entry *lru;
 	uint64_t oldsize, used;
 	int status;
 
-	if (!iscache)
+	if (!iscache || !shard)
 		return -pte_internal;
 
-	status = pt_iscache_lru_add(iscache, section);
+	status = pt_iscache_lru_add(iscache, shard, section);
 	if (status < 0)
 		return status;
 
-	lru = iscache->lru;
+	lru = shard->lru;
 	if (!lru) {
 		if (status)
 			return -pte_internal;
@@ -409,20 +1138,84 @@ static int pt_iscache_lru_resize(struct pt_image_section_cache *iscache,
 	oldsize = lru->size;
 	lru->size = memsize;
 
+	used = pt_iscache_add_used(iscache, memsize - oldsize);
+
 	/* If we need to prune anyway, we're done. */
 	if (status)
 		return status;
 
-	used = iscache->used;
-	used -= oldsize;
-	used += memsize;
+	return (iscache->limit < used) ? 1 : 0;
+}
+
+/* Remove all entries from @iscache's LRU cache.
+ *
+ * This includes sections that have been pruned but not yet unmapped.
+ *
+ * Provides the removed entries in @plru.
+ *
+ * The caller must lock @iscache but none of its shards.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ */
+static int pt_iscache_lru_take(struct pt_image_section_cache *iscache,
+			       struct pt_iscache_lru_entry **plru)
+{
+	struct pt_iscache_lru_entry *head;
+	uint64_t size;
+	uint32_t idx;
+	int status;
+
+	if (!iscache || !plru)
+		return -pte_internal;
 
-	iscache->used = used;
+	head = iscache->reclaim;
+	iscache->reclaim = NULL;
+	iscache->reclaim_size = 0ull;
 
-	return (iscache->limit < used) ? 1 : 0;
+	size = 0ull;
+	status = 0;
+	for (idx = 0; idx < pt_iscache_max_shards; ++idx) {
+		struct pt_iscache_shard *shard;
+		struct pt_iscache_lru_entry *lru;
+		int errcode;
+
+		shard = &iscache->shard[idx];
+
+		errcode = pt_iscache_lock_shard(shard);
+		if (errcode < 0) {
+			status = errcode;
+			continue;
+		}
+
+		lru = shard->lru;
+		shard->lru = NULL;
+
+		pt_iscache_lru_set_mru(shard);
+
+		errcode = pt_iscache_unlock_shard(shard);
+		if (errcode < 0)
+			status = errcode;
+
+		while (lru) {
+			struct pt_iscache_lru_entry *next;
+
+			next = lru->next;
+			size += lru->size;
+
+			lru->next = head;
+			head = lru;
+
+			lru = next;
+		}
+	}
+
+	(void) pt_iscache_add_used(iscache, (uint64_t) -size);
+
+	*plru = head;
+	return status;
 }
 
-/* Clear @iscache->lru.
+/* Clear @iscache's LRU cache.
  *
  * Unlike other iscache_lru functions, the caller does not lock @iscache.
  *
@@ -431,21 +1224,25 @@ static int pt_iscache_lru_resize(struct pt_image_section_cache *iscache,
 static int pt_iscache_lru_clear(struct pt_image_section_cache *iscache)
 {
 	struct pt_iscache_lru_entry *lru;
-	int errcode;
+	int errcode, status;
 
 	errcode = pt_iscache_lock(iscache);
 	if (errcode < 0)
 		return errcode;
 
-	lru = iscache->lru;
-	iscache->lru = NULL;
-	iscache->used = 0ull;
+	status = pt_iscache_lru_take(iscache, &lru);
 
 	errcode = pt_iscache_unlock(iscache);
-	if (errcode < 0)
+	if (errcode < 0) {
+		(void) pt_iscache_lru_free(lru);
 		return errcode;
+	}
 
-	return pt_iscache_lru_free(lru);
+	errcode = pt_iscache_lru_free(lru);
+	if (status < 0)
+		return status;
+
+	return errcode;
 }
 
 /* Search @iscache for a partial or exact match of @section loaded at @laddr and
@@ -460,69 +1257,36 @@ pt_iscache_find_section_locked(const struct pt_image_section_cache *iscache,
 			       const char *filename, uint64_t offset,
 			       uint64_t size, uint64_t laddr)
 {
-	const struct pt_section *section;
-	uint16_t idx, end;
-	int match;
+	int isid;
 
 	if (!iscache || !filename)
 		return -pte_internal;
 
-	section = NULL;
-	match = end = iscache->size;
-	for (idx = 0; idx < end; ++idx) {
-		const struct pt_iscache_entry *entry;
-		const struct pt_section *sec;
-
-		entry = &iscache->entries[idx];
-
-		/* We do not zero-initialize the array - a NULL check is
-		 * pointless.
-		 */
-		sec = entry->section;
-
-		/* Avoid redundant match checks. */
-		if (sec != section) {
-			const char *sec_filename;
-
-			/* We don't have duplicates.  Skip the check. */
-			if (section)
-				continue;
-
-			if (offset != pt_section_offset(sec))
-				continue;
-
-			if (size != pt_section_size(sec))
-				continue;
-
-			sec_filename = pt_section_filename(sec);
-			if (!sec_filename)
-				return -pte_internal;
-
-			if (strcmp(filename, sec_filename) != 0)
-				continue;
+	filename = pt_iscache_find_filename(iscache, filename,
+					    pt_iscache_hash_string(filename));
+	if (!filename)
+		return (int) iscache->size;
 
-			/* Use the cached section instead. */
-			section = sec;
-			match = idx;
-		}
+	/* All entries for the same file range share the same section.  We
+	 * prefer an entry that also matches the load address.
+	 */
+	isid = pt_iscache_find_exact(iscache, filename, offset, size, laddr);
+	if (!isid)
+		isid = pt_iscache_find_shared(iscache, filename, offset, size);
 
-		/* If we didn't continue, @section == @sec and we have a match.
-		 *
-		 * If we also find a matching load address, we're done.
-		 */
-		if (laddr == entry->laddr)
-			return idx;
-	}
+	if (!isid)
+		return (int) iscache->size;
 
-	return match;
+	return isid - 1;
 }
 
 int pt_iscache_add(struct pt_image_section_cache *iscache,
 		   struct pt_section *section, uint64_t laddr)
 {
+	struct pt_iscache_entry *entry;
 	const char *filename;
 	uint64_t offset, size;
-	uint16_t idx;
+	uint32_t idx;
 	int errcode;
 
 	if (!iscache || !section)
@@ -587,7 +1351,6 @@ int pt_iscache_add(struct pt_image_section_cache *iscache,
 	 * will take another trip in the below loop.
 	 */
 	for (;;) {
-		const struct pt_iscache_entry *entry;
 		struct pt_section *sec;
 		int match;
 
@@ -602,7 +1365,7 @@ int pt_iscache_add(struct pt_image_section_cache *iscache,
 		}
 
 		/* We're done if we have not found a matching section. */
-		if (iscache->size <= match)
+		if ((int) iscache->size <= match)
 			break;
 
 		entry = &iscache->entries[match];
@@ -627,7 +1390,7 @@ int pt_iscache_add(struct pt_image_section_cache *iscache,
 				if (errcode < 0)
 					return errcode;
 
-				return isid_from_index((uint16_t) match);
+				return isid_from_index((uint32_t) match);
 			}
 
 			break;
@@ -699,6 +1462,13 @@ int pt_iscache_add(struct pt_image_section_cache *iscache,
 		section = sec;
 	}
 
+	/* We index entries by their interned filename. */
+	filename = pt_iscache_intern(iscache, filename);
+	if (!filename) {
+		errcode = -pte_nomem;
+		goto out_unlock_detach;
+	}
+
 	/* Expand the cache, if necessary. */
 	if (iscache->capacity <= iscache->size) {
 		/* We must never exceed the capacity. */
@@ -725,8 +1495,18 @@ int pt_iscache_add(struct pt_image_section_cache *iscache,
 	 */
 	idx = iscache->size++;
 
-	iscache->entries[idx].section = section;
-	iscache->entries[idx].laddr = laddr;
+	entry = &iscache->entries[idx];
+	entry->section = section;
+	entry->laddr = laddr;
+	entry->filename = filename;
+	entry->offset = offset;
+	entry->size = size;
+
+	pt_iscache_index(iscache, idx);
+
+	/* Publish the new entry for lock-free lookups. */
+	pt_iscache_barrier();
+	*((volatile uint32_t *) &iscache->table->size) = iscache->size;
 
 	errcode = pt_iscache_unlock(iscache);
 	if (errcode < 0)
@@ -771,8 +1551,9 @@ int pt_iscache_find(struct pt_image_section_cache *iscache,
 int pt_iscache_lookup(struct pt_image_section_cache *iscache,
 		      struct pt_section **section, uint64_t *laddr, int isid)
 {
-	uint16_t index;
-	int errcode, status;
+	const struct pt_iscache_table *table;
+	uint32_t index, epoch;
+	int status;
 
 	if (!iscache || !section || !laddr)
 		return -pte_internal;
@@ -780,41 +1561,45 @@ int pt_iscache_lookup(struct pt_image_section_cache *iscache,
 	if (isid <= 0)
 		return -pte_bad_image;
 
-	isid -= 1;
-	if (isid > UINT16_MAX)
-		return -pte_internal;
-
-	index = (uint16_t) isid;
+	index = (uint32_t) isid - 1;
 
-	errcode = pt_iscache_lock(iscache);
-	if (errcode < 0)
-		return errcode;
+	/* We do not lock @iscache.  Published entries do not change and the
+	 * table remains valid until we leave.
+	 *
+	 * We rely on guaranteed atomic operations as specified in section 8.1.1
+	 * in Volume 3A of the Intel(R) Software Developer's Manual at
+	 * http://www.intel.com/sdm.
+	 */
+	epoch = pt_iscache_enter(iscache);
 
-	if (iscache->size <= index)
+	table = *((const struct pt_iscache_table * volatile *) &iscache->table);
+	if (!table || (*((const volatile uint32_t *) &table->size) <= index))
 		status = -pte_bad_image;
 	else {
 		const struct pt_iscache_entry *entry;
 
-		entry = &iscache->entries[index];
+		pt_iscache_barrier();
+
+		entry = &table->entries[index];
 		*section = entry->section;
 		*laddr = entry->laddr;
 
 		status = pt_section_get(*section);
 	}
 
-	errcode = pt_iscache_unlock(iscache);
-	if (errcode < 0)
-		return errcode;
+	pt_iscache_leave(iscache, epoch);
 
 	return status;
 }
 
 int pt_iscache_clear(struct pt_image_section_cache *iscache)
 {
+	struct pt_iscache_filename **filenames;
 	struct pt_iscache_lru_entry *lru;
 	struct pt_iscache_entry *entries;
-	uint16_t idx, end;
-	int errcode;
+	struct pt_iscache_table *table;
+	uint32_t idx, end, nfbuckets;
+	int errcode, status;
 
 	if (!iscache)
 		return -pte_internal;
@@ -824,19 +1609,39 @@ int pt_iscache_clear(struct pt_image_section_cache *iscache)
 		return errcode;
 
 	entries = iscache->entries;
+	table = iscache->table;
 	end = iscache->size;
-	lru = iscache->lru;
+	filenames = iscache->filenames;
+	nfbuckets = iscache->nfbuckets;
+
+	free(iscache->exact);
+	free(iscache->shared);
 
 	iscache->entries = NULL;
+	iscache->table = NULL;
 	iscache->capacity = 0;
 	iscache->size = 0;
-	iscache->lru = NULL;
-	iscache->used = 0ull;
+	iscache->exact = NULL;
+	iscache->shared = NULL;
+	iscache->nbuckets = 0;
+	iscache->filenames = NULL;
+	iscache->nfbuckets = 0;
+	iscache->nfilenames = 0;
+
+	status = pt_iscache_lru_take(iscache, &lru);
 
 	errcode = pt_iscache_unlock(iscache);
 	if (errcode < 0)
 		return errcode;
 
+	if (status < 0)
+		return status;
+
+	/* Wait for lookups that may still use @table before we drop the
+	 * cache's references to its sections.
+	 */
+	pt_iscache_synchronize(iscache);
+
 	errcode = pt_iscache_lru_free(lru);
 	if (errcode < 0)
 		return errcode;
@@ -858,7 +1663,8 @@ int pt_iscache_clear(struct pt_image_section_cache *iscache)
 			return errcode;
 	}
 
-	free(entries);
+	pt_iscache_free_table(table);
+	pt_iscache_free_filenames(filenames, nfbuckets);
 	return 0;
 }
 
@@ -884,29 +1690,197 @@ void pt_iscache_free(struct pt_image_section_cache *iscache)
 
 int pt_iscache_set_limit(struct pt_image_section_cache *iscache, uint64_t limit)
 {
-	struct pt_iscache_lru_entry *tail;
-	int errcode, status;
+	return pt_iscache_set_watermarks(iscache, limit, limit);
+}
+
+int pt_iscache_set_watermarks(struct pt_image_section_cache *iscache,
+			      uint64_t high, uint64_t low)
+{
+	int errcode;
+
+	if (!iscache || (high < low))
+		return -pte_invalid;
+
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0)
+		return errcode;
+
+	iscache->limit = high;
+	iscache->low = low;
+
+	errcode = pt_iscache_unlock(iscache);
+	if (errcode < 0)
+		return errcode;
+
+	if (pt_iscache_add_used(iscache, 0ull) <= high)
+		return 0;
+
+	return pt_iscache_lru_shrink(iscache);
+}
+
+int pt_iscache_set_deferred_reclaim(struct pt_image_section_cache *iscache,
+				    int enable)
+{
+	struct pt_iscache_lru_entry *lru;
+	int errcode;
 
 	if (!iscache)
 		return -pte_invalid;
 
-	status = 0;
-	tail = NULL;
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0)
+		return errcode;
+
+	iscache->defer = enable ? 1 : 0;
+
+	/* Unmap sections that are still waiting when we stop deferring. */
+	lru = NULL;
+	if (!enable) {
+		lru = iscache->reclaim;
+
+		iscache->reclaim = NULL;
+		iscache->reclaim_size = 0ull;
+	}
+
+	errcode = pt_iscache_unlock(iscache);
+	if (errcode < 0) {
+		(void) pt_iscache_lru_free(lru);
+		return errcode;
+	}
+
+	return pt_iscache_lru_free(lru);
+}
+
+int pt_iscache_reclaim(struct pt_image_section_cache *iscache)
+{
+	struct pt_iscache_lru_entry *lru, *reclaim;
+	int errcode, nreclaimed;
+
+	if (!iscache)
+		return -pte_invalid;
 
 	errcode = pt_iscache_lock(iscache);
 	if (errcode < 0)
 		return errcode;
 
-	iscache->limit = limit;
-	if (limit < iscache->used)
-		status = pt_iscache_lru_prune(iscache, &tail);
+	reclaim = iscache->reclaim;
+
+	iscache->reclaim = NULL;
+	iscache->reclaim_size = 0ull;
 
 	errcode = pt_iscache_unlock(iscache);
+	if (errcode < 0) {
+		(void) pt_iscache_lru_free(reclaim);
+		return errcode;
+	}
 
-	if (errcode < 0 || status < 0)
-		return (status < 0) ? status : errcode;
+	nreclaimed = 0;
+	for (lru = reclaim; lru; lru = lru->next)
+		nreclaimed += 1;
+
+	errcode = pt_iscache_lru_free(reclaim);
+	if (errcode < 0)
+		return errcode;
+
+	return nreclaimed;
+}
+
+int pt_iscache_set_bcache_dir(struct pt_image_section_cache *iscache,
+			      const char *dirname)
+{
+	char *dir, *old;
+	int errcode;
+
+	if (!iscache)
+		return -pte_invalid;
+
+	dir = NULL;
+	if (dirname) {
+		dir = dupstr(dirname);
+		if (!dir)
+			return -pte_nomem;
+	}
+
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0) {
+		free(dir);
+		return errcode;
+	}
+
+	old = iscache->bcache_dir;
+	iscache->bcache_dir = dir;
+
+	errcode = pt_iscache_unlock(iscache);
+
+	free(old);
+	return errcode;
+}
+
+int pt_iscache_set_map_flags(struct pt_image_section_cache *iscache,
+			     uint32_t flags)
+{
+	int errcode;
+
+	if (!iscache)
+		return -pte_invalid;
+
+	if (flags & ~(uint32_t) (ptmf_populate | ptmf_hugepage | ptmf_copy |
+				 ptmf_wide_bcache))
+		return -pte_invalid;
+
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0)
+		return errcode;
+
+	iscache->map_flags = flags;
 
-	return pt_iscache_lru_free(tail);
+	return pt_iscache_unlock(iscache);
+}
+
+int pt_iscache_map_flags(struct pt_image_section_cache *iscache,
+			 uint32_t *flags)
+{
+	int errcode;
+
+	if (!iscache || !flags)
+		return -pte_internal;
+
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0)
+		return errcode;
+
+	*flags = iscache->map_flags;
+
+	return pt_iscache_unlock(iscache);
+}
+
+int pt_iscache_bcache_dir(struct pt_image_section_cache *iscache, char **dir)
+{
+	int errcode, status;
+
+	if (!iscache || !dir)
+		return -pte_internal;
+
+	errcode = pt_iscache_lock(iscache);
+	if (errcode < 0)
+		return errcode;
+
+	status = 0;
+	*dir = NULL;
+	if (iscache->bcache_dir) {
+		*dir = dupstr(iscache->bcache_dir);
+		if (!*dir)
+			status = -pte_nomem;
+	}
+
+	errcode = pt_iscache_unlock(iscache);
+	if (errcode < 0) {
+		free(*dir);
+		*dir = NULL;
+		return errcode;
+	}
+
+	return status;
 }
 
 const char *pt_iscache_name(const struct pt_image_section_cache *iscache)
@@ -945,7 +1919,7 @@ int pt_iscache_add_file(struct pt_image_section_cache *iscache,
 	 * If we didn't find a matching section, we create a new section, which
 	 * implicitly gives us a reference to it.
 	 */
-	if (match < iscache->size) {
+	if (match < (int) iscache->size) {
 		const struct pt_iscache_entry *entry;
 
 		entry = &iscache->entries[match];
@@ -954,7 +1928,7 @@ int pt_iscache_add_file(struct pt_image_section_cache *iscache,
 			if (errcode < 0)
 				return errcode;
 
-			return isid_from_index((uint16_t) match);
+			return isid_from_index((uint32_t) match);
 		}
 
 		section = entry->section;
@@ -1045,47 +2019,81 @@ int pt_iscache_read(struct pt_image_section_cache *iscache, uint8_t *buffer,
 int pt_iscache_notify_map(struct pt_image_section_cache *iscache,
 			  struct pt_section *section)
 {
-	struct pt_iscache_lru_entry *tail;
+	struct pt_iscache_shard *shard;
 	int errcode, status;
 
-	tail = NULL;
+	if (!iscache || !section)
+		return -pte_internal;
 
-	errcode = pt_iscache_lock(iscache);
+	shard = pt_iscache_shard(iscache, section);
+
+	/* There is nothing to do if @section is already at the front of
+	 * @shard->lru and its size has not changed.
+	 *
+	 * This check is racy.  In the worst case, we miss an update of the
+	 * access order.
+	 *
+	 * We rely on guaranteed atomic operations as specified in section 8.1.1
+	 * in Volume 3A of the Intel(R) Software Developer's Manual at
+	 * http://www.intel.com/sdm.
+	 */
+	if (*((const struct pt_section * volatile *) &shard->mru) == section) {
+		uint64_t memsize;
+
+		errcode = pt_section_memsize(section, &memsize);
+		if (errcode < 0)
+			return errcode;
+
+		if (*((volatile uint64_t *) &shard->mrusize) == memsize)
+			return 0;
+	}
+
+	errcode = pt_iscache_lock_shard(shard);
 	if (errcode < 0)
 		return errcode;
 
-	status = pt_iscache_lru_add(iscache, section);
-	if (status > 0)
-		status = pt_iscache_lru_prune(iscache, &tail);
+	status = pt_iscache_lru_add(iscache, shard, section);
 
-	errcode = pt_iscache_unlock(iscache);
+	pt_iscache_lru_set_mru(shard);
+
+	errcode = pt_iscache_unlock_shard(shard);
 
 	if (errcode < 0 || status < 0)
 		return (status < 0) ? status : errcode;
 
-	return pt_iscache_lru_free(tail);
+	/* We prune the cache after unlocking @shard. */
+	if (status > 0)
+		return pt_iscache_lru_shrink(iscache);
+
+	return 0;
 }
 
 int pt_iscache_notify_resize(struct pt_image_section_cache *iscache,
 			     struct pt_section *section, uint64_t memsize)
 {
-	struct pt_iscache_lru_entry *tail;
+	struct pt_iscache_shard *shard;
 	int errcode, status;
 
-	tail = NULL;
+	if (!iscache || !section)
+		return -pte_internal;
+
+	shard = pt_iscache_shard(iscache, section);
 
-	errcode = pt_iscache_lock(iscache);
+	errcode = pt_iscache_lock_shard(shard);
 	if (errcode < 0)
 		return errcode;
 
-	status = pt_iscache_lru_resize(iscache, section, memsize);
-	if (status > 0)
-		status = pt_iscache_lru_prune(iscache, &tail);
+	status = pt_iscache_lru_resize(iscache, shard, section, memsize);
 
-	errcode = pt_iscache_unlock(iscache);
+	pt_iscache_lru_set_mru(shard);
+
+	errcode = pt_iscache_unlock_shard(shard);
 
 	if (errcode < 0 || status < 0)
 		return (status < 0) ? status : errcode;
 
-	return pt_iscache_lru_free(tail);
+	if (status > 0)
+		return pt_iscache_lru_shrink(iscache);
+
+	return 0;
 }
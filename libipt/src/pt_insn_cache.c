@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pt_insn_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#  include <windows.h>
+#endif
+
+
+/* Get the number of page directory entries for @nentries cache entries. */
+static uint64_t pt_icache_ndir(uint64_t nentries)
+{
+	return (nentries + pt_icache_page_mask) >> pt_icache_page_shift;
+}
+
+struct pt_insn_cache *pt_icache_alloc(uint64_t nentries)
+{
+	struct pt_insn_cache *icache;
+	uint64_t size;
+
+	if (!nentries || (UINT32_MAX < nentries))
+		return NULL;
+
+	size = sizeof(*icache) +
+		(pt_icache_ndir(nentries) * sizeof(struct pt_icache_page *));
+	if (SIZE_MAX < size)
+		return NULL;
+
+	icache = malloc((size_t) size);
+	if (!icache)
+		return NULL;
+
+	memset(icache, 0, (size_t) size);
+	icache->nentries = (uint32_t) nentries;
+
+	return icache;
+}
+
+void pt_icache_free(struct pt_insn_cache *icache)
+{
+	uint64_t ndir, pidx;
+
+	if (!icache)
+		return;
+
+	ndir = pt_icache_ndir(icache->nentries);
+	for (pidx = 0; pidx < ndir; ++pidx)
+		free(icache->page[pidx]);
+
+	free(icache);
+}
+
+int pt_icache_memsize(const struct pt_insn_cache *icache, uint64_t *psize)
+{
+	uint64_t size;
+
+	if (!icache || !psize)
+		return -pte_internal;
+
+	size = sizeof(*icache);
+	size += pt_icache_ndir(icache->nentries) *
+		sizeof(struct pt_icache_page *);
+	size += (uint64_t) icache->npages * sizeof(struct pt_icache_page);
+
+	*psize = size;
+
+	return 0;
+}
+
+/* Install @page in @icache's page directory at @pidx.
+ *
+ * Another thread may have installed a page concurrently.  In that case, @page
+ * is freed.
+ *
+ * Returns the installed page.
+ */
+static struct pt_icache_page *pt_icache_install(struct pt_insn_cache *icache,
+						uint32_t pidx,
+						struct pt_icache_page *page)
+{
+	struct pt_icache_page *installed;
+
+#if defined(_MSC_VER)
+	installed = InterlockedCompareExchangePointer(
+		(PVOID volatile *) &icache->page[pidx], page, NULL);
+	if (!installed)
+		(void) InterlockedIncrement((LONG volatile *) &icache->npages);
+#else
+	installed = __sync_val_compare_and_swap(&icache->page[pidx], NULL,
+						page);
+	if (!installed)
+		(void) __sync_fetch_and_add(&icache->npages, 1);
+#endif
+
+	if (!installed)
+		return page;
+
+	free(page);
+	return installed;
+}
+
+/* Get the page of @icache containing @index and allocate it if necessary.
+ *
+ * Returns the page on success, NULL if the allocation failed.
+ */
+static struct pt_icache_page *pt_icache_page(struct pt_insn_cache *icache,
+					     uint32_t index)
+{
+	struct pt_icache_page *page;
+	uint32_t pidx;
+
+	pidx = index >> pt_icache_page_shift;
+
+	page = icache->page[pidx];
+	if (page)
+		return page;
+
+	page = malloc(sizeof(*page));
+	if (!page)
+		return NULL;
+
+	memset(page, 0, sizeof(*page));
+
+	return pt_icache_install(icache, pidx, page);
+}
+
+int pt_icache_add(struct pt_insn_cache *icache, uint64_t index,
+		  struct pt_icache_entry ice)
+{
+	struct pt_icache_page *page;
+
+	if (!icache)
+		return -pte_internal;
+
+	if (icache->nentries <= index)
+		return -pte_internal;
+
+	page = pt_icache_page(icache, (uint32_t) index);
+	if (!page)
+		return -pte_nomem;
+
+	/* We rely on guaranteed atomic operations as specified in section 8.1.1
+	 * in Volume 3A of the Intel(R) Software Developer's Manual at
+	 * http://www.intel.com/sdm.
+	 *
+	 * Entries are eight bytes in size and naturally aligned.  Their loads
+	 * and stores are not atomic on 32-bit hosts, which do not support
+	 * instruction caches.  See pt_section_alloc_icache().
+	 */
+	page->entry[index & pt_icache_page_mask] = ice;
+
+	return 0;
+}
+
+int pt_icache_lookup(struct pt_icache_entry *ice,
+		     const struct pt_insn_cache *icache, uint64_t index)
+{
+	const struct pt_icache_page *page;
+
+	if (!ice || !icache)
+		return -pte_internal;
+
+	if (icache->nentries <= index)
+		return -pte_internal;
+
+	/* A missing page means that none of its entries is valid. */
+	page = icache->page[index >> pt_icache_page_shift];
+	if (!page) {
+		memset(ice, 0, sizeof(*ice));
+		return 0;
+	}
+
+	/* We rely on guaranteed atomic operations as specified in section 8.1.1
+	 * in Volume 3A of the Intel(R) Software Developer's Manual at
+	 * http://www.intel.com/sdm.
+	 */
+	*ice = page->entry[index & pt_icache_page_mask];
+
+	return 0;
+}
@@ -28,6 +28,8 @@
 
 #include "pt_insn_decoder.h"
 #include "pt_insn.h"
+#include "pt_insn_cache.h"
+#include "pt_section.h"
 #include "pt_config.h"
 #include "pt_asid.h"
 #include "pt_compiler.h"
@@ -438,6 +440,15 @@ int pt_insn_asid(const struct pt_insn_decoder *decoder, struct pt_asid *asid,
 	return pt_asid_to_user(asid, &decoder->asid, size);
 }
 
+int pt_insn_scache_stats(const struct pt_insn_decoder *decoder,
+			 struct pt_scache_stats *stats, size_t size)
+{
+	if (!decoder || !stats)
+		return -pte_invalid;
+
+	return pt_msec_cache_stats(&decoder->scache, stats, size);
+}
+
 static inline int event_pending(struct pt_insn_decoder *decoder)
 {
 	int status;
@@ -1207,10 +1218,84 @@ static inline int insn_to_user(struct pt_insn *uinsn, size_t size,
 	return 0;
 }
 
+/* Provide @insn and @iext from the instruction cache entry @ice.
+ *
+ * The raw bytes are read from @msec.
+ *
+ * Returns a positive integer if @insn and @iext were provided.
+ * Returns zero if the raw bytes could not be read.
+ * Returns a negative error code otherwise.
+ */
+static int pt_insn_from_cache(struct pt_insn *insn, struct pt_insn_ext *iext,
+			      const struct pt_mapped_section *msec,
+			      struct pt_icache_entry ice)
+{
+	int status;
+
+	if (!insn || !iext)
+		return -pte_internal;
+
+	status = pt_msec_read(msec, insn->raw, (uint16_t) ice.size, insn->ip);
+	if (status < 0) {
+		if (status != -pte_nomap)
+			return status;
+
+		return 0;
+	}
+
+	if (status != (int) ice.size)
+		return 0;
+
+	insn->size = (uint8_t) ice.size;
+	insn->iclass = (enum pt_insn_class) ice.iclass;
+
+	iext->iclass = (pti_inst_enum_t) ice.iext;
+	iext->variant.branch.displacement = ice.displacement;
+	iext->variant.branch.is_direct = (uint8_t) ice.is_direct;
+
+	return 1;
+}
+
+/* Add @insn and @iext to the instruction cache @icache at @offset.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_insn_to_cache(struct pt_insn_cache *icache, uint64_t offset,
+			    const struct pt_insn *insn,
+			    const struct pt_insn_ext *iext)
+{
+	struct pt_icache_entry ice;
+
+	if (!insn || !iext)
+		return -pte_internal;
+
+	memset(&ice, 0, sizeof(ice));
+
+	ice.displacement = iext->variant.branch.displacement;
+	ice.mode = insn->mode;
+	ice.size = insn->size;
+	ice.iclass = insn->iclass;
+	ice.iext = iext->iclass;
+	ice.is_direct = iext->variant.branch.is_direct ? 1 : 0;
+
+	/* Skip instructions that do not fit into a cache entry.  We should not
+	 * see any.
+	 */
+	if ((pt_ice_exec_mode(ice) != insn->mode) ||
+	    (ice.size != insn->size) ||
+	    ((enum pt_insn_class) ice.iclass != insn->iclass) ||
+	    ((pti_inst_enum_t) ice.iext != iext->iclass))
+		return 0;
+
+	return pt_icache_add(icache, offset, ice);
+}
+
 static int pt_insn_decode_cached(struct pt_insn_decoder *decoder,
 				 const struct pt_mapped_section *msec,
 				 struct pt_insn *insn, struct pt_insn_ext *iext)
 {
+	struct pt_insn_cache *icache;
+	uint64_t offset;
 	int status;
 
 	if (!decoder || !insn || !iext)
@@ -1228,6 +1313,25 @@ static int pt_insn_decode_cached(struct pt_insn_decoder *decoder,
 		return pt_insn_decode(insn, iext, decoder->image,
 				      &decoder->asid);
 
+	/* Check the section's instruction cache first.  On a hit, we only need
+	 * to read the instruction's raw bytes.
+	 */
+	offset = pt_msec_unmap(msec, insn->ip);
+	icache = pt_section_icache(pt_msec_section(msec));
+	if (icache && (insn->mode != ptem_unknown)) {
+		struct pt_icache_entry ice;
+
+		status = pt_icache_lookup(&ice, icache, offset);
+		if (status < 0)
+			return status;
+
+		if (pt_ice_exec_mode(ice) == insn->mode) {
+			status = pt_insn_from_cache(insn, iext, msec, ice);
+			if (status != 0)
+				return status < 0 ? status : 0;
+		}
+	}
+
 	status = pt_msec_read(msec, insn->raw, sizeof(insn->raw), insn->ip);
 	if (status < 0) {
 		if (status != -pte_nomap)
@@ -1251,6 +1355,14 @@ static int pt_insn_decode_cached(struct pt_insn_decoder *decoder,
 				      &decoder->asid);
 	}
 
+	if (icache && (insn->mode != ptem_unknown)) {
+		int errcode;
+
+		errcode = pt_insn_to_cache(icache, offset, insn, iext);
+		if (errcode < 0)
+			return errcode;
+	}
+
 	return status;
 }
 
@@ -1260,7 +1372,7 @@ static int pt_insn_msec_lookup(struct pt_insn_decoder *decoder,
 	struct pt_msec_cache *scache;
 	struct pt_image *image;
 	uint64_t ip;
-	int isid;
+	int isid, errcode;
 
 	if (!decoder || !pmsec)
 		return -pte_internal;
@@ -1269,13 +1381,23 @@ static int pt_insn_msec_lookup(struct pt_insn_decoder *decoder,
 	image = decoder->image;
 	ip = decoder->ip;
 
-	isid = pt_msec_cache_read(scache, pmsec, image, ip);
+	isid = pt_msec_cache_read(scache, pmsec, image, &decoder->asid,
+				  ip);
 	if (isid < 0) {
 		if (isid != -pte_nomap)
 			return isid;
 
-		return pt_msec_cache_fill(scache, pmsec, image,
+		isid = pt_msec_cache_fill(scache, pmsec, image,
 					  &decoder->asid, ip);
+		if (isid < 0)
+			return isid;
+
+		/* The instruction cache is an optimization.  Sections that are
+		 * too big to be cached are decoded without it.
+		 */
+		errcode = pt_section_request_icache(pt_msec_section(*pmsec));
+		if ((errcode < 0) && (errcode != -pte_not_supported))
+			return errcode;
 	}
 
 	return isid;
@@ -1451,20 +1573,13 @@ static int pt_insn_process_async_branch(struct pt_insn_decoder *decoder)
 
 static int pt_insn_process_paging(struct pt_insn_decoder *decoder)
 {
-	uint64_t cr3;
-	int errcode;
-
 	if (!decoder)
 		return -pte_internal;
 
-	cr3 = decoder->event.variant.paging.cr3;
-	if (decoder->asid.cr3 != cr3) {
-		errcode = pt_msec_cache_invalidate(&decoder->scache);
-		if (errcode < 0)
-			return errcode;
-
-		decoder->asid.cr3 = cr3;
-	}
+	/* The section cache is keyed by address space so there is no need to
+	 * invalidate it.
+	 */
+	decoder->asid.cr3 = decoder->event.variant.paging.cr3;
 
 	return 0;
 }
@@ -1567,20 +1682,10 @@ static int pt_insn_process_stop(struct pt_insn_decoder *decoder)
 
 static int pt_insn_process_vmcs(struct pt_insn_decoder *decoder)
 {
-	uint64_t vmcs;
-	int errcode;
-
 	if (!decoder)
 		return -pte_internal;
 
-	vmcs = decoder->event.variant.vmcs.base;
-	if (decoder->asid.vmcs != vmcs) {
-		errcode = pt_msec_cache_invalidate(&decoder->scache);
-		if (errcode < 0)
-			return errcode;
-
-		decoder->asid.vmcs = vmcs;
-	}
+	decoder->asid.vmcs = decoder->event.variant.vmcs.base;
 
 	return 0;
 }
@@ -45,22 +45,30 @@ int pt_msec_cache_init(struct pt_msec_cache *cache)
 
 void pt_msec_cache_fini(struct pt_msec_cache *cache)
 {
+	int idx;
+
 	if (!cache)
 		return;
 
 	(void) pt_msec_cache_invalidate(cache);
-	pt_msec_fini(&cache->msec);
+
+	for (idx = 0; idx < pt_msec_cache_nentries; ++idx)
+		pt_msec_fini(&cache->entry[idx].msec);
 }
 
-int pt_msec_cache_invalidate(struct pt_msec_cache *cache)
+/* Release the section cached in @entry and invalidate @entry.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_msec_cache_release(struct pt_msec_cache_entry *entry)
 {
 	struct pt_section *section;
 	int errcode;
 
-	if (!cache)
+	if (!entry)
 		return -pte_internal;
 
-	section = pt_msec_section(&cache->msec);
+	section = pt_msec_section(&entry->msec);
 	if (!section)
 		return 0;
 
@@ -68,32 +76,109 @@ int pt_msec_cache_invalidate(struct pt_msec_cache *cache)
 	if (errcode < 0)
 		return errcode;
 
-	cache->msec.section = NULL;
+	entry->msec.section = NULL;
 
 	return pt_section_put(section);
 }
 
+int pt_msec_cache_invalidate(struct pt_msec_cache *cache)
+{
+	if (!cache)
+		return -pte_internal;
+
+	while (cache->nvalid) {
+		uint8_t idx;
+		int errcode;
+
+		idx = cache->mru[cache->nvalid - 1];
+		if (pt_msec_cache_nentries <= idx)
+			return -pte_internal;
+
+		errcode = pt_msec_cache_release(&cache->entry[idx]);
+		if (errcode < 0)
+			return errcode;
+
+		cache->nvalid -= 1;
+	}
+
+	cache->image = NULL;
+
+	return 0;
+}
+
+/* Check whether @cache is valid for @image. */
+static int pt_msec_cache_is_current(const struct pt_msec_cache *cache,
+				    const struct pt_image *image)
+{
+	if (!cache || !image)
+		return 0;
+
+	return (cache->image == image) &&
+		(cache->generation == pt_image_generation(image));
+}
+
+/* Check whether @entry holds the section for @vaddr in @asid. */
+static int pt_msec_cache_match(const struct pt_msec_cache_entry *entry,
+			       const struct pt_asid *asid, uint64_t vaddr)
+{
+	const struct pt_mapped_section *msec;
+
+	msec = &entry->msec;
+	if ((vaddr < pt_msec_begin(msec)) || (pt_msec_end(msec) <= vaddr))
+		return 0;
+
+	return (entry->asid.cr3 == asid->cr3) &&
+		(entry->asid.vmcs == asid->vmcs);
+}
+
+/* Make the @pos'th most recently used entry the most recently used one. */
+static void pt_msec_cache_touch(struct pt_msec_cache *cache, uint8_t pos)
+{
+	uint8_t idx;
+
+	idx = cache->mru[pos];
+	for (; pos; --pos)
+		cache->mru[pos] = cache->mru[pos - 1];
+
+	cache->mru[0] = idx;
+}
+
 int pt_msec_cache_read(struct pt_msec_cache *cache,
 		       const struct pt_mapped_section **pmsec,
-		       struct pt_image *image, uint64_t vaddr)
+		       struct pt_image *image, const struct pt_asid *asid,
+		       uint64_t vaddr)
 {
-	struct pt_mapped_section *msec;
-	int isid, errcode;
+	struct pt_msec_cache_entry *entry;
+	uint8_t pos, nvalid;
 
-	if (!cache || !pmsec)
+	if (!cache || !pmsec || !image || !asid)
 		return -pte_internal;
 
-	msec = &cache->msec;
-	isid = cache->isid;
+	if (!pt_msec_cache_is_current(cache, image))
+		return -pte_nomap;
 
-	errcode = pt_image_validate(image, msec, vaddr, isid);
-	if (errcode < 0)
-		return errcode;
+	nvalid = cache->nvalid;
+	for (pos = 0; pos < nvalid; ++pos) {
+		uint8_t idx;
 
-	*pmsec = msec;
+		idx = cache->mru[pos];
+		if (pt_msec_cache_nentries <= idx)
+			return -pte_internal;
 
-	return isid;
+		entry = &cache->entry[idx];
+		if (!pt_msec_cache_match(entry, asid, vaddr))
+			continue;
+
+		if (pos)
+			pt_msec_cache_touch(cache, pos);
 
+		cache->hits += 1;
+
+		*pmsec = &entry->msec;
+		return entry->isid;
+	}
+
+	return -pte_nomap;
 }
 
 int pt_msec_cache_fill(struct pt_msec_cache *cache,
@@ -101,18 +186,54 @@ int pt_msec_cache_fill(struct pt_msec_cache *cache,
 		       struct pt_image *image, const struct pt_asid *asid,
 		       uint64_t vaddr)
 {
+	struct pt_msec_cache_entry *entry;
 	struct pt_mapped_section *msec;
 	struct pt_section *section;
+	uint8_t idx, pos;
 	int errcode, isid;
 
-	if (!cache || !pmsec)
+	if (!cache || !pmsec || !image || !asid)
 		return -pte_internal;
 
-	errcode = pt_msec_cache_invalidate(cache);
-	if (errcode < 0)
-		return errcode;
+	cache->misses += 1;
+
+	if (!pt_msec_cache_is_current(cache, image)) {
+		errcode = pt_msec_cache_invalidate(cache);
+		if (errcode < 0)
+			return errcode;
+
+		cache->image = image;
+		cache->generation = pt_image_generation(image);
+	}
 
-	msec = &cache->msec;
+	/* Use a free entry, if there is one, or replace the least recently
+	 * used entry.
+	 */
+	pos = cache->nvalid;
+	if (pos < pt_msec_cache_nentries) {
+		for (idx = 0; idx < pt_msec_cache_nentries; ++idx) {
+			if (!pt_msec_section(&cache->entry[idx].msec))
+				break;
+		}
+
+		if (pt_msec_cache_nentries <= idx)
+			return -pte_internal;
+	} else {
+		pos -= 1;
+
+		idx = cache->mru[pos];
+		if (pt_msec_cache_nentries <= idx)
+			return -pte_internal;
+
+		errcode = pt_msec_cache_release(&cache->entry[idx]);
+		if (errcode < 0)
+			return errcode;
+
+		cache->nvalid = pos;
+	}
+
+	entry = &cache->entry[idx];
+	msec = &entry->msec;
 
 	isid = pt_image_find(image, msec, asid, vaddr);
 	if (isid < 0)
@@ -128,9 +249,39 @@ int pt_msec_cache_fill(struct pt_msec_cache *cache,
 		return errcode;
 	}
 
-	*pmsec = msec;
+	entry->asid = *asid;
+	entry->isid = isid;
 
-	cache->isid = isid;
+	cache->mru[pos] = idx;
+	cache->nvalid = pos + 1;
+	pt_msec_cache_touch(cache, pos);
+
+	*pmsec = msec;
 
 	return isid;
 }
+
+int pt_msec_cache_stats(const struct pt_msec_cache *cache,
+			struct pt_scache_stats *ustats, size_t size)
+{
+	struct pt_scache_stats stats;
+
+	if (!cache || !ustats)
+		return -pte_internal;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.hits = cache->hits;
+	stats.misses = cache->misses;
+
+	/* Zero out any unknown bytes. */
+	if (sizeof(stats) < size) {
+		memset((uint8_t *) ustats + sizeof(stats), 0,
+		       size - sizeof(stats));
+
+		size = sizeof(stats);
+	}
+
+	memcpy(ustats, &stats, size);
+
+	return 0;
+}
@@ -35,6 +35,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 
 int pt_pkt_decoder_init(struct pt_packet_decoder *decoder,
@@ -72,11 +73,59 @@ struct pt_packet_decoder *pt_pkt_alloc_decoder(const struct pt_config *config)
 	return decoder;
 }
 
+static int pt_pkt_stream_decoder_init(struct pt_packet_decoder *decoder,
+				      const struct pt_config *uconfig)
+{
+	struct pt_stream stream;
+	struct pt_config config;
+	int errcode;
+
+	if (!decoder)
+		return -pte_internal;
+
+	errcode = pt_stream_init(&stream);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_stream_config(&config, uconfig, &stream);
+	if (errcode >= 0)
+		errcode = pt_pkt_decoder_init(decoder, &config);
+
+	if (errcode < 0) {
+		pt_stream_fini(&stream);
+		return errcode;
+	}
+
+	decoder->stream = stream;
+
+	return 0;
+}
+
+struct pt_packet_decoder *
+pt_pkt_alloc_stream_decoder(const struct pt_config *config)
+{
+	struct pt_packet_decoder *decoder;
+	int errcode;
+
+	decoder = malloc(sizeof(*decoder));
+	if (!decoder)
+		return NULL;
+
+	errcode = pt_pkt_stream_decoder_init(decoder, config);
+	if (errcode < 0) {
+		free(decoder);
+		return NULL;
+	}
+
+	return decoder;
+}
+
 void pt_pkt_decoder_fini(struct pt_packet_decoder *decoder)
 {
-	(void) decoder;
+	if (!decoder)
+		return;
 
-	/* Nothing to do. */
+	pt_stream_fini(&decoder->stream);
 }
 
 void pt_pkt_free_decoder(struct pt_packet_decoder *decoder)
@@ -85,6 +134,57 @@ void pt_pkt_free_decoder(struct pt_packet_decoder *decoder)
 	free(decoder);
 }
 
+int pt_pkt_append(struct pt_packet_decoder *decoder, const uint8_t *buffer,
+		  size_t size)
+{
+	struct pt_stream *stream;
+	const uint8_t *begin;
+	uint64_t pos, sync;
+	size_t discard;
+	int errcode;
+
+	if (!decoder)
+		return -pte_invalid;
+
+	stream = &decoder->stream;
+	begin = decoder->config.begin;
+
+	/* Remember the decoder's position as stream offsets.  We may discard
+	 * everything before the last PSB.
+	 */
+	pos = decoder->pos ? stream->base + (decoder->pos - begin) : 0ull;
+	sync = decoder->sync ? stream->base + (decoder->sync - begin) : 0ull;
+	discard = decoder->sync ? (size_t) (decoder->sync - begin) : 0;
+
+	errcode = pt_stream_append(stream, buffer, size, discard);
+	if (errcode < 0)
+		return errcode;
+
+	if (decoder->pos)
+		decoder->pos = stream->buffer + (pos - stream->base);
+
+	if (decoder->sync)
+		decoder->sync = stream->buffer + (sync - stream->base);
+
+	decoder->config.begin = stream->buffer;
+	decoder->config.end = stream->buffer + stream->size;
+
+	return 0;
+}
+
+int pt_pkt_close(struct pt_packet_decoder *decoder)
+{
+	if (!decoder)
+		return -pte_invalid;
+
+	if (!decoder->stream.buffer)
+		return -pte_not_supported;
+
+	decoder->stream.closed = 1;
+
+	return 0;
+}
+
 int pt_pkt_sync_forward(struct pt_packet_decoder *decoder)
 {
 	const uint8_t *pos, *sync;
@@ -103,7 +203,7 @@ int pt_pkt_sync_forward(struct pt_packet_decoder *decoder)
 
 	errcode = pt_sync_forward(&sync, pos, &decoder->config);
 	if (errcode < 0)
-		return errcode;
+		return pt_stream_suspend(&decoder->stream, errcode);
 
 	decoder->sync = sync;
 	decoder->pos = sync;
@@ -136,16 +236,22 @@ int pt_pkt_sync_backward(struct pt_packet_decoder *decoder)
 int pt_pkt_sync_set(struct pt_packet_decoder *decoder, uint64_t offset)
 {
 	const uint8_t *begin, *end, *pos;
+	uint64_t base;
 
 	if (!decoder)
 		return -pte_invalid;
 
+	/* The trace before @base has been discarded. */
+	base = decoder->stream.base;
+	if (offset < base)
+		return -pte_eos;
+
 	begin = decoder->config.begin;
 	end = decoder->config.end;
-	pos = begin + offset;
+	pos = begin + (offset - base);
 
 	if (end < pos || pos < begin)
-		return -pte_eos;
+		return pt_stream_suspend(&decoder->stream, -pte_eos);
 
 	decoder->sync = pos;
 	decoder->pos = pos;
@@ -166,7 +272,7 @@ int pt_pkt_get_offset(const struct pt_packet_decoder *decoder, uint64_t *offset)
 	if (!pos)
 		return -pte_nosync;
 
-	*offset = pos - begin;
+	*offset = decoder->stream.base + (uint64_t) (pos - begin);
 	return 0;
 }
 
@@ -184,7 +290,7 @@ int pt_pkt_get_sync_offset(const struct pt_packet_decoder *decoder,
 	if (!sync)
 		return -pte_nosync;
 
-	*offset = sync - begin;
+	*offset = decoder->stream.base + (uint64_t) (sync - begin);
 	return 0;
 }
 
@@ -208,7 +314,8 @@ static inline int pkt_to_user(struct pt_packet *upkt, size_t size,
 
 	/* Zero out any unknown bytes. */
 	if (sizeof(*pkt) < size) {
-		memset(upkt + sizeof(*pkt), 0, size - sizeof(*pkt));
+		memset((uint8_t *) upkt + sizeof(*pkt), 0,
+		       size - sizeof(*pkt));
 
 		size = sizeof(*pkt);
 	}
@@ -218,21 +325,28 @@ static inline int pkt_to_user(struct pt_packet *upkt, size_t size,
 	return 0;
 }
 
-int pt_pkt_next(struct pt_packet_decoder *decoder, struct pt_packet *packet,
-		size_t psize)
+/* Decode the packet at @decoder's current position into @packet.
+ *
+ * Does not advance @decoder.
+ *
+ * If @dfun is not NULL, provides the packet's decoder function in @dfun.
+ *
+ * Returns the size of the packet in bytes on success, a negative error code
+ * otherwise.
+ */
+static int pkt_decode(struct pt_packet_decoder *decoder,
+		      struct pt_packet *packet,
+		      const struct pt_decoder_function **pdfun)
 {
 	const struct pt_decoder_function *dfun;
-	struct pt_packet pkt, *ppkt;
 	int errcode, size;
 
-	if (!packet || !decoder)
-		return -pte_invalid;
-
-	ppkt = psize == sizeof(pkt) ? packet : &pkt;
+	if (!decoder)
+		return -pte_internal;
 
 	errcode = pt_df_fetch(&dfun, decoder->pos, &decoder->config);
 	if (errcode < 0)
-		return errcode;
+		return pt_stream_suspend(&decoder->stream, errcode);
 
 	if (!dfun)
 		return -pte_internal;
@@ -240,7 +354,31 @@ int pt_pkt_next(struct pt_packet_decoder *decoder, struct pt_packet *packet,
 	if (!dfun->packet)
 		return -pte_internal;
 
-	size = dfun->packet(decoder, ppkt);
+	if (pdfun)
+		*pdfun = dfun;
+
+	/* A packet that is split across appended chunks is truncated until we
+	 * get the rest of it.
+	 */
+	size = dfun->packet(decoder, packet);
+	if (size < 0)
+		return pt_stream_suspend(&decoder->stream, size);
+
+	return size;
+}
+
+int pt_pkt_next(struct pt_packet_decoder *decoder, struct pt_packet *packet,
+		size_t psize)
+{
+	struct pt_packet pkt, *ppkt;
+	int errcode, size;
+
+	if (!packet || !decoder)
+		return -pte_invalid;
+
+	ppkt = psize == sizeof(pkt) ? packet : &pkt;
+
+	size = pkt_decode(decoder, ppkt, NULL);
 	if (size < 0)
 		return size;
 
@@ -253,6 +391,60 @@ int pt_pkt_next(struct pt_packet_decoder *decoder, struct pt_packet *packet,
 	return size;
 }
 
+int pt_pkt_next_batch(struct pt_packet_decoder *decoder,
+		      struct pt_packet *packets, uint64_t *offsets,
+		      size_t count, size_t psize)
+{
+	const struct pt_decoder_function *dfun;
+	const uint8_t *begin;
+	uint64_t base;
+	size_t npackets;
+
+	if (!decoder || !packets || !psize)
+		return -pte_invalid;
+
+	if (INT_MAX < count)
+		count = INT_MAX;
+
+	begin = decoder->config.begin;
+	base = decoder->stream.base;
+
+	for (npackets = 0; npackets < count; ++npackets) {
+		struct pt_packet pkt, *packet, *ppkt;
+		const uint8_t *pos;
+		int errcode, size;
+
+		packet = (struct pt_packet *)
+			((uint8_t *) packets + (npackets * psize));
+		ppkt = psize == sizeof(pkt) ? packet : &pkt;
+		pos = decoder->pos;
+
+		size = pkt_decode(decoder, ppkt, &dfun);
+		if (size < 0) {
+			/* We report the error with the next call. */
+			if (npackets)
+				break;
+
+			return size;
+		}
+
+		/* We stop in front of the next synchronization point. */
+		if (npackets && (dfun == &pt_decode_psb))
+			break;
+
+		errcode = pkt_to_user(packet, psize, ppkt);
+		if (errcode < 0)
+			return errcode;
+
+		if (offsets)
+			offsets[npackets] = base + (uint64_t) (pos - begin);
+
+		decoder->pos += size;
+	}
+
+	return (int) npackets;
+}
+
 int pt_pkt_decode_unknown(struct pt_packet_decoder *decoder,
 			  struct pt_packet *packet)
 {
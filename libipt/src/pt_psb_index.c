@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pt_psb_index.h"
+#include "pt_last_ip.h"
+#include "pt_opcodes.h"
+
+#include "intel-pt.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+
+/* The PSB index file header.
+ *
+ * The header is followed by @nrecords struct pt_psb_record objects.
+ *
+ * The file is written in host byte order.  It is not intended to be shared
+ * between different systems.
+ */
+struct pt_psb_index_header {
+	/* The file magic - pt_psb_index_magic. */
+	uint32_t magic;
+
+	/* The file format version - pt_psb_index_version. */
+	uint16_t version;
+
+	/* The size of a record in bytes. */
+	uint16_t rsize;
+
+	/* The size of the indexed trace buffer in bytes. */
+	uint64_t size;
+
+	/* The number of records following this header. */
+	uint64_t nrecords;
+};
+
+enum {
+	/* The PSB index file magic ('ptpi'). */
+	pt_psb_index_magic	= 0x69707470,
+
+	/* The PSB index file format version. */
+	pt_psb_index_version	= 1,
+
+	/* The initial number of records to allocate. */
+	pt_psb_index_initial	= 0x100
+};
+
+
+struct pt_psb_index *pt_psb_index_alloc(void)
+{
+	struct pt_psb_index *index;
+
+	index = malloc(sizeof(*index));
+	if (!index)
+		return NULL;
+
+	memset(index, 0, sizeof(*index));
+
+	return index;
+}
+
+void pt_psb_index_free(struct pt_psb_index *index)
+{
+	if (!index)
+		return;
+
+	free(index->record);
+	free(index);
+}
+
+/* Make room for @capacity records in @index.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_psb_index_reserve(struct pt_psb_index *index, uint64_t capacity)
+{
+	struct pt_psb_record *record;
+
+	if (!index)
+		return -pte_internal;
+
+	if (capacity <= (uint64_t) index->capacity)
+		return 0;
+
+	if (INT_MAX < capacity)
+		return -pte_overflow;
+
+	if (SIZE_MAX / sizeof(*record) < capacity)
+		return -pte_nomem;
+
+	record = realloc(index->record, (size_t) capacity * sizeof(*record));
+	if (!record)
+		return -pte_nomem;
+
+	index->record = record;
+	index->capacity = (int) capacity;
+
+	return 0;
+}
+
+static int pt_psb_index_add(struct pt_psb_index *index,
+			    const struct pt_psb_record *record)
+{
+	if (!index || !record)
+		return -pte_internal;
+
+	if (index->nrecords == index->capacity) {
+		uint64_t capacity;
+		int errcode;
+
+		capacity = (uint64_t) index->capacity * 2;
+		if (capacity < pt_psb_index_initial)
+			capacity = pt_psb_index_initial;
+
+		if (INT_MAX < capacity)
+			capacity = INT_MAX;
+
+		errcode = pt_psb_index_reserve(index, capacity);
+		if (errcode < 0)
+			return errcode;
+
+		if (index->nrecords == index->capacity)
+			return -pte_overflow;
+	}
+
+	index->record[index->nrecords++] = *record;
+
+	return 0;
+}
+
+/* Read the PSB+ header at @decoder's synchronization point into @record.
+ *
+ * We stop at the end of the header or at the first packet that ends it
+ * prematurely.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_psb_index_read_header(struct pt_psb_record *record,
+				    struct pt_packet_decoder *decoder,
+				    const struct pt_config *config)
+{
+	struct pt_last_ip last_ip;
+
+	if (!record)
+		return -pte_internal;
+
+	pt_last_ip_init(&last_ip);
+
+	for (;;) {
+		struct pt_packet packet;
+		enum pt_exec_mode mode;
+		uint64_t ip;
+		int errcode;
+
+		errcode = pt_pkt_next(decoder, &packet, sizeof(packet));
+		if (errcode < 0)
+			return errcode;
+
+		switch (packet.type) {
+		case ppt_psbend:
+		case ppt_ovf:
+			return 0;
+
+		case ppt_tsc:
+			record->tsc = packet.payload.tsc.tsc;
+			record->flags |= ppr_tsc;
+			break;
+
+		case ppt_tma:
+			record->ctc = packet.payload.tma.ctc;
+			record->fc = packet.payload.tma.fc;
+			record->flags |= ppr_tma;
+			break;
+
+		case ppt_cbr:
+			record->cbr = packet.payload.cbr.ratio;
+			record->flags |= ppr_cbr;
+			break;
+
+		case ppt_mode:
+			if (packet.payload.mode.leaf != pt_mol_exec)
+				break;
+
+			mode = pt_get_exec_mode(&packet.payload.mode.bits.exec);
+			record->mode = (uint8_t) mode;
+			break;
+
+		case ppt_fup:
+			errcode = pt_last_ip_update_ip(&last_ip,
+						       &packet.payload.ip,
+						       config);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_last_ip_query(&ip, &last_ip);
+			if (errcode < 0)
+				break;
+
+			record->ip = ip;
+			record->flags |= ppr_ip;
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+int pt_psb_index_build(struct pt_psb_index *index,
+		       const struct pt_config *config)
+{
+	struct pt_packet_decoder *decoder;
+	uint64_t tsc;
+	int errcode;
+
+	if (!index || !config)
+		return -pte_invalid;
+
+	decoder = pt_pkt_alloc_decoder(config);
+	if (!decoder)
+		return -pte_nomem;
+
+	index->nrecords = 0;
+	index->size = (uint64_t) (config->end - config->begin);
+
+	tsc = 0ull;
+	for (;;) {
+		struct pt_psb_record record;
+
+		errcode = pt_pkt_sync_forward(decoder);
+		if (errcode < 0) {
+			if (errcode == -pte_eos)
+				errcode = 0;
+
+			break;
+		}
+
+		memset(&record, 0, sizeof(record));
+
+		errcode = pt_pkt_get_sync_offset(decoder, &record.offset);
+		if (errcode < 0)
+			break;
+
+		/* A corrupted header still tells us where the PSB is.  We
+		 * index what we have and continue with the next PSB.
+		 */
+		(void) pt_psb_index_read_header(&record, decoder, config);
+
+		if (record.flags & ppr_tsc)
+			tsc = record.tsc;
+		else
+			record.tsc = tsc;
+
+		errcode = pt_psb_index_add(index, &record);
+		if (errcode < 0)
+			break;
+	}
+
+	pt_pkt_free_decoder(decoder);
+
+	if (errcode < 0) {
+		index->nrecords = 0;
+		return errcode;
+	}
+
+	return index->nrecords;
+}
+
+int pt_psb_index_write(const struct pt_psb_index *index, const char *filename)
+{
+	struct pt_psb_index_header header;
+	FILE *file;
+	size_t count;
+	int errcode;
+
+	if (!index || !filename)
+		return -pte_invalid;
+
+	file = fopen(filename, "wb");
+	if (!file)
+		return -pte_bad_file;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = pt_psb_index_magic;
+	header.version = pt_psb_index_version;
+	header.rsize = sizeof(struct pt_psb_record);
+	header.size = index->size;
+	header.nrecords = (uint64_t) index->nrecords;
+
+	errcode = 0;
+	count = fwrite(&header, sizeof(header), 1, file);
+	if (count != 1)
+		errcode = -pte_bad_file;
+	else if (index->nrecords) {
+		count = fwrite(index->record, sizeof(*index->record),
+			       (size_t) index->nrecords, file);
+		if (count != (size_t) index->nrecords)
+			errcode = -pte_bad_file;
+	}
+
+	if (fclose(file) && !errcode)
+		errcode = -pte_bad_file;
+
+	return errcode;
+}
+
+/* Check that the records in @index can be searched.
+ *
+ * Returns zero if they can, a negative error code otherwise.
+ */
+static int pt_psb_index_check(const struct pt_psb_index *index)
+{
+	int idx;
+
+	if (!index)
+		return -pte_internal;
+
+	for (idx = 0; idx < index->nrecords; ++idx) {
+		const struct pt_psb_record *record;
+
+		record = &index->record[idx];
+		if (index->size <= record->offset)
+			return -pte_bad_file;
+
+		if (record->reserved)
+			return -pte_bad_file;
+
+		if (!idx)
+			continue;
+
+		if (record->offset <= record[-1].offset)
+			return -pte_bad_file;
+	}
+
+	return 0;
+}
+
+/* Check whether there is a PSB packet at @pos in a buffer ending at @end.
+ *
+ * Returns non-zero if there is, zero otherwise.
+ */
+static int pt_psb_index_is_psb(const uint8_t *pos, const uint8_t *end)
+{
+	int idx;
+
+	if (!pos || !end || (end < pos) || ((end - pos) < ptps_psb))
+		return 0;
+
+	for (idx = 0; idx < ptps_psb; idx += 2) {
+		if ((pos[idx] != pt_psb_hi) || (pos[idx + 1] != pt_psb_lo))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Check that the records in @index point to PSBs in the trace in @config.
+ *
+ * An index built for a different trace of the same size will have records
+ * that do not point to PSBs.
+ *
+ * Returns zero if they do, a negative error code otherwise.
+ */
+static int pt_psb_index_match(const struct pt_psb_index *index,
+			      const struct pt_config *config)
+{
+	int idx;
+
+	if (!index || !config)
+		return -pte_internal;
+
+	for (idx = 0; idx < index->nrecords; ++idx) {
+		const uint8_t *pos;
+
+		pos = config->begin + index->record[idx].offset;
+		if (!pt_psb_index_is_psb(pos, config->end))
+			return -pte_bad_config;
+	}
+
+	return 0;
+}
+
+/* Read the index in @file into @index.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_psb_index_fread(struct pt_psb_index *index, FILE *file,
+			      const struct pt_config *config)
+{
+	struct pt_psb_index_header header;
+	size_t count;
+	int errcode;
+
+	if (!index || !file || !config)
+		return -pte_internal;
+
+	count = fread(&header, sizeof(header), 1, file);
+	if (count != 1)
+		return -pte_bad_file;
+
+	if ((header.magic != pt_psb_index_magic) ||
+	    (INT_MAX < header.nrecords))
+		return -pte_bad_file;
+
+	if ((header.version != pt_psb_index_version) ||
+	    (header.rsize != sizeof(struct pt_psb_record)))
+		return -pte_not_supported;
+
+	if (header.size != (uint64_t) (config->end - config->begin))
+		return -pte_bad_config;
+
+	errcode = pt_psb_index_reserve(index, header.nrecords);
+	if (errcode < 0)
+		return errcode;
+
+	count = 0;
+	if (header.nrecords)
+		count = fread(index->record, sizeof(*index->record),
+			      (size_t) header.nrecords, file);
+
+	if (count != header.nrecords)
+		return -pte_bad_file;
+
+	index->nrecords = (int) header.nrecords;
+	index->size = header.size;
+
+	errcode = pt_psb_index_check(index);
+	if (errcode < 0)
+		return errcode;
+
+	return pt_psb_index_match(index, config);
+}
+
+int pt_psb_index_read(struct pt_psb_index *index, const char *filename,
+		      const struct pt_config *config)
+{
+	FILE *file;
+	int errcode;
+
+	if (!index || !filename || !config)
+		return -pte_invalid;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return -pte_bad_file;
+
+	index->nrecords = 0;
+
+	errcode = pt_psb_index_fread(index, file, config);
+	fclose(file);
+
+	if (errcode < 0) {
+		index->nrecords = 0;
+		return errcode;
+	}
+
+	return index->nrecords;
+}
+
+/* Provide the @idx-th record in @index in @uentry of @size bytes.
+ *
+ * Returns @idx on success, a negative error code otherwise.
+ */
+static int pt_psb_index_entry(struct pt_psb_entry *uentry, size_t size,
+			      const struct pt_psb_index *index, int idx)
+{
+	const struct pt_psb_record *record;
+	struct pt_psb_entry entry;
+
+	if (!uentry || !index)
+		return -pte_invalid;
+
+	if ((idx < 0) || (index->nrecords <= idx))
+		return -pte_eos;
+
+	record = &index->record[idx];
+
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = record->offset;
+	entry.tsc = record->tsc;
+	entry.ip = record->ip;
+	entry.mode = (enum pt_exec_mode) record->mode;
+	entry.ctc = record->ctc;
+	entry.fc = record->fc;
+	entry.cbr = record->cbr;
+	entry.has_tsc = (record->flags & ppr_tsc) ? 1 : 0;
+	entry.has_tma = (record->flags & ppr_tma) ? 1 : 0;
+	entry.has_cbr = (record->flags & ppr_cbr) ? 1 : 0;
+	entry.has_ip = (record->flags & ppr_ip) ? 1 : 0;
+
+	/* Do not provide more than we actually have. */
+	if (sizeof(entry) < size)
+		size = sizeof(entry);
+
+	memcpy(uentry, &entry, size);
+
+	return idx;
+}
+
+int pt_psb_index_get(const struct pt_psb_index *index,
+		     struct pt_psb_entry *entry, size_t size, int idx)
+{
+	int status;
+
+	status = pt_psb_index_entry(entry, size, index, idx);
+	if (status < 0)
+		return status;
+
+	return 0;
+}
+
+int pt_psb_index_find_offset(const struct pt_psb_index *index,
+			     struct pt_psb_entry *entry, size_t size,
+			     uint64_t offset)
+{
+	int begin, end;
+
+	if (!index || !entry)
+		return -pte_invalid;
+
+	/* Find the first record behind @offset. */
+	begin = 0;
+	end = index->nrecords;
+	while (begin < end) {
+		int mid;
+
+		mid = begin + ((end - begin) / 2);
+		if (offset < index->record[mid].offset)
+			end = mid;
+		else
+			begin = mid + 1;
+	}
+
+	return pt_psb_index_entry(entry, size, index, begin - 1);
+}
+
+int pt_psb_index_find_tsc(const struct pt_psb_index *index,
+			  struct pt_psb_entry *entry, size_t size,
+			  uint64_t tsc)
+{
+	int begin, end;
+
+	if (!index || !entry)
+		return -pte_invalid;
+
+	/* The TSC is carried forward so it is enough to check the last record
+	 * for timing information.
+	 */
+	if (!index->nrecords || !index->record[index->nrecords - 1].tsc)
+		return -pte_no_time;
+
+	/* Find the first record behind @tsc. */
+	begin = 0;
+	end = index->nrecords;
+	while (begin < end) {
+		int mid;
+
+		mid = begin + ((end - begin) / 2);
+		if (tsc < index->record[mid].tsc)
+			end = mid;
+		else
+			begin = mid + 1;
+	}
+
+	/* A carried forward TSC is only a lower bound.  Go back to the PSB that
+	 * actually gave it so we don't start too late.
+	 */
+	begin -= 1;
+	while ((0 < begin) && !(index->record[begin].flags & ppr_tsc) &&
+	       (index->record[begin - 1].tsc == index->record[begin].tsc))
+		begin -= 1;
+
+	return pt_psb_index_entry(entry, size, index, begin);
+}
@@ -127,11 +127,59 @@ struct pt_query_decoder *pt_qry_alloc_decoder(const struct pt_config *config)
 	return decoder;
 }
 
+static int pt_qry_stream_decoder_init(struct pt_query_decoder *decoder,
+				      const struct pt_config *uconfig)
+{
+	struct pt_stream stream;
+	struct pt_config config;
+	int errcode;
+
+	if (!decoder)
+		return -pte_internal;
+
+	errcode = pt_stream_init(&stream);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_stream_config(&config, uconfig, &stream);
+	if (errcode >= 0)
+		errcode = pt_qry_decoder_init(decoder, &config);
+
+	if (errcode < 0) {
+		pt_stream_fini(&stream);
+		return errcode;
+	}
+
+	decoder->stream = stream;
+
+	return 0;
+}
+
+struct pt_query_decoder *
+pt_qry_alloc_stream_decoder(const struct pt_config *config)
+{
+	struct pt_query_decoder *decoder;
+	int errcode;
+
+	decoder = malloc(sizeof(*decoder));
+	if (!decoder)
+		return NULL;
+
+	errcode = pt_qry_stream_decoder_init(decoder, config);
+	if (errcode < 0) {
+		free(decoder);
+		return NULL;
+	}
+
+	return decoder;
+}
+
 void pt_qry_decoder_fini(struct pt_query_decoder *decoder)
 {
-	(void) decoder;
+	if (!decoder)
+		return;
 
-	/* Nothing to do. */
+	pt_stream_fini(&decoder->stream);
 }
 
 void pt_qry_free_decoder(struct pt_query_decoder *decoder)
@@ -203,7 +251,11 @@ static int pt_qry_will_eos(const struct pt_query_decoder *decoder)
 	 * Let's fetch again.
 	 */
 	errcode = pt_df_fetch(&dfun, decoder->pos, &decoder->config);
-	return errcode == -pte_eos;
+	if (errcode != -pte_eos)
+		return 0;
+
+	/* We're not at the end while more trace may be appended. */
+	return !pt_stream_is_open(&decoder->stream);
 }
 
 static int pt_qry_status_flags(const struct pt_query_decoder *decoder)
@@ -249,7 +301,7 @@ static int pt_qry_provoke_fetch_error(const struct pt_query_decoder *decoder)
 	/* Repeat the decoder fetch to reproduce the error. */
 	errcode = pt_df_fetch(&dfun, decoder->pos, &decoder->config);
 	if (errcode < 0)
-		return errcode;
+		return pt_stream_suspend(&decoder->stream, errcode);
 
 	/* We must get some error or something's wrong. */
 	return -pte_internal;
@@ -347,10 +399,17 @@ static int pt_qry_start(struct pt_query_decoder *decoder, const uint8_t *pos,
 			addr = NULL;
 	}
 
-	/* Read ahead until the first query-relevant packet. */
+	/* Read ahead until the first query-relevant packet.
+	 *
+	 * In streaming mode, we may run out of trace.  We will continue
+	 * reading ahead when more trace is appended.
+	 */
 	errcode = pt_qry_read_ahead(decoder);
-	if (errcode < 0)
-		return errcode;
+	if (errcode < 0) {
+		errcode = pt_stream_suspend(&decoder->stream, errcode);
+		if (errcode != -pte_suspended)
+			return errcode;
+	}
 
 	/* We return the current decoder status. */
 	status = pt_qry_status_flags(decoder);
@@ -576,7 +635,7 @@ int pt_qry_sync_forward(struct pt_query_decoder *decoder, uint64_t *ip)
 
 	errcode = pt_sync_forward(&sync, pos, &decoder->config);
 	if (errcode < 0)
-		return errcode;
+		return pt_stream_suspend(&decoder->stream, errcode);
 
 	return pt_qry_start(decoder, sync, ip);
 }
@@ -626,16 +685,22 @@ int pt_qry_sync_set(struct pt_query_decoder *decoder, uint64_t *ip,
 		    uint64_t offset)
 {
 	const uint8_t *sync, *pos;
+	uint64_t base;
 	int errcode;
 
 	if (!decoder)
 		return -pte_invalid;
 
-	pos = decoder->config.begin + offset;
+	/* The trace before @base has been discarded. */
+	base = decoder->stream.base;
+	if (offset < base)
+		return -pte_eos;
+
+	pos = decoder->config.begin + (offset - base);
 
 	errcode = pt_sync_set(&sync, pos, &decoder->config);
 	if (errcode < 0)
-		return errcode;
+		return pt_stream_suspend(&decoder->stream, errcode);
 
 	return pt_qry_start(decoder, sync, ip);
 }
@@ -653,7 +718,7 @@ int pt_qry_get_offset(const struct pt_query_decoder *decoder, uint64_t *offset)
 	if (!pos)
 		return -pte_nosync;
 
-	*offset = pos - begin;
+	*offset = decoder->stream.base + (uint64_t) (pos - begin);
 	return 0;
 }
 
@@ -671,7 +736,7 @@ int pt_qry_get_sync_offset(const struct pt_query_decoder *decoder,
 	if (!sync)
 		return -pte_nosync;
 
-	*offset = sync - begin;
+	*offset = decoder->stream.base + (uint64_t) (sync - begin);
 	return 0;
 }
 
@@ -684,6 +749,128 @@ pt_qry_get_config(const struct pt_query_decoder *decoder)
 	return &decoder->config;
 }
 
+/* Extend @decoder's trace buffer after appending trace or closing the stream.
+ *
+ * The trace buffer ended at @end before.  It is extended to the last PSB in
+ * the stream after @scan or to the end of the stream if it has been closed.
+ *
+ * If @decoder had been suspended at @end, it continues reading ahead.
+ *
+ * Returns a non-negative pt_status_flag bit-vector on success, a negative
+ * error code otherwise.
+ */
+static int pt_qry_resume(struct pt_query_decoder *decoder, const uint8_t *end,
+			 const uint8_t *scan)
+{
+	const struct pt_stream *stream;
+	const uint8_t *psb;
+	int errcode;
+
+	if (!decoder || !end || !scan)
+		return -pte_internal;
+
+	stream = &decoder->stream;
+	if (stream->closed)
+		psb = stream->buffer + stream->size;
+	else {
+		struct pt_config config;
+
+		/* A PSB may start in the trace we had before.  It can't have
+		 * ended there or we would have found it already.
+		 */
+		if (scan < end)
+			scan = end;
+
+		config = decoder->config;
+		config.begin = (uint8_t *) scan;
+		config.end = stream->buffer + stream->size;
+
+		errcode = pt_sync_backward(&psb, config.end, &config);
+		if (errcode < 0) {
+			if (errcode != -pte_eos)
+				return errcode;
+
+			psb = end;
+		}
+	}
+
+	decoder->config.end = (uint8_t *) psb;
+
+	/* Continue where we stopped if we ran out of trace. */
+	if (decoder->pos && (decoder->pos == end) && !decoder->next &&
+	    (end < psb)) {
+		errcode = pt_qry_read_ahead(decoder);
+		if ((errcode < 0) && (errcode != -pte_eos))
+			return errcode;
+	}
+
+	return pt_qry_status_flags(decoder);
+}
+
+int pt_qry_append(struct pt_query_decoder *decoder, const uint8_t *buffer,
+		  size_t size)
+{
+	struct pt_stream *stream;
+	const uint8_t *begin;
+	uint64_t pos, sync, end, scan;
+	size_t discard;
+	int errcode;
+
+	if (!decoder)
+		return -pte_invalid;
+
+	stream = &decoder->stream;
+	begin = decoder->config.begin;
+
+	/* Remember the decoder's position as stream offsets.  We may discard
+	 * everything before the last PSB.
+	 */
+	pos = decoder->pos ? stream->base + (decoder->pos - begin) : 0ull;
+	sync = decoder->sync ? stream->base + (decoder->sync - begin) : 0ull;
+	end = stream->base + (decoder->config.end - begin);
+	discard = decoder->sync ? (size_t) (decoder->sync - begin) : 0;
+
+	/* We only need to search the new trace for PSBs. */
+	scan = stream->base + stream->size;
+	if (scan < ptps_psb)
+		scan = 0ull;
+	else
+		scan -= ptps_psb - 1;
+
+	errcode = pt_stream_append(stream, buffer, size, discard);
+	if (errcode < 0)
+		return errcode;
+
+	if (decoder->pos)
+		decoder->pos = stream->buffer + (pos - stream->base);
+
+	if (decoder->sync)
+		decoder->sync = stream->buffer + (sync - stream->base);
+
+	if (scan < stream->base)
+		scan = stream->base;
+
+	decoder->config.begin = stream->buffer;
+	decoder->config.end = stream->buffer + (end - stream->base);
+
+	return pt_qry_resume(decoder, decoder->config.end,
+			     stream->buffer + (scan - stream->base));
+}
+
+int pt_qry_close(struct pt_query_decoder *decoder)
+{
+	if (!decoder)
+		return -pte_invalid;
+
+	if (!decoder->stream.buffer)
+		return -pte_not_supported;
+
+	decoder->stream.closed = 1;
+
+	return pt_qry_resume(decoder, decoder->config.end,
+			     decoder->config.end);
+}
+
 static int pt_qry_cache_tnt(struct pt_query_decoder *decoder)
 {
 	int errcode;
@@ -730,7 +917,7 @@ static int pt_qry_cache_tnt(struct pt_query_decoder *decoder)
 		/* Read ahead until the next query-relevant packet. */
 		errcode = pt_qry_read_ahead(decoder);
 		if (errcode)
-			return errcode;
+			return pt_stream_suspend(&decoder->stream, errcode);
 	}
 
 	/* Preserve the time at the TNT packet. */
@@ -757,7 +944,7 @@ int pt_qry_cond_branch(struct pt_query_decoder *decoder, int *taken)
 	if (pt_tnt_cache_is_empty(&decoder->tnt)) {
 		errcode = pt_qry_cache_tnt(decoder);
 		if (errcode < 0)
-			return errcode;
+			return pt_stream_suspend(&decoder->stream, errcode);
 	}
 
 	query = pt_tnt_cache_query(&decoder->tnt);
@@ -836,7 +1023,7 @@ int pt_qry_indirect_branch(struct pt_query_decoder *decoder, uint64_t *addr)
 		/* Read ahead until the next query-relevant packet. */
 		errcode = pt_qry_read_ahead(decoder);
 		if (errcode)
-			return errcode;
+			return pt_stream_suspend(&decoder->stream, errcode);
 	}
 
 	/* Preserve the time at the TIP packet. */
@@ -918,7 +1105,7 @@ int pt_qry_event(struct pt_query_decoder *decoder, struct pt_event *event,
 		/* Read ahead until the next query-relevant packet. */
 		errcode = pt_qry_read_ahead(decoder);
 		if (errcode)
-			return errcode;
+			return pt_stream_suspend(&decoder->stream, errcode);
 	}
 
 	/* Preserve the time at the event. */
@@ -28,6 +28,7 @@
 
 #include "pt_section.h"
 #include "pt_block_cache.h"
+#include "pt_insn_cache.h"
 #include "pt_image_section_cache.h"
 
 #include "intel-pt.h"
@@ -366,16 +367,30 @@ static int pt_section_bcache_memsize(const struct pt_section *section,
 		return 0;
 	}
 
-	*psize = sizeof(*bcache) +
-		(bcache->nentries * sizeof(struct pt_bcache_entry));
+	return pt_bcache_memsize(bcache, psize);
+}
 
-	return 0;
+static int pt_section_icache_memsize(const struct pt_section *section,
+				     uint64_t *psize)
+{
+	struct pt_insn_cache *icache;
+
+	if (!section || !psize)
+		return -pte_internal;
+
+	icache = section->icache;
+	if (!icache) {
+		*psize = 0ull;
+		return 0;
+	}
+
+	return pt_icache_memsize(icache, psize);
 }
 
 static int pt_section_memsize_locked(const struct pt_section *section,
 				     uint64_t *psize)
 {
-	uint64_t msize, bcsize;
+	uint64_t msize, bcsize, icsize;
 	int (*memsize)(const struct pt_section *section, uint64_t *size);
 	int errcode;
 
@@ -399,7 +414,11 @@ static int pt_section_memsize_locked(const struct pt_section *section,
 	if (errcode < 0)
 		return errcode;
 
-	*psize = msize + bcsize;
+	errcode = pt_section_icache_memsize(section, &icsize);
+	if (errcode < 0)
+		return errcode;
+
+	*psize = msize + bcsize + icsize;
 
 	return 0;
 }
@@ -429,12 +448,133 @@ uint64_t pt_section_offset(const struct pt_section *section)
 	return section->offset;
 }
 
+/* Compute the content hash of @section.
+ *
+ * We use the 64-bit FNV-1a hash.  The section must be mapped.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_section_hash(uint64_t *phash, const struct pt_section *section)
+{
+	uint8_t buffer[0x1000];
+	uint64_t hash, offset, size;
+
+	if (!phash || !section)
+		return -pte_internal;
+
+	hash = 0xcbf29ce484222325ull;
+	size = pt_section_size(section);
+	for (offset = 0ull; offset < size;) {
+		int status, idx;
+
+		status = pt_section_read(section, buffer, sizeof(buffer),
+					 offset);
+		if (status <= 0)
+			return (status < 0) ? status : -pte_internal;
+
+		for (idx = 0; idx < status; ++idx) {
+			hash ^= buffer[idx];
+			hash *= 0x100000001b3ull;
+		}
+
+		offset += (uint64_t) status;
+	}
+
+	*phash = hash;
+	return 0;
+}
+
+/* Compute the name of @section's persistent block cache file in @dir.
+ *
+ * The name is derived from @section's content @hash, offset, and size.
+ *
+ * Returns the name on success, NULL otherwise.
+ */
+static char *pt_section_bcache_name(const struct pt_section *section,
+				    const char *dir, uint64_t hash)
+{
+	char *name;
+	size_t size;
+	int len;
+
+	if (!section || !dir)
+		return NULL;
+
+	/* The directory plus three 64-bit hex numbers with separators and
+	 * extension.
+	 */
+	size = strlen(dir) + (3 * 17) + sizeof(".bcache");
+
+	name = malloc(size);
+	if (!name)
+		return NULL;
+
+	len = snprintf(name, size, "%s/%016llx-%llx-%llx.bcache", dir,
+		       (unsigned long long) hash,
+		       (unsigned long long) section->offset,
+		       (unsigned long long) section->size);
+	if ((len < 0) || (size <= (size_t) len)) {
+		free(name);
+		return NULL;
+	}
+
+	return name;
+}
+
+/* Determine the name of @section's persistent block cache file.
+ *
+ * Provides NULL in @pname if the block cache shall not be persisted.
+ *
+ * The content hash is computed on first use and kept in @section.
+ *
+ * The attach lock must be held.  The section must be mapped.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_section_bcache_file(char **pname, struct pt_section *section)
+{
+	char *dir;
+	int errcode;
+
+	if (!pname || !section)
+		return -pte_internal;
+
+	*pname = NULL;
+
+	if (!section->iscache)
+		return 0;
+
+	errcode = pt_iscache_bcache_dir(section->iscache, &dir);
+	if (errcode < 0)
+		return errcode;
+
+	if (!dir)
+		return 0;
+
+	if (!section->bchashed) {
+		errcode = pt_section_hash(&section->bchash, section);
+		if (errcode < 0)
+			goto out;
+
+		section->bchashed = 1;
+	}
+
+	*pname = pt_section_bcache_name(section, dir, section->bchash);
+	if (!*pname)
+		errcode = -pte_nomem;
+
+out:
+	free(dir);
+	return errcode;
+}
+
 int pt_section_alloc_bcache(struct pt_section *section)
 {
 	struct pt_image_section_cache *iscache;
 	struct pt_block_cache *bcache;
 	uint64_t ssize, memsize;
-	uint32_t csize;
+	uint32_t csize, flags;
+	char *bcname;
 	int errcode;
 
 	if (!section)
@@ -463,6 +603,24 @@ int pt_section_alloc_bcache(struct pt_section *section)
 	if (errcode < 0)
 		return errcode;
 
+	/* Hashing the section is expensive.  Do it outside of the section lock
+	 * unless some other thread already installed the block cache.
+	 */
+	bcname = NULL;
+	if (!pt_section_bcache(section)) {
+		errcode = pt_section_bcache_file(&bcname, section);
+		if (errcode < 0)
+			goto out_alock;
+	}
+
+	flags = 0u;
+	iscache = section->iscache;
+	if (iscache) {
+		errcode = pt_iscache_map_flags(iscache, &flags);
+		if (errcode < 0)
+			goto out_alock;
+	}
+
 	errcode = pt_section_lock(section);
 	if (errcode < 0)
 		goto out_alock;
@@ -473,12 +631,28 @@ int pt_section_alloc_bcache(struct pt_section *section)
 		goto out_lock;
 	}
 
-	bcache = pt_bcache_alloc(csize);
+	if (flags & ptmf_wide_bcache)
+		bcache = pt_bcache_alloc_wide(csize);
+	else
+		bcache = pt_bcache_alloc(csize);
 	if (!bcache) {
 		errcode = -pte_nomem;
 		goto out_lock;
 	}
 
+	if (bcname) {
+		errcode = pt_bcache_load(bcache, bcname, section->bchash);
+		if (errcode < 0) {
+			pt_bcache_free(bcache);
+			goto out_lock;
+		}
+
+		section->bcname = bcname;
+		section->bcvalid = (uint32_t) errcode;
+
+		bcname = NULL;
+	}
+
 	/* Install the block cache.  It will become visible and may be used
 	 * immediately.
 	 *
@@ -508,6 +682,111 @@ int pt_section_alloc_bcache(struct pt_section *section)
 	return pt_section_unlock_attach(section);
 
 
+out_lock:
+	(void) pt_section_unlock(section);
+
+out_alock:
+	(void) pt_section_unlock_attach(section);
+	free(bcname);
+	return errcode;
+}
+
+/* Check whether instruction caches are supported on this host.
+ *
+ * Instruction cache entries are read and written without locking.  We rely on
+ * 64-bit loads and stores being atomic, which they are not on 32-bit hosts.
+ *
+ * Returns zero if they are, -pte_not_supported otherwise.
+ */
+static int pt_section_icache_supported(void)
+{
+#if (UINTPTR_MAX < UINT64_MAX)
+	return -pte_not_supported;
+#else
+	return 0;
+#endif
+}
+
+int pt_section_alloc_icache(struct pt_section *section)
+{
+	struct pt_image_section_cache *iscache;
+	struct pt_insn_cache *icache;
+	uint64_t ssize, memsize;
+	uint32_t csize;
+	int errcode;
+
+	if (!section)
+		return -pte_internal;
+
+	if (!section->mcount)
+		return -pte_internal;
+
+	errcode = pt_section_icache_supported();
+	if (errcode < 0)
+		return errcode;
+
+	ssize = pt_section_size(section);
+	csize = (uint32_t) ssize;
+
+	if (csize != ssize)
+		return -pte_not_supported;
+
+	memsize = 0ull;
+
+	/* We need to take both the attach and the section lock in order to pair
+	 * the instruction cache allocation and the resize notification.
+	 *
+	 * See pt_section_alloc_bcache().
+	 */
+	errcode = pt_section_lock_attach(section);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_section_lock(section);
+	if (errcode < 0)
+		goto out_alock;
+
+	icache = pt_section_icache(section);
+	if (icache) {
+		errcode = 0;
+		goto out_lock;
+	}
+
+	icache = pt_icache_alloc(csize);
+	if (!icache) {
+		errcode = -pte_nomem;
+		goto out_lock;
+	}
+
+	/* Install the instruction cache.  It will become visible and may be
+	 * used immediately.
+	 *
+	 * If we fail later on, we leave the instruction cache and report the
+	 * error to the allocating decoder thread.
+	 */
+	section->icache = icache;
+
+	errcode = pt_section_memsize_locked(section, &memsize);
+	if (errcode < 0)
+		goto out_lock;
+
+	errcode = pt_section_unlock(section);
+	if (errcode < 0)
+		goto out_alock;
+
+	if (memsize) {
+		iscache = section->iscache;
+		if (iscache) {
+			errcode = pt_iscache_notify_resize(iscache, section,
+							  memsize);
+			if (errcode < 0)
+				goto out_alock;
+		}
+	}
+
+	return pt_section_unlock_attach(section);
+
+
 out_lock:
 	(void) pt_section_unlock(section);
 
@@ -548,6 +827,32 @@ int pt_section_on_map_lock(struct pt_section *section)
 	return status;
 }
 
+int pt_section_map_flags_lock(struct pt_section *section, uint32_t *flags)
+{
+	struct pt_image_section_cache *iscache;
+	int errcode, status;
+
+	if (!section || !flags)
+		return -pte_internal;
+
+	errcode = pt_section_lock_attach(section);
+	if (errcode < 0)
+		return errcode;
+
+	*flags = 0u;
+	status = 0;
+
+	iscache = section->iscache;
+	if (iscache)
+		status = pt_iscache_map_flags(iscache, flags);
+
+	errcode = pt_section_unlock_attach(section);
+	if (errcode < 0)
+		return errcode;
+
+	return status;
+}
+
 int pt_section_map_share(struct pt_section *section)
 {
 	uint16_t mcount;
@@ -579,7 +884,11 @@ int pt_section_map_share(struct pt_section *section)
 
 int pt_section_unmap(struct pt_section *section)
 {
+	struct pt_block_cache *bcache;
+	uint64_t bchash;
+	uint32_t bcvalid;
 	uint16_t mcount;
+	char *bcname;
 	int errcode, status;
 
 	if (!section)
@@ -605,10 +914,30 @@ int pt_section_unmap(struct pt_section *section)
 
 	status = section->unmap(section);
 
-	pt_bcache_free(section->bcache);
+	/* Storing the block cache may take a while.  We detach it from the
+	 * section and store it after releasing the section lock so we don't
+	 * block other decoders that map this section in the meantime.
+	 */
+	bcache = section->bcache;
+	bcname = section->bcname;
+	bchash = section->bchash;
+	bcvalid = section->bcvalid;
+
 	section->bcache = NULL;
+	section->bcname = NULL;
+
+	pt_icache_free(section->icache);
+	section->icache = NULL;
 
 	errcode = pt_section_unlock(section);
+
+	/* The block cache is an optimization.  We ignore errors storing it. */
+	if (bcache && bcname)
+		(void) pt_bcache_store(bcache, bcname, bchash, &bcvalid);
+
+	pt_bcache_free(bcache);
+	free(bcname);
+
 	if (errcode < 0)
 		return errcode;
 
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pt_stream.h"
+
+#include "intel-pt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	/* The initial size of a trace stream buffer in bytes. */
+	pt_stream_initial_capacity	= 0x1000
+};
+
+
+int pt_stream_init(struct pt_stream *stream)
+{
+	if (!stream)
+		return -pte_internal;
+
+	memset(stream, 0, sizeof(*stream));
+
+	stream->buffer = malloc(pt_stream_initial_capacity);
+	if (!stream->buffer)
+		return -pte_nomem;
+
+	stream->capacity = pt_stream_initial_capacity;
+
+	return 0;
+}
+
+void pt_stream_fini(struct pt_stream *stream)
+{
+	if (!stream)
+		return;
+
+	free(stream->buffer);
+	stream->buffer = NULL;
+}
+
+int pt_stream_config(struct pt_config *config,
+		     const struct pt_config *uconfig,
+		     const struct pt_stream *stream)
+{
+	size_t size;
+
+	if (!config || !stream)
+		return -pte_internal;
+
+	if (!uconfig)
+		return -pte_invalid;
+
+	/* Copy only what the user provided.  The decoder's init function will
+	 * check the size and zero out the rest.
+	 */
+	size = uconfig->size;
+	if (sizeof(*config) < size)
+		size = sizeof(*config);
+
+	memset(config, 0, sizeof(*config));
+	memcpy(config, uconfig, size);
+
+	config->begin = stream->buffer;
+	config->end = stream->buffer + stream->size;
+
+	return 0;
+}
+
+int pt_stream_append(struct pt_stream *stream, const uint8_t *buffer,
+		     size_t size, size_t discard)
+{
+	size_t keep, required;
+
+	if (!stream)
+		return -pte_internal;
+
+	if (!buffer && size)
+		return -pte_invalid;
+
+	if (!stream->buffer)
+		return -pte_not_supported;
+
+	if (stream->closed)
+		return -pte_eos;
+
+	if (stream->size < discard)
+		return -pte_internal;
+
+	keep = stream->size - discard;
+	required = keep + size;
+	if (required < keep)
+		return -pte_nomem;
+
+	if (stream->capacity < required) {
+		uint8_t *grown;
+		size_t capacity;
+
+		capacity = stream->capacity * 2;
+		if (capacity < required)
+			capacity = required;
+
+		grown = malloc(capacity);
+		if (!grown)
+			return -pte_nomem;
+
+		memcpy(grown, stream->buffer + discard, keep);
+		free(stream->buffer);
+
+		stream->buffer = grown;
+		stream->capacity = capacity;
+	} else if ((stream->capacity - stream->size) < size ||
+		   (keep < discard)) {
+		/* Move the remaining trace to the front if we need the space
+		 * or if most of the buffer is no longer needed.
+		 */
+		memmove(stream->buffer, stream->buffer + discard, keep);
+	} else
+		discard = 0;
+
+	stream->base += discard;
+	stream->size -= discard;
+
+	if (size)
+		memcpy(stream->buffer + stream->size, buffer, size);
+
+	stream->size += size;
+
+	return 0;
+}
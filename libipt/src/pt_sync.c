@@ -32,6 +32,19 @@
 
 #include "intel-pt.h"
 
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (__GNUC__ >= 5))
+#  include <immintrin.h>
+#  define PT_SYNC_SIMD
+#  define pt_sync_target(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <intrin.h>
+#  define PT_SYNC_SIMD
+#  define pt_sync_target(isa)
+#endif
+
 
 /* A psb packet contains a unique 2-byte repeating pattern.
  *
@@ -59,6 +72,293 @@ static const uint8_t *align(const uint8_t *pointer, size_t alignment)
 	return truncate(pointer + alignment - 1, alignment);
 }
 
+/* Find the next 64bit word of psb payload pattern.
+ *
+ * Search forward in steps of 64bit words starting at @pos for a word that
+ * matches psb_pattern and that lies completely before @end.
+ *
+ * Returns a pointer to the first such word, NULL if there is none.
+ */
+typedef const uint8_t *(*pt_sync_fwd_t)(const uint8_t *pos,
+					const uint8_t *end);
+
+/* Find the previous 64bit word of psb payload pattern.
+ *
+ * Search backward in steps of 64bit words ending at @pos for a word that
+ * matches psb_pattern and that lies completely behind @begin.
+ *
+ * Returns a pointer to the last such word, NULL if there is none.
+ */
+typedef const uint8_t *(*pt_sync_bwd_t)(const uint8_t *begin,
+					const uint8_t *pos);
+
+static int pt_is_psb_word(const uint8_t *pos)
+{
+	uint64_t val;
+
+	val = * (const uint64_t *) pos;
+
+	return (val == psb_pattern[0]) || (val == psb_pattern[1]);
+}
+
+static const uint8_t *pt_sync_fwd_scalar(const uint8_t *pos,
+					 const uint8_t *end)
+{
+	for (; sizeof(uint64_t) <= (size_t) (end - pos);
+	     pos += sizeof(uint64_t)) {
+		if (pt_is_psb_word(pos))
+			return pos;
+	}
+
+	return NULL;
+}
+
+static const uint8_t *pt_sync_bwd_scalar(const uint8_t *begin,
+					 const uint8_t *pos)
+{
+	while (sizeof(uint64_t) <= (size_t) (pos - begin)) {
+		pos -= sizeof(uint64_t);
+
+		if (pt_is_psb_word(pos))
+			return pos;
+	}
+
+	return NULL;
+}
+
+#if defined(PT_SYNC_SIMD)
+
+/* Compare 16 bytes at @pos against psb_pattern.
+ *
+ * SSE2 can't compare 64bit elements.  A 64bit word matches if both of its
+ * 32bit halves match the same pattern.
+ *
+ * Returns a bit-vector with bit 2*i set if the i-th word matches.
+ */
+static pt_sync_target("sse2") int pt_psb_words_sse2(const uint8_t *pos)
+{
+	__m128i val, lohi, hilo;
+	int mlohi, mhilo;
+
+	lohi = _mm_set1_epi32((int) (uint32_t) psb_pattern[0]);
+	hilo = _mm_set1_epi32((int) (uint32_t) psb_pattern[1]);
+
+	val = _mm_loadu_si128((const __m128i *) pos);
+
+	mlohi = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(val, lohi)));
+	mhilo = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(val, hilo)));
+
+	return ((mlohi & (mlohi >> 1)) | (mhilo & (mhilo >> 1))) & 0x5;
+}
+
+static pt_sync_target("sse2")
+const uint8_t *pt_sync_fwd_sse2(const uint8_t *pos, const uint8_t *end)
+{
+	for (; 32 <= (size_t) (end - pos); pos += 32) {
+		int match, word;
+
+		match = pt_psb_words_sse2(pos);
+		match |= pt_psb_words_sse2(pos + 16) << 4;
+		if (!match)
+			continue;
+
+		for (word = 0; word < 4; ++word) {
+			if (match & (1 << (word * 2)))
+				return pos + (word * sizeof(uint64_t));
+		}
+	}
+
+	return pt_sync_fwd_scalar(pos, end);
+}
+
+static pt_sync_target("sse2")
+const uint8_t *pt_sync_bwd_sse2(const uint8_t *begin, const uint8_t *pos)
+{
+	while (32 <= (size_t) (pos - begin)) {
+		int match, word;
+
+		pos -= 32;
+
+		match = pt_psb_words_sse2(pos);
+		match |= pt_psb_words_sse2(pos + 16) << 4;
+		if (!match)
+			continue;
+
+		for (word = 3; 0 <= word; --word) {
+			if (match & (1 << (word * 2)))
+				return pos + (word * sizeof(uint64_t));
+		}
+	}
+
+	return pt_sync_bwd_scalar(begin, pos);
+}
+
+/* Compare 64 bytes at @pos against psb_pattern.
+ *
+ * Returns a bit-vector with bit i set if the i-th word matches.
+ */
+static pt_sync_target("avx2") int pt_psb_words_avx2(const uint8_t *pos)
+{
+	__m256i lo, hi, lohi, hilo;
+	int mlo, mhi;
+
+	lohi = _mm256_set1_epi64x((long long) psb_pattern[0]);
+	hilo = _mm256_set1_epi64x((long long) psb_pattern[1]);
+
+	lo = _mm256_loadu_si256((const __m256i *) pos);
+	hi = _mm256_loadu_si256((const __m256i *) (pos + 32));
+
+	mlo = _mm256_movemask_pd(_mm256_castsi256_pd(
+		_mm256_or_si256(_mm256_cmpeq_epi64(lo, lohi),
+				_mm256_cmpeq_epi64(lo, hilo))));
+	mhi = _mm256_movemask_pd(_mm256_castsi256_pd(
+		_mm256_or_si256(_mm256_cmpeq_epi64(hi, lohi),
+				_mm256_cmpeq_epi64(hi, hilo))));
+
+	return mlo | (mhi << 4);
+}
+
+static pt_sync_target("avx2")
+const uint8_t *pt_sync_fwd_avx2(const uint8_t *pos, const uint8_t *end)
+{
+	for (; 64 <= (size_t) (end - pos); pos += 64) {
+		int match, word;
+
+		match = pt_psb_words_avx2(pos);
+		if (!match)
+			continue;
+
+		for (word = 0; word < 8; ++word) {
+			if (match & (1 << word))
+				return pos + (word * sizeof(uint64_t));
+		}
+	}
+
+	return pt_sync_fwd_sse2(pos, end);
+}
+
+static pt_sync_target("avx2")
+const uint8_t *pt_sync_bwd_avx2(const uint8_t *begin, const uint8_t *pos)
+{
+	while (64 <= (size_t) (pos - begin)) {
+		int match, word;
+
+		pos -= 64;
+
+		match = pt_psb_words_avx2(pos);
+		if (!match)
+			continue;
+
+		for (word = 7; 0 <= word; --word) {
+			if (match & (1 << word))
+				return pos + (word * sizeof(uint64_t));
+		}
+	}
+
+	return pt_sync_bwd_sse2(begin, pos);
+}
+
+#if defined(_MSC_VER)
+
+static int pt_sync_has_sse2(void)
+{
+	int info[4];
+
+	__cpuid(info, 1);
+
+	return (info[3] >> 26) & 1;
+}
+
+static int pt_sync_has_avx2(void)
+{
+	int info[4];
+
+	/* Check that the OS saves the ymm registers. */
+	__cpuid(info, 1);
+	if (!((info[2] >> 27) & 1) || !((info[2] >> 28) & 1))
+		return 0;
+
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return 0;
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] >> 5) & 1;
+}
+
+#else /* defined(_MSC_VER) */
+
+static int pt_sync_has_sse2(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("sse2");
+}
+
+static int pt_sync_has_avx2(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif /* defined(_MSC_VER) */
+#endif /* defined(PT_SYNC_SIMD) */
+
+/* The psb payload pattern search used by pt_sync_forward() and
+ * pt_sync_backward().
+ *
+ * We start with the scalar search.  The best search supported by the
+ * processor is selected by pt_sync_init() when the library is loaded.
+ */
+static pt_sync_fwd_t pt_sync_fwd = pt_sync_fwd_scalar;
+static pt_sync_bwd_t pt_sync_bwd = pt_sync_bwd_scalar;
+
+int pt_sync_set_search(enum pt_sync_search search)
+{
+	switch (search) {
+	case pt_sync_search_scalar:
+		pt_sync_fwd = pt_sync_fwd_scalar;
+		pt_sync_bwd = pt_sync_bwd_scalar;
+		return 0;
+
+#if defined(PT_SYNC_SIMD)
+	case pt_sync_search_sse2:
+		if (!pt_sync_has_sse2())
+			return -pte_not_supported;
+
+		pt_sync_fwd = pt_sync_fwd_sse2;
+		pt_sync_bwd = pt_sync_bwd_sse2;
+		return 0;
+
+	case pt_sync_search_avx2:
+		if (!pt_sync_has_sse2() || !pt_sync_has_avx2())
+			return -pte_not_supported;
+
+		pt_sync_fwd = pt_sync_fwd_avx2;
+		pt_sync_bwd = pt_sync_bwd_avx2;
+		return 0;
+#else
+	case pt_sync_search_sse2:
+	case pt_sync_search_avx2:
+		return -pte_not_supported;
+#endif
+	}
+
+	return -pte_invalid;
+}
+
+void pt_sync_init(void)
+{
+	if (pt_sync_set_search(pt_sync_search_avx2) >= 0)
+		return;
+
+	if (pt_sync_set_search(pt_sync_search_sse2) >= 0)
+		return;
+
+	(void) pt_sync_set_search(pt_sync_search_scalar);
+}
+
 /* Find a psb packet given a position somewhere in the payload.
  *
  * Return the position of the psb packet.
@@ -174,20 +474,18 @@ int pt_sync_forward(const uint8_t **sync, const uint8_t *pos,
 
 	/* We search for a full 64bit word. It's OK to skip the current one. */
 	pos = align(pos, sizeof(*psb_pattern));
+	if (end < pos)
+		return -pte_eos;
 
 	/* Search for the psb payload pattern in the buffer. */
 	for (;;) {
-		const uint8_t *current = pos;
-		uint64_t val;
+		const uint8_t *current;
 
-		pos += sizeof(uint64_t);
-		if (end < pos)
+		current = pt_sync_fwd(pos, end);
+		if (!current)
 			return -pte_eos;
 
-		val = * (const uint64_t *) current;
-
-		if ((val != psb_pattern[0]) && (val != psb_pattern[1]))
-			continue;
+		pos = current + sizeof(uint64_t);
 
 		/* We found a 64bit word's worth of psb payload pattern. */
 		current = pt_find_psb(pos, config);
@@ -216,22 +514,19 @@ int pt_sync_backward(const uint8_t **sync, const uint8_t *pos,
 	/* We search for a full 64bit word. It's OK to skip the current one. */
 	pos = truncate(pos, sizeof(*psb_pattern));
 
+	if (pos < begin)
+		return -pte_eos;
+
 	/* Search for the psb payload pattern in the buffer. */
 	for (;;) {
-		const uint8_t *next = pos;
-		uint64_t val;
+		const uint8_t *next;
 
-		pos -= sizeof(uint64_t);
-		if (pos < begin)
+		pos = pt_sync_bwd(begin, pos);
+		if (!pos)
 			return -pte_eos;
 
-		val = * (const uint64_t *) pos;
-
-		if ((val != psb_pattern[0]) && (val != psb_pattern[1]))
-			continue;
-
 		/* We found a 64bit word's worth of psb payload pattern. */
-		next = pt_find_psb(next, config);
+		next = pt_find_psb(pos + sizeof(uint64_t), config);
 		if (!next)
 			continue;
 
@@ -27,6 +27,7 @@
  */
 
 #include "pt_ild.h"
+#include "pt_sync.h"
 
 #include <windows.h>
 
@@ -41,6 +42,9 @@ BOOLEAN WINAPI DllMain(HINSTANCE handle, DWORD reason, LPVOID reserved)
 		/* Initialize the Intel(R) Processor Trace instruction
 		   decoder. */
 		pt_ild_init();
+
+		/* Select the fastest trace synchronization search. */
+		pt_sync_init();
 		break;
 
 	default:
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit_mkfile.h"
+#include "ptunit_time.h"
+
+#include "pt_encoder.h"
+
+#include "intel-pt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+/* A micro-benchmark for the block cache entry formats.
+ *
+ * Generates synthetic kernel code consisting of long runs of straight-line
+ * code with near direct calls to a leaf function and a far direct jump and
+ * a trace that executes this code over and over again.
+ *
+ * Measures the throughput of the block decoder once the block cache has been
+ * filled with compact and with wide block cache entries for different lengths
+ * of straight-line code.
+ */
+
+enum {
+	/* The number of calls in the generated code. */
+	bench_calls		= 4,
+
+	/* The number of bytes the far jump jumps over. */
+	bench_gap		= 0x10000,
+
+	/* The number of times the trace executes the generated code. */
+	bench_loops		= 0x100,
+
+	/* The size of the trace buffer in bytes. */
+	bench_trace_size	= 0x1000,
+
+	/* The default number of times we decode the trace. */
+	bench_iterations	= 100
+};
+
+/* The load address of the generated code. */
+static const uint64_t bench_base = 0xffffffff81000000ull;
+
+/* The benchmark state. */
+struct bench {
+	/* The name of the temporary file holding the generated code. */
+	char *filename;
+
+	/* The size of the generated code in bytes. */
+	uint64_t size;
+
+	/* The synthetic trace. */
+	uint8_t trace[bench_trace_size];
+
+	/* The configuration for decoding the synthetic trace. */
+	struct pt_config config;
+
+	/* The number of times the trace is decoded. */
+	int iterations;
+};
+
+/* Emit @nnops three-byte NOPs at @code.
+ *
+ * Returns the number of bytes written.
+ */
+static size_t bench_nops(uint8_t *code, int nnops)
+{
+	int idx;
+
+	for (idx = 0; idx < nnops; ++idx) {
+		code[(3 * idx) + 0] = 0x0f;
+		code[(3 * idx) + 1] = 0x1f;
+		code[(3 * idx) + 2] = 0x00;
+	}
+
+	return (size_t) (3 * nnops);
+}
+
+/* Emit a near direct branch with opcode @opcode at @code to @dest.
+ *
+ * Returns the number of bytes written.
+ */
+static size_t bench_branch(uint8_t *code, uint8_t opcode, const uint8_t *dest)
+{
+	int32_t disp;
+
+	disp = (int32_t) (dest - (code + 5));
+
+	code[0] = opcode;
+	code[1] = (uint8_t) disp;
+	code[2] = (uint8_t) (disp >> 8);
+	code[3] = (uint8_t) (disp >> 16);
+	code[4] = (uint8_t) (disp >> 24);
+
+	return 5;
+}
+
+/* Generate code with runs of @nnops instructions.
+ *
+ *   (nop * @nnops; call leaf) * bench_calls
+ *   jmp far
+ *   int3 * bench_gap
+ * far:
+ *   nop * @nnops
+ *   jmp *%rax
+ * leaf:
+ *   ret
+ */
+static int bench_mkcode(struct bench *bench, int nnops)
+{
+	uint8_t *code, *pos, *leaf, *far;
+	size_t size, written;
+	FILE *file;
+	int errcode, call;
+
+	size = ((size_t) bench_calls * ((3 * (size_t) nnops) + 5)) + 5 +
+		bench_gap + (3 * (size_t) nnops) + 2 + 1;
+
+	code = malloc(size);
+	if (!code)
+		return -pte_nomem;
+
+	memset(code, 0xcc, size);
+
+	leaf = code + size - 1;
+	far = leaf - 2 - (3 * (size_t) nnops);
+
+	pos = code;
+	for (call = 0; call < bench_calls; ++call) {
+		pos += bench_nops(pos, nnops);
+		pos += bench_branch(pos, 0xe8, leaf);
+	}
+
+	(void) bench_branch(pos, 0xe9, far);
+
+	pos = far;
+	pos += bench_nops(pos, nnops);
+	pos[0] = 0xff;
+	pos[1] = 0xe0;
+
+	*leaf = 0xc3;
+
+	errcode = ptunit_mkfile(&file, &bench->filename, "wb");
+	if (errcode < 0) {
+		free(code);
+		return errcode;
+	}
+
+	written = fwrite(code, size, 1, file);
+	fclose(file);
+	free(code);
+
+	if (written != 1)
+		return -pte_bad_file;
+
+	bench->size = (uint64_t) size;
+
+	return 0;
+}
+
+/* Encode a trace that executes the generated code bench_loops times. */
+static int bench_mktrace(struct bench *bench)
+{
+	struct pt_encoder encoder;
+	uint64_t offset;
+	int errcode, loop;
+
+	memset(&bench->config, 0, sizeof(bench->config));
+	bench->config.size = sizeof(bench->config);
+	bench->config.begin = bench->trace;
+	bench->config.end = bench->trace + sizeof(bench->trace);
+
+	errcode = pt_encoder_init(&encoder, &bench->config);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_psb(&encoder);
+	if (errcode < 0)
+		goto out;
+
+	errcode = pt_encode_mode_exec(&encoder, ptem_64bit);
+	if (errcode < 0)
+		goto out;
+
+	errcode = pt_encode_psbend(&encoder);
+	if (errcode < 0)
+		goto out;
+
+	errcode = pt_encode_tip_pge(&encoder, bench_base, pt_ipc_sext_48);
+	if (errcode < 0)
+		goto out;
+
+	for (loop = 0; loop < bench_loops; ++loop) {
+		/* One taken bit per compressed return from leaf. */
+		errcode = pt_encode_tnt_8(&encoder, (1 << bench_calls) - 1,
+					  bench_calls);
+		if (errcode < 0)
+			goto out;
+
+		/* Disable tracing on the last indirect jump. */
+		if (loop == (bench_loops - 1))
+			errcode = pt_encode_tip_pgd(&encoder, bench_base,
+						    pt_ipc_update_16);
+		else
+			errcode = pt_encode_tip(&encoder, bench_base,
+						pt_ipc_update_16);
+		if (errcode < 0)
+			goto out;
+	}
+
+	errcode = pt_enc_get_offset(&encoder, &offset);
+	if (errcode < 0)
+		goto out;
+
+	bench->config.end = bench->trace + offset;
+
+out:
+	pt_encoder_fini(&encoder);
+	return errcode;
+}
+
+static void bench_fini(struct bench *bench)
+{
+	if (bench->filename) {
+		(void) remove(bench->filename);
+		free(bench->filename);
+		bench->filename = NULL;
+	}
+}
+
+/* Decode the trace once.
+ *
+ * Adds the number of decoded instructions and blocks to @ninsn and @nblocks.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int bench_decode(struct pt_block_decoder *decoder, uint64_t *ninsn,
+			uint64_t *nblocks)
+{
+	int status;
+
+	status = pt_blk_sync_set(decoder, 0ull);
+	for (;;) {
+		struct pt_block block;
+
+		while (status & pts_event_pending) {
+			struct pt_event event;
+
+			status = pt_blk_event(decoder, &event, sizeof(event));
+			if (status < 0)
+				break;
+		}
+
+		if (status < 0)
+			break;
+
+		status = pt_blk_next(decoder, &block, sizeof(block));
+		if (status < 0)
+			break;
+
+		*ninsn += block.ninsn;
+		*nblocks += 1;
+	}
+
+	if (status != -pte_eos)
+		return status;
+
+	return 0;
+}
+
+static int bench_run(const struct bench *bench, const char *name,
+		     uint32_t flags, int nnops)
+{
+	struct pt_image_section_cache *iscache;
+	struct pt_block_decoder *decoder;
+	struct pt_image *image;
+	uint64_t begin, end, ninsn, nblocks;
+	double seconds;
+	int errcode, isid, iteration;
+
+	iscache = pt_iscache_alloc(NULL);
+	if (!iscache)
+		return -pte_nomem;
+
+	image = pt_image_alloc(NULL);
+	if (!image) {
+		errcode = -pte_nomem;
+		goto out_iscache;
+	}
+
+	decoder = pt_blk_alloc_decoder(&bench->config);
+	if (!decoder) {
+		errcode = -pte_nomem;
+		goto out_image;
+	}
+
+	errcode = pt_iscache_set_map_flags(iscache, flags);
+	if (errcode < 0)
+		goto out;
+
+	isid = pt_iscache_add_file(iscache, bench->filename, 0ull, bench->size,
+				   bench_base);
+	if (isid < 0) {
+		errcode = isid;
+		goto out;
+	}
+
+	errcode = pt_image_add_cached(image, iscache, isid, NULL);
+	if (errcode < 0)
+		goto out;
+
+	errcode = pt_blk_set_image(decoder, image);
+	if (errcode < 0)
+		goto out;
+
+	/* Fill the block cache. */
+	ninsn = 0ull;
+	nblocks = 0ull;
+	errcode = bench_decode(decoder, &ninsn, &nblocks);
+	if (errcode < 0)
+		goto out;
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		goto out;
+
+	ninsn = 0ull;
+	nblocks = 0ull;
+	for (iteration = 0; iteration < bench->iterations; ++iteration) {
+		errcode = bench_decode(decoder, &ninsn, &nblocks);
+		if (errcode < 0)
+			goto out;
+	}
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		goto out;
+
+	seconds = (double) (end - begin) / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	printf("%-8s %6d nops %12" PRIu64 " insn %8" PRIu64 " blocks "
+	       "%8.3f s %10.2f Minsn/s\n", name, nnops, ninsn, nblocks,
+	       seconds, ((double) ninsn / seconds) / 1e6);
+
+out:
+	pt_blk_free_decoder(decoder);
+
+out_image:
+	pt_image_free(image);
+
+out_iscache:
+	pt_iscache_free(iscache);
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	static const int nnops[] = { 0x10, 0x100, 0x1000, 0x3000 };
+	struct bench bench;
+	int errcode, idx;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.iterations = bench_iterations;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [<iterations>]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2) {
+		bench.iterations = atoi(argv[1]);
+		if (bench.iterations <= 0) {
+			fprintf(stderr, "%s: bad iterations: %s\n", argv[0],
+				argv[1]);
+			return 1;
+		}
+	}
+
+	errcode = bench_mktrace(&bench);
+	for (idx = 0; (errcode >= 0) &&
+		     (idx < (int) (sizeof(nnops) / sizeof(*nnops))); ++idx) {
+		errcode = bench_mkcode(&bench, nnops[idx]);
+		if (errcode >= 0)
+			errcode = bench_run(&bench, "compact", 0u, nnops[idx]);
+		if (errcode >= 0)
+			errcode = bench_run(&bench, "wide", ptmf_wide_bcache,
+					    nnops[idx]);
+
+		bench_fini(&bench);
+	}
+
+	if (errcode < 0) {
+		fprintf(stderr, "%s: %s\n", argv[0],
+			pt_errstr(pt_errcode(errcode)));
+		return 1;
+	}
+
+	return 0;
+}
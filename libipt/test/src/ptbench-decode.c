@@ -0,0 +1,1080 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ptunit_mkfile.h"
+#include "ptunit_time.h"
+
+#include "pt_cpu.h"
+#include "pt_encoder.h"
+
+#include "intel-pt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+/* A throughput benchmark for the decoder layers.
+ *
+ * Encodes synthetic traces with different characteristics together with the
+ * code they execute:
+ *
+ *   tnt     - a tight loop that is dominated by long TNT packets
+ *   icall   - indirect calls and compressed returns
+ *   timing  - short TNT packets interleaved with CYC, MTC, and TSC packets
+ *   ovf     - short TNT packets interleaved with overflows
+ *
+ * Optionally adds a recorded trace together with raw memory images.
+ *
+ * Measures the throughput of the packet decoder in packets/s, of the query
+ * decoder in queries/s, of the instruction flow decoder in instructions/s,
+ * and of the block decoder in blocks/s and instructions/s.
+ *
+ * Results are printed as text or as JSON for tracking them over commits.
+ */
+
+enum {
+	/* The default size of a synthetic trace in bytes. */
+	bench_trace_size	= 1 << 18,
+
+	/* The default number of times we decode each trace. */
+	bench_iterations	= 10,
+
+	/* The distance between PSBs in a synthetic trace in bytes. */
+	bench_psb_period	= 0x1000,
+
+	/* Space reserved for the last iteration of a synthetic trace. */
+	bench_slack		= 0x100,
+
+	/* The maximal number of traces. */
+	bench_max_traces	= 5,
+
+	/* The number of indirect calls in the icall code. */
+	bench_icalls		= 4
+};
+
+/* The layout of the synthetic code. */
+enum {
+	/* loop: nop; jnz loop; jmp *%rax */
+	bench_code_loop		= 0x00,
+
+	/* (call *%rax) * bench_icalls; jmp *%rcx */
+	bench_code_icall	= 0x10,
+
+	/* leaf: ret */
+	bench_code_leaf		= 0x20,
+
+	/* The size of the synthetic code in bytes. */
+	bench_code_size		= 0x40
+};
+
+/* The load address of the synthetic code. */
+static const uint64_t bench_base = 0x400000ull;
+
+/* The TNT-64 payload for the tnt trace: 46 times around the loop. */
+static const uint64_t bench_tnt_64 = 0x7ffffffffffeull;
+static const int bench_tnt_64_size = 47;
+
+/* The TNT-8 payload for other traces: 5 times around the loop. */
+static const uint8_t bench_tnt_8 = 0x3e;
+static const int bench_tnt_8_size = 6;
+
+/* A trace to decode. */
+struct bench_trace {
+	/* The name of the trace. */
+	const char *name;
+
+	/* The trace buffer. */
+	uint8_t *buffer;
+
+	/* The configuration for decoding the trace. */
+	struct pt_config config;
+
+	/* The memory image in which the trace was recorded. */
+	struct pt_image *image;
+};
+
+/* The benchmark state. */
+struct bench {
+	/* The traces to decode. */
+	struct bench_trace trace[bench_max_traces];
+
+	/* The number of traces. */
+	int ntraces;
+
+	/* The image section cache shared by all images. */
+	struct pt_image_section_cache *iscache;
+
+	/* The memory image for synthetic traces. */
+	struct pt_image *synthetic;
+
+	/* The memory image for the recorded trace. */
+	struct pt_image *recorded;
+
+	/* The name of the temporary file holding the synthetic code. */
+	char *filename;
+
+	/* The size of a synthetic trace in bytes. */
+	size_t size;
+
+	/* The cpu on which the recorded trace was recorded. */
+	struct pt_cpu cpu;
+
+	/* The number of times each trace is decoded. */
+	int iterations;
+
+	/* The output file. */
+	FILE *out;
+
+	/* A flag saying whether we print JSON. */
+	uint32_t json:1;
+
+	/* The number of results printed so far. */
+	int nresults;
+};
+
+/* A synthetic trace. */
+struct bench_scenario {
+	/* The name of the trace. */
+	const char *name;
+
+	/* The offset of the code executed by the trace. */
+	uint64_t entry;
+
+	/* Emit one iteration of the trace.
+	 *
+	 * If @last is non-zero, emit the last iteration and disable tracing.
+	 *
+	 * Returns zero on success, a negative error code otherwise.
+	 */
+	int (*emit)(struct pt_encoder *encoder, uint64_t iteration, int last);
+};
+
+/* The decode counts. */
+struct bench_count {
+	/* The number of packets, queries, instructions, or blocks. */
+	uint64_t items;
+
+	/* The number of instructions. */
+	uint64_t insn;
+
+	/* The number of decode errors. */
+	uint64_t errors;
+};
+
+/* A decoder layer. */
+struct bench_layer {
+	/* The name of the layer. */
+	const char *name;
+
+	/* The unit of bench_count.items. */
+	const char *unit;
+
+	/* Whether the layer counts instructions in addition to its items. */
+	int insns;
+
+	/* Decode @trace once and accumulate counts in @count.
+	 *
+	 * Returns zero on success, a negative error code otherwise.
+	 */
+	int (*decode)(const struct bench_trace *trace,
+		      struct bench_count *count);
+};
+
+static int bench_psb(struct pt_encoder *encoder, uint64_t ip, uint64_t tsc)
+{
+	int errcode;
+
+	errcode = pt_encode_psb(encoder);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_tsc(encoder, tsc);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_cbr(encoder, 0x20);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_mode_exec(encoder, ptem_64bit);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_fup(encoder, ip, pt_ipc_sext_48);
+	if (errcode < 0)
+		return errcode;
+
+	return pt_encode_psbend(encoder);
+}
+
+/* Emit the indirect branch back to @offset that ends each iteration. */
+static int bench_branch(struct pt_encoder *encoder, uint64_t offset, int last)
+{
+	if (last)
+		return pt_encode_tip_pgd(encoder, bench_base + offset,
+					 pt_ipc_update_16);
+
+	return pt_encode_tip(encoder, bench_base + offset, pt_ipc_update_16);
+}
+
+static int bench_emit_tnt(struct pt_encoder *encoder, uint64_t iteration,
+			  int last)
+{
+	int errcode;
+
+	(void) iteration;
+
+	errcode = pt_encode_tnt_64(encoder, bench_tnt_64, bench_tnt_64_size);
+	if (errcode < 0)
+		return errcode;
+
+	return bench_branch(encoder, bench_code_loop, last);
+}
+
+static int bench_emit_icall(struct pt_encoder *encoder, uint64_t iteration,
+			    int last)
+{
+	int errcode, call;
+
+	(void) iteration;
+
+	for (call = 0; call < bench_icalls; ++call) {
+		errcode = pt_encode_tip(encoder, bench_base + bench_code_leaf,
+					pt_ipc_update_16);
+		if (errcode < 0)
+			return errcode;
+
+		/* The compressed return. */
+		errcode = pt_encode_tnt_8(encoder, 1, 1);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	return bench_branch(encoder, bench_code_icall, last);
+}
+
+static int bench_emit_timing(struct pt_encoder *encoder, uint64_t iteration,
+			     int last)
+{
+	int errcode;
+
+	if (!(iteration % 0x10)) {
+		errcode = pt_encode_tsc(encoder, 0x100000ull + iteration);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	errcode = pt_encode_cyc(encoder, 0x10 + (iteration % 0x10));
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_tnt_8(encoder, bench_tnt_8, bench_tnt_8_size);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_mtc(encoder, (uint8_t) iteration);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_cyc(encoder, 0x8);
+	if (errcode < 0)
+		return errcode;
+
+	return bench_branch(encoder, bench_code_loop, last);
+}
+
+static int bench_emit_ovf(struct pt_encoder *encoder, uint64_t iteration,
+			  int last)
+{
+	int errcode;
+
+	(void) iteration;
+
+	errcode = pt_encode_tnt_8(encoder, bench_tnt_8, bench_tnt_8_size);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = bench_branch(encoder, bench_code_loop, last);
+	if (errcode < 0 || last)
+		return errcode;
+
+	errcode = pt_encode_ovf(encoder);
+	if (errcode < 0)
+		return errcode;
+
+	return pt_encode_fup(encoder, bench_base + bench_code_loop,
+			     pt_ipc_sext_48);
+}
+
+static const struct bench_scenario bench_scenarios[] = {
+	{ "tnt", bench_code_loop, bench_emit_tnt },
+	{ "icall", bench_code_icall, bench_emit_icall },
+	{ "timing", bench_code_loop, bench_emit_timing },
+	{ "ovf", bench_code_loop, bench_emit_ovf }
+};
+
+static int bench_mkcode(struct bench *bench)
+{
+	uint8_t code[bench_code_size];
+	size_t written;
+	FILE *file;
+	int errcode, isid, call;
+
+	memset(code, 0xcc, sizeof(code));
+
+	/* loop: nop; jnz loop; jmp *%rax */
+	code[bench_code_loop + 0] = 0x90;
+	code[bench_code_loop + 1] = 0x75;
+	code[bench_code_loop + 2] = 0xfd;
+	code[bench_code_loop + 3] = 0xff;
+	code[bench_code_loop + 4] = 0xe0;
+
+	/* (call *%rax) * bench_icalls; jmp *%rcx */
+	for (call = 0; call < bench_icalls; ++call) {
+		code[bench_code_icall + (2 * call) + 0] = 0xff;
+		code[bench_code_icall + (2 * call) + 1] = 0xd0;
+	}
+
+	code[bench_code_icall + (2 * bench_icalls) + 0] = 0xff;
+	code[bench_code_icall + (2 * bench_icalls) + 1] = 0xe1;
+
+	/* leaf: ret */
+	code[bench_code_leaf] = 0xc3;
+
+	errcode = ptunit_mkfile(&file, &bench->filename, "wb");
+	if (errcode < 0)
+		return errcode;
+
+	written = fwrite(code, sizeof(code), 1, file);
+	fclose(file);
+
+	if (written != 1)
+		return -pte_bad_file;
+
+	isid = pt_iscache_add_file(bench->iscache, bench->filename, 0ull,
+				   sizeof(code), bench_base);
+	if (isid < 0)
+		return isid;
+
+	return pt_image_add_cached(bench->synthetic, bench->iscache, isid,
+				   NULL);
+}
+
+static int bench_mktrace(struct bench *bench,
+			 const struct bench_scenario *scenario)
+{
+	struct pt_encoder encoder;
+	struct bench_trace *trace;
+	uint64_t iteration, offset, psb;
+	uint8_t *buffer;
+	int errcode;
+
+	if (bench->ntraces >= bench_max_traces)
+		return -pte_internal;
+
+	buffer = malloc(bench->size);
+	if (!buffer)
+		return -pte_nomem;
+
+	trace = &bench->trace[bench->ntraces];
+	memset(trace, 0, sizeof(*trace));
+	trace->name = scenario->name;
+	trace->buffer = buffer;
+	trace->image = bench->synthetic;
+	trace->config.size = sizeof(trace->config);
+	trace->config.begin = buffer;
+	trace->config.end = buffer + bench->size;
+	trace->config.cpuid_0x15_eax = 2;
+	trace->config.cpuid_0x15_ebx = 1;
+	trace->config.mtc_freq = 4;
+	trace->config.nom_freq = 0x20;
+
+	/* The trace owns @buffer from here on. */
+	bench->ntraces += 1;
+
+	errcode = pt_encoder_init(&encoder, &trace->config);
+	if (errcode < 0)
+		return errcode;
+
+	psb = 0ull;
+	errcode = bench_psb(&encoder, bench_base + scenario->entry, 0ull);
+	for (iteration = 0ull; errcode >= 0; ++iteration) {
+		errcode = pt_enc_get_offset(&encoder, &offset);
+		if (errcode < 0)
+			break;
+
+		if (bench->size <= (offset + bench_slack)) {
+			errcode = scenario->emit(&encoder, iteration, 1);
+			if (errcode < 0)
+				break;
+
+			errcode = pt_enc_get_offset(&encoder, &offset);
+			if (errcode < 0)
+				break;
+
+			trace->config.end = buffer + offset;
+			break;
+		}
+
+		if (bench_psb_period <= (offset - psb)) {
+			psb = offset;
+
+			errcode = bench_psb(&encoder,
+					    bench_base + scenario->entry,
+					    0x100000ull + iteration);
+			if (errcode < 0)
+				break;
+		}
+
+		errcode = scenario->emit(&encoder, iteration, 0);
+	}
+
+	pt_encoder_fini(&encoder);
+	return errcode;
+}
+
+static int bench_load(uint8_t **pbuffer, size_t *psize, const char *filename)
+{
+	uint8_t *buffer;
+	size_t read;
+	FILE *file;
+	long size;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return -pte_bad_file;
+
+	if (fseek(file, 0, SEEK_END) || ((size = ftell(file)) <= 0) ||
+	    fseek(file, 0, SEEK_SET)) {
+		fclose(file);
+		return -pte_bad_file;
+	}
+
+	buffer = malloc((size_t) size);
+	if (!buffer) {
+		fclose(file);
+		return -pte_nomem;
+	}
+
+	read = fread(buffer, (size_t) size, 1, file);
+	fclose(file);
+
+	if (read != 1) {
+		free(buffer);
+		return -pte_bad_file;
+	}
+
+	*pbuffer = buffer;
+	*psize = (size_t) size;
+
+	return 0;
+}
+
+static int bench_add_trace(struct bench *bench, const char *filename)
+{
+	struct bench_trace *trace;
+	uint8_t *buffer;
+	size_t size;
+	int errcode;
+
+	if (bench->ntraces >= bench_max_traces)
+		return -pte_internal;
+
+	errcode = bench_load(&buffer, &size, filename);
+	if (errcode < 0)
+		return errcode;
+
+	trace = &bench->trace[bench->ntraces++];
+	memset(trace, 0, sizeof(*trace));
+	trace->name = filename;
+	trace->buffer = buffer;
+	trace->image = bench->recorded;
+	trace->config.size = sizeof(trace->config);
+	trace->config.begin = buffer;
+	trace->config.end = buffer + size;
+	trace->config.cpu = bench->cpu;
+
+	if (!trace->config.cpu.vendor)
+		return 0;
+
+	return pt_cpu_errata(&trace->config.errata, &trace->config.cpu);
+}
+
+/* Add a raw memory image given as <file>:<base>. */
+static int bench_add_raw(struct bench *bench, char *arg)
+{
+	uint64_t base;
+	uint8_t *buffer;
+	size_t size;
+	char *sep, *end;
+	int errcode, isid;
+
+	sep = strrchr(arg, ':');
+	if (!sep)
+		return -pte_invalid;
+
+	base = strtoull(sep + 1, &end, 0);
+	if (!sep[1] || *end)
+		return -pte_invalid;
+
+	*sep = 0;
+
+	/* We only need the size but this also checks that we can read it. */
+	errcode = bench_load(&buffer, &size, arg);
+	if (errcode < 0)
+		return errcode;
+
+	free(buffer);
+
+	isid = pt_iscache_add_file(bench->iscache, arg, 0ull, size, base);
+	if (isid < 0)
+		return isid;
+
+	return pt_image_add_cached(bench->recorded, bench->iscache, isid, NULL);
+}
+
+static int bench_pkt(const struct bench_trace *trace, struct bench_count *count)
+{
+	struct pt_packet_decoder *decoder;
+	int status;
+
+	decoder = pt_pkt_alloc_decoder(&trace->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	for (;;) {
+		status = pt_pkt_sync_forward(decoder);
+		if (status < 0)
+			break;
+
+		for (;;) {
+			struct pt_packet packet;
+
+			status = pt_pkt_next(decoder, &packet, sizeof(packet));
+			if (status < 0)
+				break;
+
+			count->items += 1;
+		}
+
+		if (status == -pte_eos)
+			break;
+
+		count->errors += 1;
+	}
+
+	pt_pkt_free_decoder(decoder);
+
+	return (status == -pte_eos) ? 0 : status;
+}
+
+static int bench_qry(const struct bench_trace *trace, struct bench_count *count)
+{
+	struct pt_query_decoder *decoder;
+	int status;
+
+	decoder = pt_qry_alloc_decoder(&trace->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	for (;;) {
+		uint64_t ip;
+
+		status = pt_qry_sync_forward(decoder, &ip);
+		if (status < 0)
+			break;
+
+		for (;;) {
+			int taken;
+
+			while (status & pts_event_pending) {
+				struct pt_event event;
+
+				status = pt_qry_event(decoder, &event,
+						      sizeof(event));
+				if (status < 0)
+					break;
+
+				count->items += 1;
+			}
+
+			if (status < 0)
+				break;
+
+			/* We don't know the code so we try both queries. */
+			status = pt_qry_cond_branch(decoder, &taken);
+			if (status == -pte_bad_query)
+				status = pt_qry_indirect_branch(decoder, &ip);
+
+			if (status < 0)
+				break;
+
+			count->items += 1;
+		}
+
+		if (status == -pte_eos)
+			break;
+
+		count->errors += 1;
+	}
+
+	pt_qry_free_decoder(decoder);
+
+	return (status == -pte_eos) ? 0 : status;
+}
+
+static int bench_insn(const struct bench_trace *trace,
+		      struct bench_count *count)
+{
+	struct pt_insn_decoder *decoder;
+	int status;
+
+	decoder = pt_insn_alloc_decoder(&trace->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	status = pt_insn_set_image(decoder, trace->image);
+	while (status >= 0) {
+		status = pt_insn_sync_forward(decoder);
+		if (status < 0)
+			break;
+
+		for (;;) {
+			struct pt_insn insn;
+
+			while (status & pts_event_pending) {
+				struct pt_event event;
+
+				status = pt_insn_event(decoder, &event,
+						       sizeof(event));
+				if (status < 0)
+					break;
+			}
+
+			if (status < 0)
+				break;
+
+			status = pt_insn_next(decoder, &insn, sizeof(insn));
+			if (status < 0)
+				break;
+
+			count->items += 1;
+		}
+
+		if (status == -pte_eos)
+			break;
+
+		count->errors += 1;
+		status = 0;
+	}
+
+	pt_insn_free_decoder(decoder);
+
+	count->insn = count->items;
+
+	return (status == -pte_eos) ? 0 : status;
+}
+
+static int bench_blk(const struct bench_trace *trace, struct bench_count *count)
+{
+	struct pt_block_decoder *decoder;
+	int status;
+
+	decoder = pt_blk_alloc_decoder(&trace->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	status = pt_blk_set_image(decoder, trace->image);
+	while (status >= 0) {
+		status = pt_blk_sync_forward(decoder);
+		if (status < 0)
+			break;
+
+		for (;;) {
+			struct pt_block block;
+
+			while (status & pts_event_pending) {
+				struct pt_event event;
+
+				status = pt_blk_event(decoder, &event,
+						      sizeof(event));
+				if (status < 0)
+					break;
+			}
+
+			if (status < 0)
+				break;
+
+			status = pt_blk_next(decoder, &block, sizeof(block));
+			if (status < 0)
+				break;
+
+			count->items += 1;
+			count->insn += block.ninsn;
+		}
+
+		if (status == -pte_eos)
+			break;
+
+		count->errors += 1;
+		status = 0;
+	}
+
+	pt_blk_free_decoder(decoder);
+
+	return (status == -pte_eos) ? 0 : status;
+}
+
+static const struct bench_layer bench_layers[] = {
+	{ "packet", "packets", 0, bench_pkt },
+	{ "query", "queries", 0, bench_qry },
+	{ "insn", "insns", 0, bench_insn },
+	{ "block", "blocks", 1, bench_blk }
+};
+
+/* Print @string as JSON string. */
+static void bench_json_string(FILE *out, const char *string)
+{
+	fputc('"', out);
+	for (; *string; ++string) {
+		unsigned char c;
+
+		c = (unsigned char) *string;
+		if ((c == '"') || (c == '\\'))
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void bench_begin(struct bench *bench)
+{
+	struct pt_version version;
+
+	if (!bench->json)
+		return;
+
+	version = pt_library_version();
+
+	fprintf(bench->out, "{\n  \"benchmark\": \"decode\",\n"
+		"  \"version\": \"%" PRIu8 ".%" PRIu8 ".%" PRIu32 "%s\",\n"
+		"  \"iterations\": %d,\n  \"results\": [", version.major,
+		version.minor, version.build, version.ext ? version.ext : "",
+		bench->iterations);
+}
+
+static void bench_end(struct bench *bench)
+{
+	if (!bench->json)
+		return;
+
+	fprintf(bench->out, "\n  ]\n}\n");
+}
+
+static void bench_report(struct bench *bench, const struct bench_trace *trace,
+			 const struct bench_layer *layer,
+			 const struct bench_count *count, uint64_t ns)
+{
+	double seconds, rate, insn_rate;
+	uint64_t bytes;
+
+	bytes = (uint64_t) (trace->config.end - trace->config.begin);
+
+	seconds = (double) ns / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	rate = (double) count->items / seconds;
+	insn_rate = (double) count->insn / seconds;
+
+	if (!bench->json) {
+		fprintf(bench->out, "%-8s %-6s %12" PRIu64 " %-7s %8.3f s "
+			"%10.2f M%s/s", trace->name, layer->name,
+			count->items, layer->unit, seconds, rate / 1e6,
+			layer->unit);
+
+		if (layer->insns)
+			fprintf(bench->out, " %10.2f Minsns/s",
+				insn_rate / 1e6);
+
+		if (count->errors)
+			fprintf(bench->out, " (%" PRIu64 " errors)",
+				count->errors);
+
+		fputc('\n', bench->out);
+		return;
+	}
+
+	fprintf(bench->out, "%s\n    { \"trace\": ",
+		bench->nresults++ ? "," : "");
+	bench_json_string(bench->out, trace->name);
+	fprintf(bench->out, ", \"layer\": \"%s\", \"bytes\": %" PRIu64 ", "
+		"\"%s\": %" PRIu64, layer->name, bytes, layer->unit,
+		count->items);
+
+	if (layer->insns)
+		fprintf(bench->out, ", \"insns\": %" PRIu64, count->insn);
+
+	fprintf(bench->out, ", \"errors\": %" PRIu64 ", \"ns\": %" PRIu64
+		", \"%s_per_s\": %.0f", count->errors, ns, layer->unit, rate);
+
+	if (layer->insns)
+		fprintf(bench->out, ", \"insns_per_s\": %.0f", insn_rate);
+
+	fputs(" }", bench->out);
+}
+
+static int bench_run(struct bench *bench, const struct bench_trace *trace,
+		     const struct bench_layer *layer)
+{
+	struct bench_count count;
+	uint64_t begin, end;
+	int errcode, iteration;
+
+	/* Warm up the image section and block caches. */
+	memset(&count, 0, sizeof(count));
+	errcode = layer->decode(trace, &count);
+	if (errcode < 0)
+		return errcode;
+
+	memset(&count, 0, sizeof(count));
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		return errcode;
+
+	for (iteration = 0; iteration < bench->iterations; ++iteration) {
+		errcode = layer->decode(trace, &count);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		return errcode;
+
+	bench_report(bench, trace, layer, &count, end - begin);
+
+	return 0;
+}
+
+static void bench_fini(struct bench *bench)
+{
+	int idx;
+
+	for (idx = 0; idx < bench->ntraces; ++idx)
+		free(bench->trace[idx].buffer);
+
+	pt_image_free(bench->synthetic);
+	pt_image_free(bench->recorded);
+	pt_iscache_free(bench->iscache);
+
+	if (bench->filename) {
+		(void) remove(bench->filename);
+		free(bench->filename);
+	}
+
+	if (bench->out && (bench->out != stdout))
+		fclose(bench->out);
+}
+
+/* Check whether @option takes an argument. */
+static int bench_has_arg(const char *option)
+{
+	static const char * const options[] = {
+		"--iterations", "--size", "--output", "--pt", "--raw", "--cpu"
+	};
+	int idx;
+
+	for (idx = 0; idx < (int) (sizeof(options) / sizeof(*options)); ++idx)
+		if (strcmp(option, options[idx]) == 0)
+			return 1;
+
+	return 0;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [<options>]\n\n"
+		"options:\n"
+		"  --help|-h               this text.\n"
+		"  --iterations <n>        decode each trace <n> times "
+		"(default: %d).\n"
+		"  --size <n>              use <n> bytes of synthetic trace "
+		"(default: %d).\n"
+		"  --json                  print results as JSON.\n"
+		"  --output <file>         print results to <file>.\n"
+		"  --pt <file>             also decode the recorded trace in "
+		"<file>.\n"
+		"  --raw <file>:<base>     load <file> at <base> for --pt.\n"
+		"  --cpu <f>/<m>[/<s>]|auto  set the cpu for --pt.\n",
+		prog, bench_iterations, bench_trace_size);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *prog, *output, *ptfile;
+	struct bench bench;
+	int errcode, idx, layer;
+
+	prog = argv[0];
+	output = NULL;
+	ptfile = NULL;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.iterations = bench_iterations;
+	bench.size = bench_trace_size;
+	bench.out = stdout;
+
+	bench.iscache = pt_iscache_alloc(NULL);
+	bench.synthetic = pt_image_alloc("synthetic");
+	bench.recorded = pt_image_alloc("recorded");
+	if (!bench.iscache || !bench.synthetic || !bench.recorded) {
+		errcode = -pte_nomem;
+		goto out;
+	}
+
+	errcode = 0;
+	for (idx = 1; idx < argc; ++idx) {
+		const char *arg;
+
+		arg = argv[idx];
+		if ((strcmp(arg, "--help") == 0) || (strcmp(arg, "-h") == 0)) {
+			bench_fini(&bench);
+			return usage(prog);
+		}
+
+		if (strcmp(arg, "--json") == 0) {
+			bench.json = 1;
+			continue;
+		}
+
+		if (!bench_has_arg(arg)) {
+			fprintf(stderr, "%s: unknown option: %s.\n", prog,
+				arg);
+			bench_fini(&bench);
+			return 1;
+		}
+
+		if (argc <= (idx + 1)) {
+			fprintf(stderr, "%s: %s: missing argument.\n", prog,
+				arg);
+			bench_fini(&bench);
+			return 1;
+		}
+
+		if (strcmp(arg, "--iterations") == 0) {
+			bench.iterations = atoi(argv[++idx]);
+			if (bench.iterations <= 0)
+				errcode = -pte_invalid;
+		} else if (strcmp(arg, "--size") == 0) {
+			long size;
+
+			size = atol(argv[++idx]);
+			if (size < (2 * bench_slack))
+				errcode = -pte_invalid;
+			else
+				bench.size = (size_t) size;
+		} else if (strcmp(arg, "--output") == 0)
+			output = argv[++idx];
+		else if (strcmp(arg, "--pt") == 0)
+			ptfile = argv[++idx];
+		else if (strcmp(arg, "--raw") == 0)
+			errcode = bench_add_raw(&bench, argv[++idx]);
+		else if (strcmp(arg, "--cpu") == 0) {
+			arg = argv[++idx];
+			if (strcmp(arg, "auto") == 0)
+				errcode = pt_cpu_read(&bench.cpu);
+			else
+				errcode = pt_cpu_parse(&bench.cpu, arg);
+		}
+
+		if (errcode < 0) {
+			fprintf(stderr, "%s: %s %s: %s.\n", prog, arg,
+				argv[idx], pt_errstr(pt_errcode(errcode)));
+			bench_fini(&bench);
+			return 1;
+		}
+	}
+
+	if (output) {
+		bench.out = fopen(output, "w");
+		if (!bench.out) {
+			fprintf(stderr, "%s: failed to open %s.\n", prog,
+				output);
+			bench_fini(&bench);
+			return 1;
+		}
+	}
+
+	errcode = bench_mkcode(&bench);
+	for (idx = 0; (errcode >= 0) && (idx < (int)
+		     (sizeof(bench_scenarios) / sizeof(*bench_scenarios)));
+	     ++idx)
+		errcode = bench_mktrace(&bench, &bench_scenarios[idx]);
+
+	if ((errcode >= 0) && ptfile)
+		errcode = bench_add_trace(&bench, ptfile);
+
+	if (errcode < 0)
+		goto out;
+
+	bench_begin(&bench);
+
+	for (idx = 0; idx < bench.ntraces; ++idx) {
+		for (layer = 0; layer < (int)
+			     (sizeof(bench_layers) / sizeof(*bench_layers));
+		     ++layer) {
+			errcode = bench_run(&bench, &bench.trace[idx],
+					    &bench_layers[layer]);
+			if (errcode < 0)
+				goto out;
+		}
+	}
+
+	bench_end(&bench);
+
+out:
+	bench_fini(&bench);
+
+	if (errcode < 0) {
+		fprintf(stderr, "%s: %s\n", prog,
+			pt_errstr(pt_errcode(errcode)));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit_time.h"
+
+#include "pt_decoder_function.h"
+#include "pt_encoder.h"
+
+#include "intel-pt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+/* A micro-benchmark for the packet opcode dispatch.
+ *
+ * Encodes a synthetic trace that resembles a typical Intel PT trace, i.e. it
+ * is dominated by TNT, TIP, and timing packets with a PSB+ header every few
+ * kilobytes.
+ *
+ * Measures the throughput of pt_df_fetch() alone and of the packet decoder
+ * using pt_pkt_next() and pt_pkt_next_batch().
+ */
+
+enum {
+	/* The size of the synthetic trace in bytes. */
+	bench_trace_size	= 1 << 20,
+
+	/* The default number of times we decode the trace. */
+	bench_iterations	= 100,
+
+	/* The number of packets per pt_pkt_next_batch() call. */
+	bench_batch_size	= 64
+};
+
+/* The benchmark state. */
+struct bench {
+	/* The synthetic trace. */
+	uint8_t *buffer;
+
+	/* The configuration for decoding the synthetic trace. */
+	struct pt_config config;
+
+	/* The offsets of all packets in the synthetic trace. */
+	uint64_t *offsets;
+
+	/* The number of packets in the synthetic trace. */
+	size_t npackets;
+
+	/* The number of times the trace is decoded. */
+	int iterations;
+};
+
+static int bench_encode_segment(struct pt_encoder *encoder, uint64_t *tsc)
+{
+	uint64_t ip;
+	int errcode, idx;
+
+	ip = 0xffffffff81000000ull;
+
+	errcode = pt_encode_psb(encoder);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_fup(encoder, ip, pt_ipc_sext_48);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_mode_exec(encoder, ptem_64bit);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_tsc(encoder, *tsc);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_tma(encoder, 0x1234, 0x12);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_cbr(encoder, 0x24);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_encode_psbend(encoder);
+	if (errcode < 0)
+		return errcode;
+
+	*tsc += 0x10000;
+
+	for (idx = 0; idx < 256; ++idx) {
+		ip += 0x40;
+
+		errcode = pt_encode_tnt_8(encoder, (uint8_t) idx, 6);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = pt_encode_cyc(encoder, (uint32_t) idx);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = pt_encode_tip(encoder, ip, pt_ipc_update_16);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = pt_encode_tnt_8(encoder, (uint8_t) ~idx, 4);
+		if (errcode < 0)
+			return errcode;
+
+		if ((idx % 4) == 0) {
+			errcode = pt_encode_mtc(encoder, (uint8_t) idx);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		if ((idx % 8) == 0) {
+			errcode = pt_encode_tnt_64(encoder, (uint64_t) idx,
+						   40);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_encode_fup(encoder, ip, pt_ipc_update_32);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_encode_mode_tsx(encoder, 0);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_encode_pad(encoder);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		if ((idx % 64) == 0) {
+			errcode = pt_encode_tip_pgd(encoder, 0ull,
+						    pt_ipc_suppressed);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_encode_pip(encoder, 0x1000, 0);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_encode_tip_pge(encoder, ip,
+						    pt_ipc_update_48);
+			if (errcode < 0)
+				return errcode;
+		}
+	}
+
+	return 0;
+}
+
+static int bench_init(struct bench *bench)
+{
+	struct pt_packet_decoder *decoder;
+	struct pt_encoder encoder;
+	struct pt_packet packet;
+	uint64_t tsc, offset;
+	size_t capacity;
+	int errcode;
+
+	bench->buffer = malloc(bench_trace_size);
+	if (!bench->buffer)
+		return -pte_nomem;
+
+	memset(&bench->config, 0, sizeof(bench->config));
+	bench->config.size = sizeof(bench->config);
+	bench->config.begin = bench->buffer;
+	bench->config.end = bench->buffer + bench_trace_size;
+
+	errcode = pt_encoder_init(&encoder, &bench->config);
+	if (errcode < 0)
+		return errcode;
+
+	/* Encode full segments until we run out of space. */
+	tsc = 0x100000ull;
+	offset = 0ull;
+	for (;;) {
+		errcode = bench_encode_segment(&encoder, &tsc);
+		if (errcode < 0)
+			break;
+
+		errcode = pt_enc_get_offset(&encoder, &offset);
+		if (errcode < 0)
+			break;
+	}
+
+	pt_encoder_fini(&encoder);
+
+	if (errcode != -pte_eos)
+		return errcode;
+
+	bench->config.end = bench->buffer + offset;
+
+	/* Collect the packet offsets for benchmarking pt_df_fetch(). */
+	decoder = pt_pkt_alloc_decoder(&bench->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	errcode = pt_pkt_sync_forward(decoder);
+	if (errcode < 0)
+		goto out;
+
+	capacity = (size_t) offset;
+	bench->offsets = malloc(capacity * sizeof(*bench->offsets));
+	if (!bench->offsets) {
+		errcode = -pte_nomem;
+		goto out;
+	}
+
+	bench->npackets = 0;
+	for (;;) {
+		errcode = pt_pkt_get_offset(decoder, &offset);
+		if (errcode < 0)
+			break;
+
+		errcode = pt_pkt_next(decoder, &packet, sizeof(packet));
+		if (errcode < 0)
+			break;
+
+		if (capacity <= bench->npackets) {
+			errcode = -pte_internal;
+			break;
+		}
+
+		bench->offsets[bench->npackets++] = offset;
+	}
+
+	if (errcode == -pte_eos)
+		errcode = 0;
+
+out:
+	pt_pkt_free_decoder(decoder);
+	return errcode;
+}
+
+static void bench_fini(struct bench *bench)
+{
+	free(bench->offsets);
+	free(bench->buffer);
+}
+
+static void bench_report(const struct bench *bench, const char *name,
+			 uint64_t npackets, uint64_t begin, uint64_t end)
+{
+	uint64_t bytes;
+	double seconds;
+
+	bytes = (uint64_t) (bench->config.end - bench->config.begin) *
+		(uint64_t) bench->iterations;
+
+	seconds = (double) (end - begin) / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	printf("%-8s %10" PRIu64 " packets %8.3f s %8.2f Mpackets/s "
+	       "%8.2f MiB/s\n", name, npackets, seconds,
+	       ((double) npackets / seconds) / 1e6,
+	       ((double) bytes / seconds) / (1024.0 * 1024.0));
+}
+
+static int bench_fetch(const struct bench *bench)
+{
+	const struct pt_decoder_function *dfun;
+	uint64_t begin, end, npackets;
+	int errcode, iteration, flags;
+	size_t idx;
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		return errcode;
+
+	flags = 0;
+	npackets = 0ull;
+	for (iteration = 0; iteration < bench->iterations; ++iteration) {
+		for (idx = 0; idx < bench->npackets; ++idx) {
+			const uint8_t *pos;
+
+			pos = bench->config.begin + bench->offsets[idx];
+
+			errcode = pt_df_fetch(&dfun, pos, &bench->config);
+			if (errcode < 0)
+				return errcode;
+
+			flags |= dfun->flags;
+		}
+
+		npackets += bench->npackets;
+	}
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		return errcode;
+
+	/* Everything but unknown should have been seen. */
+	if (flags & pdff_unknown)
+		return -pte_internal;
+
+	bench_report(bench, "fetch", npackets, begin, end);
+	return 0;
+}
+
+static int bench_packet(const struct bench *bench)
+{
+	struct pt_packet_decoder *decoder;
+	struct pt_packet packet;
+	uint64_t begin, end, npackets;
+	int errcode, iteration;
+
+	decoder = pt_pkt_alloc_decoder(&bench->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		goto out;
+
+	npackets = 0ull;
+	for (iteration = 0; iteration < bench->iterations; ++iteration) {
+		errcode = pt_pkt_sync_set(decoder, 0ull);
+		if (errcode < 0)
+			goto out;
+
+		for (;;) {
+			errcode = pt_pkt_next(decoder, &packet,
+					      sizeof(packet));
+			if (errcode < 0)
+				break;
+
+			npackets += 1;
+		}
+
+		if (errcode != -pte_eos)
+			goto out;
+	}
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		goto out;
+
+	bench_report(bench, "packet", npackets, begin, end);
+
+out:
+	pt_pkt_free_decoder(decoder);
+	return errcode;
+}
+
+static int bench_batch(const struct bench *bench)
+{
+	struct pt_packet_decoder *decoder;
+	struct pt_packet packets[bench_batch_size];
+	uint64_t offsets[bench_batch_size];
+	uint64_t begin, end, npackets;
+	int errcode, iteration;
+
+	decoder = pt_pkt_alloc_decoder(&bench->config);
+	if (!decoder)
+		return -pte_nomem;
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		goto out;
+
+	npackets = 0ull;
+	for (iteration = 0; iteration < bench->iterations; ++iteration) {
+		errcode = pt_pkt_sync_set(decoder, 0ull);
+		if (errcode < 0)
+			goto out;
+
+		for (;;) {
+			errcode = pt_pkt_next_batch(decoder, packets, offsets,
+						    bench_batch_size,
+						    sizeof(*packets));
+			if (errcode < 0)
+				break;
+
+			npackets += (uint64_t) errcode;
+		}
+
+		if (errcode != -pte_eos)
+			goto out;
+	}
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		goto out;
+
+	bench_report(bench, "batch", npackets, begin, end);
+
+out:
+	pt_pkt_free_decoder(decoder);
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench;
+	int errcode;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.iterations = bench_iterations;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [<iterations>]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2) {
+		bench.iterations = atoi(argv[1]);
+		if (bench.iterations <= 0) {
+			fprintf(stderr, "%s: bad iterations: %s\n", argv[0],
+				argv[1]);
+			return 1;
+		}
+	}
+
+	errcode = bench_init(&bench);
+	if (errcode >= 0)
+		errcode = bench_fetch(&bench);
+	if (errcode >= 0)
+		errcode = bench_packet(&bench);
+	if (errcode >= 0)
+		errcode = bench_batch(&bench);
+
+	bench_fini(&bench);
+
+	if (errcode < 0) {
+		fprintf(stderr, "%s: %s\n", argv[0],
+			pt_errstr(pt_errcode(errcode)));
+		return 1;
+	}
+
+	return 0;
+}
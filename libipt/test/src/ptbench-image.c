@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit_mkfile.h"
+#include "ptunit_time.h"
+
+#include "pt_image.h"
+#include "pt_section.h"
+#include "pt_asid.h"
+
+#include "intel-pt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+/* A micro-benchmark for image section lookup.
+ *
+ * Builds images with an increasing number of sections, e.g. to mimic a JIT
+ * that creates a new mapping for every compiled function, and measures how
+ * the time to add sections and to find and read from them scales with the
+ * number of sections in the image.
+ */
+
+enum {
+	/* The size of the test file and of each section in bytes. */
+	bench_section_size	= 0x1000,
+
+	/* The distance between two sections in the image. */
+	bench_section_stride	= 0x2000,
+
+	/* The default number of lookups per image. */
+	bench_lookups		= 1 << 20,
+
+	/* The largest number of sections in an image. */
+	bench_max_sections	= 1 << 14
+};
+
+/* The benchmark state. */
+struct bench {
+	/* The section that is mapped into the image multiple times. */
+	struct pt_section *section;
+
+	/* The name of the temporary file backing @section. */
+	char *filename;
+
+	/* The address space. */
+	struct pt_asid asid;
+
+	/* The number of lookups per image. */
+	int lookups;
+};
+
+/* A simple pseudo-random number generator so results are reproducible. */
+static uint32_t bench_random(uint32_t *state)
+{
+	*state = (*state * 1103515245u) + 12345u;
+
+	return *state >> 8;
+}
+
+static int bench_init(struct bench *bench)
+{
+	uint8_t content[bench_section_size];
+	FILE *file;
+	size_t written;
+	int errcode;
+
+	errcode = ptunit_mkfile(&file, &bench->filename, "wb");
+	if (errcode < 0)
+		return errcode;
+
+	memset(content, 0xcc, sizeof(content));
+
+	written = fwrite(content, sizeof(content), 1, file);
+	fclose(file);
+
+	if (written != 1)
+		return -pte_bad_file;
+
+	bench->section = pt_mk_section(bench->filename, 0ull,
+				       sizeof(content));
+	if (!bench->section)
+		return -pte_bad_file;
+
+	/* Keep the section mapped so we do not measure mmap() and munmap(). */
+	errcode = pt_section_map(bench->section);
+	if (errcode < 0) {
+		(void) pt_section_put(bench->section);
+		bench->section = NULL;
+
+		return errcode;
+	}
+
+	pt_asid_init(&bench->asid);
+	bench->asid.cr3 = 0x1000ull;
+
+	return 0;
+}
+
+static void bench_fini(struct bench *bench)
+{
+	if (bench->section) {
+		(void) pt_section_unmap(bench->section);
+		(void) pt_section_put(bench->section);
+	}
+
+	if (bench->filename) {
+		(void) remove(bench->filename);
+		free(bench->filename);
+	}
+}
+
+static double bench_rate(uint64_t count, uint64_t begin, uint64_t end)
+{
+	double seconds;
+
+	seconds = (double) (end - begin) / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	return ((double) count / seconds) / 1e6;
+}
+
+static int bench_image(const struct bench *bench, uint32_t nsections)
+{
+	struct pt_mapped_section msec;
+	struct pt_image image;
+	uint64_t begin, added, found, read;
+	uint32_t idx, state;
+	uint8_t buffer[16];
+	int errcode, lookup;
+
+	pt_image_init(&image, NULL);
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		goto out;
+
+	/* Add sections in a shuffled order. */
+	state = 0x1234u;
+	for (idx = 0; idx < nsections; ++idx) {
+		uint64_t vaddr;
+		uint32_t slot;
+
+		slot = (idx * 0x9e37u) % nsections;
+		vaddr = 0x400000ull + ((uint64_t) slot * bench_section_stride);
+
+		errcode = pt_image_add(&image, bench->section, &bench->asid,
+				       vaddr, (int) slot + 1);
+		if (errcode < 0)
+			goto out;
+	}
+
+	errcode = ptunit_time(&added);
+	if (errcode < 0)
+		goto out;
+
+	for (lookup = 0; lookup < bench->lookups; ++lookup) {
+		uint64_t vaddr;
+		uint32_t slot;
+
+		slot = bench_random(&state) % nsections;
+		vaddr = 0x400000ull + ((uint64_t) slot * bench_section_stride);
+		vaddr += bench_random(&state) % bench_section_size;
+
+		errcode = pt_image_find(&image, &msec, &bench->asid, vaddr);
+		if (errcode < 0)
+			goto out;
+
+		errcode = pt_section_put(msec.section);
+		if (errcode < 0)
+			goto out;
+	}
+
+	errcode = ptunit_time(&found);
+	if (errcode < 0)
+		goto out;
+
+	for (lookup = 0; lookup < bench->lookups; ++lookup) {
+		uint64_t vaddr;
+		uint32_t slot;
+		int isid;
+
+		slot = bench_random(&state) % nsections;
+		vaddr = 0x400000ull + ((uint64_t) slot * bench_section_stride);
+
+		errcode = pt_image_read(&image, &isid, buffer, sizeof(buffer),
+					&bench->asid, vaddr);
+		if (errcode < 0)
+			goto out;
+	}
+
+	errcode = ptunit_time(&read);
+	if (errcode < 0)
+		goto out;
+
+	printf("%6" PRIu32 " sections %8.3f Madd/s %8.3f Mfind/s "
+	       "%8.3f Mread/s\n", nsections,
+	       bench_rate(nsections, begin, added),
+	       bench_rate((uint64_t) bench->lookups, added, found),
+	       bench_rate((uint64_t) bench->lookups, found, read));
+
+out:
+	pt_image_fini(&image);
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench;
+	uint32_t nsections;
+	int errcode;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.lookups = bench_lookups;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [<lookups>]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2) {
+		bench.lookups = atoi(argv[1]);
+		if (bench.lookups <= 0) {
+			fprintf(stderr, "%s: bad lookups: %s\n", argv[0],
+				argv[1]);
+			return 1;
+		}
+	}
+
+	errcode = bench_init(&bench);
+	for (nsections = 1; errcode >= 0 && nsections <= bench_max_sections;
+	     nsections *= 4)
+		errcode = bench_image(&bench, nsections);
+
+	bench_fini(&bench);
+
+	if (errcode < 0) {
+		fprintf(stderr, "%s: %s\n", argv[0],
+			pt_errstr(pt_errcode(errcode)));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit_mkfile.h"
+#include "ptunit_time.h"
+
+#include "intel-pt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#if defined(FEATURE_THREADS)
+#  include <threads.h>
+#endif /* defined(FEATURE_THREADS) */
+
+
+/* A contention benchmark for the image section cache.
+ *
+ * Multiple threads, e.g. decoders working on different parts of a trace,
+ * read from sections in a shared image section cache.  We measure the read
+ * throughput for an increasing number of threads when all threads read from
+ * the same section and when each thread reads from its own section.
+ *
+ * We further measure the read latency when the cache limit is too small to
+ * keep all sections mapped, with pruned sections unmapped on the reading
+ * thread or in batches at emulated synchronization points.
+ */
+
+enum {
+	/* The size of each section in bytes. */
+	bench_section_size	= 0x1000,
+
+	/* The default number of reads per thread. */
+	bench_reads		= 1 << 20,
+
+	/* The largest number of threads. */
+	bench_max_threads	= 8,
+
+	/* The number of sections the cache limit allows under pressure. */
+	bench_pressure_sections	= 2,
+
+	/* The number of reads between two emulated synchronization points.
+	 *
+	 * Every read prunes a section.  We reclaim them before they exceed the
+	 * cache limit and get unmapped right away.
+	 */
+	bench_sync_period	= bench_pressure_sections
+};
+
+/* The benchmark state. */
+struct bench {
+	/* The shared image section cache. */
+	struct pt_image_section_cache *iscache;
+
+	/* The name of the temporary file backing the cached sections. */
+	char *filename;
+
+	/* The isid of each thread's section. */
+	int isid[bench_max_threads];
+
+	/* The number of reads per thread. */
+	int reads;
+};
+
+/* The state of a single benchmark thread. */
+struct bench_thread {
+	/* The benchmark. */
+	const struct bench *bench;
+
+	/* The isid to read from. */
+	int isid;
+};
+
+static int bench_init(struct bench *bench)
+{
+	uint8_t content[bench_section_size * bench_max_threads];
+	FILE *file;
+	size_t written;
+	int errcode, thrd;
+
+	errcode = ptunit_mkfile(&file, &bench->filename, "wb");
+	if (errcode < 0)
+		return errcode;
+
+	memset(content, 0xcc, sizeof(content));
+
+	written = fwrite(content, sizeof(content), 1, file);
+	fclose(file);
+
+	if (written != 1)
+		return -pte_bad_file;
+
+	bench->iscache = pt_iscache_alloc(NULL);
+	if (!bench->iscache)
+		return -pte_nomem;
+
+	for (thrd = 0; thrd < bench_max_threads; ++thrd) {
+		uint64_t offset;
+
+		offset = (uint64_t) thrd * bench_section_size;
+
+		bench->isid[thrd] =
+			pt_iscache_add_file(bench->iscache, bench->filename,
+					    offset, bench_section_size,
+					    0x400000ull + offset);
+		if (bench->isid[thrd] < 0)
+			return bench->isid[thrd];
+	}
+
+	return 0;
+}
+
+static void bench_fini(struct bench *bench)
+{
+	pt_iscache_free(bench->iscache);
+
+	if (bench->filename) {
+		(void) remove(bench->filename);
+		free(bench->filename);
+	}
+}
+
+static int bench_worker(void *arg)
+{
+	const struct bench_thread *thread;
+	uint64_t vaddr;
+	uint8_t buffer[16];
+	int read, reads, isid;
+
+	thread = arg;
+	if (!thread || !thread->bench)
+		return -pte_internal;
+
+	reads = thread->bench->reads;
+	isid = thread->isid;
+
+	vaddr = 0x400000ull + ((uint64_t) (isid - 1) * bench_section_size);
+	for (read = 0; read < reads; ++read) {
+		uint64_t offset;
+		int status;
+
+		offset = ((uint64_t) read * sizeof(buffer)) %
+			(bench_section_size - sizeof(buffer));
+
+		status = pt_iscache_read(thread->bench->iscache, buffer,
+					 sizeof(buffer), isid, vaddr + offset);
+		if (status < 0)
+			return status;
+	}
+
+	return 0;
+}
+
+static double bench_rate(uint64_t count, uint64_t begin, uint64_t end)
+{
+	double seconds;
+
+	seconds = (double) (end - begin) / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	return ((double) count / seconds) / 1e6;
+}
+
+/* Run @nthreads threads reading from one shared section or from one section
+ * per thread, depending on @shared.
+ */
+static int bench_iscache(const struct bench *bench, int nthreads, int shared)
+{
+	struct bench_thread thread[bench_max_threads];
+	uint64_t begin, end;
+	int errcode, thrd;
+
+	for (thrd = 0; thrd < nthreads; ++thrd) {
+		thread[thrd].bench = bench;
+		thread[thrd].isid = bench->isid[shared ? 0 : thrd];
+	}
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		return errcode;
+
+#if defined(FEATURE_THREADS)
+	{
+		thrd_t threads[bench_max_threads];
+		int status;
+
+		for (thrd = 1; thrd < nthreads; ++thrd) {
+			errcode = thrd_create(&threads[thrd], bench_worker,
+					      &thread[thrd]);
+			if (errcode != thrd_success) {
+				nthreads = thrd;
+				errcode = -pte_bad_lock;
+				break;
+			}
+		}
+
+		status = bench_worker(&thread[0]);
+		if (errcode >= 0)
+			errcode = status;
+
+		for (thrd = 1; thrd < nthreads; ++thrd) {
+			int result;
+
+			if (thrd_join(&threads[thrd], &result) != thrd_success)
+				result = -pte_bad_lock;
+
+			if (errcode >= 0)
+				errcode = result;
+		}
+	}
+#else
+	if (nthreads != 1)
+		return 0;
+
+	errcode = bench_worker(&thread[0]);
+#endif /* defined(FEATURE_THREADS) */
+
+	if (errcode < 0)
+		return errcode;
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		return errcode;
+
+	printf("%d thread(s) %-8s %8.3f Mread/s\n", nthreads,
+	       shared ? "shared" : "distinct",
+	       bench_rate((uint64_t) bench->reads * (uint64_t) nthreads,
+			  begin, end));
+
+	return 0;
+}
+
+static int bench_cmp_latency(const void *lhs, const void *rhs)
+{
+	uint64_t lval, rval;
+
+	lval = *(const uint64_t *) lhs;
+	rval = *(const uint64_t *) rhs;
+
+	return (lval < rval) ? -1 : ((rval < lval) ? 1 : 0);
+}
+
+/* Read from all sections in turn while the cache limit only allows a few of
+ * them to stay mapped and report read latency percentiles.
+ *
+ * If @deferred is non-zero, pruned sections are unmapped in batches at
+ * emulated synchronization points outside of the measured reads.
+ */
+static int bench_pressure(struct bench *bench, int deferred)
+{
+	uint64_t *latency, begin, end;
+	uint8_t buffer[16];
+	int errcode, read, reads;
+
+	reads = bench->reads / 16;
+	if (reads <= 0)
+		reads = 1;
+
+	latency = malloc((size_t) reads * sizeof(*latency));
+	if (!latency)
+		return -pte_nomem;
+
+	errcode = pt_iscache_set_limit(bench->iscache, bench_section_size *
+				       bench_pressure_sections);
+	if (errcode < 0)
+		goto out;
+
+	errcode = pt_iscache_set_deferred_reclaim(bench->iscache, deferred);
+	if (errcode < 0)
+		goto out;
+
+	for (read = 0; read < reads; ++read) {
+		uint64_t vaddr;
+		int isid;
+
+		if (deferred && !(read % bench_sync_period)) {
+			errcode = pt_iscache_reclaim(bench->iscache);
+			if (errcode < 0)
+				goto out;
+		}
+
+		isid = bench->isid[read % bench_max_threads];
+		vaddr = 0x400000ull +
+			((uint64_t) (isid - 1) * bench_section_size);
+
+		errcode = ptunit_time(&begin);
+		if (errcode < 0)
+			goto out;
+
+		errcode = pt_iscache_read(bench->iscache, buffer,
+					  sizeof(buffer), isid, vaddr);
+		if (errcode < 0)
+			goto out;
+
+		errcode = ptunit_time(&end);
+		if (errcode < 0)
+			goto out;
+
+		latency[read] = end - begin;
+	}
+
+	qsort(latency, (size_t) reads, sizeof(*latency), bench_cmp_latency);
+
+	printf("pressure %-8s read latency p50 %6" PRIu64 " ns p99 %6" PRIu64
+	       " ns p99.9 %6" PRIu64 " ns max %8" PRIu64 " ns\n",
+	       deferred ? "deferred" : "direct",
+	       latency[reads / 2], latency[(reads / 100) * 99],
+	       latency[(reads / 1000) * 999], latency[reads - 1]);
+
+	errcode = 0;
+
+out:
+	(void) pt_iscache_set_deferred_reclaim(bench->iscache, 0);
+	(void) pt_iscache_set_limit(bench->iscache, UINT64_MAX);
+
+	free(latency);
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench;
+	int errcode, nthreads, shared;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.reads = bench_reads;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [<reads>]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2) {
+		bench.reads = atoi(argv[1]);
+		if (bench.reads <= 0) {
+			fprintf(stderr, "%s: bad reads: %s\n", argv[0],
+				argv[1]);
+			return 1;
+		}
+	}
+
+	errcode = bench_init(&bench);
+	for (shared = 1; errcode >= 0 && shared >= 0; --shared) {
+		for (nthreads = 1; errcode >= 0 &&
+			     nthreads <= bench_max_threads; nthreads *= 2)
+			errcode = bench_iscache(&bench, nthreads, shared);
+	}
+
+	if (errcode >= 0)
+		errcode = bench_pressure(&bench, 0);
+
+	if (errcode >= 0)
+		errcode = bench_pressure(&bench, 1);
+
+	bench_fini(&bench);
+
+	if (errcode < 0) {
+		fprintf(stderr, "%s: %s\n", argv[0],
+			pt_errstr(pt_errcode(errcode)));
+		return 1;
+	}
+
+	return 0;
+}
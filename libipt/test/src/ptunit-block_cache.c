@@ -27,9 +27,11 @@
  */
 
 #include "ptunit_threads.h"
+#include "ptunit_mkfile.h"
 
 #include "pt_block_cache.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -82,6 +84,16 @@ static struct ptunit_result bfix_init(struct bcache_fixture *bfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result wfix_init(struct bcache_fixture *bfix)
+{
+	ptu_test(cfix_init, bfix);
+
+	bfix->bcache = pt_bcache_alloc_wide(bfix_nentries);
+	ptu_ptr(bfix->bcache);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result bfix_fini(struct bcache_fixture *bfix)
 {
 	int thrd;
@@ -98,7 +110,8 @@ static struct ptunit_result bfix_fini(struct bcache_fixture *bfix)
 
 static struct ptunit_result bcache_entry_size(void)
 {
-	ptu_uint_eq(sizeof(struct pt_bcache_entry), sizeof(uint32_t));
+	ptu_uint_eq(sizeof(struct pt_bcache_compact), sizeof(uint32_t));
+	ptu_uint_eq(sizeof(struct pt_bcache_entry), sizeof(uint64_t));
 
 	return ptu_passed();
 }
@@ -251,6 +264,482 @@ static struct ptunit_result add(struct bcache_fixture *bfix, uint64_t index)
 	return ptu_passed();
 }
 
+static struct ptunit_result add_wide(struct bcache_fixture *bfix)
+{
+	struct pt_bcache_entry bce, exp;
+	int errcode;
+
+	/* Some hosts don't support wide block caches. */
+	if (bfix->bcache->format != pt_bcf_wide)
+		return ptu_skipped();
+
+	memset(&bce, 0xff, sizeof(bce));
+	memset(&exp, 0x00, sizeof(exp));
+
+	exp.ninsn = 0x1234;
+	exp.displacement = -0x123456;
+	exp.mode = ptem_64bit;
+	exp.qualifier = ptbq_call;
+	exp.isize = 15;
+
+	ptu_int_ne(pt_bcache_fits(bfix->bcache, exp), 0);
+
+	errcode = pt_bcache_add(bfix->bcache, 0x10ull, exp);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_lookup(&bce, bfix->bcache, 0x10ull);
+	ptu_int_eq(errcode, 0);
+
+	ptu_uint_eq(bce.ninsn, exp.ninsn);
+	ptu_int_eq(bce.displacement, exp.displacement);
+	ptu_uint_eq(pt_bce_exec_mode(bce), pt_bce_exec_mode(exp));
+	ptu_uint_eq(pt_bce_qualifier(bce), pt_bce_qualifier(exp));
+	ptu_uint_eq(bce.isize, exp.isize);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result add_no_fit(struct bcache_fixture *bfix)
+{
+	struct pt_bcache_entry bce, exp;
+	int errcode;
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.ninsn = 1;
+	exp.mode = ptem_64bit;
+	exp.qualifier = ptbq_jump;
+	exp.isize = 5;
+	exp.displacement = -0x8000;
+
+	ptu_int_ne(pt_bcache_fits(bfix->bcache, exp), 0);
+
+	exp.displacement = 0x8000;
+	ptu_int_eq(pt_bcache_fits(bfix->bcache, exp), 0);
+
+	exp.displacement = 0;
+	exp.ninsn = 0x100;
+	ptu_int_eq(pt_bcache_fits(bfix->bcache, exp), 0);
+
+	exp.ninsn = 1;
+	exp.isize = 8;
+	ptu_int_eq(pt_bcache_fits(bfix->bcache, exp), 0);
+
+	errcode = pt_bcache_add(bfix->bcache, 0x10ull, exp);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_bcache_lookup(&bce, bfix->bcache, 0x10ull);
+	ptu_int_eq(errcode, 0);
+	ptu_int_eq(pt_bce_is_valid(bce), 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result load_null(void)
+{
+	struct pt_block_cache bcache;
+	int errcode;
+
+	errcode = pt_bcache_load(NULL, "filename", 0ull);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_bcache_load(&bcache, NULL, 0ull);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result store_null(void)
+{
+	struct pt_block_cache bcache;
+	uint32_t nvalid;
+	int errcode;
+
+	errcode = pt_bcache_store(NULL, "filename", 0ull, &nvalid);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_bcache_store(&bcache, NULL, 0ull, &nvalid);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_bcache_store(&bcache, "filename", 0ull, NULL);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result load_missing(struct bcache_fixture *bfix)
+{
+	int status;
+
+	status = pt_bcache_load(bfix->bcache, "/no/such/file.bcache", 0ull);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+/* Create an empty temporary file and provide its name in @filename. */
+static struct ptunit_result bfix_mkfile(char **filename)
+{
+	FILE *file;
+	int errcode;
+
+	errcode = ptunit_mkfile(&file, filename, "wb");
+	ptu_int_eq(errcode, 0);
+
+	fclose(file);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result store_load(struct bcache_fixture *bfix,
+				       uint64_t hash)
+{
+	struct pt_block_cache *bcache;
+	struct pt_bcache_entry bce, exp;
+	uint32_t nvalid;
+	char *filename;
+	int status;
+
+	ptu_test(bfix_mkfile, &filename);
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.ninsn = 3;
+	exp.displacement = -12;
+	exp.mode = ptem_32bit;
+	exp.qualifier = ptbq_cond;
+	exp.isize = 2;
+
+	status = pt_bcache_add(bfix->bcache, 0x42ull, exp);
+	ptu_int_eq(status, 0);
+
+	status = pt_bcache_add(bfix->bcache, bfix_nentries - 1ull, exp);
+	ptu_int_eq(status, 0);
+
+	nvalid = 0;
+	status = pt_bcache_store(bfix->bcache, filename, 0xa5a5ull, &nvalid);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(nvalid, 2);
+
+	bcache = pt_bcache_alloc(bfix_nentries);
+	ptu_ptr(bcache);
+
+	status = pt_bcache_load(bcache, filename, hash);
+
+	memset(&bce, 0xff, sizeof(bce));
+	(void) pt_bcache_lookup(&bce, bcache, 0x42ull);
+
+	pt_bcache_free(bcache);
+	remove(filename);
+	free(filename);
+
+	if (hash != 0xa5a5ull) {
+		ptu_int_eq(status, 0);
+		ptu_int_eq(pt_bce_is_valid(bce), 0);
+	} else {
+		ptu_int_eq(status, 2);
+		ptu_uint_eq(bce.ninsn, exp.ninsn);
+		ptu_int_eq(bce.displacement, exp.displacement);
+		ptu_uint_eq(pt_bce_exec_mode(bce), pt_bce_exec_mode(exp));
+		ptu_uint_eq(pt_bce_qualifier(bce), pt_bce_qualifier(exp));
+		ptu_uint_eq(bce.isize, exp.isize);
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result store_unchanged(struct bcache_fixture *bfix)
+{
+	struct pt_bcache_entry exp;
+	uint32_t nvalid;
+	char *filename;
+	long size;
+	FILE *file;
+	int status;
+
+	ptu_test(bfix_mkfile, &filename);
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.ninsn = 1;
+	exp.mode = ptem_64bit;
+	exp.qualifier = ptbq_decode;
+
+	status = pt_bcache_add(bfix->bcache, 0x10ull, exp);
+	ptu_int_eq(status, 0);
+
+	/* There is nothing new to store. */
+	nvalid = 1;
+	status = pt_bcache_store(bfix->bcache, filename, 0ull, &nvalid);
+
+	file = fopen(filename, "rb");
+	size = -1;
+	if (file) {
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fclose(file);
+	}
+
+	remove(filename);
+	free(filename);
+
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(nvalid, 1);
+	ptu_int_eq(size, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result store_replace(struct bcache_fixture *bfix)
+{
+	struct pt_block_cache *bcache;
+	struct pt_bcache_entry exp;
+	uint32_t nvalid;
+	char *filename;
+	int status, loaded;
+
+	ptu_test(bfix_mkfile, &filename);
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.ninsn = 1;
+	exp.mode = ptem_64bit;
+	exp.qualifier = ptbq_decode;
+
+	(void) pt_bcache_add(bfix->bcache, 0x10ull, exp);
+
+	nvalid = 0;
+	status = pt_bcache_store(bfix->bcache, filename, 0ull, &nvalid);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(nvalid, 1);
+
+	/* A later store with more entries replaces the file. */
+	(void) pt_bcache_add(bfix->bcache, 0x20ull, exp);
+
+	status = pt_bcache_store(bfix->bcache, filename, 0ull, &nvalid);
+
+	bcache = pt_bcache_alloc(bfix_nentries);
+	ptu_ptr(bcache);
+
+	loaded = pt_bcache_load(bcache, filename, 0ull);
+
+	pt_bcache_free(bcache);
+	remove(filename);
+	free(filename);
+
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(nvalid, 2);
+	ptu_int_eq(loaded, 2);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result load_corrupt(struct bcache_fixture *bfix)
+{
+	struct pt_bcache_entry bce, exp;
+	uint8_t *buffer;
+	uint32_t nvalid;
+	char *filename;
+	long size;
+	FILE *file;
+	int status;
+
+	ptu_test(bfix_mkfile, &filename);
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.ninsn = 1;
+	exp.mode = ptem_64bit;
+	exp.qualifier = ptbq_decode;
+
+	(void) pt_bcache_add(bfix->bcache, 0x10ull, exp);
+	(void) pt_bcache_add(bfix->bcache, 0x20ull, exp);
+
+	nvalid = 0;
+	status = pt_bcache_store(bfix->bcache, filename, 0ull, &nvalid);
+	ptu_int_eq(status, 0);
+
+	/* Truncate the last record. */
+	file = fopen(filename, "rb");
+	ptu_ptr(file);
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	ptu_int_gt(size, 0);
+
+	buffer = malloc((size_t) size);
+	ptu_ptr(buffer);
+
+	fseek(file, 0, SEEK_SET);
+	ptu_uint_eq(fread(buffer, (size_t) size, 1, file), 1);
+	fclose(file);
+
+	file = fopen(filename, "wb");
+	ptu_ptr(file);
+	ptu_uint_eq(fwrite(buffer, (size_t) size - 1, 1, file), 1);
+	fclose(file);
+
+	free(buffer);
+
+	pt_bcache_free(bfix->bcache);
+	bfix->bcache = pt_bcache_alloc(bfix_nentries);
+	ptu_ptr(bfix->bcache);
+
+	status = pt_bcache_load(bfix->bcache, filename, 0ull);
+
+	remove(filename);
+	free(filename);
+
+	ptu_int_eq(status, 0);
+
+	status = pt_bcache_lookup(&bce, bfix->bcache, 0x10ull);
+	ptu_int_eq(status, 0);
+	ptu_int_eq(pt_bce_is_valid(bce), 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_null(void)
+{
+	struct pt_block_cache bcache;
+	uint64_t size;
+	int errcode;
+
+	errcode = pt_bcache_memsize(NULL, &size);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_bcache_memsize(&bcache, NULL);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_empty(struct bcache_fixture *bfix)
+{
+	uint64_t size;
+	int errcode;
+
+	errcode = pt_bcache_memsize(bfix->bcache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_lt(size, bfix_nentries * sizeof(struct pt_bcache_entry));
+	ptu_uint_lt(size, sizeof(struct pt_bcache_page));
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_sparse(struct bcache_fixture *bfix)
+{
+	struct pt_bcache_entry bce;
+	uint64_t empty, size;
+	int errcode;
+
+	memset(&bce, 0, sizeof(bce));
+	bce.ninsn = 1;
+	bce.mode = ptem_64bit;
+	bce.qualifier = ptbq_cond;
+
+	errcode = pt_bcache_memsize(bfix->bcache, &empty);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_add(bfix->bcache, 0x10ull, bce);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_add(bfix->bcache, 0x20ull, bce);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_memsize(bfix->bcache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(size, empty + sizeof(struct pt_bcache_page));
+
+	errcode = pt_bcache_add(bfix->bcache, bfix_nentries - 1ull, bce);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_memsize(bfix->bcache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(size, empty + 2 * sizeof(struct pt_bcache_page));
+
+	errcode = pt_bcache_lookup(&bce, bfix->bcache,
+				   (uint64_t) pt_bcache_page_size);
+	ptu_int_eq(errcode, 0);
+	ptu_int_eq(pt_bce_is_valid(bce), 0);
+
+	errcode = pt_bcache_memsize(bfix->bcache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(size, empty + 2 * sizeof(struct pt_bcache_page));
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_wide(struct bcache_fixture *bfix)
+{
+	struct pt_bcache_entry bce;
+	uint64_t empty, size;
+	int errcode;
+
+	/* Some hosts don't support wide block caches. */
+	if (bfix->bcache->format != pt_bcf_wide)
+		return ptu_skipped();
+
+	memset(&bce, 0, sizeof(bce));
+	bce.ninsn = 1;
+	bce.mode = ptem_64bit;
+	bce.qualifier = ptbq_cond;
+
+	errcode = pt_bcache_memsize(bfix->bcache, &empty);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_add(bfix->bcache, 0x10ull, bce);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_bcache_memsize(bfix->bcache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(size, empty + sizeof(struct pt_bcache_wpage));
+
+	return ptu_passed();
+}
+
+static struct ptunit_result store_load_no_fit(struct bcache_fixture *bfix)
+{
+	struct pt_block_cache *bcache;
+	struct pt_bcache_entry bce, exp;
+	uint32_t nvalid;
+	char *filename;
+	int status;
+
+	/* Some hosts don't support wide block caches. */
+	if (bfix->bcache->format != pt_bcf_wide)
+		return ptu_skipped();
+
+	ptu_test(bfix_mkfile, &filename);
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.ninsn = 0x400;
+	exp.displacement = 0x10000;
+	exp.mode = ptem_64bit;
+	exp.qualifier = ptbq_again;
+
+	status = pt_bcache_add(bfix->bcache, 0x42ull, exp);
+	ptu_int_eq(status, 0);
+
+	nvalid = 0;
+	status = pt_bcache_store(bfix->bcache, filename, 0ull, &nvalid);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(nvalid, 1);
+
+	/* The entry can't be loaded into a compact block cache. */
+	bcache = pt_bcache_alloc(bfix_nentries);
+	ptu_ptr(bcache);
+
+	status = pt_bcache_load(bcache, filename, 0ull);
+
+	memset(&bce, 0xff, sizeof(bce));
+	(void) pt_bcache_lookup(&bce, bcache, 0x42ull);
+
+	pt_bcache_free(bcache);
+	remove(filename);
+	free(filename);
+
+	ptu_int_eq(status, 0);
+	ptu_int_eq(pt_bce_is_valid(bce), 0);
+
+	return ptu_passed();
+}
+
 static int worker(void *arg)
 {
 	struct pt_bcache_entry exp;
@@ -334,7 +823,7 @@ static struct ptunit_result stress(struct bcache_fixture *bfix)
 
 int main(int argc, char **argv)
 {
-	struct bcache_fixture bfix, cfix;
+	struct bcache_fixture bfix, cfix, wfix;
 	struct ptunit_suite suite;
 
 	bfix.init = bfix_init;
@@ -343,6 +832,9 @@ int main(int argc, char **argv)
 	cfix.init = cfix_init;
 	cfix.fini = bfix_fini;
 
+	wfix.init = wfix_init;
+	wfix.fini = bfix_fini;
+
 	suite = ptunit_mk_suite(argc, argv);
 
 	ptu_run(suite, bcache_entry_size);
@@ -365,6 +857,29 @@ int main(int argc, char **argv)
 	ptu_run_fp(suite, add, bfix, 0ull);
 	ptu_run_fp(suite, add, bfix, bfix_nentries - 1ull);
 	ptu_run_f(suite, stress, bfix);
+	ptu_run_f(suite, add_no_fit, bfix);
+
+	ptu_run_f(suite, initially_empty, wfix);
+	ptu_run_fp(suite, add, wfix, 0ull);
+	ptu_run_fp(suite, add, wfix, bfix_nentries - 1ull);
+	ptu_run_f(suite, add_wide, wfix);
+	ptu_run_f(suite, stress, wfix);
+
+	ptu_run(suite, memsize_null);
+	ptu_run_f(suite, memsize_empty, bfix);
+	ptu_run_f(suite, memsize_sparse, bfix);
+	ptu_run_f(suite, memsize_wide, wfix);
+
+	ptu_run(suite, load_null);
+	ptu_run(suite, store_null);
+	ptu_run_f(suite, load_missing, bfix);
+	ptu_run_fp(suite, store_load, bfix, 0xa5a5ull);
+	ptu_run_fp(suite, store_load, bfix, 0x5a5aull);
+	ptu_run_f(suite, store_unchanged, bfix);
+	ptu_run_f(suite, store_replace, bfix);
+	ptu_run_f(suite, load_corrupt, bfix);
+	ptu_run_fp(suite, store_load, wfix, 0xa5a5ull);
+	ptu_run_f(suite, store_load_no_fit, wfix);
 
 	return ptunit_report(&suite);
 }
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "pt_encoder.h"
+#include "pt_image.h"
+#include "pt_section.h"
+#include "pt_block_cache.h"
+#include "pt_mapped_section.h"
+#include "pt_asid.h"
+
+#include "intel-pt.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The test program.
+ *
+ * 0x1000:	jz	0x1003
+ * 0x1003:	loopne	0x1006
+ * 0x1006:	loope	0x1009
+ * 0x1009:	loop	0x100c
+ * 0x100c:	jrcxz	0x100f
+ * 0x100f:	jz	0x1016		(rel32)
+ * 0x1016:	ds jz	0x101a
+ * 0x101a:	cs cs cs cs jz	0x1021
+ * 0x1021:	call	0x1026
+ * 0x1026:	call	0x40000
+ * 0x102b:	call	0x1035
+ * 0x1030:	jmp	0x1000
+ * 0x1035:	ret
+ *
+ * 0x40000:	call	0x40005
+ * 0x40005:	ret
+ *
+ * Each conditional branch skips an int3 when it is taken.  Calls to the next
+ * instruction do not push a return address.  A return address pushed by
+ * mistake would be used by the return from the function outside of the
+ * section.
+ */
+static const uint8_t bfix_main[] = {
+	0x74, 0x01, 0xcc,
+	0xe0, 0x01, 0xcc,
+	0xe1, 0x01, 0xcc,
+	0xe2, 0x01, 0xcc,
+	0xe3, 0x01, 0xcc,
+	0x0f, 0x84, 0x01, 0x00, 0x00, 0x00, 0xcc,
+	0x3e, 0x74, 0x01, 0xcc,
+	0x2e, 0x2e, 0x2e, 0x2e, 0x74, 0x01, 0xcc,
+	0xe8, 0x00, 0x00, 0x00, 0x00,
+	0xe8, 0xd5, 0xef, 0x03, 0x00,
+	0xe8, 0x05, 0x00, 0x00, 0x00,
+	0xe9, 0xcb, 0xff, 0xff, 0xff,
+	0xc3
+};
+
+static const uint8_t bfix_far[] = {
+	0xe8, 0x00, 0x00, 0x00, 0x00,
+	0xc3
+};
+
+enum {
+	/* The addresses of the above code fragments. */
+	bfix_main_ip	= 0x1000,
+	bfix_far_ip	= 0x40000,
+
+	/* The number of loop iterations in the test trace. */
+	bfix_iterations	= 5,
+
+	/* The number of taken conditional branches and compressed returns
+	 * in one loop iteration.
+	 */
+	bfix_ntnt	= 10,
+
+	/* The size of the trace buffer. */
+	bfix_trace_size	= 0x100,
+
+	/* The maximal number of blocks we expect. */
+	bfix_max_blocks	= 0x100
+};
+
+/* A block we expect. */
+struct bfix_block {
+	/* The IP of the first and of the last instruction. */
+	uint64_t ip;
+	uint64_t end_ip;
+
+	/* The number of instructions. */
+	uint16_t ninsn;
+};
+
+/* The blocks of one loop iteration using the block cache.
+ *
+ * The first iteration fills the block cache.  It stops at direct branches and
+ * ends blocks there.  The second iteration starts before we reach the jump
+ * back to bfix_main_ip from the block cache.
+ */
+static const struct bfix_block bfix_loop[] = {
+	{ 0x1003ull, 0x1003ull, 1 },
+	{ 0x1006ull, 0x1006ull, 1 },
+	{ 0x1009ull, 0x1009ull, 1 },
+	{ 0x100cull, 0x100cull, 1 },
+	{ 0x100full, 0x100full, 1 },
+	{ 0x1016ull, 0x1016ull, 1 },
+	{ 0x101aull, 0x101aull, 1 },
+	{ 0x1021ull, 0x1026ull, 2 },
+	{ 0x40000ull, 0x40005ull, 2 },
+	{ 0x102bull, 0x1035ull, 2 },
+	{ 0x1030ull, 0x1000ull, 2 }
+};
+
+/* A test fixture providing a trace and the files containing the code. */
+struct block_fixture {
+	/* The trace buffer. */
+	uint8_t buffer[bfix_trace_size];
+
+	/* The decoder configuration. */
+	struct pt_config config;
+
+	/* The names of the files containing the code fragments. */
+	char *main_name;
+	char *far_name;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct block_fixture *);
+	struct ptunit_result (*fini)(struct block_fixture *);
+};
+
+static struct ptunit_result bfix_mkfile(char **pname, const uint8_t *content,
+					size_t size)
+{
+	FILE *file;
+	size_t written;
+	int errcode;
+
+	errcode = ptunit_mkfile(&file, pname, "wb");
+	ptu_int_eq(errcode, 0);
+
+	written = fwrite(content, 1, size, file);
+	fclose(file);
+
+	ptu_uint_eq(written, size);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result bfix_add(struct pt_image *image,
+				     struct pt_image_section_cache *iscache,
+				     const char *filename, uint64_t size,
+				     uint64_t vaddr)
+{
+	int isid, errcode;
+
+	isid = pt_iscache_add_file(iscache, filename, 0ull, size, vaddr);
+	ptu_int_gt(isid, 0);
+
+	errcode = pt_image_add_cached(image, iscache, isid, NULL);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
+/* Check the block cache entry for the instruction at @ip in @image. */
+static struct ptunit_result bfix_check_bce(struct pt_image *image,
+					   uint64_t ip,
+					   enum pt_bcache_qualifier qualifier,
+					   int32_t displacement, uint8_t isize)
+{
+	struct pt_mapped_section msec;
+	struct pt_block_cache *bcache;
+	struct pt_bcache_entry bce;
+	struct pt_asid asid;
+	int isid, errcode;
+
+	pt_asid_init(&asid);
+
+	isid = pt_image_find(image, &msec, &asid, ip);
+	ptu_int_gt(isid, 0);
+
+	bcache = pt_section_bcache(msec.section);
+
+	errcode = pt_section_put(msec.section);
+	ptu_int_eq(errcode, 0);
+
+	ptu_ptr(bcache);
+
+	errcode = pt_bcache_lookup(&bce, bcache, pt_msec_unmap(&msec, ip));
+	ptu_int_eq(errcode, 0);
+	ptu_int_eq(pt_bce_qualifier(bce), qualifier);
+	ptu_int_eq(bce.displacement, displacement);
+	ptu_uint_eq(bce.isize, isize);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result decode(struct block_fixture *bfix, uint32_t flags)
+{
+	struct pt_image_section_cache *iscache;
+	struct pt_block_decoder *decoder;
+	struct pt_block_cache *bcache;
+	struct pt_mapped_section msec;
+	struct bfix_block *blocks;
+	struct pt_image *image;
+	struct pt_asid asid;
+	size_t nblocks, nloop, begin, idx;
+	int status, isid;
+
+	iscache = pt_iscache_alloc(NULL);
+	ptu_ptr(iscache);
+
+	status = pt_iscache_set_map_flags(iscache, flags);
+	ptu_int_eq(status, 0);
+
+	image = pt_image_alloc(NULL);
+	ptu_ptr(image);
+
+	ptu_check(bfix_add, image, iscache, bfix->main_name,
+		  sizeof(bfix_main), bfix_main_ip);
+	ptu_check(bfix_add, image, iscache, bfix->far_name,
+		  sizeof(bfix_far), bfix_far_ip);
+
+	decoder = pt_blk_alloc_decoder(&bfix->config);
+	ptu_ptr(decoder);
+
+	status = pt_blk_set_image(decoder, image);
+	ptu_int_eq(status, 0);
+
+	blocks = calloc(bfix_max_blocks, sizeof(*blocks));
+	ptu_ptr(blocks);
+
+	status = pt_blk_sync_forward(decoder);
+	ptu_int_ge(status, 0);
+
+	for (nblocks = 0; nblocks < bfix_max_blocks;) {
+		struct pt_block block;
+
+		while (status & pts_event_pending) {
+			struct pt_event event;
+
+			status = pt_blk_event(decoder, &event, sizeof(event));
+			ptu_int_ge(status, 0);
+		}
+
+		status = pt_blk_next(decoder, &block, sizeof(block));
+		if (status < 0)
+			break;
+
+		if (!block.ninsn)
+			continue;
+
+		blocks[nblocks].ip = block.ip;
+		blocks[nblocks].end_ip = block.end_ip;
+		blocks[nblocks].ninsn = block.ninsn;
+		nblocks += 1;
+	}
+
+	pt_blk_free_decoder(decoder);
+
+	ptu_int_eq(status, -pte_eos);
+
+	/* Skip the first two iterations.  Tracing is disabled before the jump
+	 * at the end of the last iteration.
+	 */
+	nloop = sizeof(bfix_loop) / sizeof(*bfix_loop);
+	for (begin = 0; begin < nblocks; ++begin) {
+		if ((blocks[begin].ip == bfix_loop[nloop - 1].ip) &&
+		    (blocks[begin].end_ip == bfix_loop[nloop - 1].end_ip))
+			break;
+	}
+
+	begin += 1;
+	ptu_uint_eq(nblocks, begin + ((bfix_iterations - 2) * nloop));
+
+	for (idx = begin; idx < nblocks - 1; ++idx) {
+		const struct bfix_block *block;
+
+		block = &bfix_loop[(idx - begin) % nloop];
+
+		ptu_uint_eq(blocks[idx].ip, block->ip);
+		ptu_uint_eq(blocks[idx].end_ip, block->end_ip);
+		ptu_uint_eq(blocks[idx].ninsn, block->ninsn);
+	}
+
+	ptu_uint_eq(blocks[idx].ip, bfix_loop[nloop - 1].ip);
+	ptu_uint_eq(blocks[idx].end_ip, bfix_loop[nloop - 1].ip);
+	ptu_uint_eq(blocks[idx].ninsn, 1);
+
+	free(blocks);
+
+	/* Check that we used the cache entries we're testing. */
+	pt_asid_init(&asid);
+
+	isid = pt_image_find(image, &msec, &asid, bfix_main_ip);
+	ptu_int_gt(isid, 0);
+
+	bcache = pt_section_bcache(msec.section);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	ptu_ptr(bcache);
+
+#if (UINTPTR_MAX >= UINT64_MAX)
+	ptu_uint_eq(bcache->format,
+		    (flags & ptmf_wide_bcache) ? pt_bcf_wide : pt_bcf_compact);
+#endif
+
+	ptu_check(bfix_check_bce, image, 0x1000ull, ptbq_cond, 0, 2);
+	ptu_check(bfix_check_bce, image, 0x100full, ptbq_cond, 0, 6);
+	ptu_check(bfix_check_bce, image, 0x1016ull, ptbq_cond, 0, 3);
+	ptu_check(bfix_check_bce, image, 0x101aull, ptbq_cond, 0, 6);
+	ptu_check(bfix_check_bce, image, 0x1021ull, ptbq_call, 0, 5);
+	ptu_check(bfix_check_bce, image, 0x40000ull, ptbq_call, 0, 5);
+	ptu_check(bfix_check_bce, image, 0x102bull, ptbq_call, 5, 5);
+	ptu_check(bfix_check_bce, image, 0x1030ull, ptbq_jump, -0x35, 5);
+
+	/* The far call only fits into the wide format. */
+	if (bcache->format == pt_bcf_wide)
+		ptu_check(bfix_check_bce, image, 0x1026ull, ptbq_call,
+			  0x3efd5, 5);
+	else
+		ptu_check(bfix_check_bce, image, 0x1026ull, ptbq_decode, 0,
+			  0);
+
+	pt_image_free(image);
+	pt_iscache_free(iscache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result bfix_init(struct block_fixture *bfix)
+{
+	struct pt_encoder encoder;
+	int idx, errcode;
+
+	bfix->main_name = NULL;
+	bfix->far_name = NULL;
+
+	ptu_check(bfix_mkfile, &bfix->main_name, bfix_main,
+		  sizeof(bfix_main));
+	ptu_check(bfix_mkfile, &bfix->far_name, bfix_far, sizeof(bfix_far));
+
+	memset(bfix->buffer, 0, sizeof(bfix->buffer));
+
+	pt_config_init(&bfix->config);
+	bfix->config.begin = bfix->buffer;
+	bfix->config.end = bfix->buffer + sizeof(bfix->buffer);
+
+	errcode = pt_encoder_init(&encoder, &bfix->config);
+	ptu_int_eq(errcode, 0);
+
+	pt_encode_psb(&encoder);
+	pt_encode_mode_exec(&encoder, ptem_64bit);
+	pt_encode_fup(&encoder, bfix_main_ip, pt_ipc_sext_48);
+	pt_encode_psbend(&encoder);
+
+	for (idx = 0; idx < bfix_iterations; ++idx)
+		pt_encode_tnt_64(&encoder, (1ull << bfix_ntnt) - 1ull,
+				 bfix_ntnt);
+
+	pt_encode_fup(&encoder, bfix_main_ip, pt_ipc_sext_48);
+	pt_encode_tip_pgd(&encoder, 0ull, pt_ipc_suppressed);
+
+	bfix->config.end = encoder.pos;
+
+	pt_encoder_fini(&encoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result bfix_fini(struct block_fixture *bfix)
+{
+	if (bfix->main_name) {
+		remove(bfix->main_name);
+		free(bfix->main_name);
+	}
+
+	if (bfix->far_name) {
+		remove(bfix->far_name);
+		free(bfix->far_name);
+	}
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct block_fixture bfix;
+	struct ptunit_suite suite;
+
+	bfix.init = bfix_init;
+	bfix.fini = bfix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run_fp(suite, decode, bfix, 0u);
+	ptu_run_fp(suite, decode, bfix, (uint32_t) ptmf_wide_bcache);
+
+	return ptunit_report(&suite);
+}
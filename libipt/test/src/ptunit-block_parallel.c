@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+
+#include "pt_encoder.h"
+
+#include "intel-pt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The test program.
+ *
+ * 0x1000:	call	0x2000
+ * 0x1005:	jmp	0x1000
+ *
+ * 0x2000:	jz	0x2002
+ * 0x2002:	jz	0x2004
+ * 0x2004:	jz	0x2006
+ * 0x2006:	ret
+ */
+static const uint8_t pfix_main[] = {
+	0xe8, 0xfb, 0x0f, 0x00, 0x00,
+	0xeb, 0xf9
+};
+
+static const uint8_t pfix_callee[] = {
+	0x74, 0x00,
+	0x74, 0x00,
+	0x74, 0x00,
+	0xc3
+};
+
+enum {
+	/* The addresses of the above code fragments. */
+	pfix_main_ip	= 0x1000,
+	pfix_callee_ip	= 0x2000,
+	pfix_ret_ip	= 0x2006,
+
+	/* The number of loop iterations in the test trace. */
+	pfix_iterations	= 0x200,
+
+	/* The size of the trace buffer. */
+	pfix_trace_size	= 0x4000,
+
+	/* The maximal number of records we expect. */
+	pfix_max_records	= 0x4000
+};
+
+/* A collection of decoder records. */
+struct pfix_records {
+	/* The records. */
+	struct pt_blk_record record[pfix_max_records];
+
+	/* The number of records. */
+	size_t nrecords;
+};
+
+/* A test fixture providing a trace and an image. */
+struct parallel_fixture {
+	/* The trace buffer. */
+	uint8_t buffer[pfix_trace_size];
+
+	/* The decoder configuration. */
+	struct pt_config config;
+
+	/* The traced memory image. */
+	struct pt_image *image;
+
+	/* The records of the sequential and the parallel decode. */
+	struct pfix_records *expected;
+	struct pfix_records *actual;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct parallel_fixture *);
+	struct ptunit_result (*fini)(struct parallel_fixture *);
+};
+
+static int pfix_read_memory(uint8_t *buffer, size_t size,
+			    const struct pt_asid *asid, uint64_t ip,
+			    void *context)
+{
+	const uint8_t *code;
+	uint64_t base, csize;
+
+	(void) asid;
+	(void) context;
+
+	if ((pfix_main_ip <= ip) && (ip < pfix_main_ip + sizeof(pfix_main))) {
+		code = pfix_main;
+		base = pfix_main_ip;
+		csize = sizeof(pfix_main);
+	} else if ((pfix_callee_ip <= ip) &&
+		   (ip < pfix_callee_ip + sizeof(pfix_callee))) {
+		code = pfix_callee;
+		base = pfix_callee_ip;
+		csize = sizeof(pfix_callee);
+	} else
+		return -pte_nomap;
+
+	csize -= ip - base;
+	if (size < csize)
+		csize = size;
+
+	memcpy(buffer, &code[ip - base], (size_t) csize);
+
+	return (int) csize;
+}
+
+static int pfix_add_record(const struct pt_blk_record *record, void *context)
+{
+	struct pfix_records *records;
+
+	records = (struct pfix_records *) context;
+	if (!records || !record)
+		return -pte_internal;
+
+	if (pfix_max_records <= records->nrecords)
+		return -pte_nomem;
+
+	records->record[records->nrecords++] = *record;
+
+	return 0;
+}
+
+static int pfix_decode_sequential(struct pfix_records *records,
+				  const struct pt_config *config,
+				  struct pt_image *image)
+{
+	struct pt_block_decoder *decoder;
+	struct pt_blk_record record;
+	uint64_t last;
+	int status, errcode;
+
+	decoder = pt_blk_alloc_decoder(config);
+	if (!decoder)
+		return -pte_nomem;
+
+	status = pt_blk_set_image(decoder, image);
+	if (status < 0)
+		goto out;
+
+	last = 0ull;
+	for (;;) {
+		memset(&record, 0, sizeof(record));
+		record.type = ptbr_sync;
+		record.status = pt_blk_sync_forward(decoder);
+		(void) pt_blk_get_offset(decoder, &record.offset);
+
+		status = pfix_add_record(&record, records);
+		if (status < 0)
+			goto out;
+
+		status = record.status;
+		if (status < 0) {
+			if (status == -pte_eos || record.offset <= last)
+				break;
+
+			last = record.offset;
+			continue;
+		}
+
+		do {
+			memset(&record, 0, sizeof(record));
+
+			if (status & pts_event_pending) {
+				struct pt_event *event;
+
+				event = &record.variant.event;
+				record.type = ptbr_event;
+				status = pt_blk_event(decoder, event,
+						      sizeof(*event));
+			} else {
+				struct pt_block *block;
+
+				block = &record.variant.block;
+				record.type = ptbr_block;
+				status = pt_blk_next(decoder, block,
+						     sizeof(*block));
+			}
+
+			record.status = status;
+			(void) pt_blk_get_offset(decoder, &record.offset);
+
+			errcode = pfix_add_record(&record, records);
+			if (errcode < 0) {
+				status = errcode;
+				goto out;
+			}
+		} while (status >= 0);
+
+		if (status == -pte_eos)
+			break;
+	}
+
+	status = 0;
+
+out:
+	pt_blk_free_decoder(decoder);
+	return status;
+}
+
+static struct ptunit_result pfix_check(const struct pfix_records *expected,
+				       const struct pfix_records *actual)
+{
+	size_t idx;
+
+	ptu_uint_eq(actual->nrecords, expected->nrecords);
+
+	for (idx = 0; idx < expected->nrecords; ++idx) {
+		const struct pt_blk_record *erec, *arec;
+
+		erec = &expected->record[idx];
+		arec = &actual->record[idx];
+
+		ptu_int_eq(arec->type, erec->type);
+		ptu_int_eq(arec->status, erec->status);
+		ptu_uint_eq(arec->offset, erec->offset);
+
+		switch (erec->type) {
+		case ptbr_sync:
+			break;
+
+		case ptbr_block:
+			ptu_uint_eq(arec->variant.block.ip,
+				    erec->variant.block.ip);
+			ptu_uint_eq(arec->variant.block.end_ip,
+				    erec->variant.block.end_ip);
+			ptu_uint_eq(arec->variant.block.ninsn,
+				    erec->variant.block.ninsn);
+			ptu_int_eq(arec->variant.block.mode,
+				   erec->variant.block.mode);
+			ptu_uint_eq(arec->variant.block.truncated,
+				    erec->variant.block.truncated);
+			break;
+
+		case ptbr_event:
+			ptu_int_eq(arec->variant.event.type,
+				   erec->variant.event.type);
+			ptu_uint_eq(arec->variant.event.status_update,
+				    erec->variant.event.status_update);
+			ptu_uint_eq(arec->variant.event.ip_suppressed,
+				    erec->variant.event.ip_suppressed);
+			break;
+		}
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result decode_null(void)
+{
+	struct pt_blk_parallel_config pconfig;
+	struct pt_config config;
+	int errcode;
+
+	pt_config_init(&config);
+	pt_blk_parallel_config_init(&pconfig);
+
+	errcode = pt_blk_decode_parallel(NULL, NULL, &pconfig);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_blk_decode_parallel(&config, NULL, NULL);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result decode_no_callback(void)
+{
+	struct pt_blk_parallel_config pconfig;
+	uint8_t buffer[] = { 0 };
+	struct pt_config config;
+	int errcode;
+
+	pt_config_init(&config);
+	config.begin = buffer;
+	config.end = buffer + sizeof(buffer);
+
+	pt_blk_parallel_config_init(&pconfig);
+
+	errcode = pt_blk_decode_parallel(&config, NULL, &pconfig);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result decode_no_psb(struct parallel_fixture *pfix)
+{
+	struct pt_blk_parallel_config pconfig;
+	struct pfix_records *records;
+	int errcode;
+
+	pfix->config.end = pfix->config.begin + 8;
+	memset(pfix->buffer, 0, 8);
+
+	records = pfix->actual;
+
+	pt_blk_parallel_config_init(&pconfig);
+	pconfig.callback = pfix_add_record;
+	pconfig.context = records;
+
+	errcode = pt_blk_decode_parallel(&pfix->config, pfix->image, &pconfig);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(records->nrecords, 1);
+	ptu_int_eq(records->record[0].type, ptbr_sync);
+	ptu_int_eq(records->record[0].status, -pte_eos);
+
+	return ptu_passed();
+}
+
+static int pfix_abort(const struct pt_blk_record *record, void *context)
+{
+	(void) record;
+	(void) context;
+
+	return -pte_bad_context;
+}
+
+static struct ptunit_result decode_abort(struct parallel_fixture *pfix,
+					 uint32_t nthreads)
+{
+	struct pt_blk_parallel_config pconfig;
+	int errcode;
+
+	pt_blk_parallel_config_init(&pconfig);
+	pconfig.callback = pfix_abort;
+	pconfig.nthreads = nthreads;
+	pconfig.segment_size = 1;
+
+	errcode = pt_blk_decode_parallel(&pfix->config, pfix->image, &pconfig);
+	ptu_int_eq(errcode, -pte_bad_context);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result decode(struct parallel_fixture *pfix,
+				   uint32_t nthreads, uint64_t segment_size)
+{
+	struct pt_blk_parallel_config pconfig;
+	int errcode;
+
+	errcode = pfix_decode_sequential(pfix->expected, &pfix->config,
+					 pfix->image);
+	ptu_int_eq(errcode, 0);
+
+	pt_blk_parallel_config_init(&pconfig);
+	pconfig.callback = pfix_add_record;
+	pconfig.context = pfix->actual;
+	pconfig.nthreads = nthreads;
+	pconfig.segment_size = segment_size;
+
+	errcode = pt_blk_decode_parallel(&pfix->config, pfix->image, &pconfig);
+	ptu_int_eq(errcode, 0);
+
+	ptu_test(pfix_check, pfix->expected, pfix->actual);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result decode_corrupt(struct parallel_fixture *pfix,
+					   uint32_t nthreads)
+{
+	size_t offset;
+
+	/* Corrupt the trace somewhere in the middle.
+	 *
+	 * The sequential and the parallel decoder should both recover at the
+	 * next PSB.
+	 */
+	offset = (size_t) (pfix->config.end - pfix->config.begin) / 2;
+	memset(&pfix->buffer[offset], 0xd9, 4);
+
+	ptu_test(decode, pfix, nthreads, 1ull);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result pfix_init(struct parallel_fixture *pfix)
+{
+	struct pt_encoder encoder;
+	int idx, errcode;
+
+	pfix->expected = calloc(1, sizeof(*pfix->expected));
+	pfix->actual = calloc(1, sizeof(*pfix->actual));
+	pfix->image = pt_image_alloc(NULL);
+
+	ptu_ptr(pfix->expected);
+	ptu_ptr(pfix->actual);
+	ptu_ptr(pfix->image);
+
+	errcode = pt_image_set_callback(pfix->image, pfix_read_memory, NULL);
+	ptu_int_eq(errcode, 0);
+
+	memset(pfix->buffer, 0, sizeof(pfix->buffer));
+
+	pt_config_init(&pfix->config);
+	pfix->config.begin = pfix->buffer;
+	pfix->config.end = pfix->buffer + sizeof(pfix->buffer);
+
+	errcode = pt_encoder_init(&encoder, &pfix->config);
+	ptu_int_eq(errcode, 0);
+
+	pt_encode_psb(&encoder);
+	pt_encode_mode_exec(&encoder, ptem_64bit);
+	pt_encode_fup(&encoder, pfix_main_ip, pt_ipc_sext_48);
+	pt_encode_psbend(&encoder);
+
+	for (idx = 0; idx < pfix_iterations; ++idx) {
+		pt_encode_tnt_8(&encoder, (uint8_t) idx & 0x7, 3);
+
+		/* Place a PSB+ between the call and the return every few
+		 * iterations so decoding a segment needs the return address
+		 * pushed in the preceding segment.
+		 */
+		if ((idx % 7) == 6) {
+			pt_encode_psb(&encoder);
+			pt_encode_mode_exec(&encoder, ptem_64bit);
+			pt_encode_fup(&encoder, pfix_ret_ip, pt_ipc_sext_48);
+			pt_encode_psbend(&encoder);
+		}
+
+		pt_encode_tnt_8(&encoder, 0x1, 1);
+	}
+
+	pt_encode_tip_pgd(&encoder, 0ull, pt_ipc_suppressed);
+
+	pfix->config.end = encoder.pos;
+
+	pt_encoder_fini(&encoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result pfix_fini(struct parallel_fixture *pfix)
+{
+	pt_image_free(pfix->image);
+	free(pfix->expected);
+	free(pfix->actual);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct parallel_fixture pfix;
+	struct ptunit_suite suite;
+
+	pfix.init = pfix_init;
+	pfix.fini = pfix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run(suite, decode_null);
+	ptu_run(suite, decode_no_callback);
+	ptu_run_f(suite, decode_no_psb, pfix);
+	ptu_run_fp(suite, decode_abort, pfix, 0);
+	ptu_run_fp(suite, decode_abort, pfix, 4);
+
+	ptu_run_fp(suite, decode, pfix, 0, 0ull);
+	ptu_run_fp(suite, decode, pfix, 0, 1ull);
+	ptu_run_fp(suite, decode, pfix, 1, 0x100ull);
+	ptu_run_fp(suite, decode, pfix, 2, 1ull);
+	ptu_run_fp(suite, decode, pfix, 4, 1ull);
+	ptu_run_fp(suite, decode, pfix, 4, 0x40ull);
+	ptu_run_fp(suite, decode, pfix, 8, 0x80ull);
+
+	ptu_run_fp(suite, decode_corrupt, pfix, 0);
+	ptu_run_fp(suite, decode_corrupt, pfix, 4);
+
+	return ptunit_report(&suite);
+}
@@ -148,6 +148,168 @@ static struct ptunit_result fetch_unknown_ext2(struct fetch_fixture *ffix)
 	return ptu_passed();
 }
 
+static struct ptunit_result fetch_ext_eos(struct fetch_fixture *ffix)
+{
+	const struct pt_decoder_function *dfun;
+	int errcode;
+
+	ffix->config.begin[0] = pt_opc_ext;
+	ffix->config.end = ffix->config.begin + 1;
+
+	errcode = pt_df_fetch(&dfun, ffix->config.begin, &ffix->config);
+	ptu_int_eq(errcode, -pte_eos);
+	ptu_null(dfun);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result fetch_ext2_eos(struct fetch_fixture *ffix)
+{
+	const struct pt_decoder_function *dfun;
+	int errcode;
+
+	ffix->config.begin[0] = pt_opc_ext;
+	ffix->config.begin[1] = pt_ext_ext2;
+	ffix->config.end = ffix->config.begin + 2;
+
+	errcode = pt_df_fetch(&dfun, ffix->config.begin, &ffix->config);
+	ptu_int_eq(errcode, -pte_eos);
+	ptu_null(dfun);
+
+	return ptu_passed();
+}
+
+/* The expected decoder function for a single-byte opcode. */
+static const struct pt_decoder_function *fetch_expected_opc(uint8_t opc)
+{
+	switch (opc) {
+	case pt_opc_pad:
+		return &pt_decode_pad;
+
+	case pt_opc_mode:
+		return &pt_decode_mode;
+
+	case pt_opc_tsc:
+		return &pt_decode_tsc;
+
+	case pt_opc_mtc:
+		return &pt_decode_mtc;
+	}
+
+	if ((opc & pt_opm_tnt_8) == pt_opc_tnt_8)
+		return &pt_decode_tnt_8;
+
+	if ((opc & pt_opm_cyc) == pt_opc_cyc)
+		return &pt_decode_cyc;
+
+	if ((opc & pt_opm_tip) == pt_opc_tip)
+		return &pt_decode_tip;
+
+	if ((opc & pt_opm_fup) == pt_opc_fup)
+		return &pt_decode_fup;
+
+	if ((opc & pt_opm_tip) == pt_opc_tip_pge)
+		return &pt_decode_tip_pge;
+
+	if ((opc & pt_opm_tip) == pt_opc_tip_pgd)
+		return &pt_decode_tip_pgd;
+
+	return &pt_decode_unknown;
+}
+
+/* The expected decoder function for an extended opcode. */
+static const struct pt_decoder_function *fetch_expected_ext(uint8_t ext)
+{
+	switch (ext) {
+	case pt_ext_psb:
+		return &pt_decode_psb;
+
+	case pt_ext_ovf:
+		return &pt_decode_ovf;
+
+	case pt_ext_tnt_64:
+		return &pt_decode_tnt_64;
+
+	case pt_ext_psbend:
+		return &pt_decode_psbend;
+
+	case pt_ext_cbr:
+		return &pt_decode_cbr;
+
+	case pt_ext_pip:
+		return &pt_decode_pip;
+
+	case pt_ext_tma:
+		return &pt_decode_tma;
+
+	case pt_ext_stop:
+		return &pt_decode_stop;
+
+	case pt_ext_vmcs:
+		return &pt_decode_vmcs;
+
+	case pt_ext_exstop:
+	case pt_ext_exstop_ip:
+		return &pt_decode_exstop;
+
+	case pt_ext_mwait:
+		return &pt_decode_mwait;
+
+	case pt_ext_pwre:
+		return &pt_decode_pwre;
+
+	case pt_ext_pwrx:
+		return &pt_decode_pwrx;
+	}
+
+	if ((ext & pt_opm_ptw) == pt_ext_ptw)
+		return &pt_decode_ptw;
+
+	return &pt_decode_unknown;
+}
+
+static struct ptunit_result fetch_opc_all(struct fetch_fixture *ffix)
+{
+	const struct pt_decoder_function *dfun;
+	int opc, errcode;
+
+	for (opc = 0; opc <= UINT8_MAX; ++opc) {
+		if (opc == pt_opc_ext)
+			continue;
+
+		ffix->config.begin[0] = (uint8_t) opc;
+
+		errcode = pt_df_fetch(&dfun, ffix->config.begin,
+				      &ffix->config);
+		ptu_int_eq(errcode, 0);
+		ptu_ptr_eq(dfun, fetch_expected_opc((uint8_t) opc));
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result fetch_ext_all(struct fetch_fixture *ffix)
+{
+	const struct pt_decoder_function *dfun;
+	int ext, errcode;
+
+	ffix->config.begin[0] = pt_opc_ext;
+
+	for (ext = 0; ext <= UINT8_MAX; ++ext) {
+		if (ext == pt_ext_ext2)
+			continue;
+
+		ffix->config.begin[1] = (uint8_t) ext;
+
+		errcode = pt_df_fetch(&dfun, ffix->config.begin,
+				      &ffix->config);
+		ptu_int_eq(errcode, 0);
+		ptu_ptr_eq(dfun, fetch_expected_ext((uint8_t) ext));
+	}
+
+	return ptu_passed();
+}
+
 static struct ptunit_result fetch_packet(struct fetch_fixture *ffix,
 					 const struct pt_packet *packet,
 					 const struct pt_decoder_function *df)
@@ -247,6 +409,10 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, fetch_unknown, ffix);
 	ptu_run_f(suite, fetch_unknown_ext, ffix);
 	ptu_run_f(suite, fetch_unknown_ext2, ffix);
+	ptu_run_f(suite, fetch_ext_eos, ffix);
+	ptu_run_f(suite, fetch_ext2_eos, ffix);
+	ptu_run_f(suite, fetch_opc_all, ffix);
+	ptu_run_f(suite, fetch_ext_all, ffix);
 
 	ptu_run_fp(suite, fetch_type, ffix, ppt_pad, &pt_decode_pad);
 	ptu_run_fp(suite, fetch_type, ffix, ppt_psb, &pt_decode_psb);
@@ -425,7 +425,8 @@ static struct ptunit_result init(void)
 
 	pt_image_init(&image, NULL);
 	ptu_null(image.name);
-	ptu_null(image.sections);
+	ptu_null(image.spaces);
+	ptu_uint_eq(image.nspaces, 0);
 	ptu_null((void *) (uintptr_t) image.readmem.callback);
 	ptu_null(image.readmem.context);
 
@@ -438,7 +439,8 @@ static struct ptunit_result init_name(struct image_fixture *ifix)
 
 	pt_image_init(&ifix->image, "image-name");
 	ptu_str_eq(ifix->image.name, "image-name");
-	ptu_null(ifix->image.sections);
+	ptu_null(ifix->image.spaces);
+	ptu_uint_eq(ifix->image.nspaces, 0);
 	ptu_null((void *) (uintptr_t) ifix->image.readmem.callback);
 	ptu_null(ifix->image.readmem.context);
 
@@ -980,6 +982,72 @@ static struct ptunit_result adjacent(struct image_fixture *ifix)
 	return ptu_passed();
 }
 
+static struct ptunit_result overlap_many(struct image_fixture *ifix)
+{
+	struct pt_mapped_section msec;
+	uint64_t vaddr;
+	int status, idx;
+
+	for (idx = 0; idx < 16; ++idx) {
+		status = pt_image_add(&ifix->image, &ifix->section[0],
+				      &ifix->asid[0],
+				      0x10000ull + ((uint64_t) idx * 0x10ull),
+				      idx + 1);
+		ptu_int_eq(status, 0);
+	}
+
+	/* Cover the second half of section 4 through the first half of
+	 * section 6.
+	 */
+	ifix->section[1].size = 0x20;
+
+	status = pt_image_add(&ifix->image, &ifix->section[1], &ifix->asid[0],
+			      0x10048ull, 17);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_find(&ifix->image, &msec, &ifix->asid[0], 0x10047ull);
+	ptu_int_eq(status, 5);
+	ptu_uint_eq(msec.vaddr, 0x10040ull);
+	ptu_uint_eq(msec.size, 0x8ull);
+	ptu_uint_eq(msec.offset, 0x0ull);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	for (vaddr = 0x10048ull; vaddr < 0x10068ull; ++vaddr) {
+		status = pt_image_find(&ifix->image, &msec, &ifix->asid[0],
+				       vaddr);
+		ptu_int_eq(status, 17);
+		ptu_ptr_eq(msec.section, &ifix->section[1]);
+
+		status = pt_section_put(msec.section);
+		ptu_int_eq(status, 0);
+	}
+
+	status = pt_image_find(&ifix->image, &msec, &ifix->asid[0], 0x10068ull);
+	ptu_int_eq(status, 7);
+	ptu_uint_eq(msec.vaddr, 0x10068ull);
+	ptu_uint_eq(msec.size, 0x8ull);
+	ptu_uint_eq(msec.offset, 0x8ull);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	/* Thirteen sections remain complete, sections 5 and 7 were
+	 * shrunk, and section 6 was removed.
+	 */
+	ptu_uint_eq(ifix->section[0].ucount, 15);
+	ptu_uint_eq(ifix->section[1].ucount, 1);
+
+	status = pt_image_find(&ifix->image, &msec, &ifix->asid[0], 0x100f8ull);
+	ptu_int_eq(status, 16);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result read_null(struct image_fixture *ifix)
 {
 	uint8_t buffer;
@@ -1933,6 +2001,50 @@ static struct ptunit_result find(struct image_fixture *ifix)
 	return ptu_passed();
 }
 
+static struct ptunit_result find_many(struct image_fixture *ifix)
+{
+	struct pt_mapped_section msec;
+	int status, idx;
+
+	/* Add sections in reverse order with gaps in-between. */
+	for (idx = 63; idx >= 0; --idx) {
+		status = pt_image_add(&ifix->image, &ifix->section[idx % 2],
+				      &ifix->asid[0],
+				      0x10000ull + ((uint64_t) idx * 0x20ull),
+				      idx + 1);
+		ptu_int_eq(status, 0);
+	}
+
+	for (idx = 0; idx < 64; ++idx) {
+		uint64_t vaddr;
+
+		vaddr = 0x10000ull + ((uint64_t) idx * 0x20ull);
+
+		status = pt_image_find(&ifix->image, &msec, &ifix->asid[0],
+				       vaddr + 0xf);
+		ptu_int_eq(status, idx + 1);
+		ptu_ptr_eq(msec.section, &ifix->section[idx % 2]);
+		ptu_uint_eq(msec.vaddr, vaddr);
+
+		status = pt_section_put(msec.section);
+		ptu_int_eq(status, 0);
+
+		status = pt_image_find(&ifix->image, &msec, &ifix->asid[0],
+				       vaddr + 0x10);
+		ptu_int_eq(status, -pte_nomap);
+
+		status = pt_image_find(&ifix->image, &msec, &ifix->asid[1],
+				       vaddr);
+		ptu_int_eq(status, -pte_nomap);
+	}
+
+	status = pt_image_find(&ifix->image, &msec, &ifix->asid[0],
+			       0xffffull);
+	ptu_int_eq(status, -pte_nomap);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result find_asid(struct image_fixture *ifix)
 {
 	struct pt_mapped_section msec;
@@ -2111,6 +2223,369 @@ static struct ptunit_result validate_bad_isid(struct image_fixture *ifix)
 	return ptu_passed();
 }
 
+static struct ptunit_result generation(struct image_fixture *ifix)
+{
+	struct pt_mapped_section msec;
+	uint64_t gen, next;
+	int status, isid;
+
+	gen = pt_image_generation(&ifix->image);
+	ptu_uint_ne(gen, 0ull);
+	ptu_uint_ne(gen, pt_image_generation(&ifix->copy));
+
+	/* Lookups do not change the generation. */
+	isid = pt_image_find(&ifix->image, &msec, &ifix->asid[1], 0x2003ull);
+	ptu_int_eq(isid, 11);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_eq(pt_image_generation(&ifix->image), gen);
+
+	status = pt_image_add(&ifix->image, &ifix->section[2], &ifix->asid[2],
+			      0x3000ull, 12);
+	ptu_int_eq(status, 0);
+
+	next = pt_image_generation(&ifix->image);
+	ptu_uint_ne(next, gen);
+	gen = next;
+
+	status = pt_image_remove(&ifix->image, &ifix->section[2],
+				 &ifix->asid[2], 0x3000ull);
+	ptu_int_eq(status, 0);
+
+	next = pt_image_generation(&ifix->image);
+	ptu_uint_ne(next, gen);
+	gen = next;
+
+	/* Nothing is removed - the generation does not change. */
+	status = pt_image_remove_by_asid(&ifix->image, &ifix->asid[2]);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(pt_image_generation(&ifix->image), gen);
+
+	status = pt_image_remove_by_asid(&ifix->image, &ifix->asid[1]);
+	ptu_int_eq(status, 1);
+
+	next = pt_image_generation(&ifix->image);
+	ptu_uint_ne(next, gen);
+	gen = next;
+
+	status = pt_image_remove_by_filename(&ifix->image,
+					     ifix->section[0].filename,
+					     &ifix->asid[0]);
+	ptu_int_eq(status, 1);
+
+	next = pt_image_generation(&ifix->image);
+	ptu_uint_ne(next, gen);
+	gen = next;
+
+	/* Re-initializing an image does not reuse an old generation. */
+	pt_image_fini(&ifix->image);
+	pt_image_init(&ifix->image, NULL);
+
+	ptu_uint_ne(pt_image_generation(&ifix->image), gen);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result set_base_null(struct image_fixture *ifix)
+{
+	int status;
+
+	status = pt_image_set_base(NULL, &ifix->image);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_image_set_base(&ifix->copy, NULL);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result set_base_cycle(struct image_fixture *ifix)
+{
+	int status;
+
+	status = pt_image_set_base(&ifix->image, &ifix->image);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_set_base(&ifix->image, &ifix->copy);
+	ptu_int_eq(status, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result layer_read(struct image_fixture *ifix)
+{
+	uint8_t buffer[] = { 0xcc, 0xcc, 0xcc };
+	int status, isid;
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	isid = -1;
+	status = pt_image_read(&ifix->copy, &isid, buffer, 2, &ifix->asid[1],
+			       0x2003ull);
+	ptu_int_eq(status, 2);
+	ptu_int_eq(isid, 11);
+	ptu_uint_eq(buffer[0], 0x03);
+	ptu_uint_eq(buffer[1], 0x04);
+	ptu_uint_eq(buffer[2], 0xcc);
+
+	/* Removing the base removes its sections. */
+	status = pt_image_set_base(&ifix->copy, NULL);
+	ptu_int_eq(status, 0);
+
+	isid = -1;
+	status = pt_image_read(&ifix->copy, &isid, buffer, 2, &ifix->asid[1],
+			       0x2003ull);
+	ptu_int_eq(status, -pte_nomap);
+	ptu_int_eq(isid, -1);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result layer_precedence(struct image_fixture *ifix)
+{
+	uint8_t buffer[] = { 0xcc, 0xcc };
+	int status, isid;
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_add(&ifix->copy, &ifix->section[2], &ifix->asid[1],
+			      0x2000ull, 12);
+	ptu_int_eq(status, 0);
+
+	isid = -1;
+	status = pt_image_read(&ifix->copy, &isid, buffer, 1, &ifix->asid[1],
+			       0x2003ull);
+	ptu_int_eq(status, 1);
+	ptu_int_eq(isid, 12);
+
+	/* The base image is not modified. */
+	isid = -1;
+	status = pt_image_read(&ifix->image, &isid, buffer, 1, &ifix->asid[1],
+			       0x2003ull);
+	ptu_int_eq(status, 1);
+	ptu_int_eq(isid, 11);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result layer_clip_begin(struct image_fixture *ifix)
+{
+	struct pt_mapped_section msec;
+	int status, isid;
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	/* Hide the beginning of the base image's section. */
+	status = pt_image_add(&ifix->copy, &ifix->section[2], &ifix->asid[1],
+			      0x1ffcull, 12);
+	ptu_int_eq(status, 0);
+
+	isid = pt_image_find(&ifix->copy, &msec, &ifix->asid[1], 0x200eull);
+	ptu_int_eq(isid, 11);
+	ptu_ptr_eq(msec.section, &ifix->section[1]);
+	ptu_uint_eq(msec.vaddr, 0x200cull);
+	ptu_uint_eq(msec.offset, 0xcull);
+	ptu_uint_eq(msec.size, 0x4ull);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_validate(&ifix->copy, &msec, 0x200eull, isid);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result layer_clip_end(struct image_fixture *ifix)
+{
+	struct pt_mapped_section msec;
+	uint8_t buffer[] = { 0xcc, 0xcc, 0xcc, 0xcc };
+	int status, isid;
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	/* Hide the end of the base image's section. */
+	status = pt_image_add(&ifix->copy, &ifix->section[2], &ifix->asid[1],
+			      0x2008ull, 12);
+	ptu_int_eq(status, 0);
+
+	isid = pt_image_find(&ifix->copy, &msec, &ifix->asid[1], 0x2003ull);
+	ptu_int_eq(isid, 11);
+	ptu_ptr_eq(msec.section, &ifix->section[1]);
+	ptu_uint_eq(msec.vaddr, 0x2000ull);
+	ptu_uint_eq(msec.offset, 0x0ull);
+	ptu_uint_eq(msec.size, 0x8ull);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	/* A read from the base image stops at the layer's section. */
+	isid = -1;
+	status = pt_image_read(&ifix->copy, &isid, buffer, sizeof(buffer),
+			       &ifix->asid[1], 0x2006ull);
+	ptu_int_eq(status, 2);
+	ptu_int_eq(isid, 11);
+	ptu_uint_eq(buffer[0], 0x06);
+	ptu_uint_eq(buffer[1], 0x07);
+	ptu_uint_eq(buffer[2], 0xcc);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result layer_update(struct image_fixture *ifix)
+{
+	struct pt_mapped_section msec;
+	uint8_t buffer[] = { 0xcc, 0xcc };
+	uint64_t gen;
+	int status, isid;
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	gen = pt_image_generation(&ifix->copy);
+
+	status = pt_image_add(&ifix->image, &ifix->section[2], &ifix->asid[1],
+			      0x3000ull, 12);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_ne(pt_image_generation(&ifix->copy), gen);
+
+	isid = pt_image_find(&ifix->copy, &msec, &ifix->asid[1], 0x3001ull);
+	ptu_int_eq(isid, 12);
+
+	status = pt_section_put(msec.section);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_validate(&ifix->copy, &msec, 0x3001ull, isid);
+	ptu_int_eq(status, 0);
+
+	gen = pt_image_generation(&ifix->copy);
+
+	status = pt_image_remove(&ifix->image, &ifix->section[2],
+				 &ifix->asid[1], 0x3000ull);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_ne(pt_image_generation(&ifix->copy), gen);
+
+	status = pt_image_validate(&ifix->copy, &msec, 0x3001ull, isid);
+	ptu_int_eq(status, -pte_nomap);
+
+	isid = -1;
+	status = pt_image_read(&ifix->copy, &isid, buffer, 1, &ifix->asid[1],
+			       0x3001ull);
+	ptu_int_eq(status, -pte_nomap);
+	ptu_int_eq(isid, -1);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result layer_generation(struct image_fixture *ifix)
+{
+	uint64_t gen;
+	int status;
+
+	gen = pt_image_generation(&ifix->copy);
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_ne(pt_image_generation(&ifix->copy), gen);
+	gen = pt_image_generation(&ifix->copy);
+
+	status = pt_image_set_base(&ifix->copy, NULL);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_ne(pt_image_generation(&ifix->copy), gen);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result copy_layered(struct image_fixture *ifix)
+{
+	struct pt_image image;
+	uint8_t buffer[] = { 0xcc, 0xcc };
+	int status, isid;
+
+	pt_image_init(&image, NULL);
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_add(&ifix->copy, &ifix->section[2], &ifix->asid[1],
+			      0x2000ull, 12);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_copy(&image, &ifix->copy);
+	ptu_int_eq(status, 0);
+
+	isid = -1;
+	status = pt_image_read(&image, &isid, buffer, 1, &ifix->asid[0],
+			       0x1003ull);
+	ptu_int_eq(status, 1);
+	ptu_int_eq(isid, 10);
+
+	isid = -1;
+	status = pt_image_read(&image, &isid, buffer, 1, &ifix->asid[1],
+			       0x2003ull);
+	ptu_int_eq(status, 1);
+	ptu_int_eq(isid, 12);
+
+	pt_image_fini(&image);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result copy_same_base(struct image_fixture *ifix)
+{
+	struct pt_image image;
+	uint8_t buffer[] = { 0xcc, 0xcc };
+	int status, isid;
+
+	pt_image_init(&image, NULL);
+
+	status = pt_image_set_base(&image, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_set_base(&ifix->copy, &ifix->image);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_add(&ifix->copy, &ifix->section[2], &ifix->asid[0],
+			      0x3000ull, 12);
+	ptu_int_eq(status, 0);
+
+	status = pt_image_copy(&image, &ifix->copy);
+	ptu_int_eq(status, 0);
+
+	/* Only @ifix->copy's own sections have been copied. */
+	status = pt_image_set_base(&image, NULL);
+	ptu_int_eq(status, 0);
+
+	isid = -1;
+	status = pt_image_read(&image, &isid, buffer, 1, &ifix->asid[0],
+			       0x3003ull);
+	ptu_int_eq(status, 1);
+	ptu_int_eq(isid, 12);
+
+	isid = -1;
+	status = pt_image_read(&image, &isid, buffer, 1, &ifix->asid[0],
+			       0x1003ull);
+	ptu_int_eq(status, -pte_nomap);
+	ptu_int_eq(isid, -1);
+
+	pt_image_fini(&image);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result ifix_init(struct image_fixture *ifix)
 {
 	int index;
@@ -2231,6 +2706,7 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, same_different_isid, ifix);
 	ptu_run_f(suite, same_different_offset, ifix);
 	ptu_run_f(suite, adjacent, ifix);
+	ptu_run_f(suite, overlap_many, ifix);
 
 	ptu_run_f(suite, read_null, rfix);
 	ptu_run_f(suite, read, rfix);
@@ -2261,6 +2737,8 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, copy_merge, ifix);
 	ptu_run_f(suite, copy_overlap, ifix);
 	ptu_run_f(suite, copy_replace, ifix);
+	ptu_run_f(suite, copy_layered, rfix);
+	ptu_run_f(suite, copy_same_base, rfix);
 
 	ptu_run(suite, add_cached_null);
 	ptu_run_f(suite, add_cached, ifix);
@@ -2271,6 +2749,7 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, find_null, rfix);
 	ptu_run_f(suite, find, rfix);
 	ptu_run_f(suite, find_asid, ifix);
+	ptu_run_f(suite, find_many, ifix);
 	ptu_run_f(suite, find_bad_asid, rfix);
 	ptu_run_f(suite, find_nomem, rfix);
 
@@ -2282,5 +2761,16 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, validate_bad_size, rfix);
 	ptu_run_f(suite, validate_bad_isid, rfix);
 
+	ptu_run_f(suite, generation, rfix);
+
+	ptu_run_f(suite, set_base_null, ifix);
+	ptu_run_f(suite, set_base_cycle, ifix);
+	ptu_run_f(suite, layer_read, rfix);
+	ptu_run_f(suite, layer_precedence, rfix);
+	ptu_run_f(suite, layer_clip_begin, rfix);
+	ptu_run_f(suite, layer_clip_end, rfix);
+	ptu_run_f(suite, layer_update, rfix);
+	ptu_run_f(suite, layer_generation, ifix);
+
 	return ptunit_report(&suite);
 }
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "pt_encoder.h"
+
+#include "intel-pt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The test program.
+ *
+ * The base image maps nop (0x90) at [0x1000, 0x3000).  The layer on top of
+ * it maps 2-byte nop (0x66 0x90) at [0x2000, 0x2100), hiding the base image
+ * in that range.
+ */
+enum {
+	/* The base image's section. */
+	lfix_base_ip	= 0x1000,
+	lfix_base_size	= 0x2000,
+
+	/* The layer's section. */
+	lfix_layer_ip	= 0x2000,
+	lfix_layer_size	= 0x100,
+
+	/* The start of the trace. */
+	lfix_start_ip	= 0x1ff0,
+
+	/* The size of the trace buffer. */
+	lfix_trace_size	= 0x100
+};
+
+/* A test fixture providing a trace and a layered image. */
+struct layer_fixture {
+	/* The trace buffer. */
+	uint8_t buffer[lfix_trace_size];
+
+	/* The decoder configuration. */
+	struct pt_config config;
+
+	/* The base image and the layer on top of it. */
+	struct pt_image *base;
+	struct pt_image *layer;
+
+	/* The names of the files backing the base and the layer sections. */
+	char *base_name;
+	char *layer_name;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct layer_fixture *);
+	struct ptunit_result (*fini)(struct layer_fixture *);
+};
+
+static struct ptunit_result lfix_mkfile(char **pname, uint8_t *content,
+					size_t size)
+{
+	FILE *file;
+	size_t written;
+	int errcode;
+
+	errcode = ptunit_mkfile(&file, pname, "wb");
+	ptu_int_eq(errcode, 0);
+
+	written = fwrite(content, 1, size, file);
+	fclose(file);
+
+	ptu_uint_eq(written, size);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result insn_cross(struct layer_fixture *lfix)
+{
+	struct pt_insn_decoder *decoder;
+	struct pt_insn insn;
+	int status, ninsn;
+
+	decoder = pt_insn_alloc_decoder(&lfix->config);
+	ptu_ptr(decoder);
+
+	status = pt_insn_set_image(decoder, lfix->layer);
+	ptu_int_eq(status, 0);
+
+	status = pt_insn_sync_forward(decoder);
+	ptu_int_ge(status, 0);
+
+	for (ninsn = 0; ninsn < 0x10; ++ninsn) {
+		while (status & pts_event_pending) {
+			struct pt_event event;
+
+			status = pt_insn_event(decoder, &event, sizeof(event));
+			ptu_int_ge(status, 0);
+		}
+
+		status = pt_insn_next(decoder, &insn, sizeof(insn));
+		ptu_int_ge(status, 0);
+		ptu_uint_eq(insn.ip, lfix_start_ip + ninsn);
+		ptu_uint_eq(insn.size, 1);
+	}
+
+	/* The next instruction is in the layer's section. */
+	status = pt_insn_next(decoder, &insn, sizeof(insn));
+	ptu_int_ge(status, 0);
+	ptu_uint_eq(insn.ip, lfix_layer_ip);
+	ptu_uint_eq(insn.size, 2);
+	ptu_uint_eq(insn.raw[0], 0x66);
+	ptu_uint_eq(insn.raw[1], 0x90);
+
+	pt_insn_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result block_cross(struct layer_fixture *lfix)
+{
+	struct pt_block_decoder *decoder;
+	struct pt_block block;
+	int status;
+
+	decoder = pt_blk_alloc_decoder(&lfix->config);
+	ptu_ptr(decoder);
+
+	status = pt_blk_set_image(decoder, lfix->layer);
+	ptu_int_eq(status, 0);
+
+	status = pt_blk_sync_forward(decoder);
+	ptu_int_ge(status, 0);
+
+	while (status & pts_event_pending) {
+		struct pt_event event;
+
+		status = pt_blk_event(decoder, &event, sizeof(event));
+		ptu_int_ge(status, 0);
+	}
+
+	/* The block ends at the end of the visible part of the base image's
+	 * section.
+	 */
+	status = pt_blk_next(decoder, &block, sizeof(block));
+	ptu_int_ge(status, 0);
+	ptu_uint_eq(block.ip, lfix_start_ip);
+	ptu_uint_eq(block.end_ip, lfix_layer_ip - 1);
+	ptu_uint_eq(block.ninsn, 0x10);
+
+	while (status & pts_event_pending) {
+		struct pt_event event;
+
+		status = pt_blk_event(decoder, &event, sizeof(event));
+		ptu_int_ge(status, 0);
+	}
+
+	/* The next block is in the layer's section. */
+	status = pt_blk_next(decoder, &block, sizeof(block));
+	ptu_int_ge(status, 0);
+	ptu_uint_eq(block.ip, lfix_layer_ip);
+	ptu_uint_eq(block.end_ip, lfix_layer_ip + lfix_layer_size - 2);
+	ptu_uint_eq(block.ninsn, lfix_layer_size / 2);
+
+	pt_blk_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lfix_init(struct layer_fixture *lfix)
+{
+	struct pt_encoder encoder;
+	uint8_t *content;
+	int idx, errcode;
+
+	lfix->base = pt_image_alloc("base");
+	lfix->layer = pt_image_alloc("layer");
+	lfix->base_name = NULL;
+	lfix->layer_name = NULL;
+
+	ptu_ptr(lfix->base);
+	ptu_ptr(lfix->layer);
+
+	content = malloc(lfix_base_size);
+	ptu_ptr(content);
+
+	memset(content, 0x90, lfix_base_size);
+	ptu_check(lfix_mkfile, &lfix->base_name, content, lfix_base_size);
+
+	for (idx = 0; idx < lfix_layer_size; idx += 2) {
+		content[idx] = 0x66;
+		content[idx + 1] = 0x90;
+	}
+	ptu_check(lfix_mkfile, &lfix->layer_name, content, lfix_layer_size);
+
+	free(content);
+
+	errcode = pt_image_add_file(lfix->base, lfix->base_name, 0ull,
+				    lfix_base_size, NULL, lfix_base_ip);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_image_add_file(lfix->layer, lfix->layer_name, 0ull,
+				    lfix_layer_size, NULL, lfix_layer_ip);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_image_set_base(lfix->layer, lfix->base);
+	ptu_int_eq(errcode, 0);
+
+	memset(lfix->buffer, 0, sizeof(lfix->buffer));
+
+	pt_config_init(&lfix->config);
+	lfix->config.begin = lfix->buffer;
+	lfix->config.end = lfix->buffer + sizeof(lfix->buffer);
+
+	errcode = pt_encoder_init(&encoder, &lfix->config);
+	ptu_int_eq(errcode, 0);
+
+	pt_encode_psb(&encoder);
+	pt_encode_mode_exec(&encoder, ptem_64bit);
+	pt_encode_fup(&encoder, lfix_start_ip, pt_ipc_sext_48);
+	pt_encode_psbend(&encoder);
+
+	lfix->config.end = encoder.pos;
+
+	pt_encoder_fini(&encoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lfix_fini(struct layer_fixture *lfix)
+{
+	pt_image_free(lfix->layer);
+	pt_image_free(lfix->base);
+
+	if (lfix->layer_name) {
+		remove(lfix->layer_name);
+		free(lfix->layer_name);
+	}
+
+	if (lfix->base_name) {
+		remove(lfix->base_name);
+		free(lfix->base_name);
+	}
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct layer_fixture lfix;
+	struct ptunit_suite suite;
+
+	lfix.init = lfix_init;
+	lfix.fini = lfix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run_f(suite, insn_cross, lfix);
+	ptu_run_f(suite, block_cross, lfix);
+
+	return ptunit_report(&suite);
+}
@@ -573,6 +573,9 @@ static struct ptunit_result cfix_init(struct iscache_fixture *cfix)
 	errcode = pt_iscache_init(&cfix->iscache, NULL);
 	ptu_int_eq(errcode, 0);
 
+	/* Use a single LRU shard so we can check the global access order. */
+	cfix->iscache.nshards = 1;
+
 	return ptu_passed();
 }
 
@@ -582,6 +585,7 @@ static struct ptunit_result sfix_init(struct iscache_fixture *cfix)
 
 	ptu_test(cfix_init, cfix);
 
+	cfix->iscache.nshards = pt_iscache_max_shards;
 	cfix->iscache.limit = 0x7800;
 
 	for (idx = 0; idx < num_sections; ++idx) {
@@ -964,6 +968,40 @@ static struct ptunit_result lookup_bad_isid(struct iscache_fixture *cfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result lookup_expanded(struct iscache_fixture *cfix)
+{
+	const struct pt_iscache_table *table;
+	struct pt_section *section;
+	uint64_t laddr;
+	int errcode, isid, idx;
+
+	for (idx = 0; idx < 9; ++idx) {
+		isid = pt_iscache_add(&cfix->iscache, cfix->section[0],
+				      (uint64_t) idx << 12);
+		ptu_int_eq(isid, idx + 1);
+	}
+
+	/* Expanding the cache replaces the table.  The new table holds all
+	 * entries.
+	 */
+	table = cfix->iscache.table;
+	ptu_ptr(table);
+	ptu_ptr_eq(table->entries, cfix->iscache.entries);
+	ptu_uint_eq(table->size, 9);
+	ptu_ptr_eq(table->entries[7].section, cfix->section[0]);
+	ptu_uint_eq(table->entries[7].laddr, 0x7000ull);
+
+	errcode = pt_iscache_lookup(&cfix->iscache, &section, &laddr, 9);
+	ptu_int_eq(errcode, 0);
+	ptu_ptr_eq(section, cfix->section[0]);
+	ptu_uint_eq(laddr, 0x8000ull);
+
+	errcode = pt_section_put(section);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result clear_empty(struct iscache_fixture *cfix)
 {
 	int errcode;
@@ -1007,6 +1045,9 @@ static struct ptunit_result clear_lookup(struct iscache_fixture *cfix)
 
 	errcode = pt_iscache_clear(&cfix->iscache);
 	ptu_int_eq(errcode, 0);
+	ptu_null(cfix->iscache.table);
+	ptu_uint_eq(cfix->iscache.readers[0], 0);
+	ptu_uint_eq(cfix->iscache.readers[1], 0);
 
 	errcode = pt_iscache_lookup(&cfix->iscache, &section, &laddr, isid);
 	ptu_int_eq(errcode, -pte_bad_image);
@@ -1157,6 +1198,75 @@ add_file_different_same_laddr(struct iscache_fixture *cfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result add_file_many(struct iscache_fixture *cfix)
+{
+	static const char * const names[] = {
+		"name-a", "name-b", "name-c", "name-d"
+	};
+	struct pt_section *section[2];
+	uint64_t laddr[2];
+	int isid, status, idx;
+
+	for (idx = 0; idx < 0x1000; ++idx) {
+		isid = pt_iscache_add_file(&cfix->iscache, names[idx % 4],
+					   (uint64_t) (idx % 8), 1ull,
+					   (uint64_t) idx);
+		ptu_int_eq(isid, idx + 1);
+	}
+
+	for (idx = 0; idx < 0x1000; ++idx) {
+		isid = pt_iscache_find(&cfix->iscache, names[idx % 4],
+				       (uint64_t) (idx % 8), 1ull,
+				       (uint64_t) idx);
+		ptu_int_eq(isid, idx + 1);
+
+		isid = pt_iscache_add_file(&cfix->iscache, names[idx % 4],
+					   (uint64_t) (idx % 8), 1ull,
+					   (uint64_t) idx);
+		ptu_int_eq(isid, idx + 1);
+
+		isid = pt_iscache_find(&cfix->iscache, names[idx % 4],
+				       (uint64_t) (idx % 8), 2ull,
+				       (uint64_t) idx);
+		ptu_int_eq(isid, 0);
+	}
+
+	/* Entries for the same file range share their section. */
+	status = pt_iscache_lookup(&cfix->iscache, &section[0], &laddr[0], 1);
+	ptu_int_eq(status, 0);
+
+	status = pt_iscache_lookup(&cfix->iscache, &section[1], &laddr[1],
+				   0xff9);
+	ptu_int_eq(status, 0);
+
+	ptu_ptr_eq(section[1], section[0]);
+	ptu_uint_eq(laddr[0], 0ull);
+	ptu_uint_eq(laddr[1], 0xff8ull);
+
+	status = pt_section_put(section[0]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_put(section[1]);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result find_copied_filename(struct iscache_fixture *cfix)
+{
+	char filename[] = "name";
+	int found, isid;
+
+	isid = pt_iscache_add_file(&cfix->iscache, "name", 0ull, 1ull, 0ull);
+	ptu_int_gt(isid, 0);
+
+	/* Filenames are compared by content. */
+	found = pt_iscache_find(&cfix->iscache, filename, 0ull, 1ull, 0ull);
+	ptu_int_eq(found, isid);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result read(struct iscache_fixture *cfix)
 {
 	uint8_t buffer[] = { 0xcc, 0xcc, 0xcc };
@@ -1228,7 +1338,7 @@ static struct ptunit_result lru_map(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1239,9 +1349,9 @@ static struct ptunit_result lru_map(struct iscache_fixture *cfix)
 	status = pt_section_unmap(cfix->section[0]);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[0]);
-	ptu_null(cfix->iscache.lru->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
 	ptu_uint_eq(cfix->iscache.used, cfix->section[0]->size);
 
 	return ptu_passed();
@@ -1254,7 +1364,7 @@ static struct ptunit_result lru_read(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1262,9 +1372,9 @@ static struct ptunit_result lru_read(struct iscache_fixture *cfix)
 	status = pt_iscache_read(&cfix->iscache, buffer, 2ull, isid, 0xa008ull);
 	ptu_int_eq(status, 2);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[0]);
-	ptu_null(cfix->iscache.lru->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
 	ptu_uint_eq(cfix->iscache.used, cfix->section[0]->size);
 
 	return ptu_passed();
@@ -1276,7 +1386,7 @@ static struct ptunit_result lru_map_nodup(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = 2 * cfix->section[0]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1293,9 +1403,9 @@ static struct ptunit_result lru_map_nodup(struct iscache_fixture *cfix)
 	status = pt_section_unmap(cfix->section[0]);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[0]);
-	ptu_null(cfix->iscache.lru->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
 	ptu_uint_eq(cfix->iscache.used, cfix->section[0]->size);
 
 	return ptu_passed();
@@ -1307,7 +1417,7 @@ static struct ptunit_result lru_map_too_big(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size - 1;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1318,7 +1428,7 @@ static struct ptunit_result lru_map_too_big(struct iscache_fixture *cfix)
 	status = pt_section_unmap(cfix->section[0]);
 	ptu_int_eq(status, 0);
 
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 	ptu_uint_eq(cfix->iscache.used, 0ull);
 
 	return ptu_passed();
@@ -1330,7 +1440,7 @@ static struct ptunit_result lru_map_add_front(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size + cfix->section[1]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1350,11 +1460,11 @@ static struct ptunit_result lru_map_add_front(struct iscache_fixture *cfix)
 	status = pt_section_unmap(cfix->section[1]);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[1]);
-	ptu_ptr(cfix->iscache.lru->next);
-	ptu_ptr_eq(cfix->iscache.lru->next->section, cfix->section[0]);
-	ptu_null(cfix->iscache.lru->next->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[1]);
+	ptu_ptr(cfix->iscache.shard[0].lru->next);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->next->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next->next);
 	ptu_uint_eq(cfix->iscache.used,
 		    cfix->section[0]->size + cfix->section[1]->size);
 
@@ -1367,7 +1477,7 @@ static struct ptunit_result lru_map_move_front(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size + cfix->section[1]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1393,17 +1503,71 @@ static struct ptunit_result lru_map_move_front(struct iscache_fixture *cfix)
 	status = pt_section_unmap(cfix->section[0]);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[0]);
-	ptu_ptr(cfix->iscache.lru->next);
-	ptu_ptr_eq(cfix->iscache.lru->next->section, cfix->section[1]);
-	ptu_null(cfix->iscache.lru->next->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[0]);
+	ptu_ptr(cfix->iscache.shard[0].lru->next);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->next->section, cfix->section[1]);
+	ptu_null(cfix->iscache.shard[0].lru->next->next);
 	ptu_uint_eq(cfix->iscache.used,
 		    cfix->section[0]->size + cfix->section[1]->size);
 
 	return ptu_passed();
 }
 
+static struct ptunit_result lru_map_mru(struct iscache_fixture *cfix)
+{
+	int status, isid;
+
+	cfix->iscache.limit = cfix->section[0]->size + cfix->section[1]->size;
+	ptu_null(cfix->iscache.shard[0].mru);
+	ptu_uint_eq(cfix->iscache.shard[0].mrusize, 0ull);
+
+	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
+	ptu_int_gt(isid, 0);
+
+	isid = pt_iscache_add(&cfix->iscache, cfix->section[1], 0xa000ull);
+	ptu_int_gt(isid, 0);
+
+	status = pt_section_map(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	ptu_ptr_eq(cfix->iscache.shard[0].mru, cfix->section[0]);
+	ptu_uint_eq(cfix->iscache.shard[0].mrusize, cfix->section[0]->size);
+
+	status = pt_section_map(cfix->section[1]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[1]);
+	ptu_int_eq(status, 0);
+
+	ptu_ptr_eq(cfix->iscache.shard[0].mru, cfix->section[1]);
+	ptu_uint_eq(cfix->iscache.shard[0].mrusize, cfix->section[1]->size);
+
+	/* Mapping the most recently used section again leaves the LRU alone. */
+	status = pt_section_map(cfix->section[1]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[1]);
+	ptu_int_eq(status, 0);
+
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[1]);
+	ptu_ptr(cfix->iscache.shard[0].lru->next);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->next->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next->next);
+
+	status = pt_iscache_clear(&cfix->iscache);
+	ptu_int_eq(status, 0);
+
+	ptu_null(cfix->iscache.shard[0].mru);
+	ptu_uint_eq(cfix->iscache.shard[0].mrusize, 0ull);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result lru_map_evict(struct iscache_fixture *cfix)
 {
 	int status, isid;
@@ -1411,7 +1575,7 @@ static struct ptunit_result lru_map_evict(struct iscache_fixture *cfix)
 	cfix->iscache.limit = cfix->section[0]->size +
 		cfix->section[1]->size - 1;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1431,9 +1595,9 @@ static struct ptunit_result lru_map_evict(struct iscache_fixture *cfix)
 	status = pt_section_unmap(cfix->section[1]);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[1]);
-	ptu_null(cfix->iscache.lru->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[1]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
 	ptu_uint_eq(cfix->iscache.used, cfix->section[1]->size);
 
 	return ptu_passed();
@@ -1446,7 +1610,7 @@ static struct ptunit_result lru_bcache_evict(struct iscache_fixture *cfix)
 	cfix->iscache.limit = 4 * cfix->section[0]->size +
 		cfix->section[1]->size - 1;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1469,21 +1633,59 @@ static struct ptunit_result lru_bcache_evict(struct iscache_fixture *cfix)
 	status = pt_section_request_bcache(cfix->section[0]);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[0]);
-	ptu_null(cfix->iscache.lru->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
 	ptu_uint_eq(cfix->iscache.used, 4 * cfix->section[0]->size);
 
 	return ptu_passed();
 }
 
+static struct ptunit_result lru_bcache_grow(struct iscache_fixture *cfix)
+{
+	int status, isid;
+
+	cfix->iscache.limit = 4 * cfix->section[0]->size;
+	ptu_uint_eq(cfix->iscache.used, 0ull);
+	ptu_null(cfix->iscache.shard[0].lru);
+
+	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
+	ptu_int_gt(isid, 0);
+
+	status = pt_section_map(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_eq(cfix->iscache.used, cfix->section[0]->size);
+
+	/* Let the block cache grow behind the iscache's back. */
+	cfix->section[0]->bcsize = cfix->section[0]->size;
+
+	status = pt_section_map(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[0]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
+	ptu_uint_eq(cfix->iscache.shard[0].lru->size,
+		    2 * cfix->section[0]->size);
+	ptu_uint_eq(cfix->iscache.used, 2 * cfix->section[0]->size);
+
+	status = pt_section_unmap(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result lru_bcache_clear(struct iscache_fixture *cfix)
 {
 	int status, isid;
 
 	cfix->iscache.limit = cfix->section[0]->size + cfix->section[1]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1506,7 +1708,7 @@ static struct ptunit_result lru_bcache_clear(struct iscache_fixture *cfix)
 	status = pt_section_request_bcache(cfix->section[0]);
 	ptu_int_eq(status, 0);
 
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 	ptu_uint_eq(cfix->iscache.used, 0ull);
 
 	return ptu_passed();
@@ -1518,7 +1720,7 @@ static struct ptunit_result lru_limit_evict(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size + cfix->section[1]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1543,10 +1745,251 @@ static struct ptunit_result lru_limit_evict(struct iscache_fixture *cfix)
 				      cfix->section[1]->size - 1);
 	ptu_int_eq(status, 0);
 
-	ptu_ptr(cfix->iscache.lru);
-	ptu_ptr_eq(cfix->iscache.lru->section, cfix->section[1]);
-	ptu_null(cfix->iscache.lru->next);
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[1]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
+	ptu_uint_eq(cfix->iscache.used, cfix->section[1]->size);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lru_watermarks(struct iscache_fixture *cfix)
+{
+	int status, isid, sec;
+
+	status = pt_iscache_set_watermarks(&cfix->iscache,
+					   cfix->section[0]->size +
+					   cfix->section[1]->size,
+					   cfix->section[2]->size);
+	ptu_int_eq(status, 0);
+
+	for (sec = 0; sec < 3; ++sec) {
+		isid = pt_iscache_add(&cfix->iscache, cfix->section[sec],
+				      0xa000ull);
+		ptu_int_gt(isid, 0);
+	}
+
+	for (sec = 0; sec < 3; ++sec) {
+		status = pt_section_map(cfix->section[sec]);
+		ptu_int_eq(status, 0);
+
+		status = pt_section_unmap(cfix->section[sec]);
+		ptu_int_eq(status, 0);
+	}
+
+	/* We exceeded the high watermark and pruned down to the low one. */
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[2]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
+	ptu_uint_eq(cfix->iscache.used, cfix->section[2]->size);
+	ptu_uint_eq(cfix->section[0]->mcount, 0);
+	ptu_uint_eq(cfix->section[1]->mcount, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lru_watermarks_bad(struct iscache_fixture *cfix)
+{
+	int status;
+
+	status = pt_iscache_set_watermarks(NULL, 0x2000ull, 0x1000ull);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_iscache_set_watermarks(&cfix->iscache, 0x1000ull,
+					   0x2000ull);
+	ptu_int_eq(status, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_flags(struct iscache_fixture *cfix)
+{
+	uint32_t flags;
+	int status;
+
+	flags = 0xffffffffu;
+
+	status = pt_iscache_map_flags(&cfix->iscache, &flags);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(flags, 0u);
+
+	status = pt_iscache_set_map_flags(&cfix->iscache,
+					  ptmf_populate | ptmf_copy);
+	ptu_int_eq(status, 0);
+
+	status = pt_iscache_map_flags(&cfix->iscache, &flags);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(flags, ptmf_populate | ptmf_copy);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_flags_bad(struct iscache_fixture *cfix)
+{
+	uint32_t flags;
+	int status;
+
+	status = pt_iscache_set_map_flags(NULL, ptmf_populate);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_iscache_set_map_flags(&cfix->iscache, 1u << 31);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_iscache_map_flags(&cfix->iscache, NULL);
+	ptu_int_eq(status, -pte_internal);
+
+	status = pt_iscache_map_flags(NULL, &flags);
+	ptu_int_eq(status, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lru_deferred(struct iscache_fixture *cfix)
+{
+	int status, isid, sec;
+
+	status = pt_iscache_set_deferred_reclaim(&cfix->iscache, 1);
+	ptu_int_eq(status, 0);
+
+	cfix->iscache.limit = cfix->section[0]->size + cfix->section[2]->size;
+
+	for (sec = 0; sec < 3; ++sec) {
+		isid = pt_iscache_add(&cfix->iscache, cfix->section[sec],
+				      0xa000ull);
+		ptu_int_gt(isid, 0);
+	}
+
+	status = pt_section_map(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[0]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_map(cfix->section[2]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[2]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_map(cfix->section[1]);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_unmap(cfix->section[1]);
+	ptu_int_eq(status, 0);
+
+	/* The pruned sections remain mapped until they are reclaimed. */
+	ptu_ptr(cfix->iscache.shard[0].lru);
+	ptu_ptr_eq(cfix->iscache.shard[0].lru->section, cfix->section[1]);
+	ptu_null(cfix->iscache.shard[0].lru->next);
 	ptu_uint_eq(cfix->iscache.used, cfix->section[1]->size);
+	ptu_ptr(cfix->iscache.reclaim);
+	ptu_uint_eq(cfix->iscache.reclaim_size,
+		    cfix->section[0]->size + cfix->section[2]->size);
+	ptu_uint_eq(cfix->section[0]->mcount, 1);
+	ptu_uint_eq(cfix->section[2]->mcount, 1);
+
+	status = pt_iscache_reclaim(&cfix->iscache);
+	ptu_int_eq(status, 2);
+	ptu_null(cfix->iscache.reclaim);
+	ptu_uint_eq(cfix->iscache.reclaim_size, 0ull);
+	ptu_uint_eq(cfix->section[0]->mcount, 0);
+	ptu_uint_eq(cfix->section[2]->mcount, 0);
+
+	status = pt_iscache_reclaim(&cfix->iscache);
+	ptu_int_eq(status, 0);
+
+	/* Sections are unmapped right away if they pile up. */
+	status = pt_iscache_set_limit(&cfix->iscache, 0ull);
+	ptu_int_eq(status, 0);
+	ptu_null(cfix->iscache.shard[0].lru);
+	ptu_null(cfix->iscache.reclaim);
+	ptu_uint_eq(cfix->iscache.used, 0ull);
+	ptu_uint_eq(cfix->section[1]->mcount, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lru_deferred_disable(struct iscache_fixture *cfix)
+{
+	int status, isid, sec;
+
+	status = pt_iscache_set_deferred_reclaim(&cfix->iscache, 1);
+	ptu_int_eq(status, 0);
+
+	cfix->iscache.limit = cfix->section[1]->size;
+
+	for (sec = 0; sec < 2; ++sec) {
+		isid = pt_iscache_add(&cfix->iscache, cfix->section[sec],
+				      0xa000ull);
+		ptu_int_gt(isid, 0);
+
+		status = pt_section_map(cfix->section[sec]);
+		ptu_int_eq(status, 0);
+
+		status = pt_section_unmap(cfix->section[sec]);
+		ptu_int_eq(status, 0);
+	}
+
+	ptu_ptr(cfix->iscache.reclaim);
+	ptu_uint_eq(cfix->section[0]->mcount, 1);
+
+	status = pt_iscache_set_deferred_reclaim(&cfix->iscache, 0);
+	ptu_int_eq(status, 0);
+	ptu_null(cfix->iscache.reclaim);
+	ptu_uint_eq(cfix->iscache.reclaim_size, 0ull);
+	ptu_uint_eq(cfix->section[0]->mcount, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lru_shards(struct iscache_fixture *cfix)
+{
+	uint64_t used;
+	int status, isid, sec, idx, nentries;
+
+	cfix->iscache.nshards = pt_iscache_max_shards;
+
+	used = 0ull;
+	for (sec = 0; sec < 4; ++sec) {
+		isid = pt_iscache_add(&cfix->iscache, cfix->section[sec],
+				      0xa000ull);
+		ptu_int_gt(isid, 0);
+
+		status = pt_section_map(cfix->section[sec]);
+		ptu_int_eq(status, 0);
+
+		status = pt_section_unmap(cfix->section[sec]);
+		ptu_int_eq(status, 0);
+
+		used += cfix->section[sec]->size;
+	}
+
+	nentries = 0;
+	for (idx = 0; idx < pt_iscache_max_shards; ++idx) {
+		const struct pt_iscache_lru_entry *lru;
+
+		for (lru = cfix->iscache.shard[idx].lru; lru; lru = lru->next)
+			nentries += 1;
+	}
+
+	ptu_int_eq(nentries, 4);
+	ptu_uint_eq(cfix->iscache.used, used);
+
+	status = pt_iscache_set_limit(&cfix->iscache, cfix->section[1]->size);
+	ptu_int_eq(status, 0);
+	ptu_uint_le(cfix->iscache.used, cfix->section[1]->size);
+
+	status = pt_iscache_clear(&cfix->iscache);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(cfix->iscache.used, 0ull);
+
+	for (idx = 0; idx < pt_iscache_max_shards; ++idx) {
+		ptu_null(cfix->iscache.shard[idx].lru);
+		ptu_null(cfix->iscache.shard[idx].mru);
+	}
+
+	for (sec = 0; sec < 4; ++sec)
+		ptu_uint_eq(cfix->section[sec]->mcount, 0);
 
 	return ptu_passed();
 }
@@ -1557,7 +2000,7 @@ static struct ptunit_result lru_clear(struct iscache_fixture *cfix)
 
 	cfix->iscache.limit = cfix->section[0]->size;
 	ptu_uint_eq(cfix->iscache.used, 0ull);
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 
 	isid = pt_iscache_add(&cfix->iscache, cfix->section[0], 0xa000ull);
 	ptu_int_gt(isid, 0);
@@ -1571,7 +2014,7 @@ static struct ptunit_result lru_clear(struct iscache_fixture *cfix)
 	status = pt_iscache_clear(&cfix->iscache);
 	ptu_int_eq(status, 0);
 
-	ptu_null(cfix->iscache.lru);
+	ptu_null(cfix->iscache.shard[0].lru);
 	ptu_uint_eq(cfix->iscache.used, 0ull);
 
 	return ptu_passed();
@@ -1743,6 +2186,54 @@ static int worker_map_limit(void *arg)
 	return 0;
 }
 
+static int worker_map_reclaim(void *arg)
+{
+	struct iscache_fixture *cfix;
+	uint64_t limits[] = { 0x8000, 0x3000, 0x12000, 0x0 }, limit;
+	int it, sec, errcode, lim;
+
+	cfix = arg;
+	if (!cfix)
+		return -pte_internal;
+
+	errcode = pt_iscache_set_deferred_reclaim(&cfix->iscache, 1);
+	if (errcode < 0)
+		return errcode;
+
+	lim = 0;
+	for (it = 0; it < num_iterations; ++it) {
+		for (sec = 0; sec < num_sections; ++sec) {
+
+			errcode = pt_section_map(cfix->section[sec]);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = pt_section_unmap(cfix->section[sec]);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		if (it % 7 == 0) {
+			errcode = pt_iscache_reclaim(&cfix->iscache);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		if (it % 23 != 0)
+			continue;
+
+		limit = limits[lim++];
+		lim %= sizeof(limits) / sizeof(*limits);
+
+		errcode = pt_iscache_set_watermarks(&cfix->iscache, limit,
+						    limit / 2);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	return 0;
+}
+
 static int worker_map_bcache(void *arg)
 {
 	struct iscache_fixture *cfix;
@@ -1917,6 +2408,49 @@ static int worker_add_file_clear(void *arg)
 	return 0;
 }
 
+static int worker_lookup_clear(void *arg)
+{
+	struct iscache_fixture *cfix;
+	int it;
+
+	cfix = arg;
+	if (!cfix)
+		return -pte_internal;
+
+	for (it = 0; it < num_iterations; ++it) {
+		struct pt_section *section;
+		uint64_t laddr;
+		int isid, errcode;
+
+		isid = pt_iscache_add_file(&cfix->iscache, "name", 0x1000ull,
+					   0x1000ull, 0x1000ull);
+		if (isid < 0)
+			return isid;
+
+		/* Another thread may have cleared the cache in-between. */
+		errcode = pt_iscache_lookup(&cfix->iscache, &section, &laddr,
+					    isid);
+		if (errcode == -pte_bad_image)
+			continue;
+
+		if (errcode < 0)
+			return errcode;
+
+		errcode = pt_section_put(section);
+		if (errcode < 0)
+			return errcode;
+
+		if (it % 5 < 4)
+			continue;
+
+		errcode = pt_iscache_clear(&cfix->iscache);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	return 0;
+}
+
 static struct ptunit_result stress(struct iscache_fixture *cfix,
 				   int (*worker)(void *))
 {
@@ -1981,6 +2515,7 @@ int main(int argc, char **argv)
 
 	ptu_run_f(suite, lookup, cfix);
 	ptu_run_f(suite, lookup_bad_isid, cfix);
+	ptu_run_f(suite, lookup_expanded, cfix);
 
 	ptu_run_f(suite, clear_empty, cfix);
 	ptu_run_f(suite, clear_find, cfix);
@@ -1995,6 +2530,8 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, add_file_same, cfix);
 	ptu_run_f(suite, add_file_same_different_laddr, cfix);
 	ptu_run_f(suite, add_file_different_same_laddr, cfix);
+	ptu_run_f(suite, add_file_many, cfix);
+	ptu_run_f(suite, find_copied_filename, cfix);
 
 	ptu_run_f(suite, read, cfix);
 	ptu_run_f(suite, read_truncate, cfix);
@@ -2007,21 +2544,32 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, lru_map_too_big, cfix);
 	ptu_run_f(suite, lru_map_add_front, cfix);
 	ptu_run_f(suite, lru_map_move_front, cfix);
+	ptu_run_f(suite, lru_map_mru, cfix);
 	ptu_run_f(suite, lru_map_evict, cfix);
 	ptu_run_f(suite, lru_limit_evict, cfix);
 	ptu_run_f(suite, lru_bcache_evict, cfix);
+	ptu_run_f(suite, lru_bcache_grow, cfix);
 	ptu_run_f(suite, lru_bcache_clear, cfix);
+	ptu_run_f(suite, lru_watermarks, cfix);
+	ptu_run_f(suite, lru_watermarks_bad, cfix);
+	ptu_run_f(suite, map_flags, cfix);
+	ptu_run_f(suite, map_flags_bad, cfix);
+	ptu_run_f(suite, lru_deferred, cfix);
+	ptu_run_f(suite, lru_deferred_disable, cfix);
+	ptu_run_f(suite, lru_shards, cfix);
 	ptu_run_f(suite, lru_clear, cfix);
 
 	ptu_run_fp(suite, stress, cfix, worker_add);
 	ptu_run_fp(suite, stress, cfix, worker_add_file);
 	ptu_run_fp(suite, stress, sfix, worker_map);
 	ptu_run_fp(suite, stress, sfix, worker_map_limit);
+	ptu_run_fp(suite, stress, sfix, worker_map_reclaim);
 	ptu_run_fp(suite, stress, sfix, worker_map_bcache);
 	ptu_run_fp(suite, stress, cfix, worker_add_map);
 	ptu_run_fp(suite, stress, cfix, worker_add_clear);
 	ptu_run_fp(suite, stress, cfix, worker_add_file_map);
 	ptu_run_fp(suite, stress, cfix, worker_add_file_clear);
+	ptu_run_fp(suite, stress, cfix, worker_lookup_clear);
 
 	return ptunit_report(&suite);
 }
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_threads.h"
+
+#include "pt_insn_cache.h"
+#include "pt_insn.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A test fixture optionally providing an instruction cache and automatically
+ * freeing the cache.
+ */
+struct icache_fixture {
+	/* Threading support. */
+	struct ptunit_thrd_fixture thrd;
+
+	/* The cache - it will be freed automatically. */
+	struct pt_insn_cache *icache;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct icache_fixture *);
+	struct ptunit_result (*fini)(struct icache_fixture *);
+};
+
+enum {
+	/* The number of entries in fixture-provided caches. */
+	ifix_nentries = 0x10000,
+
+#if defined(FEATURE_THREADS)
+
+	/* The number of additional threads to use for stress testing. */
+	ifix_threads = 3,
+
+#endif /* defined(FEATURE_THREADS) */
+
+	/* The number of iterations in stress testing. */
+	ifix_iterations = 0x10
+};
+
+static struct ptunit_result cfix_init(struct icache_fixture *ifix)
+{
+	ptu_test(ptunit_thrd_init, &ifix->thrd);
+
+	ifix->icache = NULL;
+
+	return ptu_passed();
+}
+
+static struct ptunit_result ifix_init(struct icache_fixture *ifix)
+{
+	ptu_test(cfix_init, ifix);
+
+	ifix->icache = pt_icache_alloc(ifix_nentries);
+	ptu_ptr(ifix->icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result ifix_fini(struct icache_fixture *ifix)
+{
+	int thrd;
+
+	ptu_test(ptunit_thrd_fini, &ifix->thrd);
+
+	for (thrd = 0; thrd < ifix->thrd.nthreads; ++thrd)
+		ptu_int_eq(ifix->thrd.result[thrd], 0);
+
+	pt_icache_free(ifix->icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result icache_entry_size(void)
+{
+	ptu_uint_eq(sizeof(struct pt_icache_entry), sizeof(uint64_t));
+
+	return ptu_passed();
+}
+
+static struct ptunit_result icache_entry_fields(void)
+{
+	struct pt_icache_entry ice;
+
+	memset(&ice, 0, sizeof(ice));
+
+	/* The bit-fields must be able to hold all possible values. */
+	ice.size = pt_max_insn_size;
+	ptu_uint_eq(ice.size, pt_max_insn_size);
+
+	ice.iclass = ptic_ptwrite;
+	ptu_uint_eq(ice.iclass, ptic_ptwrite);
+
+	ice.iext = PTI_INST_LAST - 1;
+	ptu_uint_eq(ice.iext, PTI_INST_LAST - 1);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result free_null(void)
+{
+	pt_icache_free(NULL);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result add_null(void)
+{
+	struct pt_icache_entry ice;
+	int errcode;
+
+	memset(&ice, 0, sizeof(ice));
+
+	errcode = pt_icache_add(NULL, 0ull, ice);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lookup_null(void)
+{
+	struct pt_icache_entry ice;
+	struct pt_insn_cache icache;
+	int errcode;
+
+	errcode = pt_icache_lookup(&ice, NULL, 0ull);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_icache_lookup(NULL, &icache, 0ull);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result alloc(struct icache_fixture *ifix)
+{
+	ifix->icache = pt_icache_alloc(0x10000ull);
+	ptu_ptr(ifix->icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result alloc_min(struct icache_fixture *ifix)
+{
+	ifix->icache = pt_icache_alloc(1ull);
+	ptu_ptr(ifix->icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result alloc_too_big(struct icache_fixture *ifix)
+{
+	ifix->icache = pt_icache_alloc(UINT32_MAX + 1ull);
+	ptu_null(ifix->icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result alloc_zero(struct icache_fixture *ifix)
+{
+	ifix->icache = pt_icache_alloc(0ull);
+	ptu_null(ifix->icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result initially_empty(struct icache_fixture *ifix)
+{
+	uint64_t index;
+
+	for (index = 0; index < ifix_nentries; ++index) {
+		struct pt_icache_entry ice;
+		int status;
+
+		memset(&ice, 0xff, sizeof(ice));
+
+		status = pt_icache_lookup(&ice, ifix->icache, index);
+		ptu_int_eq(status, 0);
+
+		status = pt_ice_is_valid(ice);
+		ptu_int_eq(status, 0);
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result add_bad_index(struct icache_fixture *ifix)
+{
+	struct pt_icache_entry ice;
+	int errcode;
+
+	memset(&ice, 0, sizeof(ice));
+
+	errcode = pt_icache_add(ifix->icache, ifix_nentries, ice);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result lookup_bad_index(struct icache_fixture *ifix)
+{
+	struct pt_icache_entry ice;
+	int errcode;
+
+	errcode = pt_icache_lookup(&ice, ifix->icache, ifix_nentries);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result add(struct icache_fixture *ifix, uint64_t index)
+{
+	struct pt_icache_entry ice, exp;
+	int errcode;
+
+	memset(&ice, 0xff, sizeof(ice));
+	memset(&exp, 0x00, sizeof(exp));
+
+	exp.displacement = -0x12345;
+	exp.mode = ptem_64bit;
+	exp.size = 5;
+	exp.iclass = ptic_call;
+	exp.iext = PTI_INST_CALL_E8;
+	exp.is_direct = 1;
+
+	errcode = pt_icache_add(ifix->icache, index, exp);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_icache_lookup(&ice, ifix->icache, index);
+	ptu_int_eq(errcode, 0);
+
+	ptu_int_eq(ice.displacement, exp.displacement);
+	ptu_uint_eq(pt_ice_exec_mode(ice), pt_ice_exec_mode(exp));
+	ptu_uint_eq(ice.size, exp.size);
+	ptu_uint_eq(ice.iclass, exp.iclass);
+	ptu_uint_eq(ice.iext, exp.iext);
+	ptu_uint_eq(ice.is_direct, exp.is_direct);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_null(void)
+{
+	struct pt_insn_cache icache;
+	uint64_t size;
+	int errcode;
+
+	errcode = pt_icache_memsize(NULL, &size);
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = pt_icache_memsize(&icache, NULL);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_sparse(struct icache_fixture *ifix)
+{
+	struct pt_icache_entry ice;
+	uint64_t empty, size;
+	int errcode;
+
+	memset(&ice, 0, sizeof(ice));
+	ice.mode = ptem_64bit;
+	ice.size = 1;
+	ice.iclass = ptic_other;
+
+	errcode = pt_icache_memsize(ifix->icache, &empty);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_lt(empty, sizeof(struct pt_icache_page));
+
+	errcode = pt_icache_add(ifix->icache, 0x10ull, ice);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_icache_add(ifix->icache, 0x20ull, ice);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_icache_memsize(ifix->icache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(size, empty + sizeof(struct pt_icache_page));
+
+	errcode = pt_icache_add(ifix->icache, ifix_nentries - 1ull, ice);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_icache_memsize(ifix->icache, &size);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(size, empty + 2 * sizeof(struct pt_icache_page));
+
+	return ptu_passed();
+}
+
+static int worker(void *arg)
+{
+	struct pt_icache_entry exp;
+	struct pt_insn_cache *icache;
+	uint64_t iter, index;
+
+	icache = arg;
+	if (!icache)
+		return -pte_internal;
+
+	memset(&exp, 0x00, sizeof(exp));
+	exp.displacement = 0x7ffffff0;
+	exp.mode = ptem_32bit;
+	exp.size = 2;
+	exp.iclass = ptic_cond_jump;
+	exp.iext = PTI_INST_JCC;
+	exp.is_direct = 1;
+
+	for (index = 0; index < ifix_nentries; ++index) {
+		for (iter = 0; iter < ifix_iterations; ++iter) {
+			struct pt_icache_entry ice;
+			int errcode;
+
+			memset(&ice, 0xff, sizeof(ice));
+
+			errcode = pt_icache_lookup(&ice, icache, index);
+			if (errcode < 0)
+				return errcode;
+
+			if (!pt_ice_is_valid(ice)) {
+				errcode = pt_icache_add(icache, index, exp);
+				if (errcode < 0)
+					return errcode;
+			}
+
+			errcode = pt_icache_lookup(&ice, icache, index);
+			if (errcode < 0)
+				return errcode;
+
+			if (memcmp(&ice, &exp, sizeof(ice)) != 0)
+				return -pte_nosync;
+		}
+	}
+
+	return 0;
+}
+
+static struct ptunit_result stress(struct icache_fixture *ifix)
+{
+	int errcode;
+
+#if defined(FEATURE_THREADS)
+	{
+		int thrd;
+
+		for (thrd = 0; thrd < ifix_threads; ++thrd)
+			ptu_test(ptunit_thrd_create, &ifix->thrd, worker,
+				 ifix->icache);
+	}
+#endif /* defined(FEATURE_THREADS) */
+
+	errcode = worker(ifix->icache);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct icache_fixture ifix, cfix;
+	struct ptunit_suite suite;
+
+	ifix.init = ifix_init;
+	ifix.fini = ifix_fini;
+
+	cfix.init = cfix_init;
+	cfix.fini = ifix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run(suite, icache_entry_size);
+	ptu_run(suite, icache_entry_fields);
+
+	ptu_run(suite, free_null);
+	ptu_run(suite, add_null);
+	ptu_run(suite, lookup_null);
+
+	ptu_run_f(suite, alloc, cfix);
+	ptu_run_f(suite, alloc_min, cfix);
+	ptu_run_f(suite, alloc_too_big, cfix);
+	ptu_run_f(suite, alloc_zero, cfix);
+
+	ptu_run_f(suite, initially_empty, ifix);
+
+	ptu_run_f(suite, add_bad_index, ifix);
+	ptu_run_f(suite, lookup_bad_index, ifix);
+
+	ptu_run_fp(suite, add, ifix, 0ull);
+	ptu_run_fp(suite, add, ifix, ifix_nentries - 1ull);
+	ptu_run_f(suite, stress, ifix);
+
+	ptu_run(suite, memsize_null);
+	ptu_run_f(suite, memsize_sparse, ifix);
+
+	return ptunit_report(&suite);
+}
@@ -32,6 +32,8 @@
 
 #include "intel-pt.h"
 
+#include <string.h>
+
 
 int pt_section_get(struct pt_section *section)
 {
@@ -101,67 +103,76 @@ int pt_section_unmap(struct pt_section *section)
 	return 0;
 }
 
+enum {
+	/* The number of sections in the mock image. */
+	tfix_nsecs	= pt_msec_cache_nentries + 2,
+
+	/* The size of each section in the mock image. */
+	tfix_secsize	= 0x1000
+};
+
 /* A mock image. */
 struct pt_image {
-	/* The section stored in the image.
+	/* The sections stored in the image.
 	 *
-	 * This is either the fixture's section or NULL.
+	 * Section i is loaded at (i + 1) * tfix_secsize.  A NULL entry means
+	 * that there is no section at that address.
 	 */
-	struct pt_section *section;
+	struct pt_section *section[tfix_nsecs];
+
+	/* The image generation. */
+	uint64_t generation;
+
+	/* The number of pt_image_find() calls. */
+	uint32_t nfind;
 };
 
-extern int pt_image_validate(struct pt_image *, struct pt_mapped_section *,
-			     uint64_t, int);
 extern int pt_image_find(struct pt_image *, struct pt_mapped_section *,
 			 const struct pt_asid *, uint64_t);
+extern uint64_t pt_image_generation(const struct pt_image *);
 
-int pt_image_validate(struct pt_image *image, struct pt_mapped_section *msec,
-		      uint64_t vaddr, int isid)
+uint64_t pt_image_generation(const struct pt_image *image)
 {
-	struct pt_section *section;
-
-	(void) vaddr;
-	(void) isid;
-
-	if (!image || !msec)
-		return -pte_internal;
+	if (!image)
+		return 0ull;
 
-	section = image->section;
-	if (!section)
-		return -pte_nomap;
-
-	if (section != msec->section)
-		return -pte_nomap;
-
-	return 0;
+	return image->generation;
 }
 
 int pt_image_find(struct pt_image *image, struct pt_mapped_section *msec,
 		  const struct pt_asid *asid, uint64_t vaddr)
 {
 	struct pt_section *section;
-
-	(void) vaddr;
+	uint64_t idx;
 
 	if (!image || !msec || !asid)
 		return -pte_internal;
 
-	section = image->section;
-	if (!section)
-		return -pte_nomap;
+	image->nfind += 1;
 
 	if (msec->section)
 		return -pte_internal;
 
-	msec->section = section;
+	idx = vaddr / tfix_secsize;
+	if (!idx || (tfix_nsecs < idx))
+		return -pte_nomap;
+
+	idx -= 1;
+
+	section = image->section[idx];
+	if (!section)
+		return -pte_nomap;
+
+	pt_msec_init(msec, section, asid, (idx + 1) * tfix_secsize, 0ull,
+		     tfix_secsize);
 
 	return pt_section_get(section);
 }
 
-/* A test fixture providing a section and checking the use and map count. */
+/* A test fixture providing sections and checking the use and map count. */
 struct test_fixture {
-	/* A test section. */
-	struct pt_section section;
+	/* The test sections. */
+	struct pt_section section[tfix_nsecs];
 
 	/* A test cache. */
 	struct pt_msec_cache mcache;
@@ -169,11 +180,20 @@ struct test_fixture {
 	/* A test image. */
 	struct pt_image image;
 
+	/* A test address space. */
+	struct pt_asid asid;
+
 	/* The test fixture initialization and finalization functions. */
 	struct ptunit_result (*init)(struct test_fixture *);
 	struct ptunit_result (*fini)(struct test_fixture *);
 };
 
+/* Return an address inside the @idx'th test section. */
+static uint64_t tfix_vaddr(uint64_t idx)
+{
+	return ((idx + 1) * tfix_secsize) + 0x10;
+}
+
 static struct ptunit_result init_null(void)
 {
 	int status;
@@ -206,15 +226,19 @@ static struct ptunit_result read_null(void)
 	const struct pt_mapped_section *msec;
 	struct pt_msec_cache mcache;
 	struct pt_image image;
+	struct pt_asid asid;
 	int status;
 
-	status = pt_msec_cache_read(NULL, &msec, &image, 0ull);
+	status = pt_msec_cache_read(NULL, &msec, &image, &asid, 0ull);
+	ptu_int_eq(status, -pte_internal);
+
+	status = pt_msec_cache_read(&mcache, NULL, &image, &asid, 0ull);
 	ptu_int_eq(status, -pte_internal);
 
-	status = pt_msec_cache_read(&mcache, NULL, &image, 0ull);
+	status = pt_msec_cache_read(&mcache, &msec, NULL, &asid, 0ull);
 	ptu_int_eq(status, -pte_internal);
 
-	status = pt_msec_cache_read(&mcache, &msec, NULL, 0ull);
+	status = pt_msec_cache_read(&mcache, &msec, &image, NULL, 0ull);
 	ptu_int_eq(status, -pte_internal);
 
 	return ptu_passed();
@@ -245,50 +269,191 @@ static struct ptunit_result fill_null(void)
 	return ptu_passed();
 }
 
-static struct ptunit_result invalidate(struct test_fixture *tfix)
+static struct ptunit_result stats_null(void)
 {
-	struct pt_section *section;
+	struct pt_scache_stats stats;
+	struct pt_msec_cache mcache;
 	int status;
 
+	status = pt_msec_cache_stats(NULL, &stats, sizeof(stats));
+	ptu_int_eq(status, -pte_internal);
+
+	status = pt_msec_cache_stats(&mcache, NULL, sizeof(stats));
+	ptu_int_eq(status, -pte_internal);
+
+	return ptu_passed();
+}
+
+/* Check that the @idx'th test section is used and mapped @count times. */
+static struct ptunit_result check_count(struct test_fixture *tfix, int idx,
+					uint16_t count)
+{
+	ptu_uint_eq(tfix->section[idx].ucount, count);
+	ptu_uint_eq(tfix->section[idx].mcount, count);
+
+	return ptu_passed();
+}
+
+/* Fill the cache with the @idx'th test section. */
+static struct ptunit_result fill_idx(struct test_fixture *tfix, int idx)
+{
+	const struct pt_mapped_section *msec;
+	int status;
+
+	msec = NULL;
+
+	status = pt_msec_cache_fill(&tfix->mcache, &msec, &tfix->image,
+				    &tfix->asid, tfix_vaddr(idx));
+	ptu_int_eq(status, 0);
+	ptu_ptr(msec);
+	ptu_ptr_eq(pt_msec_section(msec), &tfix->section[idx]);
+
+	return ptu_passed();
+}
+
+/* Read the @idx'th test section and expect a hit if @hit is non-zero. */
+static struct ptunit_result read_idx(struct test_fixture *tfix, int idx,
+				     int hit)
+{
+	const struct pt_mapped_section *msec;
+	uint32_t nfind;
+	int status;
+
+	msec = NULL;
+	nfind = tfix->image.nfind;
+
+	status = pt_msec_cache_read(&tfix->mcache, &msec, &tfix->image,
+				    &tfix->asid, tfix_vaddr(idx));
+	if (hit) {
+		ptu_int_eq(status, 0);
+		ptu_ptr(msec);
+		ptu_ptr_eq(pt_msec_section(msec), &tfix->section[idx]);
+	} else {
+		ptu_int_eq(status, -pte_nomap);
+		ptu_null(msec);
+	}
+
+	ptu_uint_eq(tfix->image.nfind, nfind);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result invalidate(struct test_fixture *tfix)
+{
+	int status, idx;
+
+	for (idx = 0; idx < pt_msec_cache_nentries; ++idx)
+		ptu_test(fill_idx, tfix, idx);
+
 	status = pt_msec_cache_invalidate(&tfix->mcache);
 	ptu_int_eq(status, 0);
 
-	section = pt_msec_section(&tfix->mcache.msec);
-	ptu_null(section);
+	for (idx = 0; idx < tfix_nsecs; ++idx)
+		ptu_test(check_count, tfix, idx, 0);
 
-	ptu_uint_eq(tfix->section.mcount, 0);
-	ptu_uint_eq(tfix->section.ucount, 0);
+	ptu_test(read_idx, tfix, 0, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result invalidate_empty(struct test_fixture *tfix)
+{
+	int status;
+
+	status = pt_msec_cache_invalidate(&tfix->mcache);
+	ptu_int_eq(status, 0);
+
+	ptu_test(check_count, tfix, 0, 0);
 
 	return ptu_passed();
 }
 
 static struct ptunit_result read_nomap(struct test_fixture *tfix)
+{
+	ptu_test(read_idx, tfix, 0, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read(struct test_fixture *tfix)
+{
+	ptu_test(fill_idx, tfix, 0);
+	ptu_test(read_idx, tfix, 0, 1);
+	ptu_test(check_count, tfix, 0, 1);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_outside(struct test_fixture *tfix)
 {
 	const struct pt_mapped_section *msec;
 	int status;
 
-	msec = NULL;
+	ptu_test(fill_idx, tfix, 0);
 
-	status = pt_msec_cache_read(&tfix->mcache, &msec, &tfix->image, 0ull);
+	status = pt_msec_cache_read(&tfix->mcache, &msec, &tfix->image,
+				    &tfix->asid, tfix_secsize - 1ull);
+	ptu_int_eq(status, -pte_nomap);
+
+	status = pt_msec_cache_read(&tfix->mcache, &msec, &tfix->image,
+				    &tfix->asid, 2 * tfix_secsize);
 	ptu_int_eq(status, -pte_nomap);
-	ptu_null(msec);
 
 	return ptu_passed();
 }
 
-static struct ptunit_result read(struct test_fixture *tfix)
+static struct ptunit_result read_asid(struct test_fixture *tfix)
+{
+	ptu_test(fill_idx, tfix, 0);
+
+	tfix->asid.cr3 = 0x4000ull;
+	ptu_test(read_idx, tfix, 0, 0);
+
+	ptu_test(fill_idx, tfix, 0);
+	ptu_test(check_count, tfix, 0, 2);
+
+	tfix->asid.cr3 = pt_asid_no_cr3;
+	ptu_test(read_idx, tfix, 0, 1);
+
+	tfix->asid.vmcs = 0x5000ull;
+	ptu_test(read_idx, tfix, 0, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_generation(struct test_fixture *tfix)
+{
+	ptu_test(fill_idx, tfix, 0);
+	ptu_test(fill_idx, tfix, 1);
+
+	tfix->image.generation += 1;
+
+	ptu_test(read_idx, tfix, 0, 0);
+	ptu_test(read_idx, tfix, 1, 0);
+
+	/* The next fill drops all entries from the old generation. */
+	ptu_test(fill_idx, tfix, 1);
+	ptu_test(check_count, tfix, 0, 0);
+	ptu_test(check_count, tfix, 1, 1);
+
+	ptu_test(read_idx, tfix, 1, 1);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_image(struct test_fixture *tfix)
 {
 	const struct pt_mapped_section *msec;
-	struct pt_section *section;
+	struct pt_image image;
 	int status;
 
-	status = pt_msec_cache_read(&tfix->mcache, &msec, &tfix->image, 0ull);
-	ptu_int_eq(status, 0);
+	ptu_test(fill_idx, tfix, 0);
 
-	ptu_ptr_eq(msec, &tfix->mcache.msec);
+	image = tfix->image;
 
-	section = pt_msec_section(msec);
-	ptu_ptr_eq(section, &tfix->section);
+	status = pt_msec_cache_read(&tfix->mcache, &msec, &image, &tfix->asid,
+				    tfix_vaddr(0));
+	ptu_int_eq(status, -pte_nomap);
 
 	return ptu_passed();
 }
@@ -296,83 +461,155 @@ static struct ptunit_result read(struct test_fixture *tfix)
 static struct ptunit_result fill_nomap(struct test_fixture *tfix)
 {
 	const struct pt_mapped_section *msec;
-	struct pt_asid asid;
-	struct pt_section *section;
 	int status;
 
 	msec = NULL;
 
-	status = pt_msec_cache_fill(&tfix->mcache, &msec, &tfix->image, &asid,
-				    0ull);
+	status = pt_msec_cache_fill(&tfix->mcache, &msec, &tfix->image,
+				    &tfix->asid, 0ull);
 	ptu_int_eq(status, -pte_nomap);
-
-	section = pt_msec_section(&tfix->mcache.msec);
-	ptu_null(section);
 	ptu_null(msec);
 
-	ptu_uint_eq(tfix->section.mcount, 0);
-	ptu_uint_eq(tfix->section.ucount, 0);
+	ptu_test(check_count, tfix, 0, 0);
 
 	return ptu_passed();
 }
 
 static struct ptunit_result fill(struct test_fixture *tfix)
 {
-	const struct pt_mapped_section *msec;
-	struct pt_section *section;
-	struct pt_asid asid;
-	int status;
+	ptu_test(fill_idx, tfix, 0);
+	ptu_test(check_count, tfix, 0, 1);
 
-	status = pt_msec_cache_fill(&tfix->mcache, &msec, &tfix->image, &asid,
-				    0ull);
-	ptu_int_eq(status, 0);
+	return ptu_passed();
+}
 
-	ptu_ptr_eq(msec, &tfix->mcache.msec);
+static struct ptunit_result fill_all(struct test_fixture *tfix)
+{
+	int idx;
 
-	section = pt_msec_section(msec);
-	ptu_ptr_eq(section, &tfix->section);
+	for (idx = 0; idx < pt_msec_cache_nentries; ++idx)
+		ptu_test(fill_idx, tfix, idx);
 
-	ptu_uint_eq(section->mcount, 1);
-	ptu_uint_eq(section->ucount, 1);
+	for (idx = 0; idx < pt_msec_cache_nentries; ++idx) {
+		ptu_test(read_idx, tfix, idx, 1);
+		ptu_test(check_count, tfix, idx, 1);
+	}
 
 	return ptu_passed();
 }
 
-static struct ptunit_result sfix_init(struct test_fixture *tfix)
+static struct ptunit_result fill_evict(struct test_fixture *tfix)
 {
-	memset(&tfix->section, 0, sizeof(tfix->section));
-	memset(&tfix->mcache, 0, sizeof(tfix->mcache));
-	memset(&tfix->image, 0, sizeof(tfix->image));
+	int idx;
+
+	for (idx = 0; idx < pt_msec_cache_nentries; ++idx)
+		ptu_test(fill_idx, tfix, idx);
+
+	/* Make the first section the most recently used one. */
+	ptu_test(read_idx, tfix, 0, 1);
+
+	/* This replaces the second section. */
+	ptu_test(fill_idx, tfix, pt_msec_cache_nentries);
+	ptu_test(check_count, tfix, 1, 0);
+	ptu_test(check_count, tfix, pt_msec_cache_nentries, 1);
+
+	ptu_test(read_idx, tfix, 0, 1);
+	ptu_test(read_idx, tfix, 1, 0);
+
+	for (idx = 2; idx <= pt_msec_cache_nentries; ++idx)
+		ptu_test(read_idx, tfix, idx, 1);
+
+	/* This replaces the first section. */
+	ptu_test(fill_idx, tfix, pt_msec_cache_nentries + 1);
+	ptu_test(check_count, tfix, 0, 0);
+
+	ptu_test(read_idx, tfix, 0, 0);
 
 	return ptu_passed();
 }
 
-static struct ptunit_result ifix_init(struct test_fixture *tfix)
+static struct ptunit_result stats(struct test_fixture *tfix)
 {
-	ptu_test(sfix_init, tfix);
+	struct pt_scache_stats stats;
+	uint8_t buffer[sizeof(stats) + 4];
+	int status;
 
-	tfix->image.section = &tfix->section;
+	ptu_test(fill_idx, tfix, 0);
+	ptu_test(fill_idx, tfix, 1);
+	ptu_test(read_idx, tfix, 0, 1);
+	ptu_test(read_idx, tfix, 1, 1);
+	ptu_test(read_idx, tfix, 0, 1);
+
+	memset(&stats, 0xcd, sizeof(stats));
+
+	status = pt_msec_cache_stats(&tfix->mcache, &stats, sizeof(stats));
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(stats.hits, 3ull);
+	ptu_uint_eq(stats.misses, 2ull);
+
+	/* Invalidation does not reset the counters. */
+	status = pt_msec_cache_invalidate(&tfix->mcache);
+	ptu_int_eq(status, 0);
+
+	memset(buffer, 0xcd, sizeof(buffer));
+
+	status = pt_msec_cache_stats(&tfix->mcache,
+				     (struct pt_scache_stats *) buffer,
+				     sizeof(buffer));
+	ptu_int_eq(status, 0);
+	ptu_int_eq(memcmp(buffer, &stats, sizeof(stats)), 0);
+	ptu_uint_eq(buffer[sizeof(stats)], 0);
+	ptu_uint_eq(buffer[sizeof(buffer) - 1], 0);
+
+	memset(buffer, 0xcd, sizeof(buffer));
+
+	status = pt_msec_cache_stats(&tfix->mcache,
+				     (struct pt_scache_stats *) buffer,
+				     sizeof(stats.hits));
+	ptu_int_eq(status, 0);
+	ptu_int_eq(memcmp(buffer, &stats.hits, sizeof(stats.hits)), 0);
+	ptu_uint_eq(buffer[sizeof(stats.hits)], 0xcd);
 
 	return ptu_passed();
 }
 
-static struct ptunit_result cfix_init(struct test_fixture *tfix)
+static struct ptunit_result tfix_init(struct test_fixture *tfix)
 {
-	ptu_test(sfix_init, tfix);
+	int status;
 
-	tfix->mcache.msec.section = &tfix->section;
+	memset(tfix->section, 0, sizeof(tfix->section));
+	memset(&tfix->image, 0, sizeof(tfix->image));
 
-	tfix->section.ucount = 1;
-	tfix->section.mcount = 1;
+	pt_asid_init(&tfix->asid);
+
+	status = pt_msec_cache_init(&tfix->mcache);
+	ptu_int_eq(status, 0);
 
 	return ptu_passed();
 }
 
-static struct ptunit_result cifix_init(struct test_fixture *tfix)
+static struct ptunit_result ifix_init(struct test_fixture *tfix)
 {
-	ptu_test(cfix_init, tfix);
+	int idx;
+
+	ptu_test(tfix_init, tfix);
+
+	for (idx = 0; idx < tfix_nsecs; ++idx)
+		tfix->image.section[idx] = &tfix->section[idx];
 
-	tfix->image.section = &tfix->section;
+	tfix->image.generation = 1ull;
+
+	return ptu_passed();
+}
+
+static struct ptunit_result tfix_fini(struct test_fixture *tfix)
+{
+	int idx;
+
+	pt_msec_cache_fini(&tfix->mcache);
+
+	for (idx = 0; idx < tfix_nsecs; ++idx)
+		ptu_test(check_count, tfix, idx, 0);
 
 	return ptu_passed();
 }
@@ -380,19 +617,13 @@ static struct ptunit_result cifix_init(struct test_fixture *tfix)
 int main(int argc, char **argv)
 {
 	struct ptunit_suite suite;
-	struct test_fixture sfix, ifix, cfix, cifix;
+	struct test_fixture sfix, ifix;
 
-	sfix.init = sfix_init;
-	sfix.fini = NULL;
+	sfix.init = tfix_init;
+	sfix.fini = tfix_fini;
 
 	ifix.init = ifix_init;
-	ifix.fini = NULL;
-
-	cfix.init = cfix_init;
-	cfix.fini = NULL;
-
-	cifix.init = cifix_init;
-	cifix.fini = NULL;
+	ifix.fini = tfix_fini;
 
 	suite = ptunit_mk_suite(argc, argv);
 
@@ -401,19 +632,26 @@ int main(int argc, char **argv)
 	ptu_run(suite, invalidate_null);
 	ptu_run(suite, read_null);
 	ptu_run(suite, fill_null);
+	ptu_run(suite, stats_null);
 
-	ptu_run_f(suite, invalidate, sfix);
-	ptu_run_f(suite, invalidate, cfix);
+	ptu_run_f(suite, invalidate_empty, sfix);
+	ptu_run_f(suite, invalidate, ifix);
 
 	ptu_run_f(suite, read_nomap, sfix);
 	ptu_run_f(suite, read_nomap, ifix);
-	ptu_run_f(suite, read_nomap, cfix);
-	ptu_run_f(suite, read, cifix);
+	ptu_run_f(suite, read, ifix);
+	ptu_run_f(suite, read_outside, ifix);
+	ptu_run_f(suite, read_asid, ifix);
+	ptu_run_f(suite, read_generation, ifix);
+	ptu_run_f(suite, read_image, ifix);
 
 	ptu_run_f(suite, fill_nomap, sfix);
-	ptu_run_f(suite, fill_nomap, cfix);
+	ptu_run_f(suite, fill_nomap, ifix);
 	ptu_run_f(suite, fill, ifix);
-	ptu_run_f(suite, fill, cifix);
+	ptu_run_f(suite, fill_all, ifix);
+	ptu_run_f(suite, fill_evict, ifix);
+
+	ptu_run_f(suite, stats, ifix);
 
 	return ptunit_report(&suite);
 }
@@ -542,6 +542,159 @@ static struct ptunit_result cutoff_mode(struct packet_fixture *pfix,
 	return ptu_passed();
 }
 
+static struct ptunit_result batch_null(struct packet_fixture *pfix)
+{
+	struct pt_packet packets[2];
+	uint64_t offsets[2];
+	int status;
+
+	status = pt_pkt_next_batch(NULL, packets, offsets, 2, sizeof(*packets));
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_pkt_next_batch(&pfix->decoder, NULL, offsets, 2,
+				   sizeof(*packets));
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, offsets, 2, 0);
+	ptu_int_eq(status, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result batch(struct packet_fixture *pfix)
+{
+	struct pt_packet packets[4];
+	uint64_t offsets[4];
+	int status;
+
+	status = pt_encode_tnt_8(&pfix->encoder, 0x2, 2);
+	ptu_int_eq(status, 1);
+
+	status = pt_encode_tip(&pfix->encoder, 0x1000ull, pt_ipc_update_16);
+	ptu_int_eq(status, 3);
+
+	status = pt_encode_psb(&pfix->encoder);
+	ptu_int_eq(status, ptps_psb);
+
+	status = pt_encode_tsc(&pfix->encoder, 0x1234ull);
+	ptu_int_eq(status, ptps_tsc);
+
+	pfix->decoder.config.end = pfix->encoder.pos;
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, offsets, 4,
+				   sizeof(*packets));
+	ptu_int_eq(status, 2);
+	ptu_int_eq(packets[0].type, ppt_tnt_8);
+	ptu_uint_eq(offsets[0], 0ull);
+	ptu_int_eq(packets[1].type, ppt_tip);
+	ptu_uint_eq(packets[1].payload.ip.ip, 0x1000ull);
+	ptu_uint_eq(offsets[1], 1ull);
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, offsets, 4,
+				   sizeof(*packets));
+	ptu_int_eq(status, 2);
+	ptu_int_eq(packets[0].type, ppt_psb);
+	ptu_uint_eq(offsets[0], 4ull);
+	ptu_int_eq(packets[1].type, ppt_tsc);
+	ptu_uint_eq(packets[1].payload.tsc.tsc, 0x1234ull);
+	ptu_uint_eq(offsets[1], 4ull + ptps_psb);
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, offsets, 4,
+				   sizeof(*packets));
+	ptu_int_eq(status, -pte_eos);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result batch_count(struct packet_fixture *pfix)
+{
+	struct pt_packet packets[2];
+	uint64_t offset;
+	int status;
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, NULL, 2,
+				   sizeof(*packets));
+	ptu_int_eq(status, 2);
+	ptu_int_eq(packets[0].type, ppt_pad);
+	ptu_int_eq(packets[1].type, ppt_pad);
+
+	status = pt_pkt_get_offset(&pfix->decoder, &offset);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(offset, 2ull);
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, NULL, 0,
+				   sizeof(*packets));
+	ptu_int_eq(status, 0);
+
+	status = pt_pkt_get_offset(&pfix->decoder, &offset);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(offset, 2ull);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result batch_error(struct packet_fixture *pfix)
+{
+	struct pt_packet packets[4];
+	uint64_t offset;
+	int status;
+
+	status = pt_encode_tnt_8(&pfix->encoder, 0x2, 2);
+	ptu_int_eq(status, 1);
+
+	status = pt_encode_tsc(&pfix->encoder, 0x1234ull);
+	ptu_int_eq(status, ptps_tsc);
+
+	pfix->decoder.config.end = pfix->encoder.pos - 1;
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, NULL, 4,
+				   sizeof(*packets));
+	ptu_int_eq(status, 1);
+	ptu_int_eq(packets[0].type, ppt_tnt_8);
+
+	status = pt_pkt_next_batch(&pfix->decoder, packets, NULL, 4,
+				   sizeof(*packets));
+	ptu_int_eq(status, -pte_eos);
+
+	status = pt_pkt_get_offset(&pfix->decoder, &offset);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(offset, 1ull);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result batch_stride(struct packet_fixture *pfix)
+{
+	struct {
+		struct pt_packet packet;
+		uint8_t extra[8];
+	} packets[2];
+	size_t byte;
+	int status;
+
+	memset(packets, 0xcc, sizeof(packets));
+
+	status = pt_encode_tnt_8(&pfix->encoder, 0x2, 2);
+	ptu_int_eq(status, 1);
+
+	status = pt_encode_cbr(&pfix->encoder, 0x24);
+	ptu_int_eq(status, ptps_cbr);
+
+	status = pt_pkt_next_batch(&pfix->decoder, &packets[0].packet, NULL, 2,
+				   sizeof(packets[0]));
+	ptu_int_eq(status, 2);
+	ptu_int_eq(packets[0].packet.type, ppt_tnt_8);
+	ptu_int_eq(packets[1].packet.type, ppt_cbr);
+	ptu_uint_eq(packets[1].packet.payload.cbr.ratio, 0x24);
+
+	for (byte = 0; byte < sizeof(packets[0].extra); ++byte) {
+		ptu_uint_eq(packets[0].extra[byte], 0);
+		ptu_uint_eq(packets[1].extra[byte], 0);
+	}
+
+	return ptu_passed();
+}
+
 int main(int argc, char **argv)
 {
 	struct packet_fixture pfix;
@@ -648,6 +801,12 @@ int main(int argc, char **argv)
 	ptu_run_fp(suite, cutoff, pfix, ppt_pwrx);
 	ptu_run_fp(suite, cutoff, pfix, ppt_ptw);
 
+	ptu_run_f(suite, batch_null, pfix);
+	ptu_run_f(suite, batch, pfix);
+	ptu_run_f(suite, batch_count, pfix);
+	ptu_run_f(suite, batch_error, pfix);
+	ptu_run_f(suite, batch_stride, pfix);
+
 	return ptunit_report(&suite);
 }
 
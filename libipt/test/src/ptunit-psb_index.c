@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "pt_psb_index.h"
+#include "pt_encoder.h"
+#include "pt_opcodes.h"
+
+#include "intel-pt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	/* The number of PSB+ headers in the test trace. */
+	ifix_npsb	= 0x20,
+
+	/* The size of the trace buffer. */
+	ifix_trace_size	= 0x1000
+};
+
+/* A test fixture providing a trace and an index. */
+struct index_fixture {
+	/* The trace buffer. */
+	uint8_t buffer[ifix_trace_size];
+
+	/* The offsets of the PSB packets in @buffer. */
+	uint64_t offset[ifix_npsb];
+
+	/* The decoder configuration. */
+	struct pt_config config;
+
+	/* The index - it will be freed automatically. */
+	struct pt_psb_index *index;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct index_fixture *);
+	struct ptunit_result (*fini)(struct index_fixture *);
+};
+
+/* The TSC given in the @idx-th PSB+ header of the test trace.
+ *
+ * Every fourth header does not give a TSC.
+ */
+static uint64_t ifix_tsc(int idx)
+{
+	return 0x1000ull + ((uint64_t) idx * 0x100ull);
+}
+
+static int ifix_has_tsc(int idx)
+{
+	return (idx % 4) != 3;
+}
+
+static uint64_t ifix_ip(int idx)
+{
+	return 0x400000ull + ((uint64_t) idx * 0x10ull);
+}
+
+static struct ptunit_result ifix_init(struct index_fixture *ifix)
+{
+	struct pt_encoder encoder;
+	int idx, errcode;
+
+	memset(ifix->buffer, 0, sizeof(ifix->buffer));
+
+	pt_config_init(&ifix->config);
+	ifix->config.begin = ifix->buffer;
+	ifix->config.end = ifix->buffer + sizeof(ifix->buffer);
+
+	errcode = pt_encoder_init(&encoder, &ifix->config);
+	ptu_int_eq(errcode, 0);
+
+	/* Start with some trace that can't be indexed. */
+	pt_encode_tnt_8(&encoder, 0, 1);
+	pt_encode_pad(&encoder);
+
+	for (idx = 0; idx < ifix_npsb; ++idx) {
+		ifix->offset[idx] = (uint64_t) (encoder.pos - ifix->buffer);
+
+		pt_encode_psb(&encoder);
+		if (ifix_has_tsc(idx))
+			pt_encode_tsc(&encoder, ifix_tsc(idx));
+		pt_encode_cbr(&encoder, (uint8_t) idx);
+		pt_encode_tma(&encoder, (uint16_t) idx, (uint16_t) (idx + 1));
+		pt_encode_mode_exec(&encoder, (idx & 1) ? ptem_32bit :
+				    ptem_64bit);
+		if (idx != 5)
+			pt_encode_fup(&encoder, ifix_ip(idx), pt_ipc_sext_48);
+		pt_encode_psbend(&encoder);
+
+		pt_encode_tnt_8(&encoder, 0x2, 2);
+		pt_encode_tip(&encoder, 0x1000ull, pt_ipc_update_16);
+	}
+
+	ifix->config.end = encoder.pos;
+
+	pt_encoder_fini(&encoder);
+
+	ifix->index = pt_psb_index_alloc();
+	ptu_ptr(ifix->index);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result ifix_fini(struct index_fixture *ifix)
+{
+	pt_psb_index_free(ifix->index);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result free_null(void)
+{
+	pt_psb_index_free(NULL);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result null(struct index_fixture *ifix)
+{
+	struct pt_psb_entry entry;
+	int errcode;
+
+	errcode = pt_psb_index_build(NULL, &ifix->config);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_build(ifix->index, NULL);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_write(NULL, "filename");
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_write(ifix->index, NULL);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_read(NULL, "filename", &ifix->config);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_read(ifix->index, NULL, &ifix->config);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_read(ifix->index, "filename", NULL);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_get(NULL, &entry, sizeof(entry), 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_get(ifix->index, NULL, sizeof(entry), 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_find_offset(NULL, &entry, sizeof(entry), 0ull);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_find_offset(ifix->index, NULL, sizeof(entry),
+					   0ull);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_find_tsc(NULL, &entry, sizeof(entry), 0ull);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_psb_index_find_tsc(ifix->index, NULL, sizeof(entry),
+					0ull);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result empty(struct index_fixture *ifix)
+{
+	struct pt_psb_entry entry;
+	int status;
+
+	ifix->config.end = ifix->config.begin + ifix->offset[0];
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, 0);
+
+	status = pt_psb_index_get(ifix->index, &entry, sizeof(entry), 0);
+	ptu_int_eq(status, -pte_eos);
+
+	status = pt_psb_index_find_offset(ifix->index, &entry, sizeof(entry),
+					  0ull);
+	ptu_int_eq(status, -pte_eos);
+
+	status = pt_psb_index_find_tsc(ifix->index, &entry, sizeof(entry),
+				       ifix_tsc(0));
+	ptu_int_eq(status, -pte_no_time);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result check_entry(const struct pt_psb_entry *entry,
+					const struct index_fixture *ifix,
+					int idx)
+{
+	ptu_uint_eq(entry->offset, ifix->offset[idx]);
+	ptu_uint_eq(entry->cbr, (uint8_t) idx);
+	ptu_uint_eq(entry->ctc, (uint16_t) idx);
+	ptu_uint_eq(entry->fc, (uint16_t) (idx + 1));
+	ptu_uint_eq(entry->has_cbr, 1);
+	ptu_uint_eq(entry->has_tma, 1);
+	ptu_int_eq(entry->mode, (idx & 1) ? ptem_32bit : ptem_64bit);
+
+	if (ifix_has_tsc(idx)) {
+		ptu_uint_eq(entry->has_tsc, 1);
+		ptu_uint_eq(entry->tsc, ifix_tsc(idx));
+	} else {
+		ptu_uint_eq(entry->has_tsc, 0);
+		ptu_uint_eq(entry->tsc, ifix_tsc(idx - 1));
+	}
+
+	if (idx == 5)
+		ptu_uint_eq(entry->has_ip, 0);
+	else {
+		ptu_uint_eq(entry->has_ip, 1);
+		ptu_uint_eq(entry->ip, ifix_ip(idx));
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result build(struct index_fixture *ifix)
+{
+	struct pt_psb_entry entry;
+	int idx, status;
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	for (idx = 0; idx < ifix_npsb; ++idx) {
+		memset(&entry, 0xcd, sizeof(entry));
+
+		status = pt_psb_index_get(ifix->index, &entry, sizeof(entry),
+					  idx);
+		ptu_int_eq(status, 0);
+		ptu_test(check_entry, &entry, ifix, idx);
+	}
+
+	status = pt_psb_index_get(ifix->index, &entry, sizeof(entry), idx);
+	ptu_int_eq(status, -pte_eos);
+
+	status = pt_psb_index_get(ifix->index, &entry, sizeof(entry), -1);
+	ptu_int_eq(status, -pte_eos);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result find_offset(struct index_fixture *ifix)
+{
+	struct pt_psb_entry entry;
+	int idx, status;
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	status = pt_psb_index_find_offset(ifix->index, &entry, sizeof(entry),
+					  ifix->offset[0] - 1ull);
+	ptu_int_eq(status, -pte_eos);
+
+	for (idx = 0; idx < ifix_npsb; ++idx) {
+		status = pt_psb_index_find_offset(ifix->index, &entry,
+						  sizeof(entry),
+						  ifix->offset[idx]);
+		ptu_int_eq(status, idx);
+		ptu_test(check_entry, &entry, ifix, idx);
+
+		status = pt_psb_index_find_offset(ifix->index, &entry,
+						  sizeof(entry),
+						  ifix->offset[idx] + 1ull);
+		ptu_int_eq(status, idx);
+		ptu_uint_eq(entry.offset, ifix->offset[idx]);
+	}
+
+	status = pt_psb_index_find_offset(ifix->index, &entry, sizeof(entry),
+					  UINT64_MAX);
+	ptu_int_eq(status, ifix_npsb - 1);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result find_tsc(struct index_fixture *ifix)
+{
+	struct pt_psb_entry entry;
+	int idx, status;
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	status = pt_psb_index_find_tsc(ifix->index, &entry, sizeof(entry),
+				       ifix_tsc(0) - 1ull);
+	ptu_int_eq(status, -pte_eos);
+
+	for (idx = 0; idx < ifix_npsb; ++idx) {
+		int expected;
+
+		/* We must not start at a PSB that does not give a TSC.  Its
+		 * time is only known to be after the previous PSB's.
+		 */
+		expected = ifix_has_tsc(idx) ? idx : idx - 1;
+
+		status = pt_psb_index_find_tsc(ifix->index, &entry,
+					       sizeof(entry), ifix_tsc(idx));
+		ptu_int_eq(status, expected);
+		ptu_uint_eq(entry.offset, ifix->offset[expected]);
+
+		status = pt_psb_index_find_tsc(ifix->index, &entry,
+					       sizeof(entry),
+					       ifix_tsc(idx) + 1ull);
+		ptu_int_eq(status, expected);
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result no_time(struct index_fixture *ifix)
+{
+	struct pt_psb_entry entry;
+	int status;
+
+	/* Index a trace with a single PSB+ that does not give a TSC. */
+	ifix->config.begin += ifix->offset[3];
+	ifix->config.end = ifix->buffer + ifix->offset[4];
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, 1);
+
+	status = pt_psb_index_find_tsc(ifix->index, &entry, sizeof(entry),
+				       ifix_tsc(3));
+	ptu_int_eq(status, -pte_no_time);
+
+	status = pt_psb_index_find_offset(ifix->index, &entry, sizeof(entry),
+					  0ull);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(entry.offset, 0ull);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result write_read(struct index_fixture *ifix)
+{
+	struct pt_psb_index *index;
+	struct pt_psb_entry entry;
+	char *filename;
+	FILE *file;
+	int idx, status;
+
+	status = ptunit_mkfile(&file, &filename, "wb");
+	ptu_int_eq(status, 0);
+
+	fclose(file);
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	status = pt_psb_index_write(ifix->index, filename);
+	ptu_int_eq(status, 0);
+
+	index = pt_psb_index_alloc();
+	ptu_ptr(index);
+
+	status = pt_psb_index_read(index, filename, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	for (idx = 0; idx < ifix_npsb; ++idx) {
+		status = pt_psb_index_get(index, &entry, sizeof(entry), idx);
+		ptu_int_eq(status, 0);
+		ptu_test(check_entry, &entry, ifix, idx);
+	}
+
+	/* The index does not fit a different trace. */
+	ifix->config.end -= 1;
+
+	status = pt_psb_index_read(index, filename, &ifix->config);
+	ptu_int_eq(status, -pte_bad_config);
+
+	status = pt_psb_index_get(index, &entry, sizeof(entry), 0);
+	ptu_int_eq(status, -pte_eos);
+
+	pt_psb_index_free(index);
+	remove(filename);
+	free(filename);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_other_trace(struct index_fixture *ifix)
+{
+	char *filename;
+	FILE *file;
+	int status;
+
+	status = ptunit_mkfile(&file, &filename, "wb");
+	ptu_int_eq(status, 0);
+
+	fclose(file);
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	status = pt_psb_index_write(ifix->index, filename);
+	ptu_int_eq(status, 0);
+
+	/* A different trace of the same size has no PSB at that offset. */
+	memset(&ifix->buffer[ifix->offset[ifix_npsb - 1]], pt_opc_pad, 2);
+
+	status = pt_psb_index_read(ifix->index, filename, &ifix->config);
+	remove(filename);
+	free(filename);
+
+	ptu_int_eq(status, -pte_bad_config);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_version(struct index_fixture *ifix)
+{
+	uint16_t version;
+	char *filename;
+	FILE *file;
+	int status;
+
+	status = ptunit_mkfile(&file, &filename, "wb");
+	ptu_int_eq(status, 0);
+
+	fclose(file);
+
+	status = pt_psb_index_build(ifix->index, &ifix->config);
+	ptu_int_eq(status, ifix_npsb);
+
+	status = pt_psb_index_write(ifix->index, filename);
+	ptu_int_eq(status, 0);
+
+	/* Patch the format version following the 32-bit magic. */
+	file = fopen(filename, "r+b");
+	ptu_ptr(file);
+
+	version = 0xffff;
+	status = fseek(file, 4, SEEK_SET);
+	if (!status && (fwrite(&version, sizeof(version), 1, file) != 1))
+		status = -1;
+
+	fclose(file);
+	ptu_int_eq(status, 0);
+
+	status = pt_psb_index_read(ifix->index, filename, &ifix->config);
+	remove(filename);
+	free(filename);
+
+	ptu_int_eq(status, -pte_not_supported);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_bad_file(struct index_fixture *ifix)
+{
+	char *filename;
+	FILE *file;
+	int status;
+
+	status = ptunit_mkfile(&file, &filename, "wb");
+	ptu_int_eq(status, 0);
+
+	fwrite(ifix->buffer, 1, sizeof(ifix->buffer), file);
+	fclose(file);
+
+	status = pt_psb_index_read(ifix->index, filename, &ifix->config);
+	remove(filename);
+
+	ptu_int_eq(status, -pte_bad_file);
+
+	status = pt_psb_index_read(ifix->index, filename, &ifix->config);
+	free(filename);
+
+	ptu_int_eq(status, -pte_bad_file);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct index_fixture ifix;
+	struct ptunit_suite suite;
+
+	ifix.init = ifix_init;
+	ifix.fini = ifix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run(suite, free_null);
+	ptu_run_f(suite, null, ifix);
+	ptu_run_f(suite, empty, ifix);
+	ptu_run_f(suite, build, ifix);
+	ptu_run_f(suite, find_offset, ifix);
+	ptu_run_f(suite, find_tsc, ifix);
+	ptu_run_f(suite, no_time, ifix);
+	ptu_run_f(suite, write_read, ifix);
+	ptu_run_f(suite, read_other_trace, ifix);
+	ptu_run_f(suite, read_version, ifix);
+	ptu_run_f(suite, read_bad_file, ifix);
+
+	return ptunit_report(&suite);
+}
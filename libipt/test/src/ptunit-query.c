@@ -730,6 +730,37 @@ static struct ptunit_result cond(struct ptu_decoder_fixture *dfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result cond_cached(struct ptu_decoder_fixture *dfix)
+{
+	struct pt_query_decoder *decoder = &dfix->decoder;
+	struct pt_encoder *encoder = &dfix->encoder;
+	int errcode, taken;
+
+	pt_encode_tnt_8(encoder, 0x02, 3);
+
+	ptu_check(ptu_sync_decoder, decoder);
+
+	taken = pt_qry_cond_branch_cached(decoder);
+	ptu_int_eq(taken, -pte_bad_query);
+
+	errcode = pt_qry_cond_branch(decoder, &taken);
+	ptu_int_eq(errcode, 0);
+	ptu_int_eq(taken, 0);
+
+	taken = pt_qry_cond_branch_cached(decoder);
+	ptu_int_eq(taken, 1);
+
+	/* The last bit needs to go through the slow path. */
+	taken = pt_qry_cond_branch_cached(decoder);
+	ptu_int_eq(taken, -pte_bad_query);
+
+	errcode = pt_qry_cond_branch(decoder, &taken);
+	ptu_int_eq(errcode, pts_eos);
+	ptu_int_eq(taken, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result cond_skip_tip_fail(struct ptu_decoder_fixture *dfix)
 {
 	struct pt_query_decoder *decoder = &dfix->decoder;
@@ -2500,6 +2531,7 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, cond_null, dfix_empty);
 	ptu_run_f(suite, cond_empty, dfix_empty);
 	ptu_run_f(suite, cond, dfix_empty);
+	ptu_run_f(suite, cond_cached, dfix_empty);
 	ptu_run_f(suite, cond_skip_tip_fail, dfix_empty);
 	ptu_run_f(suite, cond_skip_tip_pge_fail, dfix_empty);
 	ptu_run_f(suite, cond_skip_tip_pgd_fail, dfix_empty);
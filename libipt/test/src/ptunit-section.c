@@ -31,22 +31,36 @@
 
 #include "pt_section.h"
 #include "pt_block_cache.h"
+#include "pt_insn_cache.h"
 
 #include "intel-pt.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 
 
 struct pt_image_section_cache {
 	int map;
+	uint32_t flags;
+
+	/* The persistent block cache directory - NULL if none. */
+	const char *dir;
 };
 
+/* The number of pt_bcache_store() calls and the last stored hash. */
+static int bcache_nstored;
+static uint64_t bcache_stored_hash;
+
 extern int pt_iscache_notify_map(struct pt_image_section_cache *iscache,
 				 struct pt_section *section);
 extern int pt_iscache_notify_resize(struct pt_image_section_cache *iscache,
 				    struct pt_section *section, uint64_t size);
+extern int pt_iscache_bcache_dir(struct pt_image_section_cache *iscache,
+				 char **dir);
+extern int pt_iscache_map_flags(struct pt_image_section_cache *iscache,
+				uint32_t *flags);
 
 int pt_iscache_notify_map(struct pt_image_section_cache *iscache,
 			  struct pt_section *section)
@@ -88,6 +102,33 @@ int pt_iscache_notify_resize(struct pt_image_section_cache *iscache,
 	return pt_section_map_share(section);
 }
 
+int pt_iscache_bcache_dir(struct pt_image_section_cache *iscache, char **dir)
+{
+	if (!iscache || !dir)
+		return -pte_internal;
+
+	*dir = NULL;
+	if (iscache->dir) {
+		*dir = malloc(strlen(iscache->dir) + 1);
+		if (!*dir)
+			return -pte_nomem;
+
+		strcpy(*dir, iscache->dir);
+	}
+
+	return 0;
+}
+
+int pt_iscache_map_flags(struct pt_image_section_cache *iscache,
+			 uint32_t *flags)
+{
+	if (!iscache || !flags)
+		return -pte_internal;
+
+	*flags = iscache->flags;
+	return 0;
+}
+
 struct pt_block_cache *pt_bcache_alloc(uint64_t nentries)
 {
 	struct pt_block_cache *bcache;
@@ -101,8 +142,21 @@ struct pt_block_cache *pt_bcache_alloc(uint64_t nentries)
 	 * We still set the number of entries to the requested size.
 	 */
 	bcache = malloc(sizeof(*bcache));
-	if (bcache)
+	if (bcache) {
 		bcache->nentries = (uint32_t) nentries;
+		bcache->format = pt_bcf_compact;
+	}
+
+	return bcache;
+}
+
+struct pt_block_cache *pt_bcache_alloc_wide(uint64_t nentries)
+{
+	struct pt_block_cache *bcache;
+
+	bcache = pt_bcache_alloc(nentries);
+	if (bcache)
+		bcache->format = pt_bcf_wide;
 
 	return bcache;
 }
@@ -112,6 +166,75 @@ void pt_bcache_free(struct pt_block_cache *bcache)
 	free(bcache);
 }
 
+int pt_bcache_memsize(const struct pt_block_cache *bcache, uint64_t *size)
+{
+	if (!bcache || !size)
+		return -pte_internal;
+
+	/* Pretend that we allocated one entry per byte. */
+	*size = sizeof(*bcache) +
+		(bcache->nentries * sizeof(struct pt_bcache_entry));
+
+	return 0;
+}
+
+int pt_bcache_load(struct pt_block_cache *bcache, const char *filename,
+		   uint64_t hash)
+{
+	(void) hash;
+
+	if (!bcache || !filename)
+		return -pte_internal;
+
+	return 0;
+}
+
+int pt_bcache_store(const struct pt_block_cache *bcache,
+		    const char *filename, uint64_t hash, uint32_t *nvalid)
+{
+	if (!bcache || !filename || !nvalid)
+		return -pte_internal;
+
+	bcache_nstored += 1;
+	bcache_stored_hash = hash;
+
+	return 0;
+}
+
+struct pt_insn_cache *pt_icache_alloc(uint64_t nentries)
+{
+	struct pt_insn_cache *icache;
+
+	if (!nentries || (UINT32_MAX < nentries))
+		return NULL;
+
+	/* Like the block cache, the instruction cache is not really used by
+	 * tests.
+	 */
+	icache = malloc(sizeof(*icache));
+	if (icache)
+		icache->nentries = (uint32_t) nentries;
+
+	return icache;
+}
+
+void pt_icache_free(struct pt_insn_cache *icache)
+{
+	free(icache);
+}
+
+int pt_icache_memsize(const struct pt_insn_cache *icache, uint64_t *size)
+{
+	if (!icache || !size)
+		return -pte_internal;
+
+	/* Pretend that we allocated one entry per byte. */
+	*size = sizeof(*icache) +
+		(icache->nentries * sizeof(struct pt_icache_entry));
+
+	return 0;
+}
+
 /* A test fixture providing a temporary file and an initially NULL section. */
 struct section_fixture {
 	/* Threading support. */
@@ -627,6 +750,8 @@ static struct ptunit_result attach_map(struct section_fixture *sfix)
 	int errcode;
 
 	iscache.map = 0;
+	iscache.flags = 0u;
+	iscache.dir = NULL;
 
 	sfix_write(sfix, bytes);
 
@@ -663,6 +788,8 @@ static struct ptunit_result attach_bad_map(struct section_fixture *sfix)
 	int errcode;
 
 	iscache.map = -pte_eos;
+	iscache.flags = 0u;
+	iscache.dir = NULL;
 
 	sfix_write(sfix, bytes);
 
@@ -688,6 +815,8 @@ static struct ptunit_result attach_map_overflow(struct section_fixture *sfix)
 	int errcode;
 
 	iscache.map = 1;
+	iscache.flags = 0u;
+	iscache.dir = NULL;
 
 	sfix_write(sfix, bytes);
 
@@ -708,6 +837,54 @@ static struct ptunit_result attach_map_overflow(struct section_fixture *sfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result attach_map_flags(struct section_fixture *sfix,
+					    uint32_t flags, uint64_t min,
+					    uint64_t max)
+{
+	struct pt_image_section_cache iscache;
+	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
+	uint8_t buffer[] = { 0xcc, 0xcc, 0xcc, 0xcc };
+	uint64_t memsize;
+	int status;
+
+	iscache.map = 0;
+	iscache.flags = flags;
+	iscache.dir = NULL;
+
+	sfix_write(sfix, bytes);
+
+	sfix->section = pt_mk_section(sfix->name, 0x1ull, 0x3ull);
+	ptu_ptr(sfix->section);
+
+	status = pt_section_attach(sfix->section, &iscache);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_map(sfix->section);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_read(sfix->section, buffer, 3, 0x0ull);
+	ptu_int_eq(status, 3);
+	ptu_uint_eq(buffer[0], bytes[1]);
+	ptu_uint_eq(buffer[1], bytes[2]);
+	ptu_uint_eq(buffer[2], bytes[3]);
+	ptu_uint_eq(buffer[3], 0xcc);
+
+	memsize = 0ull;
+
+	status = pt_section_memsize(sfix->section, &memsize);
+	ptu_int_eq(status, 0);
+	ptu_uint_ge(memsize, min);
+	ptu_uint_le(memsize, max);
+
+	status = pt_section_unmap(sfix->section);
+	ptu_int_eq(status, 0);
+
+	status = pt_section_detach(sfix->section, &iscache);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result read(struct section_fixture *sfix)
 {
 	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
@@ -1142,6 +1319,111 @@ static struct ptunit_result bcache_alloc_free(struct section_fixture *sfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result bcache_alloc_wide(struct section_fixture *sfix,
+					     uint32_t flags,
+					     enum pt_bcache_format format)
+{
+	struct pt_image_section_cache iscache;
+	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
+	struct pt_block_cache *bcache;
+	int errcode;
+
+	iscache.map = 0;
+	iscache.flags = flags;
+	iscache.dir = NULL;
+
+	sfix_write(sfix, bytes);
+
+	sfix->section = pt_mk_section(sfix->name, 0x1ull, 0x3ull);
+	ptu_ptr(sfix->section);
+
+	errcode = pt_section_attach(sfix->section, &iscache);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_map(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_alloc_bcache(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	bcache = pt_section_bcache(sfix->section);
+	ptu_ptr(bcache);
+	ptu_uint_eq(bcache->format, format);
+
+	errcode = pt_section_unmap(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_detach(sfix->section, &iscache);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result bcache_persist(struct section_fixture *sfix)
+{
+	struct pt_image_section_cache iscache;
+	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
+	uint64_t hash;
+	int errcode;
+
+	iscache.map = 0;
+	iscache.flags = 0u;
+	iscache.dir = "bcdir";
+
+	bcache_nstored = 0;
+	bcache_stored_hash = 0ull;
+
+	sfix_write(sfix, bytes);
+
+	sfix->section = pt_mk_section(sfix->name, 0x1ull, 0x3ull);
+	ptu_ptr(sfix->section);
+
+	errcode = pt_section_attach(sfix->section, &iscache);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_map(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_alloc_bcache(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	ptu_uint_eq(sfix->section->bchashed, 1);
+	ptu_ptr(sfix->section->bcname);
+	ptu_int_eq(strncmp(sfix->section->bcname, "bcdir/", 6), 0);
+
+	hash = sfix->section->bchash;
+
+	errcode = pt_section_unmap(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	ptu_int_eq(bcache_nstored, 1);
+	ptu_uint_eq(bcache_stored_hash, hash);
+	ptu_null(sfix->section->bcname);
+
+	/* The hash is kept for the next mapping. */
+	ptu_uint_eq(sfix->section->bchashed, 1);
+	ptu_uint_eq(sfix->section->bchash, hash);
+
+	errcode = pt_section_map(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_alloc_bcache(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	ptu_ptr(sfix->section->bcname);
+	ptu_uint_eq(sfix->section->bchash, hash);
+
+	errcode = pt_section_unmap(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	ptu_int_eq(bcache_nstored, 2);
+
+	errcode = pt_section_detach(sfix->section, &iscache);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result bcache_alloc_twice(struct section_fixture *sfix)
 {
 	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
@@ -1280,6 +1562,102 @@ static struct ptunit_result memsize_map_bcache(struct section_fixture *sfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result icache_alloc_free(struct section_fixture *sfix)
+{
+	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
+	struct pt_insn_cache *icache;
+	int errcode;
+
+	sfix_write(sfix, bytes);
+
+	sfix->section = pt_mk_section(sfix->name, 0x1ull, 0x3ull);
+	ptu_ptr(sfix->section);
+
+	errcode = pt_section_map(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	icache = pt_section_icache(sfix->section);
+	ptu_null(icache);
+
+	errcode = pt_section_request_icache(sfix->section);
+#if (UINTPTR_MAX < UINT64_MAX)
+	ptu_int_eq(errcode, -pte_not_supported);
+	ptu_null(pt_section_icache(sfix->section));
+#else
+	ptu_int_eq(errcode, 0);
+
+	icache = pt_section_icache(sfix->section);
+	ptu_ptr(icache);
+	ptu_uint_eq(icache->nentries, sfix->section->size);
+
+	errcode = pt_section_request_icache(sfix->section);
+	ptu_int_eq(errcode, 0);
+	ptu_ptr_eq(pt_section_icache(sfix->section), icache);
+#endif
+
+	errcode = pt_section_unmap(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	icache = pt_section_icache(sfix->section);
+	ptu_null(icache);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result icache_alloc_nomap(struct section_fixture *sfix)
+{
+	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
+	int errcode;
+
+	sfix_write(sfix, bytes);
+
+	sfix->section = pt_mk_section(sfix->name, 0x1ull, 0x3ull);
+	ptu_ptr(sfix->section);
+
+	errcode = pt_section_alloc_icache(sfix->section);
+	ptu_int_eq(errcode, -pte_internal);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result memsize_map_icache(struct section_fixture *sfix)
+{
+	uint64_t memsize, bcsize;
+	uint8_t bytes[] = { 0xcc, 0x2, 0x4, 0x6 };
+	int errcode;
+
+	sfix_write(sfix, bytes);
+
+	sfix->section = pt_mk_section(sfix->name, 0x1ull, 0x3ull);
+	ptu_ptr(sfix->section);
+
+	errcode = pt_section_map(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_alloc_bcache(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_memsize(sfix->section, &bcsize);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_alloc_icache(sfix->section);
+#if (UINTPTR_MAX < UINT64_MAX)
+	ptu_int_eq(errcode, -pte_not_supported);
+#else
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_section_memsize(sfix->section, &memsize);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_ge(memsize, bcsize +
+		    sfix->section->size * sizeof(struct pt_icache_entry));
+#endif
+
+	errcode = pt_section_unmap(sfix->section);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
 static struct ptunit_result sfix_init(struct section_fixture *sfix)
 {
 	int errcode;
@@ -1367,6 +1745,14 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, attach_map, sfix);
 	ptu_run_f(suite, attach_bad_map, sfix);
 	ptu_run_f(suite, attach_map_overflow, sfix);
+	ptu_run_fp(suite, attach_map_flags, sfix, ptmf_populate, 0x0ull,
+		   0x2000ull);
+	ptu_run_fp(suite, attach_map_flags, sfix, ptmf_hugepage, 0x0ull,
+		   0x2000ull);
+	ptu_run_fp(suite, attach_map_flags, sfix, ptmf_copy, 0x0ull,
+		   0x10000ull);
+	ptu_run_fp(suite, attach_map_flags, sfix, ptmf_copy | ptmf_hugepage,
+		   0x0ull, 0x200000ull);
 	ptu_run_f(suite, read, sfix);
 	ptu_run_f(suite, read_null, sfix);
 	ptu_run_f(suite, read_offset, sfix);
@@ -1380,6 +1766,10 @@ int main(int argc, char **argv)
 
 	ptu_run_f(suite, init_no_bcache, sfix);
 	ptu_run_f(suite, bcache_alloc_free, sfix);
+	ptu_run_fp(suite, bcache_alloc_wide, sfix, 0u, pt_bcf_compact);
+	ptu_run_fp(suite, bcache_alloc_wide, sfix, ptmf_wide_bcache,
+		   pt_bcf_wide);
+	ptu_run_f(suite, bcache_persist, sfix);
 	ptu_run_f(suite, bcache_alloc_twice, sfix);
 	ptu_run_f(suite, bcache_alloc_nomap, sfix);
 
@@ -1388,6 +1778,9 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, memsize_unmap, sfix);
 	ptu_run_f(suite, memsize_map_nobcache, sfix);
 	ptu_run_f(suite, memsize_map_bcache, sfix);
+	ptu_run_f(suite, icache_alloc_free, sfix);
+	ptu_run_f(suite, icache_alloc_nomap, sfix);
+	ptu_run_f(suite, memsize_map_icache, sfix);
 
 	ptu_run_fp(suite, stress, sfix, worker_bcache);
 	ptu_run_fp(suite, stress, sfix, worker_read);
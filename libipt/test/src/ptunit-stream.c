@@ -0,0 +1,664 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+
+#include "pt_encoder.h"
+#include "pt_opcodes.h"
+
+#include "intel-pt.h"
+
+#include <string.h>
+
+
+enum {
+	/* The number of loop iterations in the test trace. */
+	sfix_iterations		= 0x40,
+
+	/* The size of the trace buffer. */
+	sfix_trace_size		= 0x1000,
+
+	/* The maximal number of records we expect. */
+	sfix_max_records	= 0x400
+};
+
+/* A decode record.
+ *
+ * We record what we decoded in one go and compare it with what we decoded
+ * while feeding the same trace in chunks.
+ */
+struct sfix_record {
+	/* The packet type, the query, or the event type. */
+	int type;
+
+	/* The status or error code returned by the decoder. */
+	int status;
+
+	/* The decoder's offset or zero if it isn't compared. */
+	uint64_t offset;
+
+	/* The packet payload or the query result. */
+	uint64_t value;
+};
+
+/* A collection of decode records. */
+struct sfix_records {
+	/* The records. */
+	struct sfix_record record[sfix_max_records];
+
+	/* The number of records. */
+	size_t nrecords;
+};
+
+/* The queries we record. */
+enum sfix_query {
+	sfq_sync,
+	sfq_event,
+	sfq_cond,
+	sfq_indirect
+};
+
+/* A test fixture providing a trace. */
+struct stream_fixture {
+	/* The trace buffer. */
+	uint8_t buffer[sfix_trace_size];
+
+	/* The decoder configuration. */
+	struct pt_config config;
+
+	/* The number of trace bytes fed into a streaming decoder so far. */
+	size_t fed;
+
+	/* The records of the one-shot and of the streaming decode. */
+	struct sfix_records expected;
+	struct sfix_records actual;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct stream_fixture *);
+	struct ptunit_result (*fini)(struct stream_fixture *);
+};
+
+static int sfix_add(struct sfix_records *records, int type, int status,
+		    uint64_t offset, uint64_t value)
+{
+	struct sfix_record *record;
+
+	if (!records || (sfix_max_records <= records->nrecords))
+		return -pte_internal;
+
+	record = &records->record[records->nrecords++];
+	record->type = type;
+	record->status = status;
+	record->offset = offset;
+	record->value = value;
+
+	return 0;
+}
+
+static struct ptunit_result sfix_check(const struct sfix_records *expected,
+				       const struct sfix_records *actual)
+{
+	size_t idx;
+
+	ptu_uint_eq(actual->nrecords, expected->nrecords);
+
+	for (idx = 0; idx < expected->nrecords; ++idx) {
+		const struct sfix_record *erec, *arec;
+
+		erec = &expected->record[idx];
+		arec = &actual->record[idx];
+
+		ptu_int_eq(arec->type, erec->type);
+		ptu_int_eq(arec->status, erec->status);
+		ptu_uint_eq(arec->offset, erec->offset);
+		ptu_uint_eq(arec->value, erec->value);
+	}
+
+	return ptu_passed();
+}
+
+/* The amount of trace left to feed into a streaming decoder. */
+static size_t sfix_left(const struct stream_fixture *sfix, size_t chunk)
+{
+	size_t left;
+
+	left = (size_t) (sfix->config.end - sfix->config.begin) - sfix->fed;
+	if (chunk < left)
+		left = chunk;
+
+	return left;
+}
+
+static int sfix_pkt_feed(struct stream_fixture *sfix,
+			 struct pt_packet_decoder *decoder, size_t chunk)
+{
+	size_t size;
+	int errcode;
+
+	size = sfix_left(sfix, chunk);
+	if (!size)
+		return pt_pkt_close(decoder);
+
+	errcode = pt_pkt_append(decoder, sfix->config.begin + sfix->fed,
+				size);
+	if (errcode < 0)
+		return errcode;
+
+	sfix->fed += size;
+
+	return 0;
+}
+
+static int sfix_qry_feed(struct stream_fixture *sfix,
+			 struct pt_query_decoder *decoder, size_t chunk)
+{
+	size_t size;
+	int status;
+
+	size = sfix_left(sfix, chunk);
+	if (!size)
+		return pt_qry_close(decoder);
+
+	status = pt_qry_append(decoder, sfix->config.begin + sfix->fed, size);
+	if (status < 0)
+		return status;
+
+	sfix->fed += size;
+
+	return status;
+}
+
+/* Decode packets from @decoder into @records.
+ *
+ * If @chunk is not zero, @decoder is a streaming decoder that is fed @chunk
+ * bytes of trace at a time when it is suspended.
+ */
+static int sfix_pkt_decode(struct stream_fixture *sfix,
+			   struct pt_packet_decoder *decoder,
+			   struct sfix_records *records, size_t chunk)
+{
+	struct pt_packet packet;
+	uint64_t offset;
+	int status, errcode;
+
+	for (;;) {
+		status = pt_pkt_sync_forward(decoder);
+		if (status != -pte_suspended)
+			break;
+
+		errcode = sfix_pkt_feed(sfix, decoder, chunk);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	if (status < 0)
+		return sfix_add(records, -1, status, 0ull, 0ull);
+
+	errcode = pt_pkt_get_sync_offset(decoder, &offset);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = sfix_add(records, -1, status, offset, 0ull);
+	if (errcode < 0)
+		return errcode;
+
+	for (;;) {
+		uint64_t value;
+
+		errcode = pt_pkt_get_offset(decoder, &offset);
+		if (errcode < 0)
+			return errcode;
+
+		memset(&packet, 0, sizeof(packet));
+		status = pt_pkt_next(decoder, &packet, sizeof(packet));
+		if (status == -pte_suspended) {
+			errcode = sfix_pkt_feed(sfix, decoder, chunk);
+			if (errcode < 0)
+				return errcode;
+
+			continue;
+		}
+
+		switch (packet.type) {
+		case ppt_tnt_8:
+		case ppt_tnt_64:
+			value = packet.payload.tnt.payload;
+			break;
+
+		case ppt_tip:
+		case ppt_tip_pge:
+		case ppt_tip_pgd:
+		case ppt_fup:
+			value = packet.payload.ip.ip;
+			break;
+
+		default:
+			value = 0ull;
+			break;
+		}
+
+		errcode = sfix_add(records, packet.type, status, offset,
+				   value);
+		if (errcode < 0)
+			return errcode;
+
+		if (status < 0)
+			return 0;
+	}
+}
+
+/* Decode queries from @decoder into @records.
+ *
+ * If @chunk is not zero, @decoder is a streaming decoder that is fed @chunk
+ * bytes of trace at a time when it is suspended.
+ *
+ * The decoder's offset depends on how far it could read ahead so we only
+ * compare the synchronization offset.
+ */
+static int sfix_qry_decode(struct stream_fixture *sfix,
+			   struct pt_query_decoder *decoder,
+			   struct sfix_records *records, size_t chunk)
+{
+	uint64_t offset, ip;
+	int status, errcode;
+
+	for (;;) {
+		status = pt_qry_sync_forward(decoder, &ip);
+		if (status != -pte_suspended)
+			break;
+
+		errcode = sfix_qry_feed(sfix, decoder, chunk);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	if (status < 0)
+		return sfix_add(records, sfq_sync, status, 0ull, 0ull);
+
+	errcode = pt_qry_get_sync_offset(decoder, &offset);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = sfix_add(records, sfq_sync, status, offset, ip);
+	if (errcode < 0)
+		return errcode;
+
+	for (;;) {
+		enum sfix_query query;
+		uint64_t value;
+
+		if (status & pts_event_pending) {
+			struct pt_event event;
+
+			query = sfq_event;
+			status = pt_qry_event(decoder, &event, sizeof(event));
+			value = (uint64_t) event.type;
+		} else if (status & pts_eos)
+			return 0;
+		else {
+			int taken;
+
+			query = sfq_cond;
+			status = pt_qry_cond_branch(decoder, &taken);
+			value = (uint64_t) taken;
+
+			if (status == -pte_bad_query) {
+				query = sfq_indirect;
+				status = pt_qry_indirect_branch(decoder, &ip);
+				value = ip;
+			}
+		}
+
+		if (status == -pte_suspended) {
+			status = sfix_qry_feed(sfix, decoder, chunk);
+			if (status < 0)
+				return status;
+
+			continue;
+		}
+
+		/* The status flags depend on how far the decoder could read
+		 * ahead.  We compare them indirectly via the queries we make.
+		 */
+		errcode = sfix_add(records, query, status < 0 ? status : 0,
+				   0ull, status < 0 ? 0ull : value);
+		if (errcode < 0)
+			return errcode;
+
+		if (status < 0)
+			return 0;
+	}
+}
+
+static struct ptunit_result pkt_alloc_null(void)
+{
+	struct pt_packet_decoder *decoder;
+
+	decoder = pt_pkt_alloc_stream_decoder(NULL);
+	ptu_null(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result pkt_append_null(void)
+{
+	uint8_t buffer[] = { 0 };
+	int errcode;
+
+	errcode = pt_pkt_append(NULL, buffer, sizeof(buffer));
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_pkt_close(NULL);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result pkt_append_not_stream(struct stream_fixture *sfix)
+{
+	struct pt_packet_decoder *decoder;
+	int errcode;
+
+	decoder = pt_pkt_alloc_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = pt_pkt_append(decoder, sfix->buffer, 1);
+	ptu_int_eq(errcode, -pte_not_supported);
+
+	errcode = pt_pkt_close(decoder);
+	ptu_int_eq(errcode, -pte_not_supported);
+
+	pt_pkt_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result pkt_empty(struct stream_fixture *sfix)
+{
+	struct pt_packet_decoder *decoder;
+	uint64_t offset;
+	int errcode;
+
+	decoder = pt_pkt_alloc_stream_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = pt_pkt_sync_forward(decoder);
+	ptu_int_eq(errcode, -pte_suspended);
+
+	errcode = pt_pkt_append(decoder, NULL, 0);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_pkt_append(decoder, NULL, 1);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_pkt_close(decoder);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_pkt_sync_forward(decoder);
+	ptu_int_eq(errcode, -pte_eos);
+
+	errcode = pt_pkt_append(decoder, sfix->buffer, 1);
+	ptu_int_eq(errcode, -pte_eos);
+
+	errcode = pt_pkt_get_offset(decoder, &offset);
+	ptu_int_eq(errcode, -pte_nosync);
+
+	pt_pkt_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result pkt_stream(struct stream_fixture *sfix,
+				       size_t chunk)
+{
+	struct pt_packet_decoder *decoder;
+	int errcode;
+
+	decoder = pt_pkt_alloc_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = sfix_pkt_decode(sfix, decoder, &sfix->expected, 0);
+	pt_pkt_free_decoder(decoder);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_gt(sfix->expected.nrecords, 2 * sfix_iterations);
+
+	decoder = pt_pkt_alloc_stream_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = sfix_pkt_decode(sfix, decoder, &sfix->actual, chunk);
+	pt_pkt_free_decoder(decoder);
+	ptu_int_eq(errcode, 0);
+
+	ptu_test(sfix_check, &sfix->expected, &sfix->actual);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result qry_alloc_null(void)
+{
+	struct pt_query_decoder *decoder;
+
+	decoder = pt_qry_alloc_stream_decoder(NULL);
+	ptu_null(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result qry_append_null(void)
+{
+	uint8_t buffer[] = { 0 };
+	int errcode;
+
+	errcode = pt_qry_append(NULL, buffer, sizeof(buffer));
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_qry_close(NULL);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result qry_append_not_stream(struct stream_fixture *sfix)
+{
+	struct pt_query_decoder *decoder;
+	int errcode;
+
+	decoder = pt_qry_alloc_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = pt_qry_append(decoder, sfix->buffer, 1);
+	ptu_int_eq(errcode, -pte_not_supported);
+
+	errcode = pt_qry_close(decoder);
+	ptu_int_eq(errcode, -pte_not_supported);
+
+	pt_qry_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result qry_empty(struct stream_fixture *sfix)
+{
+	struct pt_query_decoder *decoder;
+	uint64_t ip;
+	int errcode;
+
+	decoder = pt_qry_alloc_stream_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = pt_qry_sync_forward(decoder, &ip);
+	ptu_int_eq(errcode, -pte_suspended);
+
+	errcode = pt_qry_close(decoder);
+	ptu_int_ge(errcode, 0);
+
+	errcode = pt_qry_sync_forward(decoder, &ip);
+	ptu_int_eq(errcode, -pte_eos);
+
+	errcode = pt_qry_append(decoder, sfix->buffer, 1);
+	ptu_int_eq(errcode, -pte_eos);
+
+	pt_qry_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result qry_wait_for_psb(struct stream_fixture *sfix)
+{
+	struct pt_query_decoder *decoder;
+	uint64_t ip;
+	size_t size;
+	int errcode;
+
+	decoder = pt_qry_alloc_stream_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	/* The first PSB+ alone is not enough to synchronize. */
+	size = (size_t) (sfix->config.end - sfix->config.begin);
+	errcode = pt_qry_append(decoder, sfix->config.begin, ptps_psb + 1);
+	ptu_int_ge(errcode, 0);
+
+	errcode = pt_qry_sync_forward(decoder, &ip);
+	ptu_int_eq(errcode, -pte_suspended);
+
+	errcode = pt_qry_append(decoder, sfix->config.begin + ptps_psb + 1,
+				size - ptps_psb - 1);
+	ptu_int_ge(errcode, 0);
+
+	errcode = pt_qry_sync_forward(decoder, &ip);
+	ptu_int_ge(errcode, 0);
+	ptu_uint_eq(ip, 0x1000ull);
+
+	pt_qry_free_decoder(decoder);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result qry_stream(struct stream_fixture *sfix,
+				       size_t chunk)
+{
+	struct pt_query_decoder *decoder;
+	int errcode;
+
+	decoder = pt_qry_alloc_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = sfix_qry_decode(sfix, decoder, &sfix->expected, 0);
+	pt_qry_free_decoder(decoder);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_gt(sfix->expected.nrecords, 2 * sfix_iterations);
+
+	decoder = pt_qry_alloc_stream_decoder(&sfix->config);
+	ptu_ptr(decoder);
+
+	errcode = sfix_qry_decode(sfix, decoder, &sfix->actual, chunk);
+	pt_qry_free_decoder(decoder);
+	ptu_int_eq(errcode, 0);
+
+	ptu_test(sfix_check, &sfix->expected, &sfix->actual);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result sfix_init(struct stream_fixture *sfix)
+{
+	struct pt_encoder encoder;
+	int idx, errcode;
+
+	memset(sfix->buffer, 0, sizeof(sfix->buffer));
+	memset(&sfix->expected, 0, sizeof(sfix->expected));
+	memset(&sfix->actual, 0, sizeof(sfix->actual));
+	sfix->fed = 0;
+
+	pt_config_init(&sfix->config);
+	sfix->config.begin = sfix->buffer;
+	sfix->config.end = sfix->buffer + sizeof(sfix->buffer);
+
+	errcode = pt_encoder_init(&encoder, &sfix->config);
+	ptu_int_eq(errcode, 0);
+
+	for (idx = 0; idx < sfix_iterations; ++idx) {
+		/* Place a PSB+ every few iterations so the streaming decoders
+		 * discard trace while we feed it.
+		 */
+		if ((idx % 5) == 0) {
+			pt_encode_psb(&encoder);
+			pt_encode_mode_exec(&encoder, ptem_64bit);
+			pt_encode_fup(&encoder, 0x1000ull + (uint64_t) idx,
+				      pt_ipc_sext_48);
+			pt_encode_psbend(&encoder);
+		}
+
+		pt_encode_tnt_8(&encoder, (uint8_t) idx & 0x7, 3);
+		pt_encode_tip(&encoder, 0x2000ull + (uint64_t) idx,
+			      pt_ipc_update_16);
+		pt_encode_tnt_64(&encoder, (uint64_t) idx, 7);
+		pt_encode_tip(&encoder, 0x7fff0000ull + (uint64_t) idx,
+			      pt_ipc_sext_48);
+	}
+
+	pt_encode_tip_pgd(&encoder, 0ull, pt_ipc_suppressed);
+
+	sfix->config.end = encoder.pos;
+
+	pt_encoder_fini(&encoder);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct stream_fixture sfix;
+	struct ptunit_suite suite;
+
+	sfix.init = sfix_init;
+	sfix.fini = NULL;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run(suite, pkt_alloc_null);
+	ptu_run(suite, pkt_append_null);
+	ptu_run_f(suite, pkt_append_not_stream, sfix);
+	ptu_run_f(suite, pkt_empty, sfix);
+	ptu_run_fp(suite, pkt_stream, sfix, 1);
+	ptu_run_fp(suite, pkt_stream, sfix, 3);
+	ptu_run_fp(suite, pkt_stream, sfix, 16);
+	ptu_run_fp(suite, pkt_stream, sfix, 0x1000);
+
+	ptu_run(suite, qry_alloc_null);
+	ptu_run(suite, qry_append_null);
+	ptu_run_f(suite, qry_append_not_stream, sfix);
+	ptu_run_f(suite, qry_empty, sfix);
+	ptu_run_f(suite, qry_wait_for_psb, sfix);
+	ptu_run_fp(suite, qry_stream, sfix, 1);
+	ptu_run_fp(suite, qry_stream, sfix, 3);
+	ptu_run_fp(suite, qry_stream, sfix, 16);
+	ptu_run_fp(suite, qry_stream, sfix, 0x1000);
+
+	return ptunit_report(&suite);
+}
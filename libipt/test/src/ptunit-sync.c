@@ -271,6 +271,175 @@ static struct ptunit_result sync_bwd_cutoff(struct sync_fixture *sfix)
 	return ptu_passed();
 }
 
+static struct ptunit_result sync_search(struct sync_fixture *sfix,
+				       enum pt_sync_search search)
+{
+	uint8_t *buffer;
+	size_t offset;
+	int errcode;
+
+	errcode = pt_sync_set_search(search);
+	if (errcode == -pte_not_supported)
+		return ptu_skipped();
+
+	ptu_int_eq(errcode, 0);
+
+	buffer = sfix->buffer;
+
+	/* Move a psb across the word and vector boundaries at the end of the
+	 * trace buffer.
+	 */
+	for (offset = 0; offset < 2 * 64; ++offset) {
+		const uint8_t *sync;
+
+		memset(buffer, 0xcd, sizeof(sfix->buffer));
+		sfix_encode_psb(buffer + offset);
+
+		sfix->config.end = buffer + offset + ptps_psb;
+
+		errcode = pt_sync_forward(&sync, sfix->config.begin,
+					  &sfix->config);
+		ptu_int_eq(errcode, 0);
+		ptu_ptr_eq(sync, buffer + offset);
+
+		errcode = pt_sync_backward(&sync, sfix->config.end,
+					   &sfix->config);
+		ptu_int_eq(errcode, 0);
+		ptu_ptr_eq(sync, buffer + offset);
+
+		sfix->config.end -= 1;
+
+		errcode = pt_sync_forward(&sync, sfix->config.begin,
+					  &sfix->config);
+		ptu_int_eq(errcode, -pte_eos);
+
+		errcode = pt_sync_backward(&sync, sfix->config.end,
+					   &sfix->config);
+		ptu_int_eq(errcode, -pte_eos);
+	}
+
+	(void) pt_sync_set_search(pt_sync_search_scalar);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result sync_search_unaligned(struct sync_fixture *sfix,
+						  enum pt_sync_search search)
+{
+	size_t shift;
+	int errcode;
+
+	errcode = pt_sync_set_search(search);
+	if (errcode == -pte_not_supported)
+		return ptu_skipped();
+
+	ptu_int_eq(errcode, 0);
+
+	/* Move a psb at the beginning of the trace buffer across a word. */
+	for (shift = 0; shift < sizeof(uint64_t); ++shift) {
+		const uint8_t *sync;
+
+		memset(sfix->buffer, 0xcd, sizeof(sfix->buffer));
+
+		sfix->config.begin = sfix->buffer + shift;
+		sfix_encode_psb(sfix->config.begin);
+
+		errcode = pt_sync_forward(&sync, sfix->config.begin,
+					  &sfix->config);
+		ptu_int_eq(errcode, 0);
+		ptu_ptr_eq(sync, sfix->config.begin);
+
+		errcode = pt_sync_backward(&sync, sfix->config.end,
+					   &sfix->config);
+		ptu_int_eq(errcode, 0);
+		ptu_ptr_eq(sync, sfix->config.begin);
+
+		sfix->config.begin += 1;
+
+		errcode = pt_sync_forward(&sync, sfix->config.begin,
+					  &sfix->config);
+		ptu_int_eq(errcode, -pte_eos);
+
+		errcode = pt_sync_backward(&sync, sfix->config.end,
+					   &sfix->config);
+		ptu_int_eq(errcode, -pte_eos);
+	}
+
+	(void) pt_sync_set_search(pt_sync_search_scalar);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result sync_search_noise(struct sync_fixture *sfix,
+					      enum pt_sync_search search)
+{
+	const uint8_t *pos;
+	uint8_t *buffer;
+	size_t offset;
+	int errcode;
+
+	errcode = pt_sync_set_search(search);
+	if (errcode == -pte_not_supported)
+		return ptu_skipped();
+
+	ptu_int_eq(errcode, 0);
+
+	/* Fill the trace buffer with psb payload pattern that is too short
+	 * for a psb packet and place a few psb packets in between.
+	 */
+	buffer = sfix->buffer;
+	for (offset = 0; offset + ptps_psb < sizeof(sfix->buffer);) {
+		size_t gap;
+
+		sfix_encode_psb(buffer + offset);
+
+		if ((offset % 7) == 3)
+			offset += ptps_psb;
+		else
+			offset += ptps_psb - 2;
+
+		gap = (offset % 5) + 1;
+		memset(buffer + offset, 0xcd, gap);
+		offset += gap;
+	}
+
+	/* Compare the results with the scalar search from every position. */
+	for (pos = sfix->config.begin; pos <= sfix->config.end; ++pos) {
+		const uint8_t *expected, *actual;
+		int status;
+
+		errcode = pt_sync_set_search(pt_sync_search_scalar);
+		ptu_int_eq(errcode, 0);
+
+		status = pt_sync_forward(&expected, pos, &sfix->config);
+
+		errcode = pt_sync_set_search(search);
+		ptu_int_eq(errcode, 0);
+
+		errcode = pt_sync_forward(&actual, pos, &sfix->config);
+		ptu_int_eq(errcode, status);
+		if (status >= 0)
+			ptu_ptr_eq(actual, expected);
+
+		errcode = pt_sync_set_search(pt_sync_search_scalar);
+		ptu_int_eq(errcode, 0);
+
+		status = pt_sync_backward(&expected, pos, &sfix->config);
+
+		errcode = pt_sync_set_search(search);
+		ptu_int_eq(errcode, 0);
+
+		errcode = pt_sync_backward(&actual, pos, &sfix->config);
+		ptu_int_eq(errcode, status);
+		if (status >= 0)
+			ptu_ptr_eq(actual, expected);
+	}
+
+	(void) pt_sync_set_search(pt_sync_search_scalar);
+
+	return ptu_passed();
+}
+
 int main(int argc, char **argv)
 {
 	struct sync_fixture sfix;
@@ -302,5 +471,16 @@ int main(int argc, char **argv)
 	ptu_run_f(suite, sync_fwd_cutoff, sfix);
 	ptu_run_f(suite, sync_bwd_cutoff, sfix);
 
+	ptu_run_fp(suite, sync_search, sfix, pt_sync_search_scalar);
+	ptu_run_fp(suite, sync_search, sfix, pt_sync_search_sse2);
+	ptu_run_fp(suite, sync_search, sfix, pt_sync_search_avx2);
+
+	ptu_run_fp(suite, sync_search_unaligned, sfix, pt_sync_search_scalar);
+	ptu_run_fp(suite, sync_search_unaligned, sfix, pt_sync_search_sse2);
+	ptu_run_fp(suite, sync_search_unaligned, sfix, pt_sync_search_avx2);
+
+	ptu_run_fp(suite, sync_search_noise, sfix, pt_sync_search_sse2);
+	ptu_run_fp(suite, sync_search_noise, sfix, pt_sync_search_avx2);
+
 	return ptunit_report(&suite);
 }
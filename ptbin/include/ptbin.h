@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PTBIN_H
+#define PTBIN_H
+
+#include "intel-pt.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* The binary instruction trace format written by ptxed --format=bin.
+ *
+ * A file starts with a struct ptb_header followed by fixed-size records.
+ * Depending on the header's kind, each record starts with a struct ptb_insn
+ * or a struct ptb_block.  If ptbf_time is set in the header's flags, the
+ * record is followed by a 64-bit timestamp.
+ *
+ * The header's rsize field gives the size of each record in bytes including
+ * the optional timestamp.  Readers must use it to step through the records.
+ *
+ * All fields are stored in host byte order.  The exec mode and instruction
+ * class fields contain enum pt_exec_mode and enum pt_insn_class values.
+ */
+
+enum {
+	/* The magic number identifying a ptbin file: 'ptxb'. */
+	ptb_magic	= 0x62787470,
+
+	/* The current format version. */
+	ptb_version	= 1
+};
+
+/* The kind of records in a ptbin file. */
+enum ptb_kind {
+	/* Instruction records. */
+	ptbk_insn	= 1,
+
+	/* Block records. */
+	ptbk_block	= 2
+};
+
+/* The ptbin header flags. */
+enum ptb_header_flag {
+	/* Each record is followed by a 64-bit timestamp. */
+	ptbf_time	= 1 << 0
+};
+
+/* The ptbin file header. */
+struct ptb_header {
+	/* The magic number - ptb_magic. */
+	uint32_t magic;
+
+	/* The format version - ptb_version. */
+	uint16_t version;
+
+	/* The kind of records - enum ptb_kind. */
+	uint8_t kind;
+
+	/* A bit-vector of enum ptb_header_flag. */
+	uint8_t flags;
+
+	/* The size of each record in bytes. */
+	uint32_t rsize;
+
+	/* Reserved - must be zero. */
+	uint32_t reserved;
+};
+
+/* The ptbin record flags. */
+enum ptb_record_flag {
+	/* The instruction or block has been executed speculatively. */
+	ptbr_speculative	= 1 << 0,
+
+	/* The instruction or the last instruction in the block is truncated,
+	 * i.e. it spans two sections.
+	 */
+	ptbr_truncated		= 1 << 1
+};
+
+/* A ptbin instruction record. */
+struct ptb_insn {
+	/* The virtual address of the instruction. */
+	uint64_t ip;
+
+	/* The size of the instruction in bytes. */
+	uint8_t size;
+
+	/* The instruction class - enum pt_insn_class. */
+	uint8_t iclass;
+
+	/* The execution mode - enum pt_exec_mode. */
+	uint8_t mode;
+
+	/* A bit-vector of enum ptb_record_flag. */
+	uint8_t flags;
+
+	/* Reserved - must be zero. */
+	uint32_t reserved;
+};
+
+/* A ptbin block record. */
+struct ptb_block {
+	/* The virtual address of the first instruction in the block. */
+	uint64_t ip;
+
+	/* The virtual address of the last instruction in the block. */
+	uint64_t end_ip;
+
+	/* The number of instructions in the block. */
+	uint32_t ninsn;
+
+	/* The class of the last instruction - enum pt_insn_class. */
+	uint8_t iclass;
+
+	/* The execution mode - enum pt_exec_mode. */
+	uint8_t mode;
+
+	/* A bit-vector of enum ptb_record_flag. */
+	uint8_t flags;
+
+	/* Reserved - must be zero. */
+	uint8_t reserved;
+};
+
+
+/* A ptbin file opened for reading.
+ *
+ * The records are read in place from a mapping of the file, if possible.
+ */
+struct ptb_file {
+	/* The file header. */
+	struct ptb_header header;
+
+	/* The first record. */
+	const uint8_t *begin;
+
+	/* The number of complete records. */
+	uint64_t nrecords;
+
+	/* The file content. */
+	uint8_t *content;
+
+	/* The size of @content in bytes. */
+	size_t size;
+
+	/* A non-zero value if @content is a mapping of the file. */
+	int mapped;
+};
+
+/* Open the ptbin file @filename.
+ *
+ * Maps or reads @filename and validates its header.  A partial record at the
+ * end of the file is ignored.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ * Returns -pte_internal if @file or @filename is NULL.
+ * Returns -pte_bad_file if @filename can't be read or is not a ptbin file.
+ * Returns -pte_bad_config if the header is not supported.
+ * Returns -pte_nomem if the file content can't be allocated.
+ */
+extern int ptb_open(struct ptb_file *file, const char *filename);
+
+/* Close a ptbin file opened with ptb_open(). */
+extern void ptb_close(struct ptb_file *file);
+
+/* Return the number of records in @file. */
+static inline uint64_t ptb_nrecords(const struct ptb_file *file)
+{
+	return file->nrecords;
+}
+
+/* Return a pointer to the @idx'th record in @file or NULL if @idx is out of
+ * bounds.
+ */
+static inline const void *ptb_record(const struct ptb_file *file,
+				     uint64_t idx)
+{
+	if (file->nrecords <= idx)
+		return NULL;
+
+	return file->begin + (idx * file->header.rsize);
+}
+
+/* Return the @idx'th instruction record in @file.
+ *
+ * Returns NULL if @idx is out of bounds or if @file contains block records.
+ */
+static inline const struct ptb_insn *ptb_insn(const struct ptb_file *file,
+					      uint64_t idx)
+{
+	if (file->header.kind != ptbk_insn)
+		return NULL;
+
+	return (const struct ptb_insn *) ptb_record(file, idx);
+}
+
+/* Return the @idx'th block record in @file.
+ *
+ * Returns NULL if @idx is out of bounds or if @file contains instruction
+ * records.
+ */
+static inline const struct ptb_block *ptb_block(const struct ptb_file *file,
+						uint64_t idx)
+{
+	if (file->header.kind != ptbk_block)
+		return NULL;
+
+	return (const struct ptb_block *) ptb_record(file, idx);
+}
+
+/* Provide the timestamp of the @idx'th record in @file in @time.
+ *
+ * Returns zero on success, a negative pt_error_code otherwise.
+ * Returns -pte_no_time if @file does not contain timestamps.
+ * Returns -pte_eos if @idx is out of bounds.
+ */
+static inline int ptb_time(const struct ptb_file *file, uint64_t idx,
+			   uint64_t *time)
+{
+	const uint8_t *record;
+
+	if (!(file->header.flags & ptbf_time))
+		return -pte_no_time;
+
+	record = (const uint8_t *) ptb_record(file, idx);
+	if (!record)
+		return -pte_eos;
+
+	*time = *(const uint64_t *) (record + file->header.rsize -
+				     sizeof(*time));
+	return 0;
+}
+
+#endif /* PTBIN_H */
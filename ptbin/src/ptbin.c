@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptbin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_POSIX_C_SOURCE)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+
+#if defined(_POSIX_C_SOURCE)
+
+static int ptb_map(struct ptb_file *file, const char *filename)
+{
+	struct stat info;
+	void *base;
+	size_t size;
+	int fd, errcode;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -pte_bad_file;
+
+	errcode = fstat(fd, &info);
+	if (errcode || !S_ISREG(info.st_mode) || (info.st_size <= 0)) {
+		close(fd);
+		return -pte_bad_file;
+	}
+
+	size = (size_t) info.st_size;
+	if ((off_t) size != info.st_size) {
+		close(fd);
+		return -pte_nomem;
+	}
+
+	base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return -pte_nomem;
+
+	/* Readers typically go through the records front to back. */
+	(void) posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+
+	file->content = (uint8_t *) base;
+	file->size = size;
+	file->mapped = 1;
+
+	return 0;
+}
+
+#endif /* defined(_POSIX_C_SOURCE) */
+
+static int ptb_load(struct ptb_file *file, const char *filename)
+{
+	uint8_t *content;
+	FILE *stream;
+	long size;
+	size_t read;
+	int errcode;
+
+	stream = fopen(filename, "rb");
+	if (!stream)
+		return -pte_bad_file;
+
+	errcode = fseek(stream, 0, SEEK_END);
+	if (errcode) {
+		fclose(stream);
+		return -pte_bad_file;
+	}
+
+	size = ftell(stream);
+	if (size <= 0) {
+		fclose(stream);
+		return -pte_bad_file;
+	}
+
+	errcode = fseek(stream, 0, SEEK_SET);
+	if (errcode) {
+		fclose(stream);
+		return -pte_bad_file;
+	}
+
+	content = malloc((size_t) size);
+	if (!content) {
+		fclose(stream);
+		return -pte_nomem;
+	}
+
+	read = fread(content, (size_t) size, 1u, stream);
+	fclose(stream);
+
+	if (read != 1u) {
+		free(content);
+		return -pte_bad_file;
+	}
+
+	file->content = content;
+	file->size = (size_t) size;
+	file->mapped = 0;
+
+	return 0;
+}
+
+static void ptb_unload(struct ptb_file *file)
+{
+#if defined(_POSIX_C_SOURCE)
+	if (file->mapped) {
+		(void) munmap(file->content, file->size);
+		return;
+	}
+#endif /* defined(_POSIX_C_SOURCE) */
+
+	free(file->content);
+}
+
+static int ptb_check_header(const struct ptb_header *header)
+{
+	size_t rsize;
+
+	if (header->magic != ptb_magic)
+		return -pte_bad_file;
+
+	if (header->version != ptb_version)
+		return -pte_bad_config;
+
+	switch (header->kind) {
+	case ptbk_insn:
+		rsize = sizeof(struct ptb_insn);
+		break;
+
+	case ptbk_block:
+		rsize = sizeof(struct ptb_block);
+		break;
+
+	default:
+		return -pte_bad_config;
+	}
+
+	if (header->flags & ~ptbf_time)
+		return -pte_bad_config;
+
+	if (header->flags & ptbf_time)
+		rsize += sizeof(uint64_t);
+
+	/* Records may grow in future versions but they stay 8-byte aligned
+	 * and the timestamp remains at the end.
+	 */
+	if ((header->rsize < rsize) || (header->rsize % sizeof(uint64_t)))
+		return -pte_bad_config;
+
+	if (header->reserved)
+		return -pte_bad_config;
+
+	return 0;
+}
+
+int ptb_open(struct ptb_file *file, const char *filename)
+{
+	int errcode;
+
+	if (!file || !filename)
+		return -pte_internal;
+
+	memset(file, 0, sizeof(*file));
+
+	errcode = -pte_not_supported;
+#if defined(_POSIX_C_SOURCE)
+	errcode = ptb_map(file, filename);
+#endif /* defined(_POSIX_C_SOURCE) */
+	if (errcode < 0) {
+		errcode = ptb_load(file, filename);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	if (file->size < sizeof(file->header)) {
+		errcode = -pte_bad_file;
+		goto err;
+	}
+
+	memcpy(&file->header, file->content, sizeof(file->header));
+
+	errcode = ptb_check_header(&file->header);
+	if (errcode < 0)
+		goto err;
+
+	file->begin = file->content + sizeof(file->header);
+	file->nrecords = (file->size - sizeof(file->header)) /
+		file->header.rsize;
+
+	return 0;
+
+err:
+	ptb_unload(file);
+	memset(file, 0, sizeof(*file));
+
+	return errcode;
+}
+
+void ptb_close(struct ptb_file *file)
+{
+	if (!file || !file->content)
+		return;
+
+	ptb_unload(file);
+	memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "ptbin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Write @size bytes of @buffer to a new temporary file.
+ *
+ * The caller needs to remove and free @filename after use.
+ */
+static struct ptunit_result write_file(char **filename, const void *buffer,
+				       size_t size)
+{
+	FILE *file;
+	size_t written;
+	int errcode;
+
+	errcode = ptunit_mkfile(&file, filename, "wb");
+	ptu_int_eq(errcode, 0);
+
+	written = size ? fwrite(buffer, size, 1u, file) : 1u;
+	fclose(file);
+
+	ptu_uint_eq(written, 1u);
+
+	return ptu_passed();
+}
+
+static void init_header(struct ptb_header *header, uint8_t kind,
+			uint8_t flags, uint32_t rsize)
+{
+	memset(header, 0, sizeof(*header));
+	header->magic = ptb_magic;
+	header->version = ptb_version;
+	header->kind = kind;
+	header->flags = flags;
+	header->rsize = rsize;
+}
+
+static struct ptunit_result open_null(void)
+{
+	struct ptb_file file;
+	int errcode;
+
+	errcode = ptb_open(NULL, "foo");
+	ptu_int_eq(errcode, -pte_internal);
+
+	errcode = ptb_open(&file, NULL);
+	ptu_int_eq(errcode, -pte_internal);
+
+	ptb_close(NULL);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result open_bad_header(uint32_t magic, uint16_t version,
+					    uint8_t kind, uint8_t flags,
+					    uint32_t rsize, int expected)
+{
+	struct ptb_header header;
+	struct ptb_file file;
+	char *filename;
+	int errcode;
+
+	init_header(&header, kind, flags, rsize);
+	header.magic = magic;
+	header.version = version;
+
+	ptu_test(write_file, &filename, &header, sizeof(header));
+
+	errcode = ptb_open(&file, filename);
+	ptu_int_eq(errcode, expected);
+
+	remove(filename);
+	free(filename);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result open_truncated_header(void)
+{
+	struct ptb_header header;
+	struct ptb_file file;
+	char *filename;
+	int errcode;
+
+	init_header(&header, ptbk_insn, 0, sizeof(struct ptb_insn));
+
+	ptu_test(write_file, &filename, &header, sizeof(header) - 1);
+
+	errcode = ptb_open(&file, filename);
+	ptu_int_eq(errcode, -pte_bad_file);
+
+	remove(filename);
+	free(filename);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result open_empty(void)
+{
+	struct ptb_header header;
+	struct ptb_file file;
+	char *filename;
+	uint64_t time;
+	int errcode;
+
+	init_header(&header, ptbk_insn, 0, sizeof(struct ptb_insn));
+
+	ptu_test(write_file, &filename, &header, sizeof(header));
+
+	errcode = ptb_open(&file, filename);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(ptb_nrecords(&file), 0ull);
+	ptu_null(ptb_insn(&file, 0ull));
+	ptu_null(ptb_block(&file, 0ull));
+
+	errcode = ptb_time(&file, 0ull, &time);
+	ptu_int_eq(errcode, -pte_no_time);
+
+	ptb_close(&file);
+
+	remove(filename);
+	free(filename);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_insn(void)
+{
+	struct {
+		struct ptb_header header;
+		struct ptb_insn insn[3];
+	} content;
+	const struct ptb_insn *insn;
+	struct ptb_file file;
+	char *filename;
+	uint64_t idx;
+	int errcode;
+
+	memset(&content, 0, sizeof(content));
+	init_header(&content.header, ptbk_insn, 0, sizeof(struct ptb_insn));
+
+	for (idx = 0; idx < 3; ++idx) {
+		content.insn[idx].ip = 0x1000ull + idx;
+		content.insn[idx].size = (uint8_t) (idx + 1);
+		content.insn[idx].iclass = ptic_other;
+		content.insn[idx].mode = ptem_64bit;
+	}
+	content.insn[1].flags = ptbr_speculative;
+
+	/* Leave out half of the last record. */
+	ptu_test(write_file, &filename, &content,
+		 sizeof(content) - (sizeof(struct ptb_insn) / 2));
+
+	errcode = ptb_open(&file, filename);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(ptb_nrecords(&file), 2ull);
+	ptu_null(ptb_block(&file, 0ull));
+	ptu_null(ptb_insn(&file, 2ull));
+
+	for (idx = 0; idx < 2; ++idx) {
+		insn = ptb_insn(&file, idx);
+		ptu_ptr(insn);
+		ptu_uint_eq(insn->ip, 0x1000ull + idx);
+		ptu_uint_eq(insn->size, idx + 1);
+		ptu_uint_eq(insn->iclass, ptic_other);
+		ptu_uint_eq(insn->mode, ptem_64bit);
+		ptu_uint_eq(insn->flags, idx ? ptbr_speculative : 0);
+	}
+
+	ptb_close(&file);
+
+	remove(filename);
+	free(filename);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result read_block_time(void)
+{
+	struct record {
+		struct ptb_block block;
+		uint64_t time;
+	};
+	struct {
+		struct ptb_header header;
+		struct record record[2];
+	} content;
+	const struct ptb_block *block;
+	struct ptb_file file;
+	char *filename;
+	uint64_t idx, time;
+	int errcode;
+
+	memset(&content, 0, sizeof(content));
+	init_header(&content.header, ptbk_block, ptbf_time,
+		    sizeof(struct record));
+
+	for (idx = 0; idx < 2; ++idx) {
+		content.record[idx].block.ip = 0x1000ull * (idx + 1);
+		content.record[idx].block.end_ip = content.record[idx].block.ip
+			+ 0x10ull;
+		content.record[idx].block.ninsn = (uint32_t) (idx + 4);
+		content.record[idx].block.iclass = ptic_jump;
+		content.record[idx].block.mode = ptem_32bit;
+		content.record[idx].time = 0xa000ull + idx;
+	}
+
+	ptu_test(write_file, &filename, &content, sizeof(content));
+
+	errcode = ptb_open(&file, filename);
+	ptu_int_eq(errcode, 0);
+	ptu_uint_eq(ptb_nrecords(&file), 2ull);
+	ptu_null(ptb_insn(&file, 0ull));
+
+	for (idx = 0; idx < 2; ++idx) {
+		block = ptb_block(&file, idx);
+		ptu_ptr(block);
+		ptu_uint_eq(block->ip, 0x1000ull * (idx + 1));
+		ptu_uint_eq(block->end_ip, block->ip + 0x10ull);
+		ptu_uint_eq(block->ninsn, idx + 4);
+		ptu_uint_eq(block->iclass, ptic_jump);
+		ptu_uint_eq(block->mode, ptem_32bit);
+
+		errcode = ptb_time(&file, idx, &time);
+		ptu_int_eq(errcode, 0);
+		ptu_uint_eq(time, 0xa000ull + idx);
+	}
+
+	errcode = ptb_time(&file, 2ull, &time);
+	ptu_int_eq(errcode, -pte_eos);
+
+	ptb_close(&file);
+
+	remove(filename);
+	free(filename);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct ptunit_suite suite;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run(suite, open_null);
+	ptu_run(suite, open_truncated_header);
+	ptu_run_p(suite, open_bad_header, 0u, ptb_version, ptbk_insn, 0,
+		  sizeof(struct ptb_insn), -pte_bad_file);
+	ptu_run_p(suite, open_bad_header, ptb_magic, ptb_version + 1,
+		  ptbk_insn, 0, sizeof(struct ptb_insn), -pte_bad_config);
+	ptu_run_p(suite, open_bad_header, ptb_magic, ptb_version, 0, 0,
+		  sizeof(struct ptb_insn), -pte_bad_config);
+	ptu_run_p(suite, open_bad_header, ptb_magic, ptb_version, ptbk_insn,
+		  0x80, sizeof(struct ptb_insn), -pte_bad_config);
+	ptu_run_p(suite, open_bad_header, ptb_magic, ptb_version, ptbk_insn,
+		  ptbf_time, sizeof(struct ptb_insn), -pte_bad_config);
+	ptu_run_p(suite, open_bad_header, ptb_magic, ptb_version, ptbk_block,
+		  0, sizeof(struct ptb_block) + 4, -pte_bad_config);
+	ptu_run(suite, open_empty);
+	ptu_run(suite, read_insn);
+	ptu_run(suite, read_block_time);
+
+	return ptunit_report(&suite);
+}
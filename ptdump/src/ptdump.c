@@ -26,6 +26,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#if defined(__linux__)
+/* We need MADV_HUGEPAGE for mapping the trace. */
+#  define _DEFAULT_SOURCE
+#endif
+
 #include "pt_cpu.h"
 #include "pt_last_ip.h"
 #include "pt_time.h"
@@ -45,16 +50,38 @@
 #include <errno.h>
 #include <limits.h>
 
+#if defined(_POSIX_C_SOURCE)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER < 1900)
 #  define snprintf _snprintf_c
 #endif
 
 
+enum {
+	/* The number of packets we decode at a time. */
+	ptdump_batch_size	= 64
+};
+
 struct ptdump_options {
 #if defined(FEATURE_SIDEBAND)
 	/* Sideband dump flags. */
 	uint32_t sb_dump_flags;
 #endif
+	/* The PSB index file - NULL if none. */
+	const char *index;
+
+	/* The TSC range to dump - [tsc_begin; tsc_end). */
+	uint64_t tsc_begin;
+	uint64_t tsc_end;
+
+	/* The offset of the PSB to start dumping at. */
+	uint64_t sync_offset;
+
 	/* Show the current offset in the trace stream. */
 	uint32_t show_offset:1;
 
@@ -88,6 +115,12 @@ struct ptdump_options {
 	/* Do not try to sync the decoder. */
 	uint32_t no_sync:1;
 
+	/* Only dump the trace around the TSC range. */
+	uint32_t tsc_range:1;
+
+	/* Sync the decoder at the PSB at sync_offset. */
+	uint32_t sync_set:1;
+
 	/* Do not calibrate timing. */
 	uint32_t no_tcal:1;
 
@@ -213,6 +246,9 @@ static int help(const char *name)
 	printf("  --no-tcal                 skip timing calibration.\n");
 	printf("                            this will result in errors when CYC packets are encountered.\n");
 	printf("  --no-wall-clock           suppress the no-time error and print relative time.\n");
+	printf("  --index <file>            read the PSB index from <file>.\n");
+	printf("                            if <file> is missing or stale, index the trace and write the index to <file>.\n");
+	printf("  --tsc-range <from>[-<to>] only dump the trace between the PSBs around the TSC range.\n");
 #if defined(FEATURE_SIDEBAND)
 	printf("  --sb:compact | --sb       show sideband records in compact format.\n");
 	printf("  --sb:verbose              show sideband records in verbose format.\n");
@@ -450,23 +486,158 @@ err_file:
 	return -1;
 }
 
-static int load_pt(struct pt_config *config, const char *filename,
-		   uint64_t foffset, uint64_t fsize, const char *prog)
+#if defined(_POSIX_C_SOURCE)
+
+/* Map @size bytes at @offset of @filename.
+ *
+ * If @size is zero, map the rest of the file.
+ *
+ * The trace is decoded front to back so we tell the kernel to read ahead
+ * aggressively.  We further ask for transparent huge pages to reduce TLB
+ * pressure.
+ *
+ * This does not print diagnostics.  The caller is expected to fall back to
+ * load_file(), which reports errors.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int map_file(uint8_t **buffer, size_t *psize, const char *filename,
+		    uint64_t offset, uint64_t size)
+{
+	struct stat info;
+	uint64_t begin, end;
+	uint8_t *base;
+	size_t length;
+	long pgsize;
+	int fd, errcode;
+
+	if (!buffer || !psize || !filename)
+		return -pte_internal;
+
+	pgsize = sysconf(_SC_PAGESIZE);
+	if (pgsize <= 0)
+		return -pte_not_supported;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -pte_bad_file;
+
+	errcode = fstat(fd, &info);
+	if (errcode || !S_ISREG(info.st_mode) || (info.st_size <= 0)) {
+		close(fd);
+		return -pte_bad_file;
+	}
+
+	end = (uint64_t) info.st_size;
+	if (end <= offset) {
+		close(fd);
+		return -pte_invalid;
+	}
+
+	if (size) {
+		if ((end - offset) < size) {
+			close(fd);
+			return -pte_invalid;
+		}
+
+		end = offset + size;
+	}
+
+	/* The mapping must start at a page boundary. */
+	begin = offset & ~((uint64_t) pgsize - 1ull);
+
+	length = (size_t) (end - begin);
+	if ((uint64_t) length != (end - begin)) {
+		close(fd);
+		return -pte_nomem;
+	}
+
+	base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, (off_t) begin);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return -pte_nomem;
+
+	/* The advice is just a hint.  We ignore errors. */
+	(void) posix_madvise(base, length, POSIX_MADV_SEQUENTIAL);
+
+#if defined(MADV_HUGEPAGE)
+	(void) madvise(base, length, MADV_HUGEPAGE);
+#endif
+
+	*buffer = base + (offset - begin);
+	*psize = (size_t) (end - offset);
+
+	return 0;
+}
+
+/* Unmap a buffer provided by map_file(). */
+static void unmap_file(uint8_t *begin, uint8_t *end)
+{
+	uint8_t *base;
+	long pgsize;
+
+	pgsize = sysconf(_SC_PAGESIZE);
+	if (pgsize <= 0)
+		return;
+
+	base = (uint8_t *) ((uintptr_t) begin & ~((uintptr_t) pgsize - 1));
+
+	(void) munmap(base, (size_t) (end - base));
+}
+
+#endif /* defined(_POSIX_C_SOURCE) */
+
+static int load_pt(struct pt_config *config, int *mapped,
+		   const char *filename, uint64_t foffset, uint64_t fsize,
+		   const char *prog)
 {
 	uint8_t *buffer;
 	size_t size;
 	int errcode;
 
+	if (!mapped)
+		return -pte_internal;
+
+#if defined(_POSIX_C_SOURCE)
+	errcode = map_file(&buffer, &size, filename, foffset, fsize);
+	if (errcode >= 0) {
+		config->begin = buffer;
+		config->end = buffer + size;
+		*mapped = 1;
+
+		return 0;
+	}
+#endif /* defined(_POSIX_C_SOURCE) */
+
 	errcode = load_file(&buffer, &size, filename, foffset, fsize, prog);
 	if (errcode < 0)
 		return errcode;
 
 	config->begin = buffer;
 	config->end = buffer + size;
+	*mapped = 0;
 
 	return 0;
 }
 
+static void unload_pt(struct pt_config *config, int mapped)
+{
+	if (!config)
+		return;
+
+#if defined(_POSIX_C_SOURCE)
+	if (mapped) {
+		unmap_file(config->begin, config->end);
+		return;
+	}
+#else
+	(void) mapped;
+#endif /* defined(_POSIX_C_SOURCE) */
+
+	free(config->begin);
+}
+
 static int diag(const char *errstr, uint64_t offset, int errcode)
 {
 	if (errcode)
@@ -1370,29 +1541,35 @@ static int dump_packets(struct pt_packet_decoder *decoder,
 			const struct ptdump_options *options,
 			const struct pt_config *config)
 {
-	uint64_t offset;
-	int errcode;
+	struct pt_packet packets[ptdump_batch_size];
+	uint64_t offsets[ptdump_batch_size];
 
-	offset = 0ull;
 	for (;;) {
-		struct pt_packet packet;
-
-		errcode = pt_pkt_get_offset(decoder, &offset);
-		if (errcode < 0)
-			return diag("error getting offset", offset, errcode);
-
-		errcode = pt_pkt_next(decoder, &packet, sizeof(packet));
-		if (errcode < 0) {
-			if (errcode == -pte_eos)
+		uint64_t offset;
+		int errcode, npackets, idx;
+
+		npackets = pt_pkt_next_batch(decoder, packets, offsets,
+					     ptdump_batch_size,
+					     sizeof(*packets));
+		if (npackets < 0) {
+			if (npackets == -pte_eos)
 				return 0;
 
-			return diag("error decoding packet", offset, errcode);
+			offset = 0ull;
+			errcode = pt_pkt_get_offset(decoder, &offset);
+			if (errcode < 0)
+				return diag("error getting offset", offset,
+					    errcode);
+
+			return diag("error decoding packet", offset, npackets);
 		}
 
-		errcode = dump_one_packet(offset, &packet, tracking, options,
-					  config);
-		if (errcode < 0)
-			return errcode;
+		for (idx = 0; idx < npackets; ++idx) {
+			errcode = dump_one_packet(offsets[idx], &packets[idx],
+						  tracking, options, config);
+			if (errcode < 0)
+				return errcode;
+		}
 	}
 }
 
@@ -1410,6 +1587,15 @@ static int dump_sync(struct pt_packet_decoder *decoder,
 		errcode = pt_pkt_sync_set(decoder, 0ull);
 		if (errcode < 0)
 			return diag("sync error", 0ull, errcode);
+	} else if (options->sync_set) {
+		errcode = pt_pkt_sync_set(decoder, options->sync_offset);
+		if (errcode < 0) {
+			if (errcode == -pte_eos)
+				return 0;
+
+			return diag("sync error", options->sync_offset,
+				    errcode);
+		}
 	} else {
 		errcode = pt_pkt_sync_forward(decoder);
 		if (errcode < 0) {
@@ -1467,6 +1653,140 @@ static int dump(struct ptdump_tracking *tracking,
 	return 0;
 }
 
+/* Read or build the PSB index for the trace in @config.
+ *
+ * If @filename is not NULL, try to read the index from @filename.  If the file
+ * does not exist or holds a stale index, build the index and write it to
+ * @filename.  Other files are not overwritten.
+ */
+static int load_index(struct pt_psb_index *index,
+		      const struct pt_config *config, const char *filename,
+		      const char *prog)
+{
+	int errcode;
+
+	if (filename) {
+		FILE *file;
+
+		errcode = pt_psb_index_read(index, filename, config);
+		if (errcode >= 0)
+			return 0;
+
+		switch (pt_errcode(errcode)) {
+		case pte_bad_config:
+			fprintf(stderr, "%s: warning: %s indexes a different "
+				"trace.  Rebuilding it.\n", prog, filename);
+			break;
+
+		case pte_not_supported:
+			fprintf(stderr, "%s: warning: %s has an unsupported "
+				"format.  Rebuilding it.\n", prog, filename);
+			break;
+
+		default:
+			file = fopen(filename, "rb");
+			if (file) {
+				fclose(file);
+
+				fprintf(stderr, "%s: failed to read %s: %s.\n",
+					prog, filename,
+					pt_errstr(pt_errcode(errcode)));
+				return errcode;
+			}
+
+			break;
+		}
+	}
+
+	errcode = pt_psb_index_build(index, config);
+	if (errcode < 0) {
+		fprintf(stderr, "%s: failed to index the trace: %s.\n", prog,
+			pt_errstr(pt_errcode(errcode)));
+		return errcode;
+	}
+
+	if (filename) {
+		errcode = pt_psb_index_write(index, filename);
+		if (errcode < 0) {
+			fprintf(stderr, "%s: failed to write %s: %s.\n", prog,
+				filename, pt_errstr(pt_errcode(errcode)));
+			return errcode;
+		}
+	}
+
+	return 0;
+}
+
+/* Restrict @config to the trace between the PSBs around the TSC range in
+ * @options and set @options' sync offset to the first of those PSBs.
+ */
+static int apply_tsc_range(struct pt_config *config,
+			   struct ptdump_options *options,
+			   const struct pt_psb_index *index, const char *prog)
+{
+	struct pt_psb_entry entry;
+	int status;
+
+	/* Start at the last PSB before the range or at the very first PSB if
+	 * the trace starts inside the range.
+	 */
+	status = pt_psb_index_find_tsc(index, &entry, sizeof(entry),
+				       options->tsc_begin);
+	if (status == -pte_eos)
+		status = pt_psb_index_get(index, &entry, sizeof(entry), 0);
+
+	if (status < 0) {
+		fprintf(stderr, "%s: --tsc-range: %s.\n", prog,
+			pt_errstr(pt_errcode(status)));
+		return status;
+	}
+
+	options->sync_offset = entry.offset;
+	options->sync_set = 1;
+
+	/* Stop at the first PSB that gives a TSC at or behind the range. */
+	status = pt_psb_index_find_tsc(index, &entry, sizeof(entry),
+				       options->tsc_end);
+	if (status < 0)
+		status = 0;
+
+	for (;; ++status) {
+		if (pt_psb_index_get(index, &entry, sizeof(entry), status) < 0)
+			return 0;
+
+		if (entry.has_tsc && (options->tsc_end <= entry.tsc))
+			break;
+	}
+
+	config->end = config->begin + entry.offset;
+
+	return 0;
+}
+
+static int ptdump_index(struct pt_config *config,
+			struct ptdump_options *options, const char *prog)
+{
+	struct pt_psb_index *index;
+	int errcode;
+
+	if (!options->index && !options->tsc_range)
+		return 0;
+
+	index = pt_psb_index_alloc();
+	if (!index) {
+		fprintf(stderr, "%s: failed to allocate index.\n", prog);
+		return -pte_nomem;
+	}
+
+	errcode = load_index(index, config, options->index, prog);
+	if ((errcode >= 0) && options->tsc_range)
+		errcode = apply_tsc_range(config, options, index, prog);
+
+	pt_psb_index_free(index);
+
+	return errcode;
+}
+
 #if defined(FEATURE_SIDEBAND)
 
 static int ptdump_print_error(int errcode, const char *filename,
@@ -1722,6 +2042,28 @@ static int process_args(int argc, char *argv[],
 			options->no_tcal = 1;
 		else if (strcmp(argv[idx], "--no-wall-clock") == 0)
 			options->no_wall_clock = 1;
+		else if (strcmp(argv[idx], "--index") == 0) {
+			options->index = argv[++idx];
+			if (!options->index) {
+				fprintf(stderr,
+					"%s: --index: missing argument.\n",
+					argv[0]);
+				return -1;
+			}
+		} else if (strcmp(argv[idx], "--tsc-range") == 0) {
+			options->tsc_end = UINT64_MAX;
+
+			errcode = parse_range(argv[++idx], &options->tsc_begin,
+					      &options->tsc_end);
+			if (errcode <= 0) {
+				fprintf(stderr,
+					"%s: --tsc-range: bad argument: %s.\n",
+					argv[0], argv[idx] ? argv[idx] : "");
+				return -1;
+			}
+
+			options->tsc_range = 1;
+		}
 #if defined(FEATURE_SIDEBAND)
 		else if ((strcmp(argv[idx], "--sb:compact") == 0) ||
 			 (strcmp(argv[idx], "--sb") == 0)) {
@@ -1874,12 +2216,13 @@ int main(int argc, char *argv[])
 {
 	struct ptdump_tracking tracking;
 	struct ptdump_options options;
-	struct pt_config config;
-	int errcode;
+	struct pt_config config, window;
+	int errcode, mapped;
 	char *ptfile;
 	uint64_t pt_offset, pt_size;
 
 	ptfile = NULL;
+	mapped = 0;
 
 	memset(&options, 0, sizeof(options));
 	options.show_offset = 1;
@@ -1927,7 +2270,15 @@ int main(int argc, char *argv[])
 			diag("failed to determine errata", 0ull, errcode);
 	}
 
-	errcode = load_pt(&config, ptfile, pt_offset, pt_size, argv[0]);
+	errcode = load_pt(&config, &mapped, ptfile, pt_offset, pt_size,
+			  argv[0]);
+	if (errcode < 0)
+		goto out;
+
+	/* We may restrict the trace we dump.  Keep @config for unloading. */
+	window = config;
+
+	errcode = ptdump_index(&window, &options, argv[0]);
 	if (errcode < 0)
 		goto out;
 
@@ -1941,10 +2292,10 @@ int main(int argc, char *argv[])
 	}
 #endif /* defined(FEATURE_SIDEBAND) */
 
-	errcode = dump(&tracking, &config, &options);
+	errcode = dump(&tracking, &window, &options);
 
 out:
-	free(config.begin);
+	unload_pt(&config, mapped);
 	ptdump_tracking_fini(&tracking);
 
 	return -errcode;
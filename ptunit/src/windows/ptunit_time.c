@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit_time.h"
+
+#include "intel-pt.h"
+
+#include <windows.h>
+
+
+int ptunit_time(uint64_t *ns)
+{
+	LARGE_INTEGER count, frequency;
+	uint64_t sec, rem;
+
+	if (!ns)
+		return -pte_internal;
+
+	if (!QueryPerformanceFrequency(&frequency) || !frequency.QuadPart)
+		return -pte_not_supported;
+
+	if (!QueryPerformanceCounter(&count))
+		return -pte_not_supported;
+
+	/* Split the computation to avoid overflowing the multiplication. */
+	sec = (uint64_t) count.QuadPart / (uint64_t) frequency.QuadPart;
+	rem = (uint64_t) count.QuadPart % (uint64_t) frequency.QuadPart;
+
+	*ns = (sec * 1000000000ull) +
+		((rem * 1000000000ull) / (uint64_t) frequency.QuadPart);
+
+	return 0;
+}
@@ -26,6 +26,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#if defined(__linux__)
+/* We need MADV_HUGEPAGE for mapping the trace. */
+#  define _DEFAULT_SOURCE
+#endif
+
 #if defined(FEATURE_ELF)
 # include "load_elf.h"
 #endif /* defined(FEATURE_ELF) */
@@ -33,6 +38,7 @@
 #include "pt_cpu.h"
 
 #include "intel-pt.h"
+#include "ptbin.h"
 
 #if defined(FEATURE_SIDEBAND)
 #  include "libipt-sb.h"
@@ -44,15 +50,48 @@
 #include <inttypes.h>
 #include <errno.h>
 
+#if defined(_POSIX_C_SOURCE)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 #include <xed-interface.h>
 
 
+enum {
+	/* The size of the binary output buffer in bytes. */
+	ptxed_bin_buffer_size	= 1 << 20
+};
+
 /* The type of decoder to be used. */
 enum ptxed_decoder_type {
 	pdt_insn_decoder,
 	pdt_block_decoder
 };
 
+/* A buffered writer for binary output. */
+struct ptxed_bin {
+	/* The output file - NULL if closed. */
+	FILE *file;
+
+	/* The output buffer. */
+	uint8_t *buffer;
+
+	/* The number of bytes in @buffer. */
+	size_t pos;
+
+	/* The size of a record in bytes. */
+	size_t rsize;
+
+	/* The first error writing @file. */
+	int errcode;
+
+	/* Append a timestamp to each record. */
+	uint32_t time:1;
+};
+
 /* The decoder to use. */
 struct ptxed_decoder {
 	/* The decoder type. */
@@ -70,6 +109,9 @@ struct ptxed_decoder {
 	/* The image section cache. */
 	struct pt_image_section_cache *iscache;
 
+	/* The binary output. */
+	struct ptxed_bin bin;
+
 #if defined(FEATURE_SIDEBAND)
 	/* The sideband session. */
 	struct pt_sb_session *session;
@@ -87,6 +129,19 @@ struct ptxed_options {
 	/* Sideband dump flags. */
 	uint32_t sb_dump_flags;
 #endif
+	/* The PSB index file - NULL if none. */
+	const char *index;
+
+	/* The binary output file - NULL if none. */
+	const char *output;
+
+	/* The TSC range to decode - [tsc_begin; tsc_end). */
+	uint64_t tsc_begin;
+	uint64_t tsc_end;
+
+	/* The offset of the PSB to start decoding at. */
+	uint64_t sync_offset;
+
 	/* Do not print the instruction. */
 	uint32_t dont_print_insn:1;
 
@@ -129,6 +184,15 @@ struct ptxed_options {
 	/* Request tick events. */
 	uint32_t enable_tick_events:1;
 
+	/* Only decode the trace around the TSC range. */
+	uint32_t tsc_range:1;
+
+	/* Sync the decoder at the PSB at sync_offset. */
+	uint32_t sync_set:1;
+
+	/* Write binary records instead of printing instructions. */
+	uint32_t bin_format:1;
+
 #if defined(FEATURE_SIDEBAND)
 	/* Print sideband warnings. */
 	uint32_t print_sb_warnings:1;
@@ -141,7 +205,10 @@ enum ptxed_stats_flag {
 	ptxed_stat_insn		= (1 << 0),
 
 	/* Collect number of blocks. */
-	ptxed_stat_blocks	= (1 << 1)
+	ptxed_stat_blocks	= (1 << 1),
+
+	/* Collect section cache hits and misses. */
+	ptxed_stat_scache	= (1 << 2)
 };
 
 /* A collection of statistics. */
@@ -155,10 +222,188 @@ struct ptxed_stats {
 	 */
 	uint64_t blocks;
 
+	/* The decoder's section cache statistics. */
+	struct pt_scache_stats scache;
+
 	/* A collection of flags saying which statistics to collect/print. */
 	uint32_t flags;
 };
 
+static int ptxed_bin_open(struct ptxed_bin *bin, const char *filename,
+			  enum ptb_kind kind, int time)
+{
+	struct ptb_header header;
+	size_t rsize;
+
+	if (!bin || !filename)
+		return -pte_internal;
+
+	switch (kind) {
+	case ptbk_insn:
+		rsize = sizeof(struct ptb_insn);
+		break;
+
+	case ptbk_block:
+		rsize = sizeof(struct ptb_block);
+		break;
+
+	default:
+		return -pte_internal;
+	}
+
+	if (time)
+		rsize += sizeof(uint64_t);
+
+	bin->buffer = malloc(ptxed_bin_buffer_size);
+	if (!bin->buffer)
+		return -pte_nomem;
+
+	bin->file = fopen(filename, "wb");
+	if (!bin->file) {
+		free(bin->buffer);
+		bin->buffer = NULL;
+
+		return -pte_bad_file;
+	}
+
+	/* We do our own buffering. */
+	(void) setvbuf(bin->file, NULL, _IONBF, 0);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = ptb_magic;
+	header.version = ptb_version;
+	header.kind = (uint8_t) kind;
+	header.flags = time ? ptbf_time : 0;
+	header.rsize = (uint32_t) rsize;
+
+	memcpy(bin->buffer, &header, sizeof(header));
+
+	bin->pos = sizeof(header);
+	bin->rsize = rsize;
+	bin->errcode = 0;
+	bin->time = time ? 1 : 0;
+
+	return 0;
+}
+
+static int ptxed_bin_flush(struct ptxed_bin *bin)
+{
+	size_t written;
+
+	if (!bin->pos)
+		return 0;
+
+	written = fwrite(bin->buffer, bin->pos, 1u, bin->file);
+	bin->pos = 0;
+
+	if (written != 1u)
+		return -pte_bad_file;
+
+	return 0;
+}
+
+/* Flush and close @bin.
+ *
+ * Returns the first error writing @bin's file, if any.
+ */
+static int ptxed_bin_close(struct ptxed_bin *bin)
+{
+	int errcode, status;
+
+	if (!bin || !bin->file)
+		return 0;
+
+	errcode = ptxed_bin_flush(bin);
+	if (bin->errcode < 0)
+		errcode = bin->errcode;
+
+	status = fclose(bin->file);
+	if (status && (errcode >= 0))
+		errcode = -pte_bad_file;
+
+	free(bin->buffer);
+	memset(bin, 0, sizeof(*bin));
+
+	return errcode;
+}
+
+/* Reserve the next record in @bin's buffer.
+ *
+ * The record is zero-initialized.  Write errors are remembered and reported
+ * by ptxed_bin_close().
+ */
+static uint8_t *ptxed_bin_next(struct ptxed_bin *bin)
+{
+	uint8_t *record;
+
+	if ((ptxed_bin_buffer_size - bin->pos) < bin->rsize) {
+		int errcode;
+
+		errcode = ptxed_bin_flush(bin);
+		if ((errcode < 0) && (bin->errcode >= 0))
+			bin->errcode = errcode;
+	}
+
+	record = bin->buffer + bin->pos;
+	bin->pos += bin->rsize;
+
+	memset(record, 0, bin->rsize);
+
+	return record;
+}
+
+static void ptxed_bin_time(struct ptxed_bin *bin, uint8_t *record,
+			   uint64_t time)
+{
+	if (!bin->time)
+		return;
+
+	memcpy(record + bin->rsize - sizeof(time), &time, sizeof(time));
+}
+
+static void ptxed_bin_insn(struct ptxed_bin *bin, const struct pt_insn *insn,
+			   uint64_t time)
+{
+	struct ptb_insn *record;
+
+	record = (struct ptb_insn *) ptxed_bin_next(bin);
+
+	record->ip = insn->ip;
+	record->size = insn->size;
+	record->iclass = (uint8_t) insn->iclass;
+	record->mode = (uint8_t) insn->mode;
+
+	if (insn->speculative)
+		record->flags |= ptbr_speculative;
+
+	if (insn->truncated)
+		record->flags |= ptbr_truncated;
+
+	ptxed_bin_time(bin, (uint8_t *) record, time);
+}
+
+static void ptxed_bin_block(struct ptxed_bin *bin,
+			    const struct pt_block *block, uint64_t time)
+{
+	struct ptb_block *record;
+
+	record = (struct ptb_block *) ptxed_bin_next(bin);
+
+	record->ip = block->ip;
+	record->end_ip = block->end_ip;
+	record->ninsn = block->ninsn;
+	record->iclass = (uint8_t) block->iclass;
+	record->mode = (uint8_t) block->mode;
+
+	if (block->speculative)
+		record->flags |= ptbr_speculative;
+
+	if (block->truncated)
+		record->flags |= ptbr_truncated;
+
+	ptxed_bin_time(bin, (uint8_t *) record, time);
+}
+
 static int ptxed_have_decoder(const struct ptxed_decoder *decoder)
 {
 	/* It suffices to check for one decoder in the variant union. */
@@ -214,6 +459,7 @@ static void ptxed_free_decoder(struct ptxed_decoder *decoder)
 	pt_sb_free(decoder->session);
 #endif
 
+	(void) ptxed_bin_close(&decoder->bin);
 	pt_iscache_free(decoder->iscache);
 }
 
@@ -238,8 +484,15 @@ static void help(const char *name)
 	printf("  --offset                             print the offset into the trace file.\n");
 	printf("  --time                               print the current timestamp.\n");
 	printf("  --raw-insn                           print the raw bytes of each instruction.\n");
+	printf("  --format=text                        print instructions or blocks as text (default).\n");
+	printf("  --format=bin                         write binary instruction or block records to the --output file.\n");
+	printf("  --output <file>                      write binary records to <file> (requires --format=bin).\n");
 	printf("  --check                              perform checks (expensive).\n");
 	printf("  --iscache-limit <size>               set the image section cache limit to <size> bytes.\n");
+	printf("  --bcache-dir <dir>                   load and store block caches in <dir>.\n");
+	printf("  --index <file>                       read the PSB index from <file>.\n");
+	printf("                                       if <file> is missing or stale, index the trace and write the index to <file>.\n");
+	printf("  --tsc-range <from>[-<to>]            only decode the trace between the PSBs around the TSC range.\n");
 	printf("  --event:time                         print the tsc for events if available.\n");
 	printf("  --event:ip                           print the ip of events if available.\n");
 	printf("  --event:tick                         request tick events.\n");
@@ -249,6 +502,7 @@ static void help(const char *name)
 	printf("  --stat                               print statistics (even when quiet).\n");
 	printf("                                       collects all statistics unless one or more are selected.\n");
 	printf("  --stat:insn                          collect number of instructions.\n");
+	printf("  --stat:scache                        collect section cache hits and misses.\n");
 #if defined(FEATURE_SIDEBAND)
 	printf("  --sb:compact | --sb                  show sideband records in compact format.\n");
 	printf("  --sb:verbose                         show sideband records in verbose format.\n");
@@ -520,13 +774,119 @@ err_file:
 	return -1;
 }
 
-static int load_pt(struct pt_config *config, char *arg, const char *prog)
+#if defined(_POSIX_C_SOURCE)
+
+/* Map @size bytes at @offset of @filename.
+ *
+ * If @size is zero, map the rest of the file.
+ *
+ * The trace is decoded front to back so we tell the kernel to read ahead
+ * aggressively.  We further ask for transparent huge pages to reduce TLB
+ * pressure.
+ *
+ * This does not print diagnostics.  The caller is expected to fall back to
+ * load_file(), which reports errors.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int map_file(uint8_t **buffer, size_t *psize, const char *filename,
+		    uint64_t offset, uint64_t size)
+{
+	struct stat info;
+	uint64_t begin, end;
+	uint8_t *base;
+	size_t length;
+	long pgsize;
+	int fd, errcode;
+
+	if (!buffer || !psize || !filename)
+		return -pte_internal;
+
+	pgsize = sysconf(_SC_PAGESIZE);
+	if (pgsize <= 0)
+		return -pte_not_supported;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -pte_bad_file;
+
+	errcode = fstat(fd, &info);
+	if (errcode || !S_ISREG(info.st_mode) || (info.st_size <= 0)) {
+		close(fd);
+		return -pte_bad_file;
+	}
+
+	end = (uint64_t) info.st_size;
+	if (end <= offset) {
+		close(fd);
+		return -pte_invalid;
+	}
+
+	if (size) {
+		if ((end - offset) < size) {
+			close(fd);
+			return -pte_invalid;
+		}
+
+		end = offset + size;
+	}
+
+	/* The mapping must start at a page boundary. */
+	begin = offset & ~((uint64_t) pgsize - 1ull);
+
+	length = (size_t) (end - begin);
+	if ((uint64_t) length != (end - begin)) {
+		close(fd);
+		return -pte_nomem;
+	}
+
+	base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, (off_t) begin);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return -pte_nomem;
+
+	/* The advice is just a hint.  We ignore errors. */
+	(void) posix_madvise(base, length, POSIX_MADV_SEQUENTIAL);
+
+#if defined(MADV_HUGEPAGE)
+	(void) madvise(base, length, MADV_HUGEPAGE);
+#endif
+
+	*buffer = base + (offset - begin);
+	*psize = (size_t) (end - offset);
+
+	return 0;
+}
+
+/* Unmap a buffer provided by map_file(). */
+static void unmap_file(uint8_t *begin, uint8_t *end)
+{
+	uint8_t *base;
+	long pgsize;
+
+	pgsize = sysconf(_SC_PAGESIZE);
+	if (pgsize <= 0)
+		return;
+
+	base = (uint8_t *) ((uintptr_t) begin & ~((uintptr_t) pgsize - 1));
+
+	(void) munmap(base, (size_t) (end - base));
+}
+
+#endif /* defined(_POSIX_C_SOURCE) */
+
+static int load_pt(struct pt_config *config, int *mapped, char *arg,
+		   const char *prog)
 {
 	uint64_t foffset, fsize;
 	uint8_t *buffer;
 	size_t size;
 	int errcode;
 
+	if (!mapped)
+		return -pte_internal;
+
 	errcode = preprocess_filename(arg, &foffset, &fsize);
 	if (errcode < 0) {
 		fprintf(stderr, "%s: bad file %s: %s.\n", prog, arg,
@@ -534,16 +894,179 @@ static int load_pt(struct pt_config *config, char *arg, const char *prog)
 		return -1;
 	}
 
+#if defined(_POSIX_C_SOURCE)
+	errcode = map_file(&buffer, &size, arg, foffset, fsize);
+	if (errcode >= 0) {
+		config->begin = buffer;
+		config->end = buffer + size;
+		*mapped = 1;
+
+		return 0;
+	}
+#endif /* defined(_POSIX_C_SOURCE) */
+
 	errcode = load_file(&buffer, &size, arg, foffset, fsize, prog);
 	if (errcode < 0)
 		return errcode;
 
 	config->begin = buffer;
 	config->end = buffer + size;
+	*mapped = 0;
+
+	return 0;
+}
+
+static void unload_pt(struct pt_config *config, int mapped)
+{
+	if (!config)
+		return;
+
+#if defined(_POSIX_C_SOURCE)
+	if (mapped) {
+		unmap_file(config->begin, config->end);
+		return;
+	}
+#else
+	(void) mapped;
+#endif /* defined(_POSIX_C_SOURCE) */
+
+	free(config->begin);
+}
+
+/* Read or build the PSB index for the trace in @config.
+ *
+ * If @filename is not NULL, try to read the index from @filename.  If the file
+ * does not exist or holds a stale index, build the index and write it to
+ * @filename.  Other files are not overwritten.
+ */
+static int load_index(struct pt_psb_index *index,
+		      const struct pt_config *config, const char *filename,
+		      const char *prog)
+{
+	int errcode;
+
+	if (filename) {
+		FILE *file;
+
+		errcode = pt_psb_index_read(index, filename, config);
+		if (errcode >= 0)
+			return 0;
+
+		switch (pt_errcode(errcode)) {
+		case pte_bad_config:
+			fprintf(stderr, "%s: warning: %s indexes a different "
+				"trace.  Rebuilding it.\n", prog, filename);
+			break;
+
+		case pte_not_supported:
+			fprintf(stderr, "%s: warning: %s has an unsupported "
+				"format.  Rebuilding it.\n", prog, filename);
+			break;
+
+		default:
+			file = fopen(filename, "rb");
+			if (file) {
+				fclose(file);
+
+				fprintf(stderr, "%s: failed to read %s: %s.\n",
+					prog, filename,
+					pt_errstr(pt_errcode(errcode)));
+				return errcode;
+			}
+
+			break;
+		}
+	}
+
+	errcode = pt_psb_index_build(index, config);
+	if (errcode < 0) {
+		fprintf(stderr, "%s: failed to index the trace: %s.\n", prog,
+			pt_errstr(pt_errcode(errcode)));
+		return errcode;
+	}
+
+	if (filename) {
+		errcode = pt_psb_index_write(index, filename);
+		if (errcode < 0) {
+			fprintf(stderr, "%s: failed to write %s: %s.\n", prog,
+				filename, pt_errstr(pt_errcode(errcode)));
+			return errcode;
+		}
+	}
 
 	return 0;
 }
 
+/* Restrict @config to the trace between the PSBs around the TSC range in
+ * @options and set @options' sync offset to the first of those PSBs.
+ */
+static int apply_tsc_range(struct pt_config *config,
+			   struct ptxed_options *options,
+			   const struct pt_psb_index *index, const char *prog)
+{
+	struct pt_psb_entry entry;
+	int status;
+
+	/* Start at the last PSB before the range or at the very first PSB if
+	 * the trace starts inside the range.
+	 */
+	status = pt_psb_index_find_tsc(index, &entry, sizeof(entry),
+				       options->tsc_begin);
+	if (status == -pte_eos)
+		status = pt_psb_index_get(index, &entry, sizeof(entry), 0);
+
+	if (status < 0) {
+		fprintf(stderr, "%s: --tsc-range: %s.\n", prog,
+			pt_errstr(pt_errcode(status)));
+		return status;
+	}
+
+	options->sync_offset = entry.offset;
+	options->sync_set = 1;
+
+	/* Stop at the first PSB that gives a TSC at or behind the range. */
+	status = pt_psb_index_find_tsc(index, &entry, sizeof(entry),
+				       options->tsc_end);
+	if (status < 0)
+		status = 0;
+
+	for (;; ++status) {
+		if (pt_psb_index_get(index, &entry, sizeof(entry), status) < 0)
+			return 0;
+
+		if (entry.has_tsc && (options->tsc_end <= entry.tsc))
+			break;
+	}
+
+	config->end = config->begin + entry.offset;
+
+	return 0;
+}
+
+static int ptxed_index(struct pt_config *config,
+		       struct ptxed_options *options, const char *prog)
+{
+	struct pt_psb_index *index;
+	int errcode;
+
+	if (!options->index && !options->tsc_range)
+		return 0;
+
+	index = pt_psb_index_alloc();
+	if (!index) {
+		fprintf(stderr, "%s: failed to allocate index.\n", prog);
+		return -pte_nomem;
+	}
+
+	errcode = load_index(index, config, options->index, prog);
+	if ((errcode >= 0) && options->tsc_range)
+		errcode = apply_tsc_range(config, options, index, prog);
+
+	pt_psb_index_free(index);
+
+	return errcode;
+}
+
 static int load_raw(struct pt_image_section_cache *iscache,
 		    struct pt_image *image, char *arg, const char *prog)
 {
@@ -1237,6 +1760,7 @@ static void decode_insn(struct ptxed_decoder *decoder,
 	struct pt_insn_decoder *ptdec;
 	xed_state_t xed;
 	uint64_t offset, sync, time;
+	int synced;
 
 	if (!decoder || !options) {
 		printf("[internal error]\n");
@@ -1249,6 +1773,7 @@ static void decode_insn(struct ptxed_decoder *decoder,
 	offset = 0ull;
 	sync = 0ull;
 	time = 0ull;
+	synced = 0;
 	for (;;) {
 		struct pt_insn insn;
 		int status;
@@ -1256,7 +1781,12 @@ static void decode_insn(struct ptxed_decoder *decoder,
 		/* Initialize the IP - we use it for error reporting. */
 		insn.ip = 0ull;
 
-		status = pt_insn_sync_forward(ptdec);
+		if (options->sync_set && !synced)
+			status = pt_insn_sync_set(ptdec, options->sync_offset);
+		else
+			status = pt_insn_sync_forward(ptdec);
+
+		synced = 1;
 		if (status < 0) {
 			uint64_t new_sync;
 			int errcode;
@@ -1309,7 +1839,10 @@ static void decode_insn(struct ptxed_decoder *decoder,
 				 * in decoding the current instruction.
 				 */
 				if (insn.iclass != ptic_error) {
-					if (!options->quiet)
+					if (options->bin_format)
+						ptxed_bin_insn(&decoder->bin,
+							       &insn, time);
+					else if (!options->quiet)
 						print_insn(&insn, &xed, options,
 							   offset, time);
 					if (stats)
@@ -1321,7 +1854,9 @@ static void decode_insn(struct ptxed_decoder *decoder,
 				break;
 			}
 
-			if (!options->quiet)
+			if (options->bin_format)
+				ptxed_bin_insn(&decoder->bin, &insn, time);
+			else if (!options->quiet)
 				print_insn(&insn, &xed, options, offset, time);
 
 			if (stats)
@@ -1680,6 +2215,7 @@ static void decode_block(struct ptxed_decoder *decoder,
 	struct pt_image_section_cache *iscache;
 	struct pt_block_decoder *ptdec;
 	uint64_t offset, sync, time;
+	int synced;
 
 	if (!decoder || !options) {
 		printf("[internal error]\n");
@@ -1691,6 +2227,7 @@ static void decode_block(struct ptxed_decoder *decoder,
 	offset = 0ull;
 	sync = 0ull;
 	time = 0ull;
+	synced = 0;
 	for (;;) {
 		struct pt_block block;
 		int status;
@@ -1699,7 +2236,12 @@ static void decode_block(struct ptxed_decoder *decoder,
 		block.ip = 0ull;
 		block.ninsn = 0u;
 
-		status = pt_blk_sync_forward(ptdec);
+		if (options->sync_set && !synced)
+			status = pt_blk_sync_set(ptdec, options->sync_offset);
+		else
+			status = pt_blk_sync_forward(ptdec);
+
+		synced = 1;
 		if (status < 0) {
 			uint64_t new_sync;
 			int errcode;
@@ -1757,7 +2299,10 @@ static void decode_block(struct ptxed_decoder *decoder,
 						stats->blocks += 1;
 					}
 
-					if (!options->quiet)
+					if (options->bin_format)
+						ptxed_bin_block(&decoder->bin,
+								&block, time);
+					else if (!options->quiet)
 						print_block(decoder, &block,
 							    options, stats,
 							    offset, time);
@@ -1774,7 +2319,9 @@ static void decode_block(struct ptxed_decoder *decoder,
 				stats->blocks += 1;
 			}
 
-			if (!options->quiet)
+			if (options->bin_format)
+				ptxed_bin_block(&decoder->bin, &block, time);
+			else if (!options->quiet)
 				print_block(decoder, &block, options, stats,
 					    offset, time);
 
@@ -1806,10 +2353,20 @@ static void decode(struct ptxed_decoder *decoder,
 	switch (decoder->type) {
 	case pdt_insn_decoder:
 		decode_insn(decoder, options, stats);
+
+		if (stats && (stats->flags & ptxed_stat_scache))
+			(void) pt_insn_scache_stats(decoder->variant.insn,
+						    &stats->scache,
+						    sizeof(stats->scache));
 		break;
 
 	case pdt_block_decoder:
 		decode_block(decoder, options, stats);
+
+		if (stats && (stats->flags & ptxed_stat_scache))
+			(void) pt_blk_scache_stats(decoder->variant.block,
+						   &stats->scache,
+						   sizeof(stats->scache));
 		break;
 	}
 }
@@ -1881,6 +2438,10 @@ static void print_stats(struct ptxed_stats *stats)
 
 	if (stats->flags & ptxed_stat_blocks)
 		printf("blocks:\t%" PRIu64 ".\n", stats->blocks);
+
+	if (stats->flags & ptxed_stat_scache)
+		printf("scache: %" PRIu64 " hits, %" PRIu64 " misses.\n",
+		       stats->scache.hits, stats->scache.misses);
 }
 
 #if defined(FEATURE_SIDEBAND)
@@ -2118,10 +2679,10 @@ extern int main(int argc, char *argv[])
 	struct ptxed_decoder decoder;
 	struct ptxed_options options;
 	struct ptxed_stats stats;
-	struct pt_config config;
+	struct pt_config config, window;
 	struct pt_image *image;
 	const char *prog;
-	int errcode, i;
+	int errcode, i, mapped;
 
 	if (!argc) {
 		help("");
@@ -2130,6 +2691,7 @@ extern int main(int argc, char *argv[])
 
 	prog = argv[0];
 	image = NULL;
+	mapped = 0;
 
 	memset(&options, 0, sizeof(options));
 	memset(&stats, 0, sizeof(stats));
@@ -2190,11 +2752,20 @@ extern int main(int argc, char *argv[])
 					       pt_errstr(pt_errcode(errcode)));
 			}
 
-			errcode = load_pt(&config, arg, prog);
+			errcode = load_pt(&config, &mapped, arg, prog);
+			if (errcode < 0)
+				goto err;
+
+			/* We may restrict the trace we decode.  Keep @config
+			 * for unloading.
+			 */
+			window = config;
+
+			errcode = ptxed_index(&window, &options, prog);
 			if (errcode < 0)
 				goto err;
 
-			errcode = alloc_decoder(&decoder, &config, image,
+			errcode = alloc_decoder(&decoder, &window, image,
 						&options, prog);
 			if (errcode < 0)
 				goto err;
@@ -2266,6 +2837,27 @@ extern int main(int argc, char *argv[])
 
 			continue;
 		}
+		if (strcmp(arg, "--format=text") == 0) {
+			options.bin_format = 0;
+
+			continue;
+		}
+		if (strcmp(arg, "--format=bin") == 0) {
+			options.bin_format = 1;
+
+			continue;
+		}
+		if (strcmp(arg, "--output") == 0) {
+			if (argc <= i) {
+				fprintf(stderr,
+					"%s: --output: missing argument.\n",
+					prog);
+				goto err;
+			}
+
+			options.output = argv[i++];
+			continue;
+		}
 		if (strcmp(arg, "--event:time") == 0) {
 			options.print_event_time = 1;
 
@@ -2465,6 +3057,73 @@ extern int main(int argc, char *argv[])
 
 			continue;
 		}
+		if (strcmp(arg, "--bcache-dir") == 0) {
+			if (argc <= i) {
+				fprintf(stderr, "%s: --bcache-dir: missing "
+					"argument.\n", prog);
+				goto err;
+			}
+			arg = argv[i++];
+
+			errcode = pt_iscache_set_bcache_dir(decoder.iscache,
+							    arg);
+			if (errcode < 0) {
+				fprintf(stderr, "%s: error setting bcache "
+					"directory: %s.\n", prog,
+					pt_errstr(pt_errcode(errcode)));
+				goto err;
+			}
+
+			continue;
+		}
+		if (strcmp(arg, "--index") == 0) {
+			if (ptxed_have_decoder(&decoder)) {
+				fprintf(stderr,
+					"%s: please specify %s before the pt "
+					"source file.\n", prog, arg);
+				goto err;
+			}
+
+			if (argc <= i) {
+				fprintf(stderr,
+					"%s: --index: missing argument.\n",
+					prog);
+				goto out;
+			}
+
+			options.index = argv[i++];
+			continue;
+		}
+		if (strcmp(arg, "--tsc-range") == 0) {
+			if (ptxed_have_decoder(&decoder)) {
+				fprintf(stderr,
+					"%s: please specify %s before the pt "
+					"source file.\n", prog, arg);
+				goto err;
+			}
+
+			if (argc <= i) {
+				fprintf(stderr,
+					"%s: --tsc-range: missing argument.\n",
+					prog);
+				goto out;
+			}
+			arg = argv[i++];
+
+			options.tsc_end = UINT64_MAX;
+
+			errcode = parse_range(arg, &options.tsc_begin,
+					      &options.tsc_end);
+			if (errcode <= 0) {
+				fprintf(stderr,
+					"%s: --tsc-range: bad argument: %s.\n",
+					prog, arg);
+				goto err;
+			}
+
+			options.tsc_range = 1;
+			continue;
+		}
 		if (strcmp(arg, "--stat") == 0) {
 			options.print_stats = 1;
 			continue;
@@ -2477,6 +3136,10 @@ extern int main(int argc, char *argv[])
 			stats.flags |= ptxed_stat_blocks;
 			continue;
 		}
+		if (strcmp(arg, "--stat:scache") == 0) {
+			stats.flags |= ptxed_stat_scache;
+			continue;
+		}
 #if defined(FEATURE_SIDEBAND)
 		if ((strcmp(arg, "--sb:compact") == 0) ||
 		    (strcmp(arg, "--sb") == 0)) {
@@ -2788,6 +3451,32 @@ extern int main(int argc, char *argv[])
 		goto err;
 	}
 
+	if (options.bin_format) {
+		enum ptb_kind kind;
+
+		if (!options.output) {
+			fprintf(stderr, "%s: --format=bin requires --output.\n",
+				prog);
+			goto err;
+		}
+
+		kind = ptbk_insn;
+		if (decoder.type == pdt_block_decoder)
+			kind = ptbk_block;
+
+		errcode = ptxed_bin_open(&decoder.bin, options.output, kind,
+					 options.print_time);
+		if (errcode < 0) {
+			fprintf(stderr, "%s: failed to open %s: %s.\n", prog,
+				options.output,
+				pt_errstr(pt_errcode(errcode)));
+			goto err;
+		}
+	} else if (options.output) {
+		fprintf(stderr, "%s: --output requires --format=bin.\n", prog);
+		goto err;
+	}
+
 	xed_tables_init();
 
 	/* If we didn't select any statistics, select them all depending on the
@@ -2812,18 +3501,25 @@ extern int main(int argc, char *argv[])
 
 	decode(&decoder, &options, options.print_stats ? &stats : NULL);
 
+	errcode = ptxed_bin_close(&decoder.bin);
+	if (errcode < 0) {
+		fprintf(stderr, "%s: failed to write %s: %s.\n", prog,
+			options.output, pt_errstr(pt_errcode(errcode)));
+		goto err;
+	}
+
 	if (options.print_stats)
 		print_stats(&stats);
 
 out:
 	ptxed_free_decoder(&decoder);
 	pt_image_free(image);
-	free(config.begin);
+	unload_pt(&config, mapped);
 	return 0;
 
 err:
 	ptxed_free_decoder(&decoder);
 	pt_image_free(image);
-	free(config.begin);
+	unload_pt(&config, mapped);
 	return 1;
 }
@@ -43,11 +43,10 @@ enum pt_sb_abi {
 };
 
 struct pt_sb_context {
-	/* The next context in a linear list of process contexts.
+	/* The next context in the same bucket of the session's context table.
 	 *
-	 * I do not expect more than a few processes per tracing session.  And
-	 * if we had many processes, we'd also have trace spanning many context
-	 * switches and sideband decode won't be the bottleneck.
+	 * Whole-system traces may contain many thousands of short-lived
+	 * processes so the session hashes contexts by their @pid.
 	 *
 	 * This field is owned by the sideband tracing session to which this
 	 * context belongs.
@@ -35,13 +35,20 @@
 /* An Intel PT sideband decoder. */
 struct pt_sb_decoder {
 	/* The next Intel PT sideband decoder in a linear list of Intel PT
-	 * sideband decoders ordered by @tsc (ascending).
+	 * sideband decoders that are not scheduled.
 	 */
 	struct pt_sb_decoder *next;
 
 	/* The timestamp of the next sideband record. */
 	uint64_t tsc;
 
+	/* The session's schedule count when this decoder was last scheduled.
+	 *
+	 * Among decoders with equal @tsc, the one with the higher count comes
+	 * first.
+	 */
+	uint64_t scheduled;
+
 	/* Decoder functions provided by the decoder supplier:
 	 *
 	 * - fetch the next sideband record.
@@ -56,6 +63,9 @@ struct pt_sb_decoder {
 	int (*print)(struct pt_sb_session *session, FILE *stream,
 		     uint32_t flags, void *priv);
 
+	/* - optionally, prepare to fetch records starting close to @tsc. */
+	int (*seek)(struct pt_sb_session *session, uint64_t tsc, void *priv);
+
 	/* - destroy the decoder's private data. */
 	void (*dtor)(void *priv);
 
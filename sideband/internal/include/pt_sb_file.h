@@ -37,11 +37,45 @@
  * Allocates a large enough buffer and copies the contents of @file from @begin
  * to @end into it.  If @end is zero, reads from @begin until the end of @file.
  *
- * On success, provides the buffer in @buffer and its size in @size.
+ * On success, provides the buffer in @buffer and its size in @size.  An empty
+ * section provides a NULL @buffer.
  *
  * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_invalid if @begin lies beyond the end of @file.
  */
 extern int pt_sb_file_load(void **buffer, size_t *size, const char *filename,
 			   size_t begin, size_t end);
 
+
+/* A file section mapped into memory.
+ *
+ * The representation is operating-system specific.
+ */
+struct pt_sb_file_mapping;
+
+/* Map a file section.
+ *
+ * Maps the contents of @file from @begin to @end read-only into memory.  If
+ * @end is zero, maps from @begin until the end of @file.  Where the operating
+ * system does not support mapping files, the contents are loaded as with
+ * pt_sb_file_load().
+ *
+ * On success, provides the mapped contents in @buffer, their size in @size,
+ * and the mapping in @mapping.  An empty section provides a NULL @buffer.
+ *
+ * Use pt_sb_file_unmap() to unmap the section.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ * Returns -pte_invalid if @begin lies beyond the end of @file.
+ */
+extern int pt_sb_file_map(const void **buffer, size_t *size,
+			  struct pt_sb_file_mapping **mapping,
+			  const char *filename, size_t begin, size_t end);
+
+/* Unmap a file section that has been mapped with pt_sb_file_map().
+ *
+ * Invalidates the buffer provided by pt_sb_file_map().
+ */
+extern void pt_sb_file_unmap(struct pt_sb_file_mapping *mapping);
+
 #endif /* PT_SB_FILE_H */
@@ -31,6 +31,7 @@
 
 #include "pevent.h"
 
+struct pt_sb_file_mapping;
 
 /* The estimated code location. */
 enum pt_sb_pevent_loc {
@@ -97,7 +98,29 @@ struct pt_sb_pevent_priv {
 	char *vdso_ia32;
 
 	/* The begin and end of the sideband data in memory. */
-	uint8_t *begin, *end;
+	const uint8_t *begin, *end;
+
+	/* The mapping of the sideband file providing @begin and @end. */
+	struct pt_sb_file_mapping *mapping;
+
+	/* The optional index file.
+	 *
+	 * This is a copy of the index filename provided by the user when
+	 * allocating the sideband decoder.
+	 */
+	char *index;
+
+	/* The offsets of sideband records to replay after seeking.
+	 *
+	 * This is NULL if we are not replaying records.  Otherwise, we fetch
+	 * the records at @replay[@ireplay] to @replay[@nreplay - 1] before
+	 * we continue at @resume.
+	 */
+	uint64_t *replay;
+	uint64_t ireplay, nreplay;
+
+	/* The position from which to fetch after replaying records. */
+	const uint8_t *resume;
 
 	/* The position of the current and the next record in the sideband
 	 * buffer.
@@ -152,4 +175,16 @@ struct pt_sb_pevent_priv {
 extern int pt_sb_pevent_init(struct pt_sb_pevent_priv *priv,
 			     const struct pt_sb_pevent_config *config);
 
+/* Apply a timestamp offset.
+ *
+ * Subtracts @offset from @tsc without wrapping around.  A negative @offset is
+ * added, instead.
+ *
+ * Returns the adjusted timestamp.
+ */
+extern uint64_t pt_sb_pevent_tsc(uint64_t tsc, uint64_t offset);
+
+/* Check whether an MMAP record with perf event header @misc is ignored. */
+extern int pt_sb_pevent_ignore_mmap(uint16_t misc);
+
 #endif /* PT_SB_PEVENT_H */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PT_SB_PEVENT_INDEX_H
+#define PT_SB_PEVENT_INDEX_H
+
+#include "pevent.h"
+
+#include <stdint.h>
+
+
+/* A Linux perf event sideband index.
+ *
+ * The index file starts with a header followed by checkpoints in ascending
+ * order of their timestamp.  All fields are stored in host byte order.
+ */
+
+/* The index file header. */
+struct pt_sb_pidx_header {
+	/* The magic number identifying an index file. */
+	char magic[8];
+
+	/* The version of the index format. */
+	uint32_t version;
+
+	/* Reserved, must be zero. */
+	uint32_t reserved;
+
+	/* The perf_event_attr.sample_type of the indexed sideband data. */
+	uint64_t sample_type;
+
+	/* The size of the indexed sideband data in bytes. */
+	uint64_t size;
+
+	/* The perf event time conversion parameters.
+	 *
+	 * Checkpoint timestamps were converted to TSC using those.
+	 */
+	uint64_t time_zero;
+	uint32_t time_mult;
+	uint32_t time_shift;
+};
+
+/* An index checkpoint.
+ *
+ * Each checkpoint is followed by @nrecords sideband record offsets in
+ * ascending order.  Replaying those records and continuing at @offset has
+ * the same effect as fetching all records from the beginning.
+ */
+struct pt_sb_pidx_checkpoint {
+	/* The perf event timestamp of the record at @offset in TSC format. */
+	uint64_t tsc;
+
+	/* The offset of the sideband record at which to continue. */
+	uint64_t offset;
+
+	/* The number of sideband records to replay. */
+	uint64_t nrecords;
+};
+
+
+/* Write a Linux perf event sideband index.
+ *
+ * Indexes the sideband records from @begin to @end formatted according to
+ * @pev and writes a checkpoint to @filename about every @period records.
+ *
+ * Returns the number of checkpoints on success, a negative error code
+ * otherwise.
+ */
+extern int pt_sb_pidx_write(const char *filename, const uint8_t *begin,
+			    const uint8_t *end, const struct pev_config *pev,
+			    uint32_t period);
+
+/* Read a Linux perf event sideband index checkpoint.
+ *
+ * Reads the index in @filename for @size bytes of sideband data formatted
+ * according to @pev and finds the last checkpoint whose timestamp adjusted by
+ * @tsc_offset is not bigger than @tsc.
+ *
+ * On success, provides the offsets of sideband records to replay in @records
+ * and their number in @nrecords.  The caller is responsible for freeing
+ * @records.  Provides the offset of the sideband record at which to continue
+ * in @resume.
+ *
+ * Returns a positive integer if a checkpoint was found, zero if no checkpoint
+ * was found, a negative error code otherwise.
+ * Returns -pte_bad_file if @filename is not a valid index.
+ * Returns -pte_bad_config if the index does not match @pev or @size.
+ */
+extern int pt_sb_pidx_read(uint64_t **records, uint64_t *nrecords,
+			   uint64_t *resume, const char *filename,
+			   const struct pev_config *pev, uint64_t size,
+			   uint64_t tsc, uint64_t tsc_offset);
+
+#endif /* PT_SB_PEVENT_INDEX_H */
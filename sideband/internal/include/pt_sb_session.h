@@ -44,20 +44,46 @@ struct pt_sb_session {
 	 */
 	struct pt_image_section_cache *iscache;
 
-	/* A linear list of contexts in no particular order. */
-	struct pt_sb_context *contexts;
+	/* A hash table of contexts by pid with @nbuckets buckets.
+	 *
+	 * Each bucket holds a linear list of contexts in no particular order
+	 * linked via their @next field.
+	 */
+	struct pt_sb_context **contexts;
+
+	/* The number of buckets in @contexts; a power of two or zero. */
+	uint32_t nbuckets;
+
+	/* The number of contexts in @contexts. */
+	uint32_t ncontexts;
 
 	/* The kernel memory image.
 	 *
-	 * Just like process images, the kernel image may change over time.  It
-	 * is used to populate new process images.
+	 * Just like process images, the kernel image may change over time.
+	 * Process images are layered on top of it.
 	 *
 	 * This assumes that the full kernel is mapped into every process.
 	 */
 	struct pt_image *kernel;
 
-	/* A list of sideband decoders ordered by their @tsc (ascending). */
-	struct pt_sb_decoder *decoders;
+	/* A binary min-heap of sideband decoders ordered by their @tsc.
+	 *
+	 * The decoder with the smallest @tsc is at the root.  Among decoders
+	 * with equal @tsc, the one that was scheduled last comes first.
+	 */
+	struct pt_sb_decoder **decoders;
+
+	/* The number of decoders in @decoders. */
+	uint32_t ndecoders;
+
+	/* The number of decoders @decoders has room for. */
+	uint32_t capacity;
+
+	/* The number of times a decoder has been scheduled.
+	 *
+	 * This is used to order decoders with equal @tsc.
+	 */
+	uint64_t nscheduled;
 
 	/* A list of newly added sideband decoders in no particular order.
 	 *
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2017-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pt_sb_file.h"
+
+#include "intel-pt.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/* A file section mapped into memory. */
+struct pt_sb_file_mapping {
+	/* The page-aligned base address of the mapping or NULL. */
+	uint8_t *base;
+
+	/* The size of the mapping in bytes. */
+	size_t size;
+};
+
+int pt_sb_file_map(const void **pbuffer, size_t *psize,
+		   struct pt_sb_file_mapping **pmapping, const char *filename,
+		   size_t begin, size_t end)
+{
+	struct pt_sb_file_mapping *mapping;
+	struct stat buf;
+	uint64_t fsize;
+	size_t size, adjustment;
+	uint8_t *base;
+	long pagesize;
+	int fd, errcode;
+
+	if (!pbuffer || !psize || !pmapping || !filename)
+		return -pte_invalid;
+
+	if (end && end <= begin)
+		return -pte_invalid;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		return -pte_internal;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -pte_bad_file;
+
+	errcode = fstat(fd, &buf);
+	if (errcode) {
+		errcode = -pte_bad_file;
+		goto out_fd;
+	}
+
+	fsize = (uint64_t) buf.st_size;
+	if (fsize < begin) {
+		errcode = -pte_invalid;
+		goto out_fd;
+	}
+
+	if (!end || fsize < end) {
+		/* The file may be too big to fit into our address space. */
+		if (SIZE_MAX < fsize) {
+			errcode = -pte_nomem;
+			goto out_fd;
+		}
+
+		end = (size_t) fsize;
+	}
+
+	size = end - begin;
+
+	mapping = malloc(sizeof(*mapping));
+	if (!mapping) {
+		errcode = -pte_nomem;
+		goto out_fd;
+	}
+
+	mapping->base = NULL;
+	mapping->size = 0;
+
+	/* We can't map an empty section. */
+	if (!size) {
+		close(fd);
+
+		*pbuffer = NULL;
+		*psize = 0;
+		*pmapping = mapping;
+
+		return 0;
+	}
+
+	adjustment = begin % (size_t) pagesize;
+
+	base = mmap(NULL, size + adjustment, PROT_READ, MAP_SHARED, fd,
+		    (off_t) (begin - adjustment));
+	if (base == MAP_FAILED) {
+		errcode = -pte_nomem;
+		goto out_mapping;
+	}
+
+	close(fd);
+
+#if defined(POSIX_MADV_SEQUENTIAL)
+	/* This is only a hint.  We read sideband records front to back. */
+	(void) posix_madvise(base, size + adjustment, POSIX_MADV_SEQUENTIAL);
+#endif
+
+	mapping->base = base;
+	mapping->size = size + adjustment;
+
+	*pbuffer = base + adjustment;
+	*psize = size;
+	*pmapping = mapping;
+
+	return 0;
+
+out_mapping:
+	free(mapping);
+
+out_fd:
+	close(fd);
+	return errcode;
+}
+
+void pt_sb_file_unmap(struct pt_sb_file_mapping *mapping)
+{
+	if (!mapping)
+		return;
+
+	if (mapping->base)
+		munmap(mapping->base, mapping->size);
+
+	free(mapping);
+}
@@ -67,6 +67,11 @@ int pt_sb_file_load(void **pbuffer, size_t *psize, const char *filename,
 		goto out_file;
 
 	fbegin = (long) begin;
+	if (fsize < fbegin) {
+		fclose(file);
+		return -pte_invalid;
+	}
+
 	if (!end)
 		fend = fsize;
 	else {
@@ -76,6 +81,13 @@ int pt_sb_file_load(void **pbuffer, size_t *psize, const char *filename,
 	}
 
 	size = (size_t) (fend - fbegin);
+	if (!size) {
+		fclose(file);
+
+		*pbuffer = NULL;
+		*psize = 0;
+		return 0;
+	}
 
 	errcode = fseek(file, fbegin, SEEK_SET);
 	if (errcode)
@@ -48,9 +48,11 @@ int pt_sb_alloc_pevent_decoder(struct pt_sb_session *session,
 #include "pt_sb_session.h"
 #include "pt_sb_context.h"
 #include "pt_sb_file.h"
+#include "pt_sb_pevent_index.h"
 #include "pt_compiler.h"
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -244,7 +246,9 @@ static void pt_sb_pevent_dtor(void *priv_arg)
 	free(priv->vdso_x64);
 	free(priv->vdso_x32);
 	free(priv->vdso_ia32);
-	free(priv->begin);
+	free(priv->index);
+	free(priv->replay);
+	pt_sb_file_unmap(priv->mapping);
 	free(priv);
 }
 
@@ -280,33 +284,39 @@ static int pt_sb_pevent_init_path(char **dst, const char *src)
 int pt_sb_pevent_init(struct pt_sb_pevent_priv *priv,
 		      const struct pt_sb_pevent_config *config)
 {
+	struct pt_sb_file_mapping *mapping;
 	const char *filename;
+	const void *buffer;
 	size_t size;
-	void *buffer;
 	int errcode;
 
 	if (!priv || !config)
 		return -pte_internal;
 
-	/* This is the first version - we need all the fields. */
-	if (config->size < sizeof(*config))
+	/* We need all the fields up to @index, which was added later. */
+	if (config->size < offsetof(struct pt_sb_pevent_config, index))
 		return -pte_invalid;
 
 	filename = config->filename;
 	if (!filename)
 		return -pte_invalid;
 
+	/* We read records in place.  Decoders for the same file share the
+	 * file's pages.
+	 */
 	buffer = NULL;
 	size = 0;
-	errcode = pt_sb_file_load(&buffer, &size, filename,
-				  config->begin, config->end);
+	mapping = NULL;
+	errcode = pt_sb_file_map(&buffer, &size, &mapping, filename,
+				 config->begin, config->end);
 	if (errcode < 0)
 		return errcode;
 
 	memset(priv, 0, sizeof(*priv));
-	priv->begin = (uint8_t *) buffer;
-	priv->end = (uint8_t *) buffer + size;
-	priv->next = (uint8_t *) buffer;
+	priv->mapping = mapping;
+	priv->begin = (const uint8_t *) buffer;
+	priv->end = (const uint8_t *) buffer + size;
+	priv->next = (const uint8_t *) buffer;
 
 	errcode = pt_sb_pevent_init_path(&priv->filename, filename);
 	if (errcode < 0) {
@@ -338,6 +348,15 @@ int pt_sb_pevent_init(struct pt_sb_pevent_priv *priv,
 		return errcode;
 	}
 
+	if ((offsetof(struct pt_sb_pevent_config, index) +
+	     sizeof(config->index)) <= config->size) {
+		errcode = pt_sb_pevent_init_path(&priv->index, config->index);
+		if (errcode < 0) {
+			pt_sb_pevent_dtor(priv);
+			return errcode;
+		}
+	}
+
 	pev_config_init(&priv->pev);
 	priv->pev.sample_type = config->sample_type;
 	priv->pev.time_shift = config->time_shift;
@@ -351,11 +370,75 @@ int pt_sb_pevent_init(struct pt_sb_pevent_priv *priv,
 	return 0;
 }
 
+uint64_t pt_sb_pevent_tsc(uint64_t tsc, uint64_t offset)
+{
+	/* We don't want @tsc to wrap around when subtracting @offset.  This
+	 * would suddenly push the event very far out and essentially block
+	 * this sideband channel.
+	 *
+	 * On the other hand, we want to allow 'negative' offsets.  And for
+	 * those, we want to avoid wrapping around in the other direction.
+	 */
+	if (offset <= tsc)
+		return tsc - offset;
+
+	if (0ll <= (int64_t) offset)
+		return 0ull;
+
+	if (tsc <= offset)
+		return tsc - offset;
+
+	return UINT64_MAX;
+}
+
+static int pt_sb_pevent_seek(struct pt_sb_pevent_priv *priv, uint64_t tsc)
+{
+	uint64_t *records, nrecords, resume;
+	int found;
+
+	if (!priv)
+		return -pte_internal;
+
+	/* We can't seek without an index. */
+	if (!priv->index)
+		return 0;
+
+	/* We must not have fetched any records, yet. */
+	if (priv->current || priv->replay)
+		return -pte_internal;
+
+	records = NULL;
+	nrecords = 0ull;
+	resume = 0ull;
+	found = pt_sb_pidx_read(&records, &nrecords, &resume, priv->index,
+				&priv->pev,
+				(uint64_t) (priv->end - priv->begin), tsc,
+				priv->tsc_offset);
+	if (found <= 0)
+		return found;
+
+	/* Replay the records that still matter at the checkpoint before we
+	 * continue from there.
+	 */
+	priv->resume = priv->begin + resume;
+	if (!nrecords) {
+		priv->next = priv->resume;
+		return 0;
+	}
+
+	priv->replay = records;
+	priv->nreplay = nrecords;
+	priv->ireplay = 1ull;
+	priv->next = priv->begin + records[0];
+
+	return 0;
+}
+
 static int pt_sb_pevent_fetch(uint64_t *ptsc, struct pt_sb_pevent_priv *priv)
 {
 	struct pev_event *event;
 	const uint8_t *pos;
-	uint64_t tsc, offset;
+	uint64_t tsc;
 	int size;
 
 	if (!ptsc || !priv)
@@ -375,6 +458,21 @@ static int pt_sb_pevent_fetch(uint64_t *ptsc, struct pt_sb_pevent_priv *priv)
 
 	priv->next = pos + size;
 
+	/* After seeking, we replay selected records before we continue from
+	 * the seek position.
+	 */
+	if (priv->replay) {
+		if (priv->ireplay < priv->nreplay)
+			priv->next = priv->begin +
+				priv->replay[priv->ireplay++];
+		else {
+			priv->next = priv->resume;
+
+			free(priv->replay);
+			priv->replay = NULL;
+		}
+	}
+
 	/* If we don't have a time sample, set @ptsc to zero to process the
 	 * record immediately.
 	 */
@@ -385,28 +483,8 @@ static int pt_sb_pevent_fetch(uint64_t *ptsc, struct pt_sb_pevent_priv *priv)
 
 	/* Subtract a pre-defined offset to cause sideband events from this
 	 * channel to be applied a little earlier.
-	 *
-	 * We don't want @tsc to wrap around when subtracting @offset, though.
-	 * This would suddenly push the event very far out and essentially block
-	 * this sideband channel.
-	 *
-	 * On the other hand, we want to allow 'negative' offsets.  And for
-	 * those, we want to avoid wrapping around in the other direction.
 	 */
-	offset = priv->tsc_offset;
-	tsc = event->sample.tsc;
-	if (offset <= tsc)
-		tsc -= offset;
-	else {
-		if (0ll <= (int64_t) offset)
-			tsc = 0ull;
-		else {
-			if (tsc <= offset)
-				tsc -= offset;
-			else
-				tsc = UINT64_MAX;
-		}
-	}
+	tsc = pt_sb_pevent_tsc(event->sample.tsc, priv->tsc_offset);
 
 	/* We update the event record's timestamp, as well, so we will print the
 	 * updated tsc and apply the event at the right time.
@@ -1122,9 +1200,9 @@ static int pt_sb_pevent_exec(struct pt_sb_session *session,
 
 	/* This creates a new context and a new image.
 	 *
-	 * This new image will already be initialized with kernel sections but
-	 * will otherwise be empty.  We will populate it later with MMAP records
-	 * that follow this COMM.EXEC record.
+	 * This new image will already be layered on top of the kernel image
+	 * but will otherwise be empty.  We will populate it later with MMAP
+	 * records that follow this COMM.EXEC record.
 	 */
 	context = NULL;
 	errcode = pt_sb_get_context_by_pid(&context, session, pid);
@@ -1281,7 +1359,7 @@ static int pt_sb_pevent_aux(const struct pt_sb_session *session,
 	return 0;
 }
 
-static int pt_sb_pevent_ignore_mmap(uint16_t misc)
+int pt_sb_pevent_ignore_mmap(uint16_t misc)
 {
 	/* We rely on the kernel core file for ring-0 decode.
 	 *
@@ -1651,6 +1729,19 @@ static int pt_sb_pevent_fetch_callback(struct pt_sb_session *session,
 	return errcode;
 }
 
+static int pt_sb_pevent_seek_callback(struct pt_sb_session *session,
+				      uint64_t tsc, void *priv)
+{
+	int errcode;
+
+	errcode = pt_sb_pevent_seek((struct pt_sb_pevent_priv *) priv, tsc);
+	if (errcode < 0)
+		(void) pt_sb_pevent_error(session, errcode,
+					  (struct pt_sb_pevent_priv *) priv);
+
+	return errcode;
+}
+
 static int pt_sb_pevent_print_callback(struct pt_sb_session *session,
 				       FILE *stream, uint32_t flags, void *priv)
 {
@@ -1701,9 +1792,11 @@ int pt_sb_alloc_pevent_decoder(struct pt_sb_session *session,
 	}
 
 	memset(&config, 0, sizeof(config));
+	config.size = sizeof(config);
 	config.fetch = pt_sb_pevent_fetch_callback;
 	config.apply = pt_sb_pevent_apply_callback;
 	config.print = pt_sb_pevent_print_callback;
+	config.seek = pt_sb_pevent_seek_callback;
 	config.dtor = pt_sb_pevent_dtor;
 	config.priv = priv;
 	config.primary = pev->primary;
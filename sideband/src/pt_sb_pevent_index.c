@@ -0,0 +1,839 @@
+/*
+ * Copyright (c) 2017-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "libipt-sb.h"
+
+#include "intel-pt.h"
+
+
+#ifndef FEATURE_PEVENT
+
+int pt_sb_pevent_index(const struct pt_sb_pevent_config *config,
+		       uint32_t period)
+{
+	(void) config;
+	(void) period;
+
+	return -pte_not_supported;
+}
+
+#else /* FEATURE_PEVENT */
+
+#include "pt_sb_pevent_index.h"
+#include "pt_sb_pevent.h"
+#include "pt_sb_file.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+
+/* The magic number of the index format. */
+static const char pt_sb_pidx_magic[8] = "ptsbpidx";
+
+enum {
+	/* The version of the index format. */
+	pt_sb_pidx_version	= 2,
+
+	/* The default number of records between two checkpoints. */
+	pt_sb_pidx_period	= 0x1000,
+
+	/* The smallest non-zero number of buckets in the process table. */
+	pt_sb_pidx_min_buckets	= 0x40
+};
+
+/* A sideband record that contributes to the state at a checkpoint.
+ *
+ * Nodes form a tree.  Each process refers to the last record that contributes
+ * to its image.  Following @prev yields all records that need to be replayed
+ * to rebuild it, including records of other processes it was forked from.
+ */
+struct pt_sb_pidx_node {
+	/* The previous contributing record or NULL. */
+	struct pt_sb_pidx_node *prev;
+
+	/* The offset of the sideband record. */
+	uint64_t offset;
+
+	/* The checkpoint that last collected this node. */
+	uint64_t mark;
+
+	/* The number of references to this node. */
+	uint32_t ucount;
+};
+
+/* A process seen while indexing. */
+struct pt_sb_pidx_process {
+	/* The next process in the same bucket. */
+	struct pt_sb_pidx_process *next;
+
+	/* The last record contributing to the process image. */
+	struct pt_sb_pidx_node *recipe;
+
+	/* The process id. */
+	uint32_t pid;
+};
+
+/* The indexer state. */
+struct pt_sb_pidx {
+	/* A hash table of processes by pid.
+	 *
+	 * The number of buckets is a power of two or zero.
+	 */
+	struct pt_sb_pidx_process **processes;
+	uint32_t nbuckets;
+
+	/* The number of processes in @processes. */
+	uint32_t nprocesses;
+
+	/* The offset of the last record that may switch processes. */
+	uint64_t switch_offset;
+
+	/* A flag saying whether @switch_offset is valid. */
+	uint32_t has_switch:1;
+
+	/* The number of checkpoints written so far. */
+	uint64_t ncheckpoints;
+
+	/* A buffer for collecting a checkpoint's records. */
+	uint64_t *records;
+	uint64_t capacity;
+};
+
+static uint32_t pt_sb_pidx_bucket(uint32_t pid, uint32_t nbuckets)
+{
+	uint32_t hash;
+
+	hash = pid * 0x9e3779b1u;
+	hash ^= hash >> 16;
+
+	return hash & (nbuckets - 1);
+}
+
+static struct pt_sb_pidx_node *pt_sb_pidx_node_get(struct pt_sb_pidx_node *node)
+{
+	if (node)
+		node->ucount += 1;
+
+	return node;
+}
+
+static void pt_sb_pidx_node_put(struct pt_sb_pidx_node *node)
+{
+	while (node) {
+		struct pt_sb_pidx_node *prev;
+
+		node->ucount -= 1;
+		if (node->ucount)
+			break;
+
+		prev = node->prev;
+		free(node);
+
+		node = prev;
+	}
+}
+
+/* Create a new node for the record at @offset following @prev.
+ *
+ * Takes a reference to @prev.  The new node has one reference.
+ *
+ * Returns the new node or NULL if we ran out of memory.
+ */
+static struct pt_sb_pidx_node *
+pt_sb_pidx_node_alloc(struct pt_sb_pidx_node *prev, uint64_t offset)
+{
+	struct pt_sb_pidx_node *node;
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return NULL;
+
+	node->prev = pt_sb_pidx_node_get(prev);
+	node->offset = offset;
+	node->mark = 0ull;
+	node->ucount = 1;
+
+	return node;
+}
+
+static void pt_sb_pidx_fini(struct pt_sb_pidx *pidx)
+{
+	uint32_t bucket;
+
+	for (bucket = 0; bucket < pidx->nbuckets; ++bucket) {
+		struct pt_sb_pidx_process *process;
+
+		process = pidx->processes[bucket];
+		while (process) {
+			struct pt_sb_pidx_process *trash;
+
+			trash = process;
+			process = trash->next;
+
+			pt_sb_pidx_node_put(trash->recipe);
+			free(trash);
+		}
+	}
+
+	free(pidx->processes);
+	free(pidx->records);
+}
+
+/* Grow the process table if it is full.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_pidx_reserve(struct pt_sb_pidx *pidx)
+{
+	struct pt_sb_pidx_process **processes;
+	uint32_t bucket, nbuckets;
+
+	if (pidx->nprocesses < pidx->nbuckets)
+		return 0;
+
+	nbuckets = pidx->nbuckets ? pidx->nbuckets * 2 :
+		pt_sb_pidx_min_buckets;
+	if (nbuckets <= pidx->nbuckets)
+		return pidx->nbuckets ? 0 : -pte_nomem;
+
+	processes = calloc(nbuckets, sizeof(*processes));
+	if (!processes)
+		return pidx->nbuckets ? 0 : -pte_nomem;
+
+	for (bucket = 0; bucket < pidx->nbuckets; ++bucket) {
+		struct pt_sb_pidx_process *process;
+
+		process = pidx->processes[bucket];
+		while (process) {
+			struct pt_sb_pidx_process *next;
+			uint32_t idx;
+
+			next = process->next;
+
+			idx = pt_sb_pidx_bucket(process->pid, nbuckets);
+			process->next = processes[idx];
+			processes[idx] = process;
+
+			process = next;
+		}
+	}
+
+	free(pidx->processes);
+	pidx->processes = processes;
+	pidx->nbuckets = nbuckets;
+
+	return 0;
+}
+
+static struct pt_sb_pidx_process *pt_sb_pidx_find(struct pt_sb_pidx *pidx,
+						  uint32_t pid)
+{
+	struct pt_sb_pidx_process *process;
+
+	if (!pidx->nbuckets)
+		return NULL;
+
+	process = pidx->processes[pt_sb_pidx_bucket(pid, pidx->nbuckets)];
+	for (; process; process = process->next) {
+		if (process->pid == pid)
+			break;
+	}
+
+	return process;
+}
+
+/* Find or add the process with @pid.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_pidx_get(struct pt_sb_pidx_process **pprocess,
+			  struct pt_sb_pidx *pidx, uint32_t pid)
+{
+	struct pt_sb_pidx_process *process;
+	uint32_t bucket;
+	int errcode;
+
+	process = pt_sb_pidx_find(pidx, pid);
+	if (process) {
+		*pprocess = process;
+		return 0;
+	}
+
+	errcode = pt_sb_pidx_reserve(pidx);
+	if (errcode < 0)
+		return errcode;
+
+	process = malloc(sizeof(*process));
+	if (!process)
+		return -pte_nomem;
+
+	bucket = pt_sb_pidx_bucket(pid, pidx->nbuckets);
+
+	process->pid = pid;
+	process->recipe = NULL;
+	process->next = pidx->processes[bucket];
+	pidx->processes[bucket] = process;
+	pidx->nprocesses += 1;
+
+	*pprocess = process;
+	return 0;
+}
+
+/* Remove the process with @pid, if there is one. */
+static void pt_sb_pidx_remove(struct pt_sb_pidx *pidx, uint32_t pid)
+{
+	struct pt_sb_pidx_process **pprocess, *process;
+
+	if (!pidx->nbuckets)
+		return;
+
+	pprocess = &pidx->processes[pt_sb_pidx_bucket(pid, pidx->nbuckets)];
+	for (process = *pprocess; process; process = *pprocess) {
+		if (process->pid == pid)
+			break;
+
+		pprocess = &process->next;
+	}
+
+	if (!process)
+		return;
+
+	*pprocess = process->next;
+	pidx->nprocesses -= 1;
+
+	pt_sb_pidx_node_put(process->recipe);
+	free(process);
+}
+
+/* Make the record at @offset the last record contributing to process @pid.
+ *
+ * If @prev is not NULL, the record follows @prev.  Otherwise, it is the first
+ * record contributing to process @pid.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_pidx_add(struct pt_sb_pidx *pidx, uint32_t pid,
+			  struct pt_sb_pidx_node *prev, uint64_t offset)
+{
+	struct pt_sb_pidx_process *process;
+	struct pt_sb_pidx_node *node;
+	int errcode;
+
+	errcode = pt_sb_pidx_get(&process, pidx, pid);
+	if (errcode < 0)
+		return errcode;
+
+	node = pt_sb_pidx_node_alloc(prev, offset);
+	if (!node)
+		return -pte_nomem;
+
+	pt_sb_pidx_node_put(process->recipe);
+	process->recipe = node;
+
+	return 0;
+}
+
+static int pt_sb_pidx_fork(struct pt_sb_pidx *pidx,
+			   const struct pev_record_fork *record,
+			   uint64_t offset)
+{
+	struct pt_sb_pidx_process *parent;
+
+	if (!record)
+		return -pte_internal;
+
+	/* Creating a new thread does not change the process.  The sideband
+	 * decoder rejects new processes whose initial thread id differs.
+	 */
+	if ((record->ppid == record->pid) || (record->pid != record->tid))
+		return 0;
+
+	/* The new process inherits its parent's image. */
+	parent = pt_sb_pidx_find(pidx, record->ppid);
+
+	return pt_sb_pidx_add(pidx, record->pid,
+			      parent ? parent->recipe : NULL, offset);
+}
+
+static int pt_sb_pidx_exit(struct pt_sb_pidx *pidx,
+			   const struct pev_record_exit *record)
+{
+	if (!record)
+		return -pte_internal;
+
+	/* A thread exiting does not change the process. */
+	if (record->pid != record->tid)
+		return 0;
+
+	/* The sideband decoder keeps the process until its pid is reused by
+	 * a fork, which starts over with a new image.  The process will not
+	 * fork or map files anymore so there is no need to replay the records
+	 * that built its image.  Children keep the records they inherited.
+	 */
+	pt_sb_pidx_remove(pidx, record->pid);
+
+	return 0;
+}
+
+static int pt_sb_pidx_map(struct pt_sb_pidx *pidx, uint32_t pid,
+			  uint64_t offset)
+{
+	struct pt_sb_pidx_process *process;
+
+	process = pt_sb_pidx_find(pidx, pid);
+
+	return pt_sb_pidx_add(pidx, pid, process ? process->recipe : NULL,
+			      offset);
+}
+
+/* Update the indexer state with a sideband record at @offset.
+ *
+ * This follows pt_sb_pevent_apply_event_record().
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_pidx_apply(struct pt_sb_pidx *pidx,
+			    const struct pev_event *event, uint64_t offset)
+{
+	switch (event->type) {
+	default:
+		break;
+
+	case PERF_RECORD_ITRACE_START:
+	case PERF_RECORD_SWITCH:
+	case PERF_RECORD_SWITCH_CPU_WIDE:
+		pidx->switch_offset = offset;
+		pidx->has_switch = 1;
+		break;
+
+	case PERF_RECORD_FORK:
+		return pt_sb_pidx_fork(pidx, event->record.fork, offset);
+
+	case PERF_RECORD_EXIT:
+		return pt_sb_pidx_exit(pidx, event->record.exit);
+
+	case PERF_RECORD_COMM:
+		if (!(event->misc & PERF_RECORD_MISC_COMM_EXEC))
+			break;
+
+		if (!event->record.comm)
+			return -pte_internal;
+
+		/* The process starts over with an empty image. */
+		return pt_sb_pidx_add(pidx, event->record.comm->pid, NULL,
+				      offset);
+
+	case PERF_RECORD_MMAP:
+		if (pt_sb_pevent_ignore_mmap(event->misc))
+			break;
+
+		if (!event->record.mmap)
+			return -pte_internal;
+
+		return pt_sb_pidx_map(pidx, event->record.mmap->pid, offset);
+
+	case PERF_RECORD_MMAP2:
+		if (pt_sb_pevent_ignore_mmap(event->misc))
+			break;
+
+		if (!event->record.mmap2)
+			return -pte_internal;
+
+		return pt_sb_pidx_map(pidx, event->record.mmap2->pid, offset);
+	}
+
+	return 0;
+}
+
+static int pt_sb_pidx_push(struct pt_sb_pidx *pidx, uint64_t offset,
+			   uint64_t *nrecords)
+{
+	uint64_t *records, capacity;
+
+	capacity = pidx->capacity;
+	if (capacity <= *nrecords) {
+		capacity = capacity ? capacity * 2 : 0x100;
+		if ((SIZE_MAX / sizeof(*records)) < capacity)
+			return -pte_nomem;
+
+		records = realloc(pidx->records,
+				  (size_t) capacity * sizeof(*records));
+		if (!records)
+			return -pte_nomem;
+
+		pidx->records = records;
+		pidx->capacity = capacity;
+	}
+
+	pidx->records[(*nrecords)++] = offset;
+
+	return 0;
+}
+
+static int pt_sb_pidx_cmp(const void *lhs, const void *rhs)
+{
+	uint64_t lval, rval;
+
+	lval = *(const uint64_t *) lhs;
+	rval = *(const uint64_t *) rhs;
+
+	return (lval < rval) ? -1 : (rval < lval) ? 1 : 0;
+}
+
+/* Write a checkpoint for the record at @offset with timestamp @tsc.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_pidx_checkpoint(struct pt_sb_pidx *pidx, FILE *file,
+				 uint64_t offset, uint64_t tsc)
+{
+	struct pt_sb_pidx_checkpoint checkpoint;
+	uint64_t mark, nrecords;
+	uint32_t bucket;
+	size_t written;
+	int errcode;
+
+	mark = ++pidx->ncheckpoints;
+	nrecords = 0ull;
+
+	/* Collect the records of all processes.  Processes share the records
+	 * of their ancestors up to the fork; we only collect them once.
+	 */
+	for (bucket = 0; bucket < pidx->nbuckets; ++bucket) {
+		struct pt_sb_pidx_process *process;
+
+		process = pidx->processes[bucket];
+		for (; process; process = process->next) {
+			struct pt_sb_pidx_node *node;
+
+			node = process->recipe;
+			for (; node && node->mark != mark; node = node->prev) {
+				node->mark = mark;
+
+				errcode = pt_sb_pidx_push(pidx, node->offset,
+							  &nrecords);
+				if (errcode < 0)
+					return errcode;
+			}
+		}
+	}
+
+	if (pidx->has_switch) {
+		errcode = pt_sb_pidx_push(pidx, pidx->switch_offset,
+					  &nrecords);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	/* Records are replayed in their original order. */
+	qsort(pidx->records, (size_t) nrecords, sizeof(*pidx->records),
+	      pt_sb_pidx_cmp);
+
+	memset(&checkpoint, 0, sizeof(checkpoint));
+	checkpoint.tsc = tsc;
+	checkpoint.offset = offset;
+	checkpoint.nrecords = nrecords;
+
+	written = fwrite(&checkpoint, sizeof(checkpoint), 1, file);
+	if (written != 1)
+		return -pte_bad_file;
+
+	if (nrecords) {
+		written = fwrite(pidx->records, sizeof(*pidx->records),
+				 (size_t) nrecords, file);
+		if (written != nrecords)
+			return -pte_bad_file;
+	}
+
+	return 0;
+}
+
+int pt_sb_pidx_write(const char *filename, const uint8_t *begin,
+		     const uint8_t *end, const struct pev_config *pev,
+		     uint32_t period)
+{
+	struct pt_sb_pidx_header header;
+	struct pt_sb_pidx pidx;
+	struct pev_event event;
+	const uint8_t *pos;
+	uint32_t nrecords;
+	size_t written;
+	FILE *file;
+	int errcode;
+
+	if (!filename || !pev || (end < begin) || (!begin && end))
+		return -pte_internal;
+
+	if (!period)
+		period = pt_sb_pidx_period;
+
+	file = fopen(filename, "wb");
+	if (!file)
+		return -pte_bad_file;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, pt_sb_pidx_magic, sizeof(header.magic));
+	header.version = pt_sb_pidx_version;
+	header.sample_type = pev->sample_type;
+	header.size = (uint64_t) (end - begin);
+	header.time_zero = pev->time_zero;
+	header.time_mult = pev->time_mult;
+	header.time_shift = pev->time_shift;
+
+	errcode = 0;
+	written = fwrite(&header, sizeof(header), 1, file);
+	if (written != 1)
+		errcode = -pte_bad_file;
+
+	memset(&pidx, 0, sizeof(pidx));
+	nrecords = 0;
+
+	for (pos = begin; (errcode >= 0) && (pos < end); ++nrecords) {
+		uint64_t offset;
+		int size;
+
+		size = pev_read(&event, pos, end, pev);
+		if (size < 0) {
+			errcode = size;
+			break;
+		}
+
+		offset = (uint64_t) (pos - begin);
+
+		/* Place checkpoints at records with a timestamp.
+		 *
+		 * The checkpoint describes the state before @event.
+		 */
+		if ((period <= nrecords) && event.sample.time) {
+			errcode = pt_sb_pidx_checkpoint(&pidx, file, offset,
+							event.sample.tsc);
+			if (errcode < 0)
+				break;
+
+			nrecords = 0;
+		}
+
+		errcode = pt_sb_pidx_apply(&pidx, &event, offset);
+
+		pos += size;
+	}
+
+	pt_sb_pidx_fini(&pidx);
+
+	if (fclose(file) && (errcode >= 0))
+		errcode = -pte_bad_file;
+
+	if (errcode < 0) {
+		(void) remove(filename);
+		return errcode;
+	}
+
+	if (INT_MAX < pidx.ncheckpoints)
+		return INT_MAX;
+
+	return (int) pidx.ncheckpoints;
+}
+
+int pt_sb_pidx_read(uint64_t **precords, uint64_t *pnrecords,
+		    uint64_t *presume, const char *filename,
+		    const struct pev_config *pev, uint64_t size,
+		    uint64_t tsc, uint64_t tsc_offset)
+{
+	struct pt_sb_pidx_checkpoint checkpoint, found;
+	struct pt_sb_pidx_header header;
+	uint64_t *records, idx, last;
+	fpos_t position;
+	size_t read;
+	FILE *file;
+	int errcode, positioned;
+
+	if (!precords || !pnrecords || !presume || !filename || !pev)
+		return -pte_internal;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return -pte_bad_file;
+
+	read = fread(&header, sizeof(header), 1, file);
+	if ((read != 1) ||
+	    memcmp(header.magic, pt_sb_pidx_magic, sizeof(header.magic)) ||
+	    (header.version != pt_sb_pidx_version) || header.reserved) {
+		errcode = -pte_bad_file;
+		goto out;
+	}
+
+	if ((header.sample_type != pev->sample_type) ||
+	    (header.time_zero != pev->time_zero) ||
+	    (header.time_mult != pev->time_mult) ||
+	    (header.time_shift != pev->time_shift) || (header.size != size)) {
+		errcode = -pte_bad_config;
+		goto out;
+	}
+
+	/* Checkpoints are ordered by their timestamp.  Find the last one that
+	 * is not after @tsc.
+	 *
+	 * The index may be larger than what a long can address on some systems.
+	 * We only seek relative to the current position when skipping records
+	 * and use fgetpos() and fsetpos() to return to the checkpoint we found.
+	 */
+	memset(&found, 0, sizeof(found));
+	positioned = 0;
+	for (;;) {
+		long next;
+
+		read = fread(&checkpoint, sizeof(checkpoint), 1, file);
+		if (read != 1)
+			break;
+
+		if (tsc < pt_sb_pevent_tsc(checkpoint.tsc, tsc_offset))
+			break;
+
+		if ((size <= checkpoint.offset) ||
+		    ((LONG_MAX / sizeof(uint64_t)) < checkpoint.nrecords)) {
+			errcode = -pte_bad_file;
+			goto out;
+		}
+
+		found = checkpoint;
+		errcode = fgetpos(file, &position);
+		if (errcode) {
+			errcode = -pte_bad_file;
+			goto out;
+		}
+
+		positioned = 1;
+
+		next = (long) (checkpoint.nrecords * sizeof(uint64_t));
+		errcode = fseek(file, next, SEEK_CUR);
+		if (errcode) {
+			errcode = -pte_bad_file;
+			goto out;
+		}
+	}
+
+	errcode = 0;
+	if (!positioned)
+		goto out;
+
+	records = NULL;
+	if (found.nrecords) {
+		if ((SIZE_MAX / sizeof(*records)) < found.nrecords) {
+			errcode = -pte_nomem;
+			goto out;
+		}
+
+		records = malloc((size_t) found.nrecords * sizeof(*records));
+		if (!records) {
+			errcode = -pte_nomem;
+			goto out;
+		}
+
+		errcode = fsetpos(file, &position);
+		if (!errcode) {
+			read = fread(records, sizeof(*records),
+				     (size_t) found.nrecords, file);
+			if (read != found.nrecords)
+				errcode = -pte_bad_file;
+		}
+
+		/* Records must precede the checkpoint in ascending order. */
+		for (idx = 0, last = 0; !errcode && idx < found.nrecords;
+		     ++idx) {
+			if ((found.offset <= records[idx]) ||
+			    (idx && (records[idx] <= last)))
+				errcode = -pte_bad_file;
+
+			last = records[idx];
+		}
+
+		if (errcode) {
+			free(records);
+			errcode = -pte_bad_file;
+			goto out;
+		}
+	}
+
+	*precords = records;
+	*pnrecords = found.nrecords;
+	*presume = found.offset;
+
+	errcode = 1;
+
+out:
+	fclose(file);
+	return errcode;
+}
+
+int pt_sb_pevent_index(const struct pt_sb_pevent_config *config,
+		       uint32_t period)
+{
+	struct pt_sb_file_mapping *mapping;
+	struct pev_config pev;
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	if (!config)
+		return -pte_invalid;
+
+	/* We need the @index field. */
+	if (config->size < (offsetof(struct pt_sb_pevent_config, index) +
+			    sizeof(config->index)))
+		return -pte_invalid;
+
+	if (!config->filename || !config->index)
+		return -pte_invalid;
+
+	pev_config_init(&pev);
+	pev.sample_type = config->sample_type;
+	pev.time_shift = config->time_shift;
+	pev.time_mult = config->time_mult;
+	pev.time_zero = config->time_zero;
+
+	buffer = NULL;
+	size = 0;
+	mapping = NULL;
+	errcode = pt_sb_file_map(&buffer, &size, &mapping, config->filename,
+				 config->begin, config->end);
+	if (errcode < 0)
+		return errcode;
+
+	errcode = pt_sb_pidx_write(config->index, (const uint8_t *) buffer,
+				   (const uint8_t *) buffer + size, &pev,
+				   period);
+
+	pt_sb_file_unmap(mapping);
+
+	return errcode;
+}
+
+#endif /* FEATURE_PEVENT */
@@ -92,25 +92,32 @@ static void pt_sb_free_decoder_list(struct pt_sb_decoder *list)
 void pt_sb_free(struct pt_sb_session *session)
 {
 	struct pt_sb_context *context;
+	uint32_t bucket, idx;
 
 	if (!session)
 		return;
 
-	pt_sb_free_decoder_list(session->decoders);
+	for (idx = 0; idx < session->ndecoders; ++idx)
+		pt_sb_free_decoder(session->decoders[idx]);
+
+	free(session->decoders);
 	pt_sb_free_decoder_list(session->waiting);
 	pt_sb_free_decoder_list(session->retired);
 	pt_sb_free_decoder_list(session->removed);
 
-	context = session->contexts;
-	while (context) {
-		struct pt_sb_context *trash;
+	for (bucket = 0; bucket < session->nbuckets; ++bucket) {
+		context = session->contexts[bucket];
+		while (context) {
+			struct pt_sb_context *trash;
 
-		trash = context;
-		context = trash->next;
+			trash = context;
+			context = trash->next;
 
-		(void) pt_sb_ctx_put(trash);
+			(void) pt_sb_ctx_put(trash);
+		}
 	}
 
+	free(session->contexts);
 	pt_image_free(session->kernel);
 
 	free(session);
@@ -132,11 +139,83 @@ struct pt_image *pt_sb_kernel_image(struct pt_sb_session *session)
 	return session->kernel;
 }
 
+enum {
+	/* The initial number of buckets in a session's context table. */
+	pt_sb_min_buckets	= 0x40
+};
+
+/* Return the bucket for @pid in a table with @nbuckets buckets.
+ *
+ * The number of buckets must be a power of two.
+ */
+static uint32_t pt_sb_bucket(uint32_t pid, uint32_t nbuckets)
+{
+	uint32_t hash;
+
+	hash = pid * 0x9e3779b1u;
+	hash ^= hash >> 16;
+
+	return hash & (nbuckets - 1);
+}
+
+/* Make room for one more context in @session's context table.
+ *
+ * Doubles the number of buckets when the table is full.  If that fails, we
+ * keep going with longer bucket lists.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_reserve_context(struct pt_sb_session *session)
+{
+	struct pt_sb_context **contexts;
+	uint32_t nbuckets, bucket;
+
+	if (!session)
+		return -pte_internal;
+
+	if (session->ncontexts < session->nbuckets)
+		return 0;
+
+	nbuckets = session->nbuckets ? session->nbuckets << 1 :
+		pt_sb_min_buckets;
+	if (!nbuckets)
+		return 0;
+
+	contexts = calloc(nbuckets, sizeof(*contexts));
+	if (!contexts)
+		return session->nbuckets ? 0 : -pte_nomem;
+
+	for (bucket = 0; bucket < session->nbuckets; ++bucket) {
+		struct pt_sb_context *context;
+
+		context = session->contexts[bucket];
+		while (context) {
+			struct pt_sb_context *next;
+			uint32_t nbucket;
+
+			next = context->next;
+			nbucket = pt_sb_bucket(context->pid, nbuckets);
+
+			context->next = contexts[nbucket];
+			contexts[nbucket] = context;
+
+			context = next;
+		}
+	}
+
+	free(session->contexts);
+	session->contexts = contexts;
+	session->nbuckets = nbuckets;
+
+	return 0;
+}
+
 static int pt_sb_add_context_by_pid(struct pt_sb_context **pcontext,
 				    struct pt_sb_session *session, uint32_t pid)
 {
 	struct pt_sb_context *context;
 	struct pt_image *kernel;
+	uint32_t bucket;
 	char iname[16];
 	int errcode;
 
@@ -147,6 +226,10 @@ static int pt_sb_add_context_by_pid(struct pt_sb_context **pcontext,
 	if (!kernel)
 		return -pte_internal;
 
+	errcode = pt_sb_reserve_context(session);
+	if (errcode < 0)
+		return errcode;
+
 	memset(iname, 0, sizeof(iname));
 	(void) snprintf(iname, sizeof(iname), "pid-%x", pid);
 
@@ -154,16 +237,22 @@ static int pt_sb_add_context_by_pid(struct pt_sb_context **pcontext,
 	if (!context)
 		return -pte_nomem;
 
-	errcode = pt_image_copy(context->image, kernel);
+	/* Share the kernel image rather than copying it.  Kernel image
+	 * changes are visible in all process images this way.
+	 */
+	errcode = pt_image_set_base(context->image, kernel);
 	if (errcode < 0) {
 		(void) pt_sb_ctx_put(context);
 		return errcode;
 	}
 
-	context->next = session->contexts;
+	bucket = pt_sb_bucket(pid, session->nbuckets);
+
+	context->next = session->contexts[bucket];
 	context->pid = pid;
 
-	session->contexts = context;
+	session->contexts[bucket] = context;
+	session->ncontexts += 1;
 	*pcontext = context;
 
 	return 0;
@@ -195,9 +284,13 @@ int pt_sb_find_context_by_pid(struct pt_sb_context **pcontext,
 	if (!pcontext || !session)
 		return -pte_invalid;
 
-	for (ctx = session->contexts; ctx; ctx = ctx->next) {
-		if (ctx->pid == pid)
-			break;
+	ctx = NULL;
+	if (session->nbuckets) {
+		ctx = session->contexts[pt_sb_bucket(pid, session->nbuckets)];
+		for (; ctx; ctx = ctx->next) {
+			if (ctx->pid == pid)
+				break;
+		}
 	}
 
 	*pcontext = ctx;
@@ -213,7 +306,11 @@ int pt_sb_remove_context(struct pt_sb_session *session,
 	if (!session || !context)
 		return -pte_invalid;
 
-	pnext = &session->contexts;
+	if (!session->nbuckets)
+		return -pte_nosync;
+
+	pnext = &session->contexts[pt_sb_bucket(context->pid,
+						session->nbuckets)];
 	for (ctx = *pnext; ctx; pnext = &ctx->next, ctx = *pnext) {
 		if (ctx == context)
 			break;
@@ -223,6 +320,7 @@ int pt_sb_remove_context(struct pt_sb_session *session,
 		return -pte_nosync;
 
 	*pnext = ctx->next;
+	session->ncontexts -= 1;
 
 	return pt_sb_ctx_put(ctx);
 }
@@ -248,39 +346,191 @@ int pt_sb_alloc_decoder(struct pt_sb_session *session,
 	decoder->priv = config->priv;
 	decoder->primary = config->primary;
 
+	/* The seek callback was added later. */
+	if (offsetof(struct pt_sb_decoder_config, seek) +
+	    sizeof(config->seek) <= config->size)
+		decoder->seek = config->seek;
+
 	session->waiting = decoder;
 
 	return 0;
 }
 
-/* Add a new decoder to a list of decoders.
+/* Check whether decoder @lhs is due before decoder @rhs.
+ *
+ * Decoders are ordered by their @tsc (ascending).  Among decoders with equal
+ * @tsc, the one that was scheduled last comes first.
+ */
+static int pt_sb_decoder_before(const struct pt_sb_decoder *lhs,
+				const struct pt_sb_decoder *rhs)
+{
+	if (lhs->tsc != rhs->tsc)
+		return lhs->tsc < rhs->tsc;
+
+	return rhs->scheduled < lhs->scheduled;
+}
+
+/* A qsort() comparison function for decoder pointers.
+ *
+ * Orders decoders like pt_sb_decoder_before().
+ */
+static int pt_sb_decoder_compare(const void *lhs, const void *rhs)
+{
+	const struct pt_sb_decoder *ldec, *rdec;
+
+	ldec = *(const struct pt_sb_decoder * const *) lhs;
+	rdec = *(const struct pt_sb_decoder * const *) rhs;
+
+	if (pt_sb_decoder_before(ldec, rdec))
+		return -1;
+
+	if (pt_sb_decoder_before(rdec, ldec))
+		return 1;
+
+	return 0;
+}
+
+/* Move the decoder at @idx in @session's decoder heap towards the root. */
+static void pt_sb_sift_up(struct pt_sb_session *session, uint32_t idx)
+{
+	struct pt_sb_decoder **heap, *decoder;
+
+	heap = session->decoders;
+	decoder = heap[idx];
+
+	while (idx) {
+		uint32_t parent;
+
+		parent = (idx - 1) / 2;
+		if (!pt_sb_decoder_before(decoder, heap[parent]))
+			break;
+
+		heap[idx] = heap[parent];
+		idx = parent;
+	}
+
+	heap[idx] = decoder;
+}
+
+/* Move the decoder at @idx in @session's decoder heap towards the leaves. */
+static void pt_sb_sift_down(struct pt_sb_session *session, uint32_t idx)
+{
+	struct pt_sb_decoder **heap, *decoder;
+	uint32_t ndecoders;
+
+	heap = session->decoders;
+	ndecoders = session->ndecoders;
+	decoder = heap[idx];
+
+	for (;;) {
+		uint32_t child;
+
+		child = (2 * idx) + 1;
+		if (ndecoders <= child)
+			break;
+
+		if (((child + 1) < ndecoders) &&
+		    pt_sb_decoder_before(heap[child + 1], heap[child]))
+			child += 1;
+
+		if (!pt_sb_decoder_before(heap[child], decoder))
+			break;
+
+		heap[idx] = heap[child];
+		idx = child;
+	}
+
+	heap[idx] = decoder;
+}
+
+/* Make room for @count more decoders in @session's decoder heap.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_reserve_decoders(struct pt_sb_session *session,
+				  uint32_t count)
+{
+	struct pt_sb_decoder **decoders;
+	uint32_t capacity;
+
+	if (!session)
+		return -pte_internal;
+
+	capacity = session->ndecoders + count;
+	if (capacity < count)
+		return -pte_nomem;
+
+	if (capacity <= session->capacity)
+		return 0;
+
+	decoders = realloc(session->decoders, capacity * sizeof(*decoders));
+	if (!decoders)
+		return -pte_nomem;
+
+	session->decoders = decoders;
+	session->capacity = capacity;
+
+	return 0;
+}
+
+/* Schedule @decoder according to its @tsc.
  *
- * Decoders in @list are ordered by their @tsc (ascending) and @list does not
- * contain @decoder.  Find the right place for @decoder at add it to @list.
+ * The caller must have made room for @decoder in @session's decoder heap.
  *
  * Returns zero on success, a negative error code otherwise.
  */
-static int pt_sb_add_decoder(struct pt_sb_decoder **list,
+static int pt_sb_add_decoder(struct pt_sb_session *session,
 			     struct pt_sb_decoder *decoder)
 {
-	struct pt_sb_decoder *cand;
-	uint64_t tsc;
+	uint32_t idx;
 
-	if (!list || !decoder || decoder->next)
+	if (!session || !decoder || decoder->next)
 		return -pte_internal;
 
-	tsc = decoder->tsc;
-	for (cand = *list; cand; list = &cand->next, cand = *list) {
-		if (tsc <= cand->tsc)
-			break;
-	}
+	idx = session->ndecoders;
+	if (session->capacity <= idx)
+		return -pte_internal;
+
+	decoder->scheduled = ++session->nscheduled;
+
+	session->decoders[idx] = decoder;
+	session->ndecoders = idx + 1;
 
-	decoder->next = cand;
-	*list = decoder;
+	pt_sb_sift_up(session, idx);
 
 	return 0;
 }
 
+/* Re-schedule the first decoder according to its new @tsc. */
+static void pt_sb_reschedule_first(struct pt_sb_session *session)
+{
+	session->decoders[0]->scheduled = ++session->nscheduled;
+
+	pt_sb_sift_down(session, 0);
+}
+
+/* Remove the first decoder from @session's decoder heap.
+ *
+ * Returns the removed decoder.
+ */
+static struct pt_sb_decoder *pt_sb_remove_first(struct pt_sb_session *session)
+{
+	struct pt_sb_decoder *decoder;
+	uint32_t ndecoders;
+
+	decoder = session->decoders[0];
+
+	ndecoders = session->ndecoders - 1;
+	session->ndecoders = ndecoders;
+
+	if (ndecoders) {
+		session->decoders[0] = session->decoders[ndecoders];
+		pt_sb_sift_down(session, 0);
+	}
+
+	return decoder;
+}
+
 static int pt_sb_fetch(struct pt_sb_session *session,
 		       struct pt_sb_decoder *decoder)
 {
@@ -335,14 +585,22 @@ static int pt_sb_apply(struct pt_sb_session *session, struct pt_image **image,
 int pt_sb_init_decoders(struct pt_sb_session *session)
 {
 	struct pt_sb_decoder *decoder;
+	uint32_t count;
+	int errcode;
 
 	if (!session)
 		return -pte_invalid;
 
+	count = 0;
+	for (decoder = session->waiting; decoder; decoder = decoder->next)
+		count += 1;
+
+	errcode = pt_sb_reserve_decoders(session, count);
+	if (errcode < 0)
+		return errcode;
+
 	decoder = session->waiting;
 	while (decoder) {
-		int errcode;
-
 		session->waiting = decoder->next;
 		decoder->next = NULL;
 
@@ -353,8 +611,7 @@ int pt_sb_init_decoders(struct pt_sb_session *session)
 			 */
 			pt_sb_free_decoder(decoder);
 		} else {
-			errcode = pt_sb_add_decoder(&session->decoders,
-						    decoder);
+			errcode = pt_sb_add_decoder(session, decoder);
 			if (errcode < 0)
 				return errcode;
 		}
@@ -365,6 +622,34 @@ int pt_sb_init_decoders(struct pt_sb_session *session)
 	return 0;
 }
 
+int pt_sb_seek(struct pt_sb_session *session, uint64_t tsc)
+{
+	struct pt_sb_decoder *decoder;
+	int status;
+
+	if (!session)
+		return -pte_invalid;
+
+	/* Decoders that fail to seek start at their first record.  We still
+	 * seek the remaining decoders and report the first error.
+	 */
+	status = 0;
+	for (decoder = session->waiting; decoder; decoder = decoder->next) {
+		int (*seek)(struct pt_sb_session *, uint64_t, void *);
+		int errcode;
+
+		seek = decoder->seek;
+		if (!seek)
+			continue;
+
+		errcode = seek(session, tsc, decoder->priv);
+		if ((errcode < 0) && !status)
+			status = errcode;
+	}
+
+	return status;
+}
+
 /* Copy an event provided by an unknown version of libipt.
  *
  * Copy at most @size bytes of @uevent into @event and zero-initialize any
@@ -395,6 +680,54 @@ static int pt_sb_event_from_user(struct pt_event *event,
 	return 0;
 }
 
+/* Present @event to all scheduled decoders in schedule order.
+ *
+ * Decoders may change the image when applying @event so the order matters.  We
+ * sort the decoder heap, which keeps the heap property, and present @event in
+ * that order.
+ *
+ * Decoders that fail to apply @event are removed.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int pt_sb_event_present_scheduled(struct pt_sb_session *session,
+					 struct pt_image **image,
+					 const struct pt_event *event)
+{
+	struct pt_sb_decoder **heap;
+	uint32_t idx, ndecoders;
+
+	if (!session)
+		return -pte_internal;
+
+	heap = session->decoders;
+	if (1 < session->ndecoders)
+		qsort(heap, session->ndecoders, sizeof(*heap),
+		      pt_sb_decoder_compare);
+
+	ndecoders = 0;
+	for (idx = 0; idx < session->ndecoders; ++idx) {
+		struct pt_sb_decoder *decoder;
+		int errcode;
+
+		decoder = heap[idx];
+
+		errcode = pt_sb_apply(session, image, decoder, event);
+		if (errcode < 0) {
+			decoder->next = session->removed;
+			session->removed = decoder;
+			continue;
+		}
+
+		heap[ndecoders++] = decoder;
+	}
+
+	/* Removing decoders from a sorted heap keeps it sorted. */
+	session->ndecoders = ndecoders;
+
+	return 0;
+}
+
 static int pt_sb_event_present(struct pt_sb_session *session,
 			       struct pt_image **image,
 			       struct pt_sb_decoder **pnext,
@@ -446,15 +779,12 @@ int pt_sb_event(struct pt_sb_session *session, struct pt_image **image,
 	/* In the initial round, we present the event to all decoders with
 	 * records for a smaller or equal timestamp.
 	 *
-	 * We only need to look at the first decoder.  We remove it from the
-	 * list and ask it to apply the event.  Then, we ask it to fetch the
-	 * next record and re-add it to the list according to that next record's
-	 * timestamp.
+	 * We only need to look at the first decoder.  We ask it to apply the
+	 * event.  Then, we ask it to fetch the next record and re-schedule it
+	 * according to that next record's timestamp.
 	 */
-	for (;;) {
-		decoder = session->decoders;
-		if (!decoder)
-			break;
+	while (session->ndecoders) {
+		decoder = session->decoders[0];
 
 		/* We don't check @event.has_tsc to support sideband
 		 * correlation based on relative (non-wall clock) time.
@@ -462,12 +792,11 @@ int pt_sb_event(struct pt_sb_session *session, struct pt_image **image,
 		if (event.tsc < decoder->tsc)
 			break;
 
-		session->decoders = decoder->next;
-		decoder->next = NULL;
-
 		if (stream) {
 			errcode = pt_sb_print(session, decoder, stream, flags);
 			if (errcode < 0) {
+				(void) pt_sb_remove_first(session);
+
 				decoder->next = session->removed;
 				session->removed = decoder;
 				continue;
@@ -476,6 +805,8 @@ int pt_sb_event(struct pt_sb_session *session, struct pt_image **image,
 
 		errcode = pt_sb_apply(session, image, decoder, &event);
 		if (errcode < 0) {
+			(void) pt_sb_remove_first(session);
+
 			decoder->next = session->removed;
 			session->removed = decoder;
 			continue;
@@ -483,6 +814,8 @@ int pt_sb_event(struct pt_sb_session *session, struct pt_image **image,
 
 		errcode = pt_sb_fetch(session, decoder);
 		if (errcode < 0) {
+			(void) pt_sb_remove_first(session);
+
 			if (errcode == -pte_eos) {
 				decoder->next = session->retired;
 				session->retired = decoder;
@@ -494,9 +827,7 @@ int pt_sb_event(struct pt_sb_session *session, struct pt_image **image,
 			continue;
 		}
 
-		errcode = pt_sb_add_decoder(&session->decoders, decoder);
-		if (errcode < 0)
-			return errcode;
+		pt_sb_reschedule_first(session);
 	}
 
 	/* In the second round, we present the event to all decoders.
@@ -504,8 +835,7 @@ int pt_sb_event(struct pt_sb_session *session, struct pt_image **image,
 	 * This allows decoders to postpone actions until an appropriate event,
 	 * e.g entry into or exit from the kernel.
 	 */
-	errcode = pt_sb_event_present(session, image, &session->decoders,
-				      &event);
+	errcode = pt_sb_event_present_scheduled(session, image, &event);
 	if (errcode < 0)
 		return errcode;
 
@@ -521,19 +851,16 @@ int pt_sb_dump(struct pt_sb_session *session, FILE *stream, uint32_t flags,
 	if (!session || !stream)
 		return -pte_invalid;
 
-	for (;;) {
-		decoder = session->decoders;
-		if (!decoder)
-			break;
+	while (session->ndecoders) {
+		decoder = session->decoders[0];
 
 		if (tsc < decoder->tsc)
 			break;
 
-		session->decoders = decoder->next;
-		decoder->next = NULL;
-
 		errcode = pt_sb_print(session, decoder, stream, flags);
 		if (errcode < 0) {
+			(void) pt_sb_remove_first(session);
+
 			decoder->next = session->removed;
 			session->removed = decoder;
 			continue;
@@ -541,14 +868,14 @@ int pt_sb_dump(struct pt_sb_session *session, FILE *stream, uint32_t flags,
 
 		errcode = pt_sb_fetch(session, decoder);
 		if (errcode < 0) {
+			(void) pt_sb_remove_first(session);
+
 			decoder->next = session->removed;
 			session->removed = decoder;
 			continue;
 		}
 
-		errcode = pt_sb_add_decoder(&session->decoders, decoder);
-		if (errcode < 0)
-			return errcode;
+		pt_sb_reschedule_first(session);
 	}
 
 	return 0;
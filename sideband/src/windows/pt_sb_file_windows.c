@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pt_sb_file.h"
+
+#include "intel-pt.h"
+
+#include <stdlib.h>
+
+
+/* A file section loaded into memory.
+ *
+ * We do not map sideband files on Windows.  We load the file section into a
+ * heap buffer, instead.
+ */
+struct pt_sb_file_mapping {
+	/* The buffer holding the file section. */
+	void *buffer;
+};
+
+int pt_sb_file_map(const void **pbuffer, size_t *psize,
+		   struct pt_sb_file_mapping **pmapping, const char *filename,
+		   size_t begin, size_t end)
+{
+	struct pt_sb_file_mapping *mapping;
+	void *buffer;
+	size_t size;
+	int errcode;
+
+	if (!pbuffer || !psize || !pmapping)
+		return -pte_invalid;
+
+	mapping = malloc(sizeof(*mapping));
+	if (!mapping)
+		return -pte_nomem;
+
+	buffer = NULL;
+	size = 0;
+	errcode = pt_sb_file_load(&buffer, &size, filename, begin, end);
+	if (errcode < 0) {
+		free(mapping);
+		return errcode;
+	}
+
+	mapping->buffer = buffer;
+
+	*pbuffer = buffer;
+	*psize = size;
+	*pmapping = mapping;
+
+	return 0;
+}
+
+void pt_sb_file_unmap(struct pt_sb_file_mapping *mapping)
+{
+	if (!mapping)
+		return;
+
+	free(mapping->buffer);
+	free(mapping);
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit_mkfile.h"
+#include "ptunit_time.h"
+
+#include "pt_sb_session.h"
+
+#include "libipt-sb.h"
+#include "intel-pt.h"
+
+#include "pevent.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+/* A micro-benchmark for sideband decoder scheduling.
+ *
+ * Feeds an increasing number of synthetic perf event sideband streams, e.g.
+ * to mimic per-cpu sideband files on a large system, into a sideband session
+ * and measures how the time to apply their records scales with the number of
+ * streams.
+ *
+ * The records of all streams interleave in time.  They are ignored by the
+ * sideband decoders so we mostly measure scheduling.
+ */
+
+enum {
+	/* The default total number of records over all streams. */
+	bench_records		= 1 << 18,
+
+	/* The largest number of streams. */
+	bench_max_streams	= 1 << 10,
+
+	/* The distance in time between two records of a stream. */
+	bench_period		= bench_max_streams
+};
+
+/* The benchmark state. */
+struct bench {
+	/* The name of the temporary file holding all streams. */
+	char *filename;
+
+	/* The total number of records over all streams. */
+	uint32_t records;
+};
+
+/* Write @nrecords ITRACE_START records for stream @stream to @file.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int bench_write_stream(FILE *file, uint32_t stream, uint32_t nrecords,
+			      const struct pev_config *pev)
+{
+	struct pev_record_itrace_start itrace_start;
+	struct pev_event event;
+	uint8_t buffer[0x40];
+	uint64_t time;
+	uint32_t record;
+
+	memset(&itrace_start, 0, sizeof(itrace_start));
+	itrace_start.pid = stream + 1;
+	itrace_start.tid = stream + 1;
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_ITRACE_START;
+	event.record.itrace_start = &itrace_start;
+	event.sample.time = &time;
+
+	for (record = 0; record < nrecords; ++record) {
+		size_t written;
+		int size;
+
+		time = ((uint64_t) record * bench_period) + stream + 1;
+
+		size = pev_write(&event, buffer, buffer + sizeof(buffer), pev);
+		if (size <= 0)
+			return size < 0 ? size : -pte_internal;
+
+		written = fwrite(buffer, (size_t) size, 1, file);
+		if (written != 1)
+			return -pte_bad_file;
+	}
+
+	return 0;
+}
+
+static void bench_pev_config(struct pev_config *pev)
+{
+	pev_config_init(pev);
+	pev->sample_type = PERF_SAMPLE_TIME;
+	pev->time_mult = 1;
+}
+
+/* Write @nstreams streams back-to-back into a new temporary file.
+ *
+ * Returns zero on success, a negative error code otherwise.
+ */
+static int bench_init(struct bench *bench, uint32_t nstreams)
+{
+	struct pev_config pev;
+	uint32_t stream;
+	FILE *file;
+	int errcode;
+
+	errcode = ptunit_mkfile(&file, &bench->filename, "wb");
+	if (errcode < 0)
+		return errcode;
+
+	bench_pev_config(&pev);
+
+	for (stream = 0; stream < nstreams; ++stream) {
+		errcode = bench_write_stream(file, stream,
+					     bench->records / nstreams, &pev);
+		if (errcode < 0)
+			break;
+	}
+
+	fclose(file);
+
+	return errcode;
+}
+
+static void bench_fini(struct bench *bench)
+{
+	if (bench->filename) {
+		(void) remove(bench->filename);
+		free(bench->filename);
+		bench->filename = NULL;
+	}
+}
+
+static double bench_rate(uint64_t count, uint64_t begin, uint64_t end)
+{
+	double seconds;
+
+	seconds = (double) (end - begin) / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	return ((double) count / seconds) / 1e6;
+}
+
+static int bench_session(struct bench *bench, uint32_t nstreams)
+{
+	struct pt_sb_pevent_config config;
+	struct pt_sb_session *session;
+	struct pev_config pev;
+	struct pt_event event;
+	uint64_t begin, end, tsc, last;
+	uint32_t stream, nrecords, nevents;
+	size_t size;
+	int errcode;
+
+	errcode = bench_init(bench, nstreams);
+	if (errcode < 0)
+		return errcode;
+
+	session = pt_sb_alloc(NULL);
+	if (!session) {
+		errcode = -pte_nomem;
+		goto out;
+	}
+
+	bench_pev_config(&pev);
+	nrecords = bench->records / nstreams;
+	size = (size_t) nrecords * (sizeof(struct perf_event_header) +
+				    sizeof(struct pev_record_itrace_start) +
+				    sizeof(uint64_t));
+
+	memset(&config, 0, sizeof(config));
+	config.size = sizeof(config);
+	config.filename = bench->filename;
+	config.sample_type = pev.sample_type;
+	config.time_mult = pev.time_mult;
+
+	for (stream = 0; stream < nstreams; ++stream) {
+		config.begin = stream * size;
+		config.end = config.begin + size;
+
+		errcode = pt_sb_alloc_pevent_decoder(session, &config);
+		if (errcode < 0)
+			goto out;
+	}
+
+	errcode = pt_sb_init_decoders(session);
+	if (errcode < 0)
+		goto out;
+
+	/* Advance time in steps of one record per stream. */
+	memset(&event, 0, sizeof(event));
+	event.type = ptev_tick;
+	event.has_tsc = 1;
+
+	last = ((uint64_t) nrecords * bench_period);
+	nevents = 0;
+
+	errcode = ptunit_time(&begin);
+	if (errcode < 0)
+		goto out;
+
+	for (tsc = 0ull; tsc <= last; tsc += bench_period) {
+		event.tsc = tsc;
+
+		errcode = pt_sb_event(session, NULL, &event, sizeof(event),
+				      NULL, 0);
+		if (errcode < 0)
+			goto out;
+
+		nevents += 1;
+	}
+
+	errcode = ptunit_time(&end);
+	if (errcode < 0)
+		goto out;
+
+	if (session->ndecoders) {
+		errcode = -pte_internal;
+		goto out;
+	}
+
+	printf("%5" PRIu32 " streams %8.3f Mrecords/s %8.3f Mevents/s\n",
+	       nstreams, bench_rate((uint64_t) nrecords * nstreams, begin, end),
+	       bench_rate(nevents, begin, end));
+
+out:
+	pt_sb_free(session);
+	bench_fini(bench);
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench;
+	uint32_t nstreams;
+	int errcode;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.records = bench_records;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [<records>]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2) {
+		int records;
+
+		records = atoi(argv[1]);
+		if (records < bench_max_streams) {
+			fprintf(stderr, "%s: bad records: %s\n", argv[0],
+				argv[1]);
+			return 1;
+		}
+
+		bench.records = (uint32_t) records;
+	}
+
+	errcode = 0;
+	for (nstreams = 1; errcode >= 0 && nstreams <= bench_max_streams;
+	     nstreams *= 4)
+		errcode = bench_session(&bench, nstreams);
+
+	if (errcode < 0) {
+		fprintf(stderr, "%s: %s\n", argv[0],
+			pt_errstr(pt_errcode(errcode)));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2017-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "pt_sb_file.h"
+
+#include "intel-pt.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A test fixture providing a temporary file. */
+struct file_fixture {
+	/* The temporary file's name. */
+	char *name;
+
+	/* The temporary file's content. */
+	uint8_t content[0x3000];
+
+	/* The file mapping. */
+	struct pt_sb_file_mapping *mapping;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct file_fixture *);
+	struct ptunit_result (*fini)(struct file_fixture *);
+};
+
+static struct ptunit_result ffix_init(struct file_fixture *ffix)
+{
+	FILE *file;
+	size_t idx, written;
+	int errcode;
+
+	for (idx = 0; idx < sizeof(ffix->content); ++idx)
+		ffix->content[idx] = (uint8_t) (idx * 7);
+
+	errcode = ptunit_mkfile(&file, &ffix->name, "wb");
+	ptu_int_eq(errcode, 0);
+
+	written = fwrite(ffix->content, sizeof(ffix->content), 1, file);
+	fclose(file);
+
+	ptu_uint_eq(written, 1);
+
+	ffix->mapping = NULL;
+
+	return ptu_passed();
+}
+
+static struct ptunit_result ffix_fini(struct file_fixture *ffix)
+{
+	pt_sb_file_unmap(ffix->mapping);
+
+	if (ffix->name) {
+		(void) remove(ffix->name);
+		free(ffix->name);
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_null(struct file_fixture *ffix)
+{
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	errcode = pt_sb_file_map(NULL, &size, &ffix->mapping, ffix->name,
+				 0, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_sb_file_map(&buffer, NULL, &ffix->mapping, ffix->name,
+				 0, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_sb_file_map(&buffer, &size, NULL, ffix->name, 0, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping, NULL, 0, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	pt_sb_file_unmap(NULL);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_bad_range(struct file_fixture *ffix)
+{
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping, ffix->name,
+				 0x10, 0x10);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping, ffix->name,
+				 0x10, 0x8);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_bad_file(struct file_fixture *ffix)
+{
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping,
+				 "no-such-file", 0, 0);
+	ptu_int_eq(errcode, -pte_bad_file);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map(struct file_fixture *ffix, size_t begin,
+				size_t end, size_t expected)
+{
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	buffer = NULL;
+	size = 0;
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping, ffix->name,
+				 begin, end);
+	ptu_int_eq(errcode, 0);
+	ptu_ptr(ffix->mapping);
+	ptu_uint_eq(size, expected);
+	ptu_ptr(buffer);
+	ptu_int_eq(memcmp(buffer, &ffix->content[begin], size), 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_empty(struct file_fixture *ffix)
+{
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	buffer = (const void *) &buffer;
+	size = 1;
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping, ffix->name,
+				 sizeof(ffix->content), 0);
+	ptu_int_eq(errcode, 0);
+	ptu_ptr(ffix->mapping);
+	ptu_uint_eq(size, 0);
+	ptu_null(buffer);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result map_beyond(struct file_fixture *ffix)
+{
+	const void *buffer;
+	size_t size;
+	int errcode;
+
+	errcode = pt_sb_file_map(&buffer, &size, &ffix->mapping, ffix->name,
+				 sizeof(ffix->content) + 1, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+	ptu_null(ffix->mapping);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct file_fixture ffix;
+	struct ptunit_suite suite;
+	size_t fsize;
+
+	ffix.init = ffix_init;
+	ffix.fini = ffix_fini;
+	ffix.name = NULL;
+
+	fsize = sizeof(ffix.content);
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run_f(suite, map_null, ffix);
+	ptu_run_f(suite, map_bad_range, ffix);
+	ptu_run_f(suite, map_bad_file, ffix);
+	ptu_run_fp(suite, map, ffix, 0, 0, fsize);
+	ptu_run_fp(suite, map, ffix, 0, 0x10, 0x10);
+	ptu_run_fp(suite, map, ffix, 0x1000, 0x2000, 0x1000);
+	ptu_run_fp(suite, map, ffix, 0x1234, 0, fsize - 0x1234);
+	ptu_run_fp(suite, map, ffix, 0x1234, 0x2345, 0x2345 - 0x1234);
+	ptu_run_fp(suite, map, ffix, 0x2ff0, fsize + 0x10, 0x10);
+	ptu_run_f(suite, map_empty, ffix);
+	ptu_run_f(suite, map_beyond, ffix);
+
+	return ptunit_report(&suite);
+}
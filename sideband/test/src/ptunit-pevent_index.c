@@ -0,0 +1,750 @@
+/*
+ * Copyright (c) 2017-2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "libipt-sb.h"
+#include "intel-pt.h"
+
+#include "pt_sb_pevent_index.h"
+#include "pt_sb_pevent.h"
+#include "pt_sb_session.h"
+#include "pt_sb_context.h"
+#include "pt_sb_decoder.h"
+
+#include "pevent.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	/* The number of processes in the synthetic sideband. */
+	ifix_nprocs	= 0x20,
+
+	/* The number of filler records per process. */
+	ifix_nfill	= 0x40,
+
+	/* The size of the mapped file. */
+	ifix_fsize	= 0x1000,
+
+	/* The number of records between index checkpoints. */
+	ifix_period	= 0x10
+};
+
+/* A test fixture providing synthetic perf event sideband and its index. */
+struct index_fixture {
+	/* The sideband file. */
+	char *sideband;
+
+	/* The index file. */
+	char *index;
+
+	/* The file referenced by MMAP records. */
+	char *mapped;
+
+	/* The perf event configuration. */
+	struct pev_config pev;
+
+	/* The timestamp of the next record. */
+	uint64_t time;
+
+	/* The timestamp of the last record. */
+	uint64_t last;
+
+	/* The number of records. */
+	uint32_t nrecords;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct index_fixture *);
+	struct ptunit_result (*fini)(struct index_fixture *);
+};
+
+static int ifix_write(struct index_fixture *ifix, FILE *file,
+		      struct pev_event *event)
+{
+	uint8_t buffer[0x400];
+	size_t written;
+	int size;
+
+	event->sample.time = &ifix->time;
+
+	size = pev_write(event, buffer, buffer + sizeof(buffer), &ifix->pev);
+	if (size <= 0)
+		return size < 0 ? size : -pte_internal;
+
+	written = fwrite(buffer, (size_t) size, 1, file);
+	if (written != 1)
+		return -pte_bad_file;
+
+	ifix->last = ifix->time;
+	ifix->time += 1;
+	ifix->nrecords += 1;
+
+	return 0;
+}
+
+static int ifix_exec(struct index_fixture *ifix, FILE *file, uint32_t pid)
+{
+	static const char comm[] = "test";
+	struct pev_record_comm *record;
+	struct pev_event event;
+	int errcode;
+
+	record = malloc(sizeof(*record) + sizeof(comm));
+	if (!record)
+		return -pte_nomem;
+
+	memset(record, 0, sizeof(*record));
+	record->pid = pid;
+	record->tid = pid;
+	memcpy(record->comm, comm, sizeof(comm));
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_COMM;
+	event.misc = PERF_RECORD_MISC_COMM_EXEC;
+	event.record.comm = record;
+
+	errcode = ifix_write(ifix, file, &event);
+
+	free(record);
+	return errcode;
+}
+
+static int ifix_mmap(struct index_fixture *ifix, FILE *file, uint32_t pid,
+		     uint64_t addr)
+{
+	struct pev_record_mmap *record;
+	struct pev_event event;
+	size_t size;
+	int errcode;
+
+	size = strlen(ifix->mapped) + 1;
+	record = malloc(sizeof(*record) + size);
+	if (!record)
+		return -pte_nomem;
+
+	memset(record, 0, sizeof(*record));
+	record->pid = pid;
+	record->tid = pid;
+	record->addr = addr;
+	record->len = ifix_fsize;
+	memcpy(record->filename, ifix->mapped, size);
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_MMAP;
+	event.misc = PERF_RECORD_MISC_USER;
+	event.record.mmap = record;
+
+	errcode = ifix_write(ifix, file, &event);
+
+	free(record);
+	return errcode;
+}
+
+static int ifix_fork(struct index_fixture *ifix, FILE *file, uint32_t pid,
+		     uint32_t ppid)
+{
+	struct pev_record_fork record;
+	struct pev_event event;
+
+	memset(&record, 0, sizeof(record));
+	record.pid = pid;
+	record.tid = pid;
+	record.ppid = ppid;
+	record.ptid = ppid;
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_FORK;
+	event.record.fork = &record;
+
+	return ifix_write(ifix, file, &event);
+}
+
+static int ifix_exit(struct index_fixture *ifix, FILE *file, uint32_t pid)
+{
+	struct pev_record_exit record;
+	struct pev_event event;
+
+	memset(&record, 0, sizeof(record));
+	record.pid = pid;
+	record.tid = pid;
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_EXIT;
+	event.record.exit = &record;
+
+	return ifix_write(ifix, file, &event);
+}
+
+static int ifix_switch(struct index_fixture *ifix, FILE *file, uint32_t pid)
+{
+	struct pev_record_switch_cpu_wide record;
+	struct pev_event event;
+
+	memset(&record, 0, sizeof(record));
+	record.next_prev_pid = pid;
+	record.next_prev_tid = pid;
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_SWITCH_CPU_WIDE;
+	event.misc = PERF_RECORD_MISC_SWITCH_OUT;
+	event.record.switch_cpu_wide = &record;
+
+	return ifix_write(ifix, file, &event);
+}
+
+static int ifix_fill(struct index_fixture *ifix, FILE *file)
+{
+	struct pev_record_aux record;
+	struct pev_event event;
+
+	memset(&record, 0, sizeof(record));
+
+	pev_event_init(&event);
+	event.type = PERF_RECORD_AUX;
+	event.record.aux = &record;
+
+	return ifix_write(ifix, file, &event);
+}
+
+/* Write the synthetic sideband.
+ *
+ * Processes exec and map files.  Their children inherit their images before
+ * the parents exec again.  Context switches and filler records interleave.
+ */
+static int ifix_write_sideband(struct index_fixture *ifix, FILE *file)
+{
+	uint32_t pid, fill;
+	int errcode;
+
+	for (pid = 1; pid <= ifix_nprocs; ++pid) {
+		errcode = ifix_exec(ifix, file, pid);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = ifix_mmap(ifix, file, pid, 0x10000ull);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = ifix_mmap(ifix, file, pid, 0x20000ull * pid);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	for (pid = 1; pid <= ifix_nprocs; ++pid) {
+		errcode = ifix_fork(ifix, file, pid + 0x1000, pid);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = ifix_switch(ifix, file, pid + 0x1000);
+		if (errcode < 0)
+			return errcode;
+
+		for (fill = 0; fill < ifix_nfill; ++fill) {
+			errcode = ifix_fill(ifix, file);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		/* Every other parent starts over. */
+		if (pid & 1) {
+			errcode = ifix_exec(ifix, file, pid);
+			if (errcode < 0)
+				return errcode;
+
+			errcode = ifix_mmap(ifix, file, pid, 0x30000ull);
+			if (errcode < 0)
+				return errcode;
+		}
+
+		errcode = ifix_mmap(ifix, file, pid + 0x1000,
+				    0x40000ull * pid);
+		if (errcode < 0)
+			return errcode;
+
+		errcode = ifix_switch(ifix, file, pid);
+		if (errcode < 0)
+			return errcode;
+	}
+
+	return 0;
+}
+
+static struct ptunit_result ifix_init(struct index_fixture *ifix)
+{
+	uint8_t content[ifix_fsize];
+	FILE *file;
+	size_t written;
+	int errcode;
+
+	ifix->sideband = NULL;
+	ifix->index = NULL;
+	ifix->mapped = NULL;
+	ifix->time = 0x100ull;
+	ifix->last = 0ull;
+	ifix->nrecords = 0;
+
+	pev_config_init(&ifix->pev);
+	ifix->pev.sample_type = PERF_SAMPLE_TIME;
+	ifix->pev.time_mult = 1;
+
+	errcode = ptunit_mkfile(&file, &ifix->mapped, "wb");
+	ptu_int_eq(errcode, 0);
+
+	memset(content, 0xcc, sizeof(content));
+	written = fwrite(content, sizeof(content), 1, file);
+	fclose(file);
+	ptu_uint_eq(written, 1);
+
+	errcode = ptunit_mkfile(&file, &ifix->sideband, "wb");
+	ptu_int_eq(errcode, 0);
+
+	errcode = ifix_write_sideband(ifix, file);
+	fclose(file);
+	ptu_int_eq(errcode, 0);
+
+	errcode = ptunit_mkfile(&file, &ifix->index, "wb");
+	ptu_int_eq(errcode, 0);
+
+	fclose(file);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result ifix_fini(struct index_fixture *ifix)
+{
+	char **files[] = { &ifix->sideband, &ifix->index, &ifix->mapped };
+	size_t idx;
+
+	for (idx = 0; idx < sizeof(files) / sizeof(*files); ++idx) {
+		if (!*files[idx])
+			continue;
+
+		(void) remove(*files[idx]);
+		free(*files[idx]);
+	}
+
+	return ptu_passed();
+}
+
+static void ifix_config(struct pt_sb_pevent_config *config,
+			const struct index_fixture *ifix)
+{
+	memset(config, 0, sizeof(*config));
+	config->size = sizeof(*config);
+	config->filename = ifix->sideband;
+	config->index = ifix->index;
+	config->sample_type = ifix->pev.sample_type;
+	config->time_mult = ifix->pev.time_mult;
+	config->kernel_start = UINT64_MAX;
+	config->primary = 1;
+}
+
+static int ifix_switch_to(const struct pt_sb_context *context, void *priv)
+{
+	uint32_t *pid;
+
+	pid = (uint32_t *) priv;
+	if (!pid)
+		return -pte_internal;
+
+	*pid = pt_sb_ctx_pid(context);
+
+	return 0;
+}
+
+/* Count the sections in the image of process @pid or return -1. */
+static int ifix_nsections(struct pt_sb_session *session, uint32_t pid,
+			  const char *filename)
+{
+	struct pt_sb_context *context;
+	int errcode;
+
+	errcode = pt_sb_find_context_by_pid(&context, session, pid);
+	if (errcode < 0)
+		return errcode;
+
+	if (!context)
+		return -1;
+
+	return pt_image_remove_by_filename(pt_sb_ctx_image(context), filename,
+					   NULL);
+}
+
+static struct ptunit_result index_null(struct index_fixture *ifix)
+{
+	struct pt_sb_pevent_config config;
+	int errcode;
+
+	errcode = pt_sb_pevent_index(NULL, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	ifix_config(&config, ifix);
+	config.index = NULL;
+
+	errcode = pt_sb_pevent_index(&config, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	ifix_config(&config, ifix);
+	config.size = offsetof(struct pt_sb_pevent_config, index);
+
+	errcode = pt_sb_pevent_index(&config, 0);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	errcode = pt_sb_seek(NULL, 0ull);
+	ptu_int_eq(errcode, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result index(struct index_fixture *ifix)
+{
+	struct pt_sb_pevent_config config;
+	int ncheckpoints;
+
+	ifix_config(&config, ifix);
+
+	ncheckpoints = pt_sb_pevent_index(&config, ifix_period);
+	ptu_int_ge(ncheckpoints, (int) (ifix->nrecords / ifix_period) - 1);
+	ptu_int_le(ncheckpoints, (int) (ifix->nrecords / ifix_period));
+
+	/* The sideband is shorter than the default period.  There are no
+	 * checkpoints.
+	 */
+	ncheckpoints = pt_sb_pevent_index(&config, 0);
+	ptu_int_eq(ncheckpoints, 0);
+
+	return ptu_passed();
+}
+
+/* Write sideband where a child exits and check that its records are not
+ * replayed.
+ */
+static struct ptunit_result index_exit(struct index_fixture *ifix)
+{
+	struct pt_sb_pevent_config config;
+	uint64_t *records, nrecords, resume;
+	uint32_t fill;
+	long size;
+	FILE *file;
+	int errcode;
+
+	file = fopen(ifix->sideband, "wb");
+	ptu_ptr(file);
+
+	errcode = ifix_exec(ifix, file, 1);
+	if (errcode >= 0)
+		errcode = ifix_mmap(ifix, file, 1, 0x10000ull);
+	if (errcode >= 0)
+		errcode = ifix_fork(ifix, file, 2, 1);
+	if (errcode >= 0)
+		errcode = ifix_mmap(ifix, file, 2, 0x20000ull);
+	if (errcode >= 0)
+		errcode = ifix_exit(ifix, file, 2);
+	for (fill = 0; (errcode >= 0) && (fill < ifix_period); ++fill)
+		errcode = ifix_fill(ifix, file);
+
+	size = ftell(file);
+	fclose(file);
+
+	ptu_int_eq(errcode, 0);
+	ptu_int_gt(size, 0);
+
+	ifix_config(&config, ifix);
+
+	errcode = pt_sb_pevent_index(&config, ifix_period);
+	ptu_int_eq(errcode, 1);
+
+	records = NULL;
+	errcode = pt_sb_pidx_read(&records, &nrecords, &resume, ifix->index,
+				  &ifix->pev, (uint64_t) size, ifix->last,
+				  0ull);
+	ptu_int_eq(errcode, 1);
+
+	/* Only the parent's exec and mmap remain. */
+	ptu_uint_eq(nrecords, 2ull);
+	ptu_ptr(records);
+	ptu_uint_eq(records[0], 0ull);
+	ptu_uint_lt(records[1], resume);
+
+	free(records);
+
+	return ptu_passed();
+}
+
+/* Apply the sideband up to @tsc, optionally seeking first.
+ *
+ * Provides the pid of the last context switch in @pid.
+ */
+static struct ptunit_result apply(struct pt_sb_session *session,
+				  const struct index_fixture *ifix,
+				  uint64_t tsc, int seek, uint32_t *pid)
+{
+	struct pt_sb_pevent_config config;
+	struct pt_image *image;
+	struct pt_event event;
+	int errcode;
+
+	ifix_config(&config, ifix);
+
+	errcode = pt_sb_alloc_pevent_decoder(session, &config);
+	ptu_int_eq(errcode, 0);
+
+	if (seek) {
+		const struct pt_sb_pevent_priv *priv;
+
+		errcode = pt_sb_seek(session, tsc);
+		ptu_int_eq(errcode, 0);
+
+		/* We replay only a fraction of the preceding records. */
+		priv = (const struct pt_sb_pevent_priv *)
+			session->waiting->priv;
+		ptu_ptr(priv->resume);
+		ptu_uint_lt(priv->nreplay, (priv->resume - priv->begin) / 0x10);
+	}
+
+	errcode = pt_sb_init_decoders(session);
+	ptu_int_eq(errcode, 0);
+
+	(void) pt_sb_notify_switch(session, ifix_switch_to, pid);
+
+	memset(&event, 0, sizeof(event));
+	event.type = ptev_enabled;
+	event.tsc = tsc;
+	event.variant.enabled.ip = 0x10000ull;
+
+	image = NULL;
+	errcode = pt_sb_event(session, &image, &event, sizeof(event), NULL, 0);
+	ptu_int_eq(errcode, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result seek(struct index_fixture *ifix, uint64_t tsc)
+{
+	struct pt_sb_pevent_config config;
+	struct pt_sb_session *full, *fast;
+	uint32_t pid, full_pid, fast_pid;
+	int ncheckpoints, nsections;
+
+	ifix_config(&config, ifix);
+
+	ncheckpoints = pt_sb_pevent_index(&config, ifix_period);
+	ptu_int_gt(ncheckpoints, 0);
+
+	/* Relative to the beginning of the sideband. */
+	tsc += 0x100ull;
+
+	full = pt_sb_alloc(NULL);
+	ptu_ptr(full);
+
+	fast = pt_sb_alloc(NULL);
+	ptu_ptr(fast);
+
+	full_pid = 0;
+	fast_pid = 0;
+	ptu_test(apply, full, ifix, tsc, 0, &full_pid);
+	ptu_test(apply, fast, ifix, tsc, 1, &fast_pid);
+
+	ptu_uint_ne(full_pid, 0);
+	ptu_uint_eq(fast_pid, full_pid);
+
+	nsections = 0;
+	for (pid = 1; pid <= ifix_nprocs; ++pid) {
+		int expected;
+
+		expected = ifix_nsections(full, pid, ifix->mapped);
+		ptu_int_eq(ifix_nsections(fast, pid, ifix->mapped), expected);
+		nsections += expected;
+
+		expected = ifix_nsections(full, pid + 0x1000, ifix->mapped);
+		ptu_int_eq(ifix_nsections(fast, pid + 0x1000, ifix->mapped),
+			   expected);
+	}
+
+	ptu_int_gt(nsections, 0);
+
+	pt_sb_free(fast);
+	pt_sb_free(full);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result seek_none(struct index_fixture *ifix)
+{
+	struct pt_sb_pevent_config config;
+	const struct pt_sb_pevent_priv *priv;
+	struct pt_sb_session *session;
+	int errcode;
+
+	ifix_config(&config, ifix);
+
+	errcode = pt_sb_pevent_index(&config, ifix_period);
+	ptu_int_gt(errcode, 0);
+
+	session = pt_sb_alloc(NULL);
+	ptu_ptr(session);
+
+	errcode = pt_sb_alloc_pevent_decoder(session, &config);
+	ptu_int_eq(errcode, 0);
+
+	/* There is no checkpoint before the first record. */
+	errcode = pt_sb_seek(session, 0x100ull);
+	ptu_int_eq(errcode, 0);
+
+	priv = (const struct pt_sb_pevent_priv *) session->waiting->priv;
+	ptu_null(priv->replay);
+	ptu_ptr_eq(priv->next, priv->begin);
+
+	pt_sb_free(session);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result seek_stale(struct index_fixture *ifix)
+{
+	struct pt_sb_pevent_config config;
+	struct pt_sb_session *session;
+	int errcode;
+
+	ifix_config(&config, ifix);
+
+	errcode = pt_sb_pevent_index(&config, ifix_period);
+	ptu_int_gt(errcode, 0);
+
+	session = pt_sb_alloc(NULL);
+	ptu_ptr(session);
+
+	/* The index does not match a different part of the sideband. */
+	config.begin = 0x20;
+	errcode = pt_sb_alloc_pevent_decoder(session, &config);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_sb_seek(session, ifix->last);
+	ptu_int_eq(errcode, -pte_bad_config);
+
+	pt_sb_free(session);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result seek_stale_time(struct index_fixture *ifix)
+{
+	struct pt_sb_pevent_config config[3];
+	struct pt_sb_session *session;
+	size_t idx;
+	int errcode;
+
+	ifix_config(&config[0], ifix);
+
+	errcode = pt_sb_pevent_index(&config[0], ifix_period);
+	ptu_int_gt(errcode, 0);
+
+	/* The index does not match different time conversion parameters. */
+	config[1] = config[0];
+	config[2] = config[0];
+	config[0].time_zero = 0x100ull;
+	config[1].time_mult = 2;
+	config[2].time_shift = 1;
+
+	for (idx = 0; idx < sizeof(config) / sizeof(*config); ++idx) {
+		session = pt_sb_alloc(NULL);
+		ptu_ptr(session);
+
+		errcode = pt_sb_alloc_pevent_decoder(session, &config[idx]);
+		ptu_int_eq(errcode, 0);
+
+		errcode = pt_sb_seek(session, ifix->last);
+		ptu_int_eq(errcode, -pte_bad_config);
+
+		pt_sb_free(session);
+	}
+
+	return ptu_passed();
+}
+
+static struct ptunit_result seek_bad_index(struct index_fixture *ifix)
+{
+	const struct pt_sb_pevent_priv *priv;
+	struct pt_sb_pevent_config config;
+	struct pt_sb_session *session;
+	FILE *file;
+	int errcode;
+
+	file = fopen(ifix->index, "wb");
+	ptu_ptr(file);
+
+	fputs("not an index", file);
+	fclose(file);
+
+	session = pt_sb_alloc(NULL);
+	ptu_ptr(session);
+
+	ifix_config(&config, ifix);
+	errcode = pt_sb_alloc_pevent_decoder(session, &config);
+	ptu_int_eq(errcode, 0);
+
+	errcode = pt_sb_seek(session, ifix->last);
+	ptu_int_eq(errcode, -pte_bad_file);
+
+	priv = (const struct pt_sb_pevent_priv *) session->waiting->priv;
+	ptu_null(priv->replay);
+	ptu_ptr_eq(priv->next, priv->begin);
+
+	pt_sb_free(session);
+
+	return ptu_passed();
+}
+
+int main(int argc, char **argv)
+{
+	struct index_fixture ifix;
+	struct ptunit_suite suite;
+
+	ifix.init = ifix_init;
+	ifix.fini = ifix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run_f(suite, index_null, ifix);
+	ptu_run_f(suite, index, ifix);
+	ptu_run_f(suite, index_exit, ifix);
+	ptu_run_fp(suite, seek, ifix, 0x200ull);
+	ptu_run_fp(suite, seek, ifix, 0x555ull);
+	ptu_run_fp(suite, seek, ifix, 0x800ull);
+	ptu_run_fp(suite, seek, ifix, 0xfffffull);
+	ptu_run_f(suite, seek_none, ifix);
+	ptu_run_f(suite, seek_stale, ifix);
+	ptu_run_f(suite, seek_stale_time, ifix);
+	ptu_run_f(suite, seek_bad_index, ifix);
+
+	return ptunit_report(&suite);
+}
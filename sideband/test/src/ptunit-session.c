@@ -0,0 +1,636 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ptunit.h"
+#include "ptunit_mkfile.h"
+
+#include "pt_sb_session.h"
+#include "pt_sb_context.h"
+
+#include "libipt-sb.h"
+#include "intel-pt.h"
+
+#if defined(FEATURE_PEVENT)
+#  include "pevent.h"
+#endif /* defined(FEATURE_PEVENT) */
+
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	/* The number of processes in stress tests. */
+	sfix_npids	= 100000,
+
+	/* The number of decoders and records per decoder in scheduling
+	 * tests.
+	 */
+	sfix_ndecoders	= 300,
+	sfix_nrecords	= 64
+};
+
+/* A test fixture providing an empty sideband session. */
+struct session_fixture {
+	/* The sideband session. */
+	struct pt_sb_session *session;
+
+	/* The test fixture initialization and finalization functions. */
+	struct ptunit_result (*init)(struct session_fixture *);
+	struct ptunit_result (*fini)(struct session_fixture *);
+};
+
+static struct ptunit_result sfix_init(struct session_fixture *sfix)
+{
+	sfix->session = pt_sb_alloc(NULL);
+	ptu_ptr(sfix->session);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result sfix_fini(struct session_fixture *sfix)
+{
+	pt_sb_free(sfix->session);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result get_null(struct session_fixture *sfix)
+{
+	struct pt_sb_context *context;
+	int status;
+
+	status = pt_sb_get_context_by_pid(NULL, sfix->session, 1);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_sb_get_context_by_pid(&context, NULL, 1);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_sb_find_context_by_pid(NULL, sfix->session, 1);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_sb_find_context_by_pid(&context, NULL, 1);
+	ptu_int_eq(status, -pte_invalid);
+
+	status = pt_sb_remove_context(NULL, NULL);
+	ptu_int_eq(status, -pte_invalid);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result find_none(struct session_fixture *sfix)
+{
+	struct pt_sb_context *context;
+	int status;
+
+	context = (struct pt_sb_context *) &context;
+	status = pt_sb_find_context_by_pid(&context, sfix->session, 1);
+	ptu_int_eq(status, 0);
+	ptu_null(context);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result get(struct session_fixture *sfix)
+{
+	struct pt_sb_context *context, *found;
+	int status;
+
+	context = NULL;
+	status = pt_sb_get_context_by_pid(&context, sfix->session, 0x42);
+	ptu_int_eq(status, 0);
+	ptu_ptr(context);
+	ptu_uint_eq(pt_sb_ctx_pid(context), 0x42);
+
+	found = NULL;
+	status = pt_sb_find_context_by_pid(&found, sfix->session, 0x42);
+	ptu_int_eq(status, 0);
+	ptu_ptr_eq(found, context);
+
+	found = NULL;
+	status = pt_sb_get_context_by_pid(&found, sfix->session, 0x42);
+	ptu_int_eq(status, 0);
+	ptu_ptr_eq(found, context);
+
+	found = NULL;
+	status = pt_sb_find_context_by_pid(&found, sfix->session, 0x43);
+	ptu_int_eq(status, 0);
+	ptu_null(found);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result remove_context(struct session_fixture *sfix)
+{
+	struct pt_sb_context *context, *found;
+	int status;
+
+	context = NULL;
+	status = pt_sb_get_context_by_pid(&context, sfix->session, 0x42);
+	ptu_int_eq(status, 0);
+	ptu_ptr(context);
+
+	/* Keep @context alive beyond its removal. */
+	status = pt_sb_ctx_get(context);
+	ptu_int_eq(status, 0);
+
+	status = pt_sb_remove_context(sfix->session, context);
+	ptu_int_eq(status, 0);
+
+	found = NULL;
+	status = pt_sb_find_context_by_pid(&found, sfix->session, 0x42);
+	ptu_int_eq(status, 0);
+	ptu_null(found);
+
+	status = pt_sb_remove_context(sfix->session, context);
+	ptu_int_eq(status, -pte_nosync);
+
+	status = pt_sb_get_context_by_pid(&found, sfix->session, 0x42);
+	ptu_int_eq(status, 0);
+	ptu_ptr(found);
+	ptu_ptr_ne(found, context);
+	ptu_ptr(pt_sb_ctx_image(context));
+
+	status = pt_sb_ctx_put(context);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result remove_unknown(struct session_fixture *sfix)
+{
+	struct pt_sb_context *context, *other;
+	int status;
+
+	context = pt_sb_ctx_alloc(NULL);
+	ptu_ptr(context);
+
+	status = pt_sb_remove_context(sfix->session, context);
+	ptu_int_eq(status, -pte_nosync);
+
+	/* A context for the same pid in the session is not @context. */
+	status = pt_sb_get_context_by_pid(&other, sfix->session,
+					  pt_sb_ctx_pid(context));
+	ptu_int_eq(status, 0);
+
+	status = pt_sb_remove_context(sfix->session, context);
+	ptu_int_eq(status, -pte_nosync);
+
+	status = pt_sb_ctx_put(context);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result stress(struct session_fixture *sfix)
+{
+	struct pt_sb_context *context;
+	uint32_t pid;
+	int status;
+
+	for (pid = 1; pid <= sfix_npids; ++pid) {
+		status = pt_sb_get_context_by_pid(&context, sfix->session,
+						  pid);
+		ptu_int_eq(status, 0);
+		ptu_uint_eq(pt_sb_ctx_pid(context), pid);
+	}
+
+	ptu_uint_eq(sfix->session->ncontexts, sfix_npids);
+
+	/* Remove contexts for even pids. */
+	for (pid = 2; pid <= sfix_npids; pid += 2) {
+		status = pt_sb_find_context_by_pid(&context, sfix->session,
+						   pid);
+		ptu_int_eq(status, 0);
+		ptu_ptr(context);
+		ptu_uint_eq(pt_sb_ctx_pid(context), pid);
+
+		status = pt_sb_remove_context(sfix->session, context);
+		ptu_int_eq(status, 0);
+	}
+
+	ptu_uint_eq(sfix->session->ncontexts, sfix_npids / 2);
+
+	for (pid = 1; pid <= sfix_npids; ++pid) {
+		status = pt_sb_find_context_by_pid(&context, sfix->session,
+						   pid);
+		ptu_int_eq(status, 0);
+
+		if (pid & 1) {
+			ptu_ptr(context);
+			ptu_uint_eq(pt_sb_ctx_pid(context), pid);
+		} else
+			ptu_null(context);
+	}
+
+	return ptu_passed();
+}
+
+/* A scripted sideband decoder. */
+struct sdec {
+	/* The timestamps of the decoder's records. */
+	const uint64_t *tsc;
+
+	/* The number of records in @tsc. */
+	size_t nrecords;
+
+	/* The index of the current record. */
+	size_t record;
+
+	/* The decoder's identifier. */
+	char id;
+
+	/* The log of printed records shared by all decoders. */
+	char *log;
+
+	/* The log of applied events shared by all decoders. */
+	char *alog;
+
+	/* The timestamp of the last printed record shared by all decoders. */
+	uint64_t *last;
+};
+
+static int sdec_fetch(struct pt_sb_session *session, uint64_t *tsc,
+		      void *priv)
+{
+	struct sdec *sdec;
+
+	(void) session;
+
+	sdec = (struct sdec *) priv;
+	if (!sdec || !tsc)
+		return -pte_internal;
+
+	if (sdec->nrecords <= sdec->record)
+		return -pte_eos;
+
+	*tsc = sdec->tsc[sdec->record++];
+
+	return 0;
+}
+
+static int sdec_apply(struct pt_sb_session *session, struct pt_image **image,
+		      const struct pt_event *event, void *priv)
+{
+	struct sdec *sdec;
+
+	(void) session;
+	(void) image;
+	(void) event;
+
+	sdec = (struct sdec *) priv;
+	if (!sdec)
+		return -pte_internal;
+
+	if (sdec->alog) {
+		char *log;
+
+		log = sdec->alog;
+		while (*log)
+			log += 1;
+
+		*log = sdec->id;
+	}
+
+	return 0;
+}
+
+static int sdec_print(struct pt_sb_session *session, FILE *stream,
+		      uint32_t flags, void *priv)
+{
+	struct sdec *sdec;
+	uint64_t tsc;
+
+	(void) session;
+	(void) stream;
+	(void) flags;
+
+	sdec = (struct sdec *) priv;
+	if (!sdec || !sdec->record)
+		return -pte_internal;
+
+	/* Records must be printed in timestamp order. */
+	tsc = sdec->tsc[sdec->record - 1];
+	if (sdec->last) {
+		if (tsc < *sdec->last)
+			return -pte_internal;
+
+		*sdec->last = tsc;
+	}
+
+	if (sdec->log) {
+		char *log;
+
+		log = sdec->log;
+		while (*log)
+			log += 1;
+
+		*log = sdec->id;
+	}
+
+	return 0;
+}
+
+static struct ptunit_result sdec_add(struct session_fixture *sfix,
+				     struct sdec *sdec)
+{
+	struct pt_sb_decoder_config config;
+	int status;
+
+	memset(&config, 0, sizeof(config));
+	config.size = sizeof(config);
+	config.fetch = sdec_fetch;
+	config.apply = sdec_apply;
+	config.print = sdec_print;
+	config.priv = sdec;
+
+	status = pt_sb_alloc_decoder(sfix->session, &config);
+	ptu_int_eq(status, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result schedule_ties(struct session_fixture *sfix)
+{
+	static const uint64_t atsc[] = { 1ull, 3ull, 3ull };
+	static const uint64_t btsc[] = { 2ull, 3ull };
+	static const uint64_t ctsc[] = { 3ull, 3ull };
+	struct sdec sdec[3];
+	char log[8];
+	int status;
+
+	memset(sdec, 0, sizeof(sdec));
+	memset(log, 0, sizeof(log));
+
+	sdec[0].tsc = atsc;
+	sdec[0].nrecords = sizeof(atsc) / sizeof(*atsc);
+	sdec[0].id = 'a';
+	sdec[0].log = log;
+
+	sdec[1].tsc = btsc;
+	sdec[1].nrecords = sizeof(btsc) / sizeof(*btsc);
+	sdec[1].id = 'b';
+	sdec[1].log = log;
+
+	sdec[2].tsc = ctsc;
+	sdec[2].nrecords = sizeof(ctsc) / sizeof(*ctsc);
+	sdec[2].id = 'c';
+	sdec[2].log = log;
+
+	ptu_test(sdec_add, sfix, &sdec[0]);
+	ptu_test(sdec_add, sfix, &sdec[1]);
+	ptu_test(sdec_add, sfix, &sdec[2]);
+
+	status = pt_sb_init_decoders(sfix->session);
+	ptu_int_eq(status, 0);
+
+	status = pt_sb_dump(sfix->session, stdout, 0, 2ull);
+	ptu_int_eq(status, 0);
+	ptu_str_eq(log, "ab");
+
+	/* Among decoders with equal timestamps, the one that fetched its
+	 * record last goes first.
+	 */
+	status = pt_sb_dump(sfix->session, stdout, 0, 3ull);
+	ptu_int_eq(status, 0);
+	ptu_str_eq(log, "abbaacc");
+	ptu_uint_eq(sfix->session->ndecoders, 0);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result present_order(struct session_fixture *sfix)
+{
+	static const uint64_t tsc[] = { 2ull, 5ull, 1ull };
+	struct sdec sdec[3];
+	struct pt_event event;
+	char log[8];
+	int idx, status;
+
+	memset(sdec, 0, sizeof(sdec));
+	memset(log, 0, sizeof(log));
+
+	for (idx = 0; idx < 3; ++idx) {
+		sdec[idx].tsc = &tsc[idx];
+		sdec[idx].nrecords = 1;
+		sdec[idx].id = (char) ('a' + idx);
+		sdec[idx].alog = log;
+
+		ptu_test(sdec_add, sfix, &sdec[idx]);
+	}
+
+	status = pt_sb_init_decoders(sfix->session);
+	ptu_int_eq(status, 0);
+
+	/* The event precedes all records.  It is only presented in the second
+	 * round, which must follow the schedule.
+	 */
+	memset(&event, 0, sizeof(event));
+
+	status = pt_sb_event(sfix->session, NULL, &event, sizeof(event), NULL,
+			     0);
+	ptu_int_eq(status, 0);
+	ptu_str_eq(log, "cab");
+	ptu_uint_eq(sfix->session->ndecoders, 3);
+
+	return ptu_passed();
+}
+
+static struct ptunit_result schedule_many(struct session_fixture *sfix)
+{
+	struct sdec sdec[sfix_ndecoders];
+	struct pt_event event;
+	uint64_t tsc[sfix_nrecords], last;
+	size_t idx;
+	int status;
+
+	for (idx = 0; idx < sfix_nrecords; ++idx)
+		tsc[idx] = (uint64_t) idx * 7ull;
+
+	memset(sdec, 0, sizeof(sdec));
+	last = 0ull;
+
+	for (idx = 0; idx < sfix_ndecoders; ++idx) {
+		/* Skew decoders so their records interleave. */
+		sdec[idx].tsc = &tsc[idx % 5];
+		sdec[idx].nrecords = sfix_nrecords - (idx % 5);
+		sdec[idx].last = &last;
+
+		ptu_test(sdec_add, sfix, &sdec[idx]);
+	}
+
+	status = pt_sb_init_decoders(sfix->session);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(sfix->session->ndecoders, sfix_ndecoders);
+
+	memset(&event, 0, sizeof(event));
+	event.tsc = tsc[sfix_nrecords / 2];
+
+	status = pt_sb_event(sfix->session, NULL, &event, sizeof(event),
+			     stdout, 0);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(last, event.tsc);
+	ptu_uint_eq(sfix->session->ndecoders, sfix_ndecoders);
+
+	for (idx = 0; idx < sfix_ndecoders; ++idx)
+		ptu_uint_gt(sdec[idx].tsc[sdec[idx].record - 1], event.tsc);
+
+	event.tsc = UINT64_MAX;
+
+	status = pt_sb_event(sfix->session, NULL, &event, sizeof(event),
+			     stdout, 0);
+	ptu_int_eq(status, 0);
+	ptu_uint_eq(last, tsc[sfix_nrecords - 1]);
+	ptu_uint_eq(sfix->session->ndecoders, 0);
+
+	for (idx = 0; idx < sfix_ndecoders; ++idx)
+		ptu_uint_eq(sdec[idx].record, sdec[idx].nrecords);
+
+	return ptu_passed();
+}
+
+#if defined(FEATURE_PEVENT)
+
+/* Fork @sfix_npids processes in a chain via perf event sideband. */
+static struct ptunit_result pevent_fork_stress(struct session_fixture *sfix)
+{
+	struct pt_sb_pevent_config config;
+	struct pev_record_fork fork;
+	struct pt_sb_context *context, *parent;
+	struct pev_config pev;
+	struct pev_event event;
+	struct pt_event tevent;
+	struct pt_image *image;
+	uint8_t buffer[0x100];
+	char *filename;
+	FILE *file;
+	uint32_t pid;
+	int status;
+
+	status = ptunit_mkfile(&file, &filename, "wb");
+	ptu_int_eq(status, 0);
+
+	pev_config_init(&pev);
+	pev_event_init(&event);
+	memset(&fork, 0, sizeof(fork));
+
+	event.type = PERF_RECORD_FORK;
+	event.record.fork = &fork;
+
+	for (pid = 2; pid <= sfix_npids; ++pid) {
+		size_t written;
+
+		fork.pid = pid;
+		fork.tid = pid;
+		fork.ppid = pid - 1;
+		fork.ptid = pid - 1;
+
+		status = pev_write(&event, buffer, buffer + sizeof(buffer),
+				   &pev);
+		if (status <= 0)
+			break;
+
+		written = fwrite(buffer, (size_t) status, 1, file);
+		if (written != 1) {
+			status = -pte_bad_file;
+			break;
+		}
+	}
+
+	fclose(file);
+
+	memset(&config, 0, sizeof(config));
+	config.size = sizeof(config);
+	config.filename = filename;
+	config.primary = 1;
+
+	if (status > 0)
+		status = pt_sb_alloc_pevent_decoder(sfix->session, &config);
+
+	(void) remove(filename);
+	free(filename);
+
+	ptu_int_ge(status, 0);
+
+	status = pt_sb_init_decoders(sfix->session);
+	ptu_int_eq(status, 0);
+
+	/* All records are due at time zero. */
+	memset(&tevent, 0, sizeof(tevent));
+	tevent.type = ptev_enabled;
+
+	image = NULL;
+	status = pt_sb_event(sfix->session, &image, &tevent, sizeof(tevent),
+			     NULL, 0);
+	ptu_int_eq(status, 0);
+
+	ptu_uint_eq(sfix->session->ncontexts, sfix_npids - 1);
+
+	for (pid = 2; pid <= sfix_npids; ++pid) {
+		status = pt_sb_find_context_by_pid(&context, sfix->session,
+						   pid);
+		ptu_int_eq(status, 0);
+		ptu_ptr(context);
+		ptu_uint_eq(pt_sb_ctx_pid(context), pid);
+	}
+
+	/* We never saw pid 1 so its child's context is a new one. */
+	status = pt_sb_find_context_by_pid(&parent, sfix->session, 1);
+	ptu_int_eq(status, 0);
+	ptu_null(parent);
+
+	return ptu_passed();
+}
+
+#endif /* defined(FEATURE_PEVENT) */
+
+int main(int argc, char **argv)
+{
+	struct session_fixture sfix;
+	struct ptunit_suite suite;
+
+	sfix.init = sfix_init;
+	sfix.fini = sfix_fini;
+
+	suite = ptunit_mk_suite(argc, argv);
+
+	ptu_run_f(suite, get_null, sfix);
+	ptu_run_f(suite, find_none, sfix);
+	ptu_run_f(suite, get, sfix);
+	ptu_run_f(suite, remove_context, sfix);
+	ptu_run_f(suite, remove_unknown, sfix);
+	ptu_run_f(suite, stress, sfix);
+	ptu_run_f(suite, schedule_ties, sfix);
+	ptu_run_f(suite, present_order, sfix);
+	ptu_run_f(suite, schedule_many, sfix);
+
+#if defined(FEATURE_PEVENT)
+	ptu_run_f(suite, pevent_fork_stress, sfix);
+#endif /* defined(FEATURE_PEVENT) */
+
+	return ptunit_report(&suite);
+}